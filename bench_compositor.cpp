@@ -0,0 +1,167 @@
+// Compositor pixel check and benchmark
+// Portable C++ (no Win32). Drives calc_compositor.h the way the window
+// does, with widgets standing in for the display and the keypad buttons,
+// through a long random run of state changes, moves, hides and stray
+// invalidations. After every compose the frame must match a full render
+// of the same scene pixel for pixel. Then times a full recompose against
+// a display-only update at the window's size.
+//
+// Build and run: g++ -O2 -std=c++17 bench_compositor.cpp -o bench_compositor && ./bench_compositor
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "calc_compositor.h"
+
+#define IDC_DISPLAY 1   // Widget ids; buttons follow
+
+static const int kWidth = 700, kHeight = 520;
+static const uint32_t kTop = CompRgb(232, 244, 252), kBottom = CompRgb(196, 224, 240);
+
+static uint64_t g_seed = 88172645463325252ULL;
+
+static unsigned Next(unsigned n) {
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return (unsigned)(g_seed >> 33) % n;
+}
+
+// What each widget currently shows; a draw depends only on this and the
+// pixel's offset inside the widget, so any clip of it is reproducible
+static unsigned g_widgetState[64];
+
+static uint32_t WidgetPixel(int id, int dx, int dy) {
+    unsigned s = g_widgetState[id];
+    if ((dx + dy + (int)s) % 7 == 0) return CompRgb(50, 50, 50);   // "Text"
+    return CompRgb((id * 37 + s) & 0xff, (dx * 3 + s) & 0xff, (dy * 5) & 0xff);
+}
+
+static void DrawWidget(CompSurface& s, const CompWidget& w, const CompRect& clip) {
+    for (int y = clip.top; y < clip.bottom; y++) {
+        uint32_t* row = s.Row(y);
+        for (int x = clip.left; x < clip.right; x++) row[x] = WidgetPixel(w.id, x - w.rect.left, y - w.rect.top);
+    }
+}
+
+// The whole scene from scratch, as a window without a compositor would paint it
+static void RenderReference(const Compositor& comp, CompSurface& out) {
+    out.Allocate(comp.frame.width, comp.frame.height);
+    CompFillVerticalGradient(out, kTop, kBottom);
+    for (size_t i = 0; i < comp.widgets.size(); i++) {
+        const CompWidget& w = comp.widgets[i];
+        if (!w.visible) continue;
+        CompRect clip = CompIntersect(w.rect, out.Bounds());
+        if (!clip.IsEmpty()) DrawWidget(out, w, clip);
+    }
+}
+
+static long long Mismatches(const CompSurface& a, const CompSurface& b) {
+    long long n = 0;
+    for (int y = 0; y < a.height; y++) {
+        for (int x = 0; x < a.width; x++) n += a.At(x, y) != b.At(x, y);
+    }
+    return n;
+}
+
+// The calculator's layout: the display, then a 5 x 6 keypad
+static void AddWidgets(Compositor& comp) {
+    comp.SetWidget(IDC_DISPLAY, CompRect(20, 60, 680, 130));
+    for (int i = 0; i < 30; i++) {
+        int col = i % 5, row = i / 5;
+        comp.SetWidget(2 + i, CompRect(20 + col * 70, 150 + row * 55, 80 + col * 70, 195 + row * 55));
+    }
+}
+
+static CompRect RandomRect(int maxSize) {
+    int l = (int)Next(kWidth + 40) - 20, t = (int)Next(kHeight + 40) - 20;
+    return CompRect(l, t, l + 1 + (int)Next(maxSize), t + 1 + (int)Next(maxSize));
+}
+
+static double Seconds(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+int main() {
+    Compositor comp;
+    comp.SetGradient(kTop, kBottom);
+    comp.Resize(kWidth, kHeight);
+    AddWidgets(comp);
+
+    std::vector<CompRect> changed;
+    CompSurface reference;
+    auto draw = [&](const CompWidget& w, const CompRect& clip) { DrawWidget(comp.frame, w, clip); };
+
+    // --- Pixel correctness ---
+    const int kSteps = 3000;
+    long long bad = 0, composed = 0;
+    int badSteps = 0;
+    for (int step = 0; step < kSteps; step++) {
+        int events = 1 + (int)Next(4);
+        for (int e = 0; e < events; e++) {
+            int id = 1 + (int)Next((unsigned)comp.widgets.size());
+            switch (Next(6)) {
+                case 0: case 1:   // New content, like a key press updating the display
+                    g_widgetState[id]++;
+                    comp.InvalidateWidget(id);
+                    break;
+                case 2:           // Tab switch
+                    comp.ShowWidget(id, !comp.FindWidget(id)->visible);
+                    break;
+                case 3:           // Layout change; may hang off the edge
+                    comp.SetWidget(id, RandomRect(200));
+                    break;
+                case 4:           // Windows reporting a stray update region
+                    comp.Invalidate(RandomRect(300));
+                    break;
+                case 5:
+                    if (Next(50) == 0) comp.Resize(kWidth, kHeight);
+                    break;
+            }
+        }
+        unsigned long long before = comp.pixelsComposed;
+        comp.Compose(draw, &changed);
+        composed += (long long)(comp.pixelsComposed - before);
+
+        RenderReference(comp, reference);
+        long long n = Mismatches(comp.frame, reference);
+        if (n) {
+            if (!badSteps) printf("step %d: %lld mismatched pixels\n", step, n);
+            badSteps++;
+            bad += n;
+        }
+    }
+    double full = (double)kSteps * kWidth * kHeight;
+    printf("Pixel check: %d random steps, %lld mismatched pixels in %d steps\n", kSteps, bad, badSteps);
+    printf("Composed %.1f%% of the pixels a full repaint per step would\n", 100.0 * composed / full);
+
+    // --- Benchmark ---
+    Compositor bench;
+    bench.SetGradient(kTop, kBottom);
+    bench.Resize(kWidth, kHeight);
+    AddWidgets(bench);
+    auto benchDraw = [&](const CompWidget& w, const CompRect& clip) { DrawWidget(bench.frame, w, clip); };
+    bench.Compose(benchDraw, &changed);
+
+    const int kRuns = 2000;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int run = 0; run < kRuns; run++) {
+        bench.Invalidate(bench.frame.Bounds());
+        bench.Compose(benchDraw, &changed);
+    }
+    double fullUs = Seconds(t0) * 1e6 / kRuns;
+
+    t0 = std::chrono::steady_clock::now();
+    for (int run = 0; run < kRuns; run++) {
+        g_widgetState[IDC_DISPLAY]++;
+        bench.InvalidateWidget(IDC_DISPLAY);
+        bench.Compose(benchDraw, &changed);
+    }
+    double displayUs = Seconds(t0) * 1e6 / kRuns;
+
+    printf("%dx%d, %d runs: full compose %.1f us, display-only update %.1f us (%.1fx)\n",
+           kWidth, kHeight, kRuns, fullUs, displayUs, fullUs / displayUs);
+    printf("%s\n", bad ? "FAIL: damage-limited frames differ from a full render" : "PASS");
+    return bad ? 1 : 0;
+}
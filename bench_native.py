@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Windows 7 Calculator - Native Module Benchmark
+Times calc_native against the same work done in pure Python: keypad
+sequences, display formatting, date differences and month arithmetic.
+Every result is compared, and the batch calls are also run from several
+threads to show that they release the GIL. Build with build_native.py first.
+"""
+
+import calendar
+import datetime
+import random
+import sys
+import threading
+import time
+
+import calc_native
+
+try:
+    from dateutil.relativedelta import relativedelta
+except ImportError:
+    relativedelta = None
+
+
+# --- Pure Python paths ---
+
+def py_format(value):
+    """The keypad's display text for a double"""
+    if value == int(value):
+        return "%.0f" % value
+    return "%.12g" % value
+
+
+def py_keys(keys):
+    """Digits, point, + - * / and = on a four-function keypad"""
+    display, previous, op, waiting = "0", 0.0, None, False
+    for k in keys:
+        if k.isdigit():
+            if waiting or display == "0":
+                display, waiting = k, False
+            else:
+                display += k
+        elif k == ".":
+            if waiting:
+                display, waiting = "0.", False
+            elif "." not in display:
+                display += "."
+        elif k in "+-*/=":
+            # A result carries on at full precision, not as displayed
+            if op and not waiting:
+                a, b = previous, float(display)
+                if op == "/" and b == 0:
+                    display = "Error"
+                else:
+                    previous = a + b if op == "+" else a - b if op == "-" else a * b if op == "*" else a / b
+                    display = py_format(previous)
+            elif k != "=":
+                previous = 0.0 if display == "Error" else float(display)
+            op = None if k == "=" else k
+            waiting = True
+    return display
+
+
+def py_add_months(d, months):
+    """Jan 31 + 1 month -> Feb 28/29, as the date calc tab does"""
+    if relativedelta is not None:
+        return d + relativedelta(months=months)
+    total = d.year * 12 + d.month - 1 + months
+    year, month = divmod(total, 12)
+    day = min(d.day, calendar.monthrange(year, month + 1)[1])
+    return datetime.date(year, month + 1, day)
+
+
+# --- Inputs ---
+
+def make_inputs(count, seed=1):
+    rng = random.Random(seed)
+    sequences = []
+    for _ in range(count):
+        parts = []
+        for _ in range(rng.randint(1, 4)):
+            parts.append(str(rng.randint(0, 99999)))
+            if rng.random() < 0.3:
+                parts[-1] += "." + str(rng.randint(0, 999))
+            parts.append(rng.choice("+-*/"))
+        parts.append(str(rng.randint(1, 9999)))
+        parts.append("=")
+        sequences.append("".join(parts))
+    values = [rng.uniform(-1e6, 1e6) for _ in range(count)]
+    base = datetime.date(1900, 1, 1)
+    starts = [base + datetime.timedelta(days=rng.randint(0, 70000)) for _ in range(count)]
+    ends = [base + datetime.timedelta(days=rng.randint(0, 70000)) for _ in range(count)]
+    months = [rng.randint(-600, 600) for _ in range(count)]
+    return sequences, values, starts, ends, months
+
+
+def timed(fn, *args):
+    start = time.perf_counter()
+    result = fn(*args)
+    return result, time.perf_counter() - start
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 200000
+    sequences, values, starts, ends, months = make_inputs(count)
+
+    cases = [
+        ("keypad sequences",
+         lambda: [py_keys(s) for s in sequences],
+         lambda: calc_native.keys_many(sequences)),
+        ("display formatting",
+         lambda: [py_format(v) for v in values],
+         lambda: calc_native.format_many(values)),
+        ("date differences",
+         lambda: [(b - a).days for a, b in zip(starts, ends)],
+         lambda: calc_native.date_diff_many(starts, ends)),
+        ("add months",
+         lambda: [py_add_months(d, m) for d, m in zip(starts, months)],
+         lambda: calc_native.date_add_many(starts, months, calc_native.MONTHS)),
+    ]
+
+    print("%d items each%s" % (count, "" if relativedelta else " (dateutil not installed; months use calendar)"))
+    print("%-20s %10s %10s %8s" % ("", "Python", "native", "speedup"))
+    ok = True
+    for name, py_fn, native_fn in cases:
+        expected, py_sec = timed(py_fn)
+        actual, native_sec = timed(native_fn)
+        same = expected == actual
+        ok = ok and same
+        print("%-20s %8.1f ms %8.1f ms %7.1fx%s" % (
+            name, py_sec * 1000, native_sec * 1000, py_sec / native_sec, "" if same else "  MISMATCH"))
+
+    # The batch releases the GIL, so threads overlap on multi-core machines
+    threads = 4
+    chunks = [sequences[i::threads] for i in range(threads)]
+    _, one_sec = timed(lambda: [calc_native.keys_many(c) for c in chunks])
+    workers = [threading.Thread(target=calc_native.keys_many, args=(c,)) for c in chunks]
+    start = time.perf_counter()
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+    many_sec = time.perf_counter() - start
+    print("keypad sequences on %d threads: %.1f ms (%.1f ms on one)" % (threads, many_sec * 1000, one_sec * 1000))
+
+    print("All results match" if ok else "RESULTS DIFFER")
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Windows 7 Calculator - Native Module Build Script
+Compiles calc_pymodule.cpp into the calc_native extension next to this file
+"""
+
+import sys
+import os
+
+from setuptools import setup, Extension
+
+
+def build():
+    """Build calc_native in place"""
+
+    base_dir = os.path.dirname(os.path.abspath(__file__))
+    os.chdir(base_dir)
+
+    if sys.platform == 'win32':
+        compile_args = ['/O2', '/std:c++17', '/EHsc', '/utf-8']
+    else:
+        compile_args = ['-O2', '-std=c++17']
+
+    module = Extension(
+        'calc_native',
+        sources=['calc_pymodule.cpp'],
+        language='c++',
+        extra_compile_args=compile_args,
+    )
+
+    print("=" * 60)
+    print("Building calc_native...")
+    print("=" * 60)
+
+    try:
+        setup(
+            name='calc_native',
+            ext_modules=[module],
+            script_args=['build_ext', '--inplace'],
+        )
+        print("=" * 60)
+        print("Build completed successfully!")
+        print("=" * 60)
+    except SystemExit as e:
+        if e.code:
+            print("Build failed: {}".format(e))
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    build()
@@ -0,0 +1,327 @@
+// Pluggable memory for the calculator engine
+// Portable C++ (no Win32). Every heap block the engine's number types use
+// (BigInt limbs, and through them Rational and the double-double
+// formatter) comes from a CalcAllocator: the plain heap by default, or a
+// pool or arena supplied by whoever embeds the engine. The allocator is
+// picked up from the calling thread when a container is created, so the
+// number code itself never mentions it; CalcAllocScope switches it for a
+// block of work.
+//
+// Builds with CALC_COUNT_ALLOCS defined count every allocation per thread,
+// separating blocks that came from the heap from blocks served by a pool
+// or arena. Other builds compile the counters out.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+struct CalcAllocator {
+    void* (*alloc)(void* ctx, size_t size);
+    void (*release)(void* ctx, void* p, size_t size);  // size as passed to alloc
+    void* ctx;
+};
+
+// --- Instrumentation ---
+
+struct CalcAllocStats {
+    unsigned long long allocs;      // Blocks handed out by any allocator
+    unsigned long long bytes;
+    unsigned long long heapAllocs;  // Of those, blocks that came from the heap
+    unsigned long long frees;
+
+    CalcAllocStats() : allocs(0), bytes(0), heapAllocs(0), frees(0) {}
+
+    CalcAllocStats Since(const CalcAllocStats& start) const {
+        CalcAllocStats d;
+        d.allocs = allocs - start.allocs;
+        d.bytes = bytes - start.bytes;
+        d.heapAllocs = heapAllocs - start.heapAllocs;
+        d.frees = frees - start.frees;
+        return d;
+    }
+};
+
+#ifdef CALC_COUNT_ALLOCS
+inline CalcAllocStats& CalcAllocCounters() {
+    static thread_local CalcAllocStats stats;
+    return stats;
+}
+#define CALC_COUNT_ALLOC(size) (CalcAllocCounters().allocs++, CalcAllocCounters().bytes += (size))
+#define CALC_COUNT_HEAP()      (CalcAllocCounters().heapAllocs++)
+#define CALC_COUNT_FREE()      (CalcAllocCounters().frees++)
+#else
+#define CALC_COUNT_ALLOC(size) ((void)0)
+#define CALC_COUNT_HEAP()      ((void)0)
+#define CALC_COUNT_FREE()      ((void)0)
+#endif
+
+// Snapshot of this thread's counters; all zero when counting is compiled out
+inline CalcAllocStats CalcAllocSnapshot() {
+#ifdef CALC_COUNT_ALLOCS
+    return CalcAllocCounters();
+#else
+    return CalcAllocStats();
+#endif
+}
+
+// --- Heap ---
+
+inline void* CalcHeapAlloc(void*, size_t size) {
+    CALC_COUNT_HEAP();
+    return malloc(size ? size : 1);
+}
+
+inline void CalcHeapRelease(void*, void* p, size_t) {
+    free(p);
+}
+
+inline CalcAllocator* CalcHeapAllocator() {
+    static CalcAllocator heap = {CalcHeapAlloc, CalcHeapRelease, NULL};
+    return &heap;
+}
+
+// --- Current allocator ---
+
+inline CalcAllocator*& CalcCurrentAllocatorSlot() {
+    static thread_local CalcAllocator* current = NULL;
+    return current;
+}
+
+inline CalcAllocator* CalcCurrentAllocator() {
+    CalcAllocator* a = CalcCurrentAllocatorSlot();
+    return a ? a : CalcHeapAllocator();
+}
+
+// Makes `a` the current allocator until the end of the scope (NULL = heap)
+struct CalcAllocScope {
+    CalcAllocator* saved;
+
+    explicit CalcAllocScope(CalcAllocator* a) : saved(CalcCurrentAllocatorSlot()) {
+        CalcCurrentAllocatorSlot() = a;
+    }
+    ~CalcAllocScope() { CalcCurrentAllocatorSlot() = saved; }
+};
+
+inline void* CalcAllocate(CalcAllocator* a, size_t size) {
+    CALC_COUNT_ALLOC(size);
+    return a->alloc(a->ctx, size);
+}
+
+inline void CalcRelease(CalcAllocator* a, void* p, size_t size) {
+    if (!p) return;
+    CALC_COUNT_FREE();
+    a->release(a->ctx, p, size);
+}
+
+// std::allocator adapter for engine containers. A container keeps the
+// allocator that was current when it was created; copies are made with the
+// allocator current at the time of the copy, and assignment keeps the
+// destination's allocator, so a long-lived value assigned from a temporary
+// never ends up pointing into scratch memory.
+template <typename T>
+struct CalcStdAllocator {
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::false_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    CalcAllocator* source;
+
+    CalcStdAllocator() : source(CalcCurrentAllocator()) {}
+    template <typename U>
+    CalcStdAllocator(const CalcStdAllocator<U>& other) : source(other.source) {}
+
+    T* allocate(size_t n) {
+        void* p = CalcAllocate(source, n * sizeof(T));
+        if (!p) throw std::bad_alloc();
+        return (T*)p;
+    }
+    void deallocate(T* p, size_t n) { CalcRelease(source, p, n * sizeof(T)); }
+
+    CalcStdAllocator select_on_container_copy_construction() const { return CalcStdAllocator(); }
+};
+
+template <typename T, typename U>
+inline bool operator==(const CalcStdAllocator<T>& a, const CalcStdAllocator<U>& b) { return a.source == b.source; }
+template <typename T, typename U>
+inline bool operator!=(const CalcStdAllocator<T>& a, const CalcStdAllocator<U>& b) { return a.source != b.source; }
+
+// --- Pool ---
+
+// Size-class free lists carved from large chunks. Freed blocks are reused
+// by later requests of the same class, so a workload that keeps a steady
+// set of live values stops touching the upstream allocator once warm.
+// Memory can be donated up front (a static buffer, say) so the pool never
+// needs the heap at all; requests above the largest class go upstream.
+// Not thread-safe: one pool per engine.
+struct CalcPool {
+    enum { kClasses = 8, kMinBlock = 16, kMaxBlock = kMinBlock << (kClasses - 1), kChunkSize = 64 * 1024 };
+
+    struct FreeBlock { FreeBlock* next; };
+    struct Chunk { Chunk* next; size_t size; };  // Header of a chunk taken from upstream
+
+    CalcAllocator allocator;
+    CalcAllocator* upstream;
+    FreeBlock* freeLists[kClasses];
+    char* carve;            // Unused tail of the current chunk or buffer
+    size_t carveLeft;
+    Chunk* chunks;
+    size_t inUse;           // Bytes in blocks currently handed out (rounded up)
+
+    explicit CalcPool(CalcAllocator* up = NULL) : upstream(up ? up : CalcHeapAllocator()),
+                                                  carve(NULL), carveLeft(0), chunks(NULL), inUse(0) {
+        allocator.alloc = Alloc;
+        allocator.release = Release;
+        allocator.ctx = this;
+        memset(freeLists, 0, sizeof(freeLists));
+    }
+
+    CalcPool(void* buffer, size_t size, CalcAllocator* up = NULL) : upstream(up ? up : CalcHeapAllocator()),
+                                                                  carve(NULL), carveLeft(0), chunks(NULL), inUse(0) {
+        allocator.alloc = Alloc;
+        allocator.release = Release;
+        allocator.ctx = this;
+        memset(freeLists, 0, sizeof(freeLists));
+        Donate(buffer, size);
+    }
+
+    ~CalcPool() {
+        while (chunks) {
+            Chunk* next = chunks->next;
+            upstream->release(upstream->ctx, chunks, chunks->size);
+            chunks = next;
+        }
+    }
+
+    CalcAllocator* Allocator() { return &allocator; }
+
+    // Hands the pool a buffer to carve blocks from before it asks upstream
+    void Donate(void* buffer, size_t size) {
+        // Whatever is left of the current region goes onto the free lists
+        RecycleTail();
+        uintptr_t p = ((uintptr_t)buffer + kMinBlock - 1) & ~(uintptr_t)(kMinBlock - 1);
+        size_t skip = (size_t)(p - (uintptr_t)buffer);
+        carve = (char*)p;
+        carveLeft = size > skip ? (size - skip) & ~(size_t)(kMinBlock - 1) : 0;
+    }
+
+    static int ClassOf(size_t size) {
+        int c = 0;
+        while (((size_t)kMinBlock << c) < size) c++;
+        return c;
+    }
+
+    void* Allocate(size_t size) {
+        if (size > kMaxBlock) return upstream->alloc(upstream->ctx, size);
+        int c = ClassOf(size);
+        size_t block = (size_t)kMinBlock << c;
+        inUse += block;
+        if (FreeBlock* f = freeLists[c]) {
+            freeLists[c] = f->next;
+            return f;
+        }
+        if (carveLeft < block) {
+            RecycleTail();
+            size_t bytes = sizeof(Chunk) + kMinBlock + kChunkSize;
+            Chunk* chunk = (Chunk*)upstream->alloc(upstream->ctx, bytes);
+            if (!chunk) { inUse -= block; return NULL; }
+            chunk->next = chunks;
+            chunk->size = bytes;
+            chunks = chunk;
+            Donate(chunk + 1, bytes - sizeof(Chunk));
+        }
+        void* p = carve;
+        carve += block;
+        carveLeft -= block;
+        return p;
+    }
+
+    void Free(void* p, size_t size) {
+        if (size > kMaxBlock) { upstream->release(upstream->ctx, p, size); return; }
+        int c = ClassOf(size);
+        inUse -= (size_t)kMinBlock << c;
+        FreeBlock* f = (FreeBlock*)p;
+        f->next = freeLists[c];
+        freeLists[c] = f;
+    }
+
+    // Splits the rest of the carving region into free blocks, largest first
+    void RecycleTail() {
+        for (int c = kClasses - 1; c >= 0; c--) {
+            size_t block = (size_t)kMinBlock << c;
+            while (carveLeft >= block) {
+                FreeBlock* f = (FreeBlock*)carve;
+                f->next = freeLists[c];
+                freeLists[c] = f;
+                carve += block;
+                carveLeft -= block;
+            }
+        }
+    }
+
+    static void* Alloc(void* ctx, size_t size) { return ((CalcPool*)ctx)->Allocate(size); }
+    static void Release(void* ctx, void* p, size_t size) { ((CalcPool*)ctx)->Free(p, size); }
+
+private:
+    CalcPool(const CalcPool&);
+    CalcPool& operator=(const CalcPool&);
+};
+
+// --- Arena ---
+
+// Bump allocation over a fixed buffer for short-lived scratch values.
+// Individual frees only give memory back when they release the most recent
+// block (the usual pattern of a growing temporary); everything else is
+// reclaimed at once by Rewind. When the buffer is full, requests fall
+// through to the upstream allocator and are freed back to it.
+struct CalcArena {
+    CalcAllocator allocator;
+    CalcAllocator* upstream;
+    char* base;
+    size_t size;
+    size_t used;
+    size_t peak;
+
+    CalcArena(void* buffer, size_t bytes, CalcAllocator* up = NULL)
+        : upstream(up ? up : CalcHeapAllocator()), base((char*)buffer), size(bytes), used(0), peak(0) {
+        allocator.alloc = Alloc;
+        allocator.release = Release;
+        allocator.ctx = this;
+    }
+
+    CalcAllocator* Allocator() { return &allocator; }
+
+    size_t Mark() const { return used; }
+    void Rewind(size_t mark) { if (mark < used) used = mark; }
+
+    bool Owns(const void* p) const { return (const char*)p >= base && (const char*)p < base + size; }
+
+    static size_t Round(size_t n) { return (n + 15) & ~(size_t)15; }
+
+    void* Allocate(size_t bytes) {
+        size_t n = Round(bytes ? bytes : 1);
+        if (n > size - used) return upstream->alloc(upstream->ctx, bytes);
+        void* p = base + used;
+        used += n;
+        if (used > peak) peak = used;
+        return p;
+    }
+
+    void Free(void* p, size_t bytes) {
+        if (!Owns(p)) { upstream->release(upstream->ctx, p, bytes); return; }
+        if ((char*)p + Round(bytes ? bytes : 1) == base + used) used = (size_t)((char*)p - base);
+    }
+
+    static void* Alloc(void* ctx, size_t size) { return ((CalcArena*)ctx)->Allocate(size); }
+    static void Release(void* ctx, void* p, size_t size) { ((CalcArena*)ctx)->Free(p, size); }
+
+private:
+    CalcArena(const CalcArena&);
+    CalcArena& operator=(const CalcArena&);
+};
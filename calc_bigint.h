@@ -0,0 +1,409 @@
+// Arbitrary precision signed integers for the calculator engine
+// Portable C++ (no Win32), header-only so the single-TU build stays unchanged.
+// Magnitude is stored as little-endian 32-bit limbs without leading zeros;
+// zero is an empty magnitude and is never negative. Limbs are allocated
+// through the current CalcAllocator (calc_alloc.h).
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "calc_alloc.h"
+
+typedef std::vector<uint32_t, CalcStdAllocator<uint32_t> > BigLimbs;
+
+struct BigInt {
+    BigLimbs mag;
+    bool neg;
+
+    BigInt() : neg(false) {}
+    BigInt(long long v) : neg(false) { Assign(v); }
+
+    void Assign(long long v) {
+        mag.clear();
+        neg = v < 0;
+        // Avoid UB on LLONG_MIN by negating in unsigned space
+        unsigned long long u = neg ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+        AssignMag(u);
+    }
+
+    void AssignMag(unsigned long long u) {
+        mag.clear();
+        while (u) { mag.push_back((uint32_t)u); u >>= 32; }
+        if (mag.empty()) neg = false;
+    }
+
+    static BigInt FromUint64(unsigned long long u) {
+        BigInt r;
+        r.AssignMag(u);
+        return r;
+    }
+
+    bool IsZero() const { return mag.empty(); }
+    bool IsOdd() const { return !mag.empty() && (mag[0] & 1); }
+    bool IsEven() const { return !IsOdd(); }
+
+    void Trim() {
+        while (!mag.empty() && mag.back() == 0) mag.pop_back();
+        if (mag.empty()) neg = false;
+    }
+
+    int BitLength() const {
+        if (mag.empty()) return 0;
+        uint32_t top = mag.back();
+        int bits = 0;
+        while (top) { bits++; top >>= 1; }
+        return (int)(mag.size() - 1) * 32 + bits;
+    }
+
+    bool TestBit(int i) const {
+        size_t limb = (size_t)i / 32;
+        if (limb >= mag.size()) return false;
+        return (mag[limb] >> (i % 32)) & 1;
+    }
+
+    // True when the value fits a signed 64-bit integer
+    bool FitsInt64() const {
+        if (mag.size() > 2) return false;
+        unsigned long long u = ToUint64Mag();
+        return neg ? u <= 0x8000000000000000ULL : u <= 0x7FFFFFFFFFFFFFFFULL;
+    }
+
+    unsigned long long ToUint64Mag() const {
+        unsigned long long u = 0;
+        if (mag.size() > 0) u = mag[0];
+        if (mag.size() > 1) u |= (unsigned long long)mag[1] << 32;
+        return u;
+    }
+
+    long long ToInt64() const {
+        unsigned long long u = ToUint64Mag();
+        return neg ? (long long)(0ULL - u) : (long long)u;
+    }
+
+    double ToDouble() const {
+        double r = 0;
+        for (size_t i = mag.size(); i-- > 0;) r = r * 4294967296.0 + mag[i];
+        return neg ? -r : r;
+    }
+};
+
+// --- Magnitude helpers ---
+
+inline int BigCompareMag(const BigInt& a, const BigInt& b) {
+    if (a.mag.size() != b.mag.size()) return a.mag.size() < b.mag.size() ? -1 : 1;
+    for (size_t i = a.mag.size(); i-- > 0;) {
+        if (a.mag[i] != b.mag[i]) return a.mag[i] < b.mag[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+inline int BigCompare(const BigInt& a, const BigInt& b) {
+    if (a.neg != b.neg) return a.neg ? -1 : 1;
+    int c = BigCompareMag(a, b);
+    return a.neg ? -c : c;
+}
+
+// r = |a| + |b|
+inline void BigAddMag(const BigInt& a, const BigInt& b, BigInt& r) {
+    const BigInt& lo = a.mag.size() < b.mag.size() ? a : b;
+    const BigInt& hi = a.mag.size() < b.mag.size() ? b : a;
+    BigLimbs out(hi.mag.size() + 1);
+    unsigned long long carry = 0;
+    for (size_t i = 0; i < hi.mag.size(); i++) {
+        carry += (unsigned long long)hi.mag[i] + (i < lo.mag.size() ? lo.mag[i] : 0);
+        out[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    out[hi.mag.size()] = (uint32_t)carry;
+    r.mag.swap(out);
+    r.Trim();
+}
+
+// r = |a| - |b|, requires |a| >= |b|
+inline void BigSubMag(const BigInt& a, const BigInt& b, BigInt& r) {
+    BigLimbs out(a.mag.size());
+    long long borrow = 0;
+    for (size_t i = 0; i < a.mag.size(); i++) {
+        long long d = (long long)a.mag[i] - borrow - (i < b.mag.size() ? (long long)b.mag[i] : 0);
+        borrow = d < 0;
+        out[i] = (uint32_t)(d + (borrow << 32));
+    }
+    r.mag.swap(out);
+    r.Trim();
+}
+
+inline BigInt operator-(const BigInt& a) {
+    BigInt r = a;
+    if (!r.IsZero()) r.neg = !r.neg;
+    return r;
+}
+
+inline BigInt BigAbs(const BigInt& a) {
+    BigInt r = a;
+    r.neg = false;
+    return r;
+}
+
+inline BigInt operator+(const BigInt& a, const BigInt& b) {
+    BigInt r;
+    if (a.neg == b.neg) {
+        BigAddMag(a, b, r);
+        r.neg = a.neg && !r.IsZero();
+    } else if (BigCompareMag(a, b) >= 0) {
+        BigSubMag(a, b, r);
+        r.neg = a.neg && !r.IsZero();
+    } else {
+        BigSubMag(b, a, r);
+        r.neg = b.neg && !r.IsZero();
+    }
+    return r;
+}
+
+inline BigInt operator-(const BigInt& a, const BigInt& b) {
+    return a + (-b);
+}
+
+inline BigInt operator*(const BigInt& a, const BigInt& b) {
+    BigInt r;
+    if (a.IsZero() || b.IsZero()) return r;
+    BigLimbs out(a.mag.size() + b.mag.size(), 0);
+    for (size_t i = 0; i < a.mag.size(); i++) {
+        unsigned long long carry = 0;
+        unsigned long long ai = a.mag[i];
+        for (size_t j = 0; j < b.mag.size(); j++) {
+            carry += ai * b.mag[j] + out[i + j];
+            out[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        out[i + b.mag.size()] = (uint32_t)carry;
+    }
+    r.mag.swap(out);
+    r.neg = a.neg != b.neg;
+    r.Trim();
+    return r;
+}
+
+inline BigInt BigShiftLeft(const BigInt& a, int bits) {
+    BigInt r;
+    if (a.IsZero() || bits <= 0) return bits < 0 ? r : a;
+    size_t limbs = (size_t)bits / 32;
+    int sh = bits % 32;
+    r.mag.assign(limbs, 0);
+    uint32_t carry = 0;
+    for (size_t i = 0; i < a.mag.size(); i++) {
+        r.mag.push_back(sh ? (a.mag[i] << sh) | carry : a.mag[i]);
+        carry = sh ? a.mag[i] >> (32 - sh) : 0;
+    }
+    if (carry) r.mag.push_back(carry);
+    r.neg = a.neg;
+    return r;
+}
+
+// Shifts the magnitude right (truncates toward zero)
+inline BigInt BigShiftRight(const BigInt& a, int bits) {
+    BigInt r;
+    size_t limbs = (size_t)bits / 32;
+    if (bits < 0 || limbs >= a.mag.size()) return bits < 0 ? a : r;
+    int sh = bits % 32;
+    r.mag.resize(a.mag.size() - limbs);
+    for (size_t i = 0; i < r.mag.size(); i++) {
+        uint32_t lo = a.mag[i + limbs] >> sh;
+        uint32_t hi = (sh && i + limbs + 1 < a.mag.size()) ? a.mag[i + limbs + 1] << (32 - sh) : 0;
+        r.mag[i] = lo | hi;
+    }
+    r.neg = a.neg;
+    r.Trim();
+    return r;
+}
+
+// Divides the magnitude by a single limb, returns the remainder
+inline uint32_t BigDivSmall(BigInt& a, uint32_t d) {
+    unsigned long long rem = 0;
+    for (size_t i = a.mag.size(); i-- > 0;) {
+        unsigned long long cur = (rem << 32) | a.mag[i];
+        a.mag[i] = (uint32_t)(cur / d);
+        rem = cur % d;
+    }
+    a.Trim();
+    return (uint32_t)rem;
+}
+
+// Truncating division (C semantics): q = trunc(a / b), r = a - q*b.
+// Knuth algorithm D on 32-bit limbs. Returns false on division by zero.
+inline bool BigDivMod(const BigInt& a, const BigInt& b, BigInt* q, BigInt* r) {
+    if (b.IsZero()) return false;
+    BigInt quot, rem;
+    if (BigCompareMag(a, b) < 0) {
+        rem = a;
+    } else if (b.mag.size() == 1) {
+        quot = BigAbs(a);
+        uint32_t rr = BigDivSmall(quot, b.mag[0]);
+        rem.AssignMag(rr);
+        quot.neg = (a.neg != b.neg) && !quot.IsZero();
+        rem.neg = a.neg && !rem.IsZero();
+    } else {
+        // Normalize so the divisor's top limb has its high bit set
+        int s = 0;
+        uint32_t top = b.mag.back();
+        while (!(top & 0x80000000u)) { top <<= 1; s++; }
+        BigInt v = BigShiftLeft(BigAbs(b), s);
+        BigInt u = BigShiftLeft(BigAbs(a), s);
+        size_t n = v.mag.size();
+        size_t m = u.mag.size() - n;
+        u.mag.push_back(0);
+        quot.mag.assign(m + 1, 0);
+        const unsigned long long base = 1ULL << 32;
+        for (size_t j = m + 1; j-- > 0;) {
+            unsigned long long num = ((unsigned long long)u.mag[j + n] << 32) | u.mag[j + n - 1];
+            unsigned long long qhat = num / v.mag[n - 1];
+            unsigned long long rhat = num % v.mag[n - 1];
+            while (qhat >= base || qhat * v.mag[n - 2] > ((rhat << 32) | u.mag[j + n - 2])) {
+                qhat--;
+                rhat += v.mag[n - 1];
+                if (rhat >= base) break;
+            }
+            // Multiply and subtract
+            long long borrow = 0;
+            unsigned long long carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                unsigned long long p = qhat * v.mag[i] + carry;
+                carry = p >> 32;
+                long long t = (long long)u.mag[i + j] - borrow - (long long)(uint32_t)p;
+                borrow = t < 0;
+                u.mag[i + j] = (uint32_t)(t + (borrow << 32));
+            }
+            long long t = (long long)u.mag[j + n] - borrow - (long long)carry;
+            borrow = t < 0;
+            u.mag[j + n] = (uint32_t)(t + (borrow << 32));
+            if (borrow) {
+                // qhat was one too large: add the divisor back
+                qhat--;
+                unsigned long long c = 0;
+                for (size_t i = 0; i < n; i++) {
+                    c += (unsigned long long)u.mag[i + j] + v.mag[i];
+                    u.mag[i + j] = (uint32_t)c;
+                    c >>= 32;
+                }
+                u.mag[j + n] = (uint32_t)(u.mag[j + n] + c);
+            }
+            quot.mag[j] = (uint32_t)qhat;
+        }
+        u.Trim();
+        rem = BigShiftRight(u, s);
+        quot.Trim();
+        quot.neg = (a.neg != b.neg) && !quot.IsZero();
+        rem.neg = a.neg && !rem.IsZero();
+    }
+    if (q) *q = quot;
+    if (r) *r = rem;
+    return true;
+}
+
+inline BigInt operator/(const BigInt& a, const BigInt& b) {
+    BigInt q;
+    BigDivMod(a, b, &q, NULL);
+    return q;
+}
+
+inline BigInt operator%(const BigInt& a, const BigInt& b) {
+    BigInt r;
+    BigDivMod(a, b, NULL, &r);
+    return r;
+}
+
+inline bool operator==(const BigInt& a, const BigInt& b) { return BigCompare(a, b) == 0; }
+inline bool operator!=(const BigInt& a, const BigInt& b) { return BigCompare(a, b) != 0; }
+inline bool operator<(const BigInt& a, const BigInt& b) { return BigCompare(a, b) < 0; }
+inline bool operator>(const BigInt& a, const BigInt& b) { return BigCompare(a, b) > 0; }
+inline bool operator<=(const BigInt& a, const BigInt& b) { return BigCompare(a, b) <= 0; }
+inline bool operator>=(const BigInt& a, const BigInt& b) { return BigCompare(a, b) >= 0; }
+
+// Non-negative greatest common divisor (Euclid on limbs)
+inline BigInt BigGcd(BigInt a, BigInt b) {
+    a.neg = false;
+    b.neg = false;
+    while (!b.IsZero()) {
+        BigInt r = a % b;
+        a.mag.swap(b.mag);
+        b.mag.swap(r.mag);
+    }
+    return a;
+}
+
+// Scales in place by up to 10^9 per pass, so the only allocations are the
+// limbs the result grows into
+inline BigInt BigPow10(int e) {
+    BigInt r(1);
+    while (e > 0) {
+        uint32_t scale = 1;
+        for (int k = 0; k < 9 && e > 0; k++, e--) scale *= 10;
+        unsigned long long carry = 0;
+        for (size_t j = 0; j < r.mag.size(); j++) {
+            carry += (unsigned long long)r.mag[j] * scale;
+            r.mag[j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry) r.mag.push_back((uint32_t)carry);
+    }
+    return r;
+}
+
+// Parses an optional sign followed by decimal digits. Stops at the first
+// non-digit and returns the number of characters consumed (0 on failure).
+inline int BigParse(const char* s, BigInt* out) {
+    int i = 0;
+    bool neg = false;
+    if (s[i] == '-' || s[i] == '+') { neg = s[i] == '-'; i++; }
+    int start = i;
+    BigInt r;
+    // Consume up to 9 digits at a time into a single multiply-add
+    while (s[i] >= '0' && s[i] <= '9') {
+        uint32_t chunk = 0, scale = 1;
+        int k = 0;
+        while (k < 9 && s[i] >= '0' && s[i] <= '9') {
+            chunk = chunk * 10 + (uint32_t)(s[i] - '0');
+            scale *= 10;
+            i++; k++;
+        }
+        unsigned long long carry = chunk;
+        for (size_t j = 0; j < r.mag.size(); j++) {
+            carry += (unsigned long long)r.mag[j] * scale;
+            r.mag[j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry) r.mag.push_back((uint32_t)carry);
+    }
+    if (i == start) return 0;
+    r.Trim();
+    r.neg = neg && !r.IsZero();
+    if (out) *out = r;
+    return i;
+}
+
+// Writes the decimal form into buf. Returns false (with a truncated,
+// terminated buffer) when the value does not fit.
+inline bool BigToString(const BigInt& a, char* buf, int size) {
+    if (size <= 1) { if (size == 1) buf[0] = '\0'; return false; }
+    if (a.IsZero()) { buf[0] = '0'; buf[1] = '\0'; return true; }
+    // Peel off base-1e9 chunks, least significant first
+    BigLimbs chunks;
+    BigInt t = BigAbs(a);
+    while (!t.IsZero()) chunks.push_back(BigDivSmall(t, 1000000000u));
+    char tmp[16];
+    int pos = 0;
+    bool ok = true;
+    if (a.neg) buf[pos++] = '-';
+    for (size_t i = chunks.size(); i-- > 0;) {
+        int n = snprintf(tmp, sizeof(tmp), i + 1 == chunks.size() ? "%u" : "%09u", chunks[i]);
+        if (pos + n >= size) { ok = false; break; }
+        memcpy(buf + pos, tmp, (size_t)n);
+        pos += n;
+    }
+    buf[pos] = '\0';
+    return ok;
+}
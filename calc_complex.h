@@ -0,0 +1,337 @@
+// Complex numbers for the keypad's complex mode and the complex tab
+// Portable C++ (no Win32). Values are a pair of doubles; arrays of them
+// are interleaved (re, im, re, im, ...). Angles on the display, in polar
+// entry and from CArgDeg() are in degrees, as on phasor diagrams; exp and
+// log work in radians as usual. Text is ASCII: "3-4i" (or "3-4j") in
+// rectangular form and "5<53.13" in polar, where the host draws '<' as ∠.
+//
+// The batch kernels run add, subtract, multiply, divide and magnitude
+// through SSE2, one complex value per register, with the same results as
+// the scalar functions bit for bit: each lane computes the same products
+// and sums in the same order, and values whose squares would overflow or
+// underflow take the scalar path. The remaining operations have no SSE2
+// form worth having (they are trig and log bound) and loop the scalar
+// function.
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPLX_SSE2 1
+#endif
+
+struct Complex {
+    double re;
+    double im;
+
+    Complex() : re(0), im(0) {}
+    Complex(double r, double i = 0) : re(r), im(i) {}
+
+    bool IsZero() const { return re == 0 && im == 0; }
+};
+
+// Batch operations (order matches the complex tab's operation combo).
+// Polar values need no operations of their own: CParse() reads them and
+// CFormat() writes them.
+enum ComplexOp {
+    CPLX_ADD, CPLX_SUB, CPLX_MUL, CPLX_DIV,
+    CPLX_ABS, CPLX_ARG, CPLX_SQRT, CPLX_EXP, CPLX_LOG,
+    CPLX_OP_COUNT
+};
+
+// Sums of squares inside this range need no scaling
+#define CPLX_SQ_MIN 1e-290
+#define CPLX_SQ_MAX 1e290
+#define CPLX_PART_MAX 1e140   // Dividend parts below this cannot overflow a product
+#define CPLX_PI 3.14159265358979323846
+
+inline Complex CAdd(const Complex& a, const Complex& b) { return Complex(a.re + b.re, a.im + b.im); }
+inline Complex CSub(const Complex& a, const Complex& b) { return Complex(a.re - b.re, a.im - b.im); }
+inline Complex CNeg(const Complex& a) { return Complex(-a.re, -a.im); }
+
+// Separate multiplies and adds, as in the kernels, so no FMA changes the bits
+inline Complex CMul(const Complex& a, const Complex& b) {
+    double rr = a.re * b.re, ii = a.im * b.im;
+    double ri = a.re * b.im, ir = a.im * b.re;
+    return Complex(rr - ii, ir + ri);
+}
+
+// Scales both by a power of two so the squares stay in range
+inline Complex CDivScaled(const Complex& a, const Complex& b) {
+    int e = ilogb(fmax(fabs(b.re), fabs(b.im)));
+    double c = scalbn(b.re, -e), d = scalbn(b.im, -e);
+    double den = c * c + d * d;
+    double re = (a.re * c + a.im * d) / den, im = (a.im * c - a.re * d) / den;
+    return Complex(scalbn(re, -e), scalbn(im, -e));
+}
+
+// a / b; a zero divisor gives NaNs (the engine checks for it first)
+inline Complex CDiv(const Complex& a, const Complex& b) {
+    if (b.IsZero()) return Complex(NAN, NAN);
+    double cc = b.re * b.re, dd = b.im * b.im;
+    double den = cc + dd;
+    if (den >= CPLX_SQ_MIN && den <= CPLX_SQ_MAX && fabs(a.re) < CPLX_PART_MAX && fabs(a.im) < CPLX_PART_MAX) {
+        double rc = a.re * b.re, id = a.im * b.im;
+        double ic = a.im * b.re, rd = a.re * b.im;
+        return Complex((rc + id) / den, (ic - rd) / den);
+    }
+    return CDivScaled(a, b);
+}
+
+inline double CAbs(const Complex& a) {
+    double rr = a.re * a.re, ii = a.im * a.im;
+    double s = rr + ii;
+    if (s >= CPLX_SQ_MIN && s <= CPLX_SQ_MAX) return sqrt(s);
+    return hypot(a.re, a.im);
+}
+
+// Degrees reduced to (-180, 180]
+inline double CReduceDeg(double deg) {
+    double r = fmod(deg, 360.0);
+    if (r > 180) r -= 360;
+    else if (r <= -180) r += 360;
+    return r;
+}
+
+inline double CArgDeg(const Complex& a) {
+    if (a.im == 0) return a.re < 0 ? 180 : 0;
+    if (a.re == 0) return a.im > 0 ? 90 : -90;
+    return atan2(a.im, a.re) * (180 / CPLX_PI);
+}
+
+// sin and cos of an angle in degrees, exact at multiples of 90
+inline void CSinCosDeg(double deg, double* s, double* c) {
+    double r = CReduceDeg(deg);
+    double q = nearbyint(r / 90);          // Quadrant, -2..2
+    double x = (r - q * 90) * (CPLX_PI / 180); // |x| <= pi/4
+    double sx = x == 0 ? 0 : sin(x), cx = x == 0 ? 1 : cos(x);
+    switch ((int)q) {
+        case 0: *s = sx; *c = cx; break;
+        case 1: *s = cx; *c = 0 - sx; break;   // 0 - sx: +0, not -0, on the axes
+        case -1: *s = -cx; *c = sx; break;
+        default: *s = 0 - sx; *c = -cx; break;
+    }
+}
+
+inline Complex CFromPolarDeg(double r, double deg) {
+    double s, c;
+    CSinCosDeg(deg, &s, &c);
+    return Complex(r * c, r * s);
+}
+
+// Principal root, with the cut along the negative reals
+inline Complex CSqrt(const Complex& a) {
+    if (a.IsZero()) return Complex(0, a.im);
+    double t = sqrt((fabs(a.re) + CAbs(a)) / 2);
+    if (a.re >= 0) return Complex(t, a.im / (2 * t));
+    return Complex(fabs(a.im) / (2 * t), copysign(t, a.im));
+}
+
+inline Complex CExp(const Complex& a) {
+    double m = exp(a.re);
+    if (a.im == 0) return Complex(m, 0);
+    return Complex(m * cos(a.im), m * sin(a.im));
+}
+
+// Principal logarithm; log(0) is -inf
+inline Complex CLog(const Complex& a) {
+    return Complex(log(CAbs(a)), atan2(a.im, a.re));
+}
+
+// --- Text ---
+
+// One part: whole numbers in full up to 15 digits, otherwise 12 significant digits
+inline int CFormatPart(double x, char* buf, size_t size) {
+    if (x == 0) x = 0; // No "-0"
+    if (x == floor(x) && fabs(x) < 1e15) return snprintf(buf, size, "%.0f", x);
+    return snprintf(buf, size, "%.12g", x);
+}
+
+// "a+bi" or, in polar view, "r<θ" with θ in degrees
+inline void CFormat(const Complex& a, bool polar, char* buf, size_t size) {
+    char re[40], im[40];
+    if (polar) {
+        if (a.IsZero() || std::isnan(a.re) || std::isnan(a.im)) {
+            CFormatPart(a.IsZero() ? 0 : NAN, buf, size);
+            return;
+        }
+        CFormatPart(CAbs(a), re, sizeof(re));
+        CFormatPart(CArgDeg(a), im, sizeof(im));
+        snprintf(buf, size, "%s<%s", re, im);
+        return;
+    }
+    if (a.im == 0) {
+        CFormatPart(a.re, buf, size);
+        return;
+    }
+    double mag = fabs(a.im);
+    if (mag == 1) im[0] = '\0';
+    else CFormatPart(mag, im, sizeof(im));
+    const char* sign = (a.im < 0 || std::signbit(a.im)) ? "-" : "+";
+    if (a.re == 0) {
+        snprintf(buf, size, "%s%si", sign[0] == '-' ? "-" : "", im);
+        return;
+    }
+    CFormatPart(a.re, re, sizeof(re));
+    snprintf(buf, size, "%s%s%si", re, sign, im);
+}
+
+inline bool CIsImagUnit(char ch) { return ch == 'i' || ch == 'j' || ch == 'I' || ch == 'J'; }
+
+// Reads "a", "a+bi", "a-bi", "bi", "i", "-i", "r<θ" (j for i, spaces
+// ignored). Returns false unless the whole text is one value.
+inline bool CParse(const char* text, Complex* out) {
+    char buf[128];
+    size_t n = 0;
+    for (const char* p = text; *p && n < sizeof(buf) - 1; p++) {
+        if (*p != ' ') buf[n++] = *p;
+    }
+    buf[n] = '\0';
+    if (!n) return false;
+
+    char* end;
+    const char* angle = strchr(buf, '<');
+    if (angle) {
+        double r = strtod(buf, &end);
+        if (end == buf || end != angle) return false;
+        double deg = strtod(angle + 1, &end);
+        if (end == angle + 1 || *end) return false;
+        *out = CFromPolarDeg(r, deg);
+        return true;
+    }
+
+    // A bare imaginary unit, signed or not
+    const char* p = buf;
+    double sign = 1;
+    if (*p == '+' || *p == '-') sign = (*p++ == '-') ? -1 : 1;
+    if (CIsImagUnit(*p) && !p[1]) {
+        *out = Complex(0, sign);
+        return true;
+    }
+
+    double first = strtod(buf, &end);
+    if (end == buf) return false;
+    if (!*end) {
+        *out = Complex(first, 0);
+        return true;
+    }
+    if (CIsImagUnit(*end) && !end[1]) {
+        *out = Complex(0, first);
+        return true;
+    }
+    if (*end != '+' && *end != '-') return false;
+    p = end;
+    sign = (*p++ == '-') ? -1 : 1;
+    if (*p == '+' || *p == '-') return false;
+    double second = 1;
+    if (!CIsImagUnit(*p)) {
+        second = strtod(p, &end);
+        if (end == p || *end == '+' || *end == '-') return false;
+        p = end;
+    }
+    if (!CIsImagUnit(*p) || p[1]) return false;
+    *out = Complex(first, sign * second);
+    return true;
+}
+
+// --- Batch kernels ---
+
+// out[i] = a[i] op b[i] over n interleaved values; with bStep 0 every a[i]
+// meets b[0]. out may alias a or b. Unary operations ignore b.
+inline void CBatchScalar(int op, const double* a, const double* b, size_t bStep, double* out, size_t from, size_t n) {
+    for (size_t i = from; i < n; i++) {
+        Complex x(a[2 * i], a[2 * i + 1]);
+        Complex y = b ? Complex(b[2 * i * bStep], b[2 * i * bStep + 1]) : Complex();
+        Complex z;
+        switch (op) {
+            case CPLX_ADD: z = CAdd(x, y); break;
+            case CPLX_SUB: z = CSub(x, y); break;
+            case CPLX_MUL: z = CMul(x, y); break;
+            case CPLX_DIV: z = CDiv(x, y); break;
+            case CPLX_ABS: z = Complex(CAbs(x), 0); break;
+            case CPLX_ARG: z = Complex(CArgDeg(x), 0); break;
+            case CPLX_SQRT: z = CSqrt(x); break;
+            case CPLX_EXP: z = CExp(x); break;
+            default: z = CLog(x); break;
+        }
+        out[2 * i] = z.re;
+        out[2 * i + 1] = z.im;
+    }
+}
+
+inline void CBatch(int op, const double* a, const double* b, size_t bStep, double* out, size_t n) {
+    size_t i = 0;
+#ifdef CPLX_SSE2
+    const __m128d negLo = _mm_set_pd(0.0, -0.0);   // Flips the real lane
+    const __m128d negHi = _mm_set_pd(-0.0, 0.0);   // Flips the imaginary lane
+    const __m128d signBits = _mm_set1_pd(-0.0);
+    const __m128d sqMin = _mm_set1_pd(CPLX_SQ_MIN), sqMax = _mm_set1_pd(CPLX_SQ_MAX);
+    const __m128d partMax = _mm_set1_pd(CPLX_PART_MAX);
+    switch (op) {
+        case CPLX_ADD:
+        case CPLX_SUB:
+            for (; i < n; i++) {
+                __m128d x = _mm_loadu_pd(a + 2 * i), y = _mm_loadu_pd(b + 2 * i * bStep);
+                _mm_storeu_pd(out + 2 * i, op == CPLX_ADD ? _mm_add_pd(x, y) : _mm_sub_pd(x, y));
+            }
+            break;
+        case CPLX_MUL:
+            for (; i < n; i++) {
+                // (re*c, im*c) + (-(im*d), re*d)
+                __m128d x = _mm_loadu_pd(a + 2 * i), y = _mm_loadu_pd(b + 2 * i * bStep);
+                __m128d c = _mm_unpacklo_pd(y, y), d = _mm_unpackhi_pd(y, y);
+                __m128d swapped = _mm_shuffle_pd(x, x, 1);
+                __m128d t = _mm_xor_pd(_mm_mul_pd(swapped, d), negLo);
+                _mm_storeu_pd(out + 2 * i, _mm_add_pd(_mm_mul_pd(x, c), t));
+            }
+            break;
+        case CPLX_DIV:
+            for (; i < n; i++) {
+                // ((re*c + im*d), (im*c - re*d)) / (c*c + d*d)
+                __m128d x = _mm_loadu_pd(a + 2 * i), y = _mm_loadu_pd(b + 2 * i * bStep);
+                __m128d c = _mm_unpacklo_pd(y, y), d = _mm_unpackhi_pd(y, y);
+                __m128d sq = _mm_mul_pd(y, y);
+                __m128d den = _mm_add_pd(_mm_unpacklo_pd(sq, sq), _mm_unpackhi_pd(sq, sq));
+                __m128d ok = _mm_and_pd(_mm_cmpge_pd(den, sqMin), _mm_cmple_pd(den, sqMax));
+                ok = _mm_and_pd(ok, _mm_cmplt_pd(_mm_andnot_pd(signBits, x), partMax));
+                if (_mm_movemask_pd(ok) != 3) {
+                    CBatchScalar(op, a, b, bStep, out, i, i + 1);
+                    continue;
+                }
+                __m128d swapped = _mm_shuffle_pd(x, x, 1);
+                __m128d t = _mm_xor_pd(_mm_mul_pd(swapped, d), negHi);
+                _mm_storeu_pd(out + 2 * i, _mm_div_pd(_mm_add_pd(_mm_mul_pd(x, c), t), den));
+            }
+            break;
+        case CPLX_ABS: {
+            // Two values at a time: their squares side by side, then summed
+            const __m128d zero = _mm_setzero_pd();
+            for (; i + 2 <= n; i += 2) {
+                __m128d x0 = _mm_loadu_pd(a + 2 * i), x1 = _mm_loadu_pd(a + 2 * i + 2);
+                __m128d s0 = _mm_mul_pd(x0, x0), s1 = _mm_mul_pd(x1, x1);
+                __m128d s = _mm_add_pd(_mm_unpacklo_pd(s0, s1), _mm_unpackhi_pd(s0, s1));
+                __m128d ok = _mm_and_pd(_mm_cmpge_pd(s, sqMin), _mm_cmple_pd(s, sqMax));
+                if (_mm_movemask_pd(ok) != 3) {
+                    CBatchScalar(op, a, b, bStep, out, i, i + 2);
+                    continue;
+                }
+                __m128d r = _mm_sqrt_pd(s);
+                _mm_storeu_pd(out + 2 * i, _mm_unpacklo_pd(r, zero));
+                _mm_storeu_pd(out + 2 * i + 2, _mm_unpackhi_pd(r, zero));
+            }
+            break;
+        }
+    }
+#endif
+    CBatchScalar(op, a, b, bStep, out, i, n);
+}
+
+// Whether an operation takes a second operand
+inline bool CBatchBinary(int op) {
+    return op == CPLX_ADD || op == CPLX_SUB || op == CPLX_MUL || op == CPLX_DIV;
+}
@@ -0,0 +1,252 @@
+// Retained-mode compositor for the main window
+// Portable C++ (no Win32). The window background is rendered once into a
+// cached surface; paints only recompose the damaged rectangles by copying
+// from that cache and letting each widget draw over its own area. Surfaces
+// are plain 32-bit pixel buffers (0x00RRGGBB, top-down) which the Win32
+// side wraps in DIB sections, so the same code runs and can be checked
+// pixel by pixel anywhere (bench_compositor.cpp).
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define CompRgb(r, g, b) ((uint32_t)(((r) << 16) | ((g) << 8) | (b)))
+
+struct CompRect {
+    int left, top, right, bottom;
+
+    CompRect() : left(0), top(0), right(0), bottom(0) {}
+    CompRect(int l, int t, int r, int b) : left(l), top(t), right(r), bottom(b) {}
+
+    bool IsEmpty() const { return right <= left || bottom <= top; }
+    long long Area() const { return IsEmpty() ? 0 : (long long)(right - left) * (bottom - top); }
+    bool Contains(const CompRect& o) const {
+        return o.left >= left && o.top >= top && o.right <= right && o.bottom <= bottom;
+    }
+};
+
+inline CompRect CompIntersect(const CompRect& a, const CompRect& b) {
+    CompRect r(a.left > b.left ? a.left : b.left, a.top > b.top ? a.top : b.top,
+               a.right < b.right ? a.right : b.right, a.bottom < b.bottom ? a.bottom : b.bottom);
+    return r.IsEmpty() ? CompRect() : r;
+}
+
+inline CompRect CompUnion(const CompRect& a, const CompRect& b) {
+    if (a.IsEmpty()) return b;
+    if (b.IsEmpty()) return a;
+    return CompRect(a.left < b.left ? a.left : b.left, a.top < b.top ? a.top : b.top,
+                    a.right > b.right ? a.right : b.right, a.bottom > b.bottom ? a.bottom : b.bottom);
+}
+
+// --- Surfaces ---
+
+// A pixel buffer that either owns its memory or wraps one supplied by the
+// platform (a DIB section on Windows). stride is in pixels.
+struct CompSurface {
+    int width, height, stride;
+    uint32_t* pixels;
+    std::vector<uint32_t> storage;
+
+    CompSurface() : width(0), height(0), stride(0), pixels(NULL) {}
+
+    void Allocate(int w, int h) {
+        storage.assign((size_t)w * h, 0);
+        Attach(storage.empty() ? NULL : &storage[0], w, h, w);
+    }
+
+    void Attach(uint32_t* bits, int w, int h, int pitch) {
+        pixels = bits;
+        width = w;
+        height = h;
+        stride = pitch;
+    }
+
+    CompRect Bounds() const { return CompRect(0, 0, width, height); }
+    uint32_t* Row(int y) const { return pixels + (size_t)y * stride; }
+    uint32_t At(int x, int y) const { return Row(y)[x]; }
+};
+
+// Vertical linear gradient, top row = top, bottom row = bottom, with each
+// channel interpolated in 16.16 fixed point
+inline void CompFillVerticalGradient(CompSurface& s, uint32_t top, uint32_t bottom) {
+    int span = s.height > 1 ? s.height - 1 : 1;
+    for (int y = 0; y < s.height; y++) {
+        uint32_t c = 0;
+        for (int shift = 0; shift <= 16; shift += 8) {
+            int a = (int)((top >> shift) & 0xff), b = (int)((bottom >> shift) & 0xff);
+            int v = a + (int)(((long long)(b - a) * y * 65536 / span + 32768) >> 16);
+            c |= (uint32_t)v << shift;
+        }
+        uint32_t* row = s.Row(y);
+        for (int x = 0; x < s.width; x++) row[x] = c;
+    }
+}
+
+inline void CompFillRect(CompSurface& s, const CompRect& rect, uint32_t color) {
+    CompRect r = CompIntersect(rect, s.Bounds());
+    for (int y = r.top; y < r.bottom; y++) {
+        uint32_t* row = s.Row(y);
+        for (int x = r.left; x < r.right; x++) row[x] = color;
+    }
+}
+
+// Copies the same rectangle between two surfaces of equal size
+inline void CompCopyRect(CompSurface& dst, const CompSurface& src, const CompRect& rect) {
+    CompRect r = CompIntersect(CompIntersect(rect, dst.Bounds()), src.Bounds());
+    size_t bytes = (size_t)(r.right - r.left) * sizeof(uint32_t);
+    for (int y = r.top; y < r.bottom; y++) memcpy(dst.Row(y) + r.left, src.Row(y) + r.left, bytes);
+}
+
+// --- Damage tracking ---
+
+// Dirty rectangles collected between paints. Overlapping or nearby
+// rectangles are merged when the union wastes little area, and the list is
+// capped so a storm of small updates never costs more than a few copies.
+struct CompDamage {
+    enum { kMaxRects = 8 };
+    std::vector<CompRect> rects;
+    CompRect bounds;
+
+    // Extra area the union of a and b would repaint that neither covers
+    static long long Waste(const CompRect& a, const CompRect& b) {
+        return CompUnion(a, b).Area() - a.Area() - b.Area() + CompIntersect(a, b).Area();
+    }
+
+    void Add(const CompRect& rect) {
+        CompRect r = CompIntersect(rect, bounds);
+        if (r.IsEmpty()) return;
+        for (size_t i = 0; i < rects.size(); i++) {
+            if (rects[i].Contains(r)) return;
+        }
+        // Absorb anything r covers, then merge with a cheap neighbour
+        for (size_t i = 0; i < rects.size();) {
+            if (r.Contains(rects[i])) { rects.erase(rects.begin() + i); continue; }
+            long long smaller = rects[i].Area() < r.Area() ? rects[i].Area() : r.Area();
+            if (Waste(rects[i], r) * 2 <= smaller) {
+                r = CompUnion(rects[i], r);
+                rects.erase(rects.begin() + i);
+                i = 0;
+                continue;
+            }
+            i++;
+        }
+        rects.push_back(r);
+        if (rects.size() > kMaxRects) MergeCheapestPair();
+    }
+
+    void MergeCheapestPair() {
+        size_t bestI = 0, bestJ = 1;
+        long long best = -1;
+        for (size_t i = 0; i < rects.size(); i++) {
+            for (size_t j = i + 1; j < rects.size(); j++) {
+                long long w = Waste(rects[i], rects[j]);
+                if (best < 0 || w < best) { best = w; bestI = i; bestJ = j; }
+            }
+        }
+        rects[bestI] = CompUnion(rects[bestI], rects[bestJ]);
+        rects.erase(rects.begin() + bestJ);
+    }
+
+    bool IsEmpty() const { return rects.empty(); }
+
+    void Take(std::vector<CompRect>* out) {
+        out->swap(rects);
+        rects.clear();
+    }
+};
+
+// --- Compositor ---
+
+// A rectangle the compositor draws through a callback (e.g. the display)
+struct CompWidget {
+    int id;
+    CompRect rect;
+    bool visible;
+};
+
+struct Compositor {
+    CompSurface background;   // Rendered once per size
+    CompSurface frame;        // Composed output presented to the screen
+    std::vector<CompWidget> widgets;
+    CompDamage damage;
+    uint32_t topColor, bottomColor;
+    unsigned long long pixelsComposed;  // Running total, for bench_compositor.cpp
+
+    Compositor() : topColor(0), bottomColor(0), pixelsComposed(0) {}
+
+    void SetGradient(uint32_t top, uint32_t bottom) {
+        topColor = top;
+        bottomColor = bottom;
+        if (background.pixels) {
+            CompFillVerticalGradient(background, top, bottom);
+            Invalidate(background.Bounds());
+        }
+    }
+
+    // Sets the size, optionally over caller-owned pixel memory (frameBits and
+    // backBits, width * height each). The background is re-rendered and the
+    // whole surface becomes dirty.
+    void Resize(int w, int h, uint32_t* frameBits = NULL, uint32_t* backBits = NULL) {
+        if (frameBits) frame.Attach(frameBits, w, h, w); else frame.Allocate(w, h);
+        if (backBits) background.Attach(backBits, w, h, w); else background.Allocate(w, h);
+        CompFillVerticalGradient(background, topColor, bottomColor);
+        damage.rects.clear();
+        damage.bounds = CompRect(0, 0, w, h);
+        Invalidate(damage.bounds);
+    }
+
+    CompWidget* FindWidget(int id) {
+        for (size_t i = 0; i < widgets.size(); i++) {
+            if (widgets[i].id == id) return &widgets[i];
+        }
+        return NULL;
+    }
+
+    void SetWidget(int id, const CompRect& rect) {
+        CompWidget* w = FindWidget(id);
+        if (!w) {
+            CompWidget nw = {id, rect, true};
+            widgets.push_back(nw);
+            Invalidate(rect);
+            return;
+        }
+        Invalidate(w->rect);
+        w->rect = rect;
+        Invalidate(rect);
+    }
+
+    void ShowWidget(int id, bool visible) {
+        CompWidget* w = FindWidget(id);
+        if (w && w->visible != visible) {
+            w->visible = visible;
+            Invalidate(w->rect);
+        }
+    }
+
+    void Invalidate(const CompRect& rect) { damage.Add(rect); }
+
+    void InvalidateWidget(int id) {
+        CompWidget* w = FindWidget(id);
+        if (w) Invalidate(w->rect);
+    }
+
+    // Recomposes every damaged rectangle into the frame: background first,
+    // then draw(widget, clip) for each visible widget overlapping it. The
+    // rectangles that changed are returned for presenting.
+    template <typename DrawFn>
+    void Compose(DrawFn draw, std::vector<CompRect>* changed) {
+        damage.Take(changed);
+        for (size_t i = 0; i < changed->size(); i++) {
+            const CompRect& r = (*changed)[i];
+            CompCopyRect(frame, background, r);
+            pixelsComposed += (unsigned long long)r.Area();
+            for (size_t j = 0; j < widgets.size(); j++) {
+                if (!widgets[j].visible) continue;
+                CompRect clip = CompIntersect(widgets[j].rect, r);
+                if (!clip.IsEmpty()) draw(widgets[j], clip);
+            }
+        }
+    }
+};
@@ -0,0 +1,222 @@
+// Civil date arithmetic and recurring schedules for the date calc tab
+// Portable C++ (no Win32). Dates are proleptic Gregorian; day numbers
+// count from 1970-01-01 so any date converts in O(1) both ways.
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+struct CivilDate {
+    int year;
+    int month;  // 1..12
+    int day;    // 1..31
+};
+
+inline bool IsLeapYear(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
+}
+
+inline int DaysInMonth(int year, int month) {
+    static const int days[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month == 2 && IsLeapYear(year)) return 29;
+    return days[month];
+}
+
+// Floor division helpers so negative years and offsets behave
+inline long long FloorDiv(long long a, long long b) {
+    long long q = a / b;
+    return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+inline long long FloorMod(long long a, long long b) {
+    return a - FloorDiv(a, b) * b;
+}
+
+// Days since 1970-01-01 (H. Hinnant's days_from_civil)
+inline long long DaysFromCivil(const CivilDate& d) {
+    long long y = d.year - (d.month <= 2 ? 1 : 0);
+    long long era = FloorDiv(y, 400);
+    long long yoe = y - era * 400;
+    long long mp = (d.month + 9) % 12;
+    long long doy = (153 * mp + 2) / 5 + d.day - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+inline CivilDate CivilFromDays(long long z) {
+    z += 719468;
+    long long era = FloorDiv(z, 146097);
+    long long doe = z - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    CivilDate d;
+    d.day = (int)(doy - (153 * mp + 2) / 5 + 1);
+    d.month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    d.year = (int)(yoe + era * 400 + (d.month <= 2 ? 1 : 0));
+    return d;
+}
+
+// 0 = Sunday ... 6 = Saturday, matching SYSTEMTIME::wDayOfWeek
+inline int WeekdayFromDays(long long z) {
+    return (int)FloorMod(z + 4, 7);
+}
+
+// Date units, in the order of the date calc unit combo
+#define DATE_UNIT_DAYS   0
+#define DATE_UNIT_WEEKS  1
+#define DATE_UNIT_MONTHS 2
+#define DATE_UNIT_YEARS  3
+
+// Adds whole months, clamping the day to the target month's length
+// (Jan 31 + 1 month -> Feb 28/29). With endOfMonth set, a start date on
+// the last day of its month maps to the last day of the target month.
+inline CivilDate AddMonthsClamped(const CivilDate& d, long long months, bool endOfMonth) {
+    long long total = (long long)d.year * 12 + (d.month - 1) + months;
+    CivilDate r;
+    r.year = (int)FloorDiv(total, 12);
+    r.month = (int)FloorMod(total, 12) + 1;
+    int dim = DaysInMonth(r.year, r.month);
+    bool wasLast = d.day == DaysInMonth(d.year, d.month);
+    r.day = (endOfMonth && wasLast) ? dim : (d.day > dim ? dim : d.day);
+    return r;
+}
+
+inline CivilDate DateAddUnits(const CivilDate& d, long long value, int unit, bool endOfMonth) {
+    switch (unit) {
+        case DATE_UNIT_WEEKS: return CivilFromDays(DaysFromCivil(d) + value * 7);
+        case DATE_UNIT_MONTHS: return AddMonthsClamped(d, value, endOfMonth);
+        case DATE_UNIT_YEARS: return AddMonthsClamped(d, value * 12, endOfMonth);
+        default: return CivilFromDays(DaysFromCivil(d) + value);
+    }
+}
+
+// Years date arithmetic may reach either side of year 0. Keeps step
+// products far from overflow and every year well inside CivilDate's int.
+#define DATE_MAX_YEAR 1000000
+
+// Whether `times` steps of `step` units from a date in `year` stay within
+// +-DATE_MAX_YEAR, checked without overflowing. Units are counted at their
+// fewest per year (365 days, 52 weeks), so the bound holds.
+inline bool DateStepsInRange(int year, long long step, int unit, long long times) {
+    if (year <= -DATE_MAX_YEAR || year >= DATE_MAX_YEAR || times < 0) return false;
+    if (times == 0) return true;
+    long long perYear = unit == DATE_UNIT_DAYS ? 365 : unit == DATE_UNIT_WEEKS ? 52 : unit == DATE_UNIT_MONTHS ? 12 : 1;
+    long long room = (long long)(DATE_MAX_YEAR - (step < 0 ? -year : year)) * perYear;
+    unsigned long long u = step < 0 ? 0ULL - (unsigned long long)step : (unsigned long long)step;
+    return u <= (unsigned long long)room / (unsigned long long)times;
+}
+
+// --- Recurring schedules ---
+
+// Business-day conventions, in the order of the schedule combo
+#define BIZ_NONE            0
+#define BIZ_FOLLOWING       1
+#define BIZ_MOD_FOLLOWING   2
+#define BIZ_PRECEDING       3
+
+struct ScheduleSpec {
+    CivilDate base;
+    long long step;      // Units between occurrences; negative runs backwards
+    int unit;            // DATE_UNIT_*
+    bool endOfMonth;     // Month/year steps stick to month end
+    int businessRule;    // BIZ_* (weekends only, no holiday calendar)
+    long long count;     // Number of occurrences, including the base date
+};
+
+// Moves a weekend date onto a weekday according to the convention
+inline long long AdjustBusinessDay(long long z, int rule) {
+    int wd = WeekdayFromDays(z);
+    if (rule == BIZ_NONE || (wd != 0 && wd != 6)) return z;
+    if (rule == BIZ_PRECEDING) return z - (wd == 6 ? 1 : 2);
+    long long next = z + (wd == 6 ? 2 : 1);
+    if (rule == BIZ_MOD_FOLLOWING) {
+        // Stay in the same month: roll back instead of crossing into the next
+        if (CivilFromDays(next).month != CivilFromDays(z).month) return z - (wd == 6 ? 1 : 2);
+    }
+    return next;
+}
+
+// The k-th occurrence (k = 0 is the base date) in O(1). Each occurrence is
+// computed from the base rather than the previous one, so month clamping
+// never drifts (Jan 31, Feb 28, Mar 31 ... instead of Mar 28).
+inline long long ScheduleDayAt(const ScheduleSpec& spec, long long k) {
+    CivilDate d = DateAddUnits(spec.base, spec.step * k, spec.unit, spec.endOfMonth);
+    return AdjustBusinessDay(DaysFromCivil(d), spec.businessRule);
+}
+
+// Whether every occurrence is within DateStepsInRange
+inline bool ScheduleInRange(const ScheduleSpec& spec) {
+    return spec.count >= 1 && DateStepsInRange(spec.base.year, spec.step, spec.unit, spec.count - 1);
+}
+
+inline CivilDate ScheduleAt(const ScheduleSpec& spec, long long k) {
+    return CivilFromDays(ScheduleDayAt(spec, k));
+}
+
+// Lazy forward iterator: nothing is generated until asked for
+struct ScheduleIterator {
+    const ScheduleSpec* spec;
+    long long index;
+
+    ScheduleIterator(const ScheduleSpec& s, long long start = 0) : spec(&s), index(start) {}
+
+    bool Next(CivilDate* out, long long* dayNumber = NULL) {
+        if (index >= spec->count) return false;
+        long long z = ScheduleDayAt(*spec, index++);
+        if (dayNumber) *dayNumber = z;
+        *out = CivilFromDays(z);
+        return true;
+    }
+};
+
+// Writes v in decimal at p (left to right), returns the end pointer
+inline char* AppendDecimal(char* p, long long v, int minDigits) {
+    char tmp[24];
+    int n = 0;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do { tmp[n++] = (char)('0' + u % 10); u /= 10; } while (u);
+    while (n < minDigits) tmp[n++] = '0';
+    if (v < 0) *p++ = '-';
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+// Streams the whole schedule as CSV ("index,date,weekday") through a
+// caller-provided stdio stream. Rows are formatted by hand since printf
+// dominates the cost at millions of rows. A background export passes
+// counters: rows written so far, and a flag that stops it early. Returns
+// the number written.
+inline long long WriteScheduleCsv(const ScheduleSpec& spec, FILE* f, std::atomic<long long>* progress = NULL,
+                                  const std::atomic<bool>* cancel = NULL) {
+    static const char* dayNames[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    if (fputs("index,date,weekday\n", f) < 0) return 0;
+    ScheduleIterator it(spec);
+    CivilDate d;
+    long long z;
+    long long rows = 0;
+    char line[80];
+    while (it.Next(&d, &z)) {
+        char* p = AppendDecimal(line, rows, 1);
+        *p++ = ',';
+        p = AppendDecimal(p, d.year, 4);
+        *p++ = '-';
+        p = AppendDecimal(p, d.month, 2);
+        *p++ = '-';
+        p = AppendDecimal(p, d.day, 2);
+        *p++ = ',';
+        memcpy(p, dayNames[WeekdayFromDays(z)], 3);
+        p += 3;
+        *p++ = '\n';
+        if (fwrite(line, 1, (size_t)(p - line), f) != (size_t)(p - line)) break;
+        rows++;
+        if ((rows & 0xFFFF) == 0) {
+            if (progress) progress->store(rows, std::memory_order_relaxed);
+            if (cancel && cancel->load(std::memory_order_relaxed)) break;
+        }
+    }
+    if (progress) progress->store(rows, std::memory_order_relaxed);
+    return rows;
+}
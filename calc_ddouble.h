@@ -0,0 +1,200 @@
+// Double-double arithmetic (~31 significant digits) for the high precision mode
+// A value is the unevaluated sum hi + lo with |lo| <= ulp(hi)/2. All
+// operations use error-free transforms on plain doubles, so the cost stays
+// within a small factor of ordinary double arithmetic. Formatting and
+// parsing go through the exact rational code so every digit round-trips.
+
+#pragma once
+
+#include "calc_rational.h"
+
+// std::fma is only worth it when the compiler targets hardware FMA;
+// otherwise the library call is far slower than Dekker's split.
+#if defined(FP_FAST_FMA) || defined(__FMA__) || defined(__AVX2__)
+#define DD_HAVE_FMA 1
+#else
+#define DD_HAVE_FMA 0
+#endif
+
+struct DDouble {
+    double hi;
+    double lo;
+
+    DDouble() : hi(0), lo(0) {}
+    DDouble(double h) : hi(h), lo(0) {}
+    DDouble(double h, double l) : hi(h), lo(l) {}
+
+    bool IsZero() const { return hi == 0; }
+    bool IsNegative() const { return hi < 0; }
+};
+
+// --- Error-free transforms ---
+
+inline double QuickTwoSum(double a, double b, double* err) {
+    double s = a + b;
+    *err = b - (s - a);
+    return s;
+}
+
+inline double TwoSum(double a, double b, double* err) {
+    double s = a + b;
+    double bb = s - a;
+    *err = (a - (s - bb)) + (b - bb);
+    return s;
+}
+
+inline double TwoProd(double a, double b, double* err) {
+    double p = a * b;
+#if DD_HAVE_FMA
+    *err = std::fma(a, b, -p);
+#else
+    // Dekker: split each factor into 26-bit halves
+    const double split = 134217729.0; // 2^27 + 1
+    double t = split * a;
+    double ahi = t - (t - a), alo = a - ahi;
+    t = split * b;
+    double bhi = t - (t - b), blo = b - bhi;
+    *err = ((ahi * bhi - p) + ahi * blo + alo * bhi) + alo * blo;
+#endif
+    return p;
+}
+
+// --- Arithmetic ---
+
+inline DDouble DDNeg(const DDouble& a) { return DDouble(-a.hi, -a.lo); }
+
+inline DDouble DDAdd(const DDouble& a, const DDouble& b) {
+    // Accurate (IEEE-style) addition: both error terms are kept
+    double e1, e2;
+    double s1 = TwoSum(a.hi, b.hi, &e1);
+    double s2 = TwoSum(a.lo, b.lo, &e2);
+    e1 += s2;
+    s1 = QuickTwoSum(s1, e1, &e1);
+    e1 += e2;
+    s1 = QuickTwoSum(s1, e1, &e1);
+    return DDouble(s1, e1);
+}
+
+inline DDouble DDSub(const DDouble& a, const DDouble& b) { return DDAdd(a, DDNeg(b)); }
+
+inline DDouble DDMul(const DDouble& a, const DDouble& b) {
+    double e;
+    double p = TwoProd(a.hi, b.hi, &e);
+    e += a.hi * b.lo + a.lo * b.hi;
+    p = QuickTwoSum(p, e, &e);
+    return DDouble(p, e);
+}
+
+inline DDouble DDMulDouble(const DDouble& a, double b) {
+    double e;
+    double p = TwoProd(a.hi, b, &e);
+    e += a.lo * b;
+    p = QuickTwoSum(p, e, &e);
+    return DDouble(p, e);
+}
+
+// Long division with two correction steps. Returns false on division by zero.
+inline bool DDDiv(const DDouble& a, const DDouble& b, DDouble* out) {
+    if (b.hi == 0) return false;
+    double q1 = a.hi / b.hi;
+    DDouble r = DDSub(a, DDMulDouble(b, q1));
+    double q2 = r.hi / b.hi;
+    r = DDSub(r, DDMulDouble(b, q2));
+    double q3 = r.hi / b.hi;
+    double e;
+    q1 = QuickTwoSum(q1, q2, &e);
+    *out = DDAdd(DDouble(q1, e), DDouble(q3));
+    return true;
+}
+
+// Karp's method: one Newton step on the double root. Returns false for a < 0.
+inline bool DDSqrt(const DDouble& a, DDouble* out) {
+    if (a.hi < 0) return false;
+    if (a.hi == 0) { *out = DDouble(); return true; }
+    double x = 1.0 / sqrt(a.hi);
+    double ax = a.hi * x;
+    double e;
+    double sq = TwoProd(ax, ax, &e);
+    DDouble diff = DDSub(a, DDouble(sq, e));
+    double corr = diff.hi * (x * 0.5);
+    double lo;
+    double hi = TwoSum(ax, corr, &lo);
+    *out = DDouble(hi, lo);
+    return true;
+}
+
+inline int DDCompare(const DDouble& a, const DDouble& b) {
+    if (a.hi != b.hi) return a.hi < b.hi ? -1 : 1;
+    if (a.lo != b.lo) return a.lo < b.lo ? -1 : 1;
+    return 0;
+}
+
+inline double DDToDouble(const DDouble& a) { return a.hi + a.lo; }
+
+// Rounds lo onto the 106-bit grid below hi. A plain double-double can hold
+// far more bits when lo sits well below hi, which no fixed number of
+// decimal digits reproduces; values shown to the user are rounded first so
+// the 34 digits on screen are exactly what is stored.
+inline DDouble DDRound106(const DDouble& a) {
+    if (a.hi == 0 || a.hi - a.hi != 0) return a;
+    double e;
+    double hi = QuickTwoSum(a.hi, a.lo, &e);
+    int exp;
+    frexp(hi, &exp);
+    double q = ldexp(1.0, exp - 106);
+    if (q == 0) return DDouble(hi, e);
+    double lo = nearbyint(e / q) * q;
+    hi = QuickTwoSum(hi, lo, &e);
+    return DDouble(hi, e);
+}
+
+// --- Conversion through exact rationals ---
+
+// Exact value of a finite double as a dyadic fraction
+inline Rational RatFromDoubleExact(double v) {
+    if (v == 0 || !(v == v)) return Rational();
+    int exp;
+    double m = frexp(v, &exp);
+    // 53 mantissa bits as an integer
+    long long mant = (long long)ldexp(m, 53);
+    exp -= 53;
+    BigInt n(mant);
+    if (exp >= 0) return RatFromBig(BigShiftLeft(n, exp), BigInt(1));
+    return RatFromBig(n, BigShiftLeft(BigInt(1), -exp));
+}
+
+inline Rational DDToRational(const DDouble& a) {
+    return RatAdd(RatFromDoubleExact(a.hi), RatFromDoubleExact(a.lo));
+}
+
+// Nearest double-double to an exact rational
+inline DDouble DDFromRational(const Rational& r) {
+    double hi = RatToDouble(r);
+    double lo = RatToDouble(RatSub(r, RatFromDoubleExact(hi)));
+    return DDRound106(DDouble(hi, lo));
+}
+
+// Parses the same syntax as RatParse ("1.25", "-3e-20", "1/3")
+inline bool DDParse(const char* s, DDouble* out) {
+    Rational r;
+    if (!RatParse(s, &r)) return false;
+    *out = DDFromRational(r);
+    return true;
+}
+
+// Formats with the shortest of a few candidate precisions (up to 34
+// significant digits) that parses back to exactly DDRound106(a)
+inline void DDFormat(const DDouble& value, char* buf, int size) {
+    if (value.hi != value.hi || value.hi - value.hi != 0) { snprintf(buf, (size_t)size, "Error"); return; }
+    DDouble a = DDRound106(value);
+    Rational exact = DDToRational(a);
+    // Most results round-trip at 17 digits or need the full 31+
+    static const int tries[] = {17, 20, 24, 28, 31, 32, 33, 34};
+    char tmp[96];
+    for (int i = 0; i < (int)(sizeof(tries) / sizeof(tries[0])); i++) {
+        RatFormatDecimal(exact, tmp, sizeof(tmp), tries[i]);
+        DDouble back;
+        if (tries[i] == 34 || (DDParse(tmp, &back) && DDCompare(back, a) == 0)) break;
+    }
+    snprintf(buf, (size_t)size, "%s", tmp);
+}
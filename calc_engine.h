@@ -0,0 +1,994 @@
+// Keypad calculator engine
+// Portable C++ (no Win32). Holds the keypad state and implements every key
+// in the four number modes; the host shows the display and keeps the
+// history through two callbacks. Display text, history lines and operands
+// all live in fixed buffers inside the engine. The only dynamic memory is
+// the limbs of big exact and high precision values, which come from the
+// allocators the host supplies:
+//
+//   values   long-lived operands, memory and the held display value
+//   scratch  an arena for temporaries, rewound after every operation
+//
+// With a pool over a preallocated buffer for values and an arena for
+// scratch, steady-state typing, formatting and history never reach the
+// heap. Builds with CALC_COUNT_ALLOCS record what each operation
+// allocated in lastOp.
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "calc_alloc.h"
+#include "calc_complex.h"
+#include "calc_ddouble.h"
+
+// Number modes (order matches the mode combo)
+#define NUM_DOUBLE      0
+#define NUM_EXACT       1
+#define NUM_DDOUBLE     2
+#define NUM_COMPLEX     3
+
+// Button IDs
+enum ButtonID {
+    BTN_0 = 100, BTN_1, BTN_2, BTN_3, BTN_4,
+    BTN_5, BTN_6, BTN_7, BTN_8, BTN_9,
+    BTN_ADD, BTN_SUB, BTN_MUL, BTN_DIV,
+    BTN_EQUAL, BTN_DOT,
+    BTN_C, BTN_CE, BTN_BACK, BTN_NEG, BTN_SQRT,
+    BTN_PERCENT, BTN_RECIP,
+    BTN_MC, BTN_MR, BTN_MS, BTN_MPLUS, BTN_MMINUS,
+    BTN_TODAY,
+    BTN_I, BTN_ANGLE, BTN_ABS, BTN_ARG, BTN_EXP, BTN_LN   // Complex mode only
+};
+
+// Longest display text, and the longest history line: two operands and
+// a result of that length with the operator and brackets between them
+#define CALC_TEXT_MAX       256
+#define CALC_HISTORY_MAX    (3 * CALC_TEXT_MAX + 16)
+
+// Calculator state
+struct CalcState {
+    double currentValue;
+    double previousValue;
+    double memoryValue;
+    char currentOp;
+    bool waitingForOperand;
+    bool hasMemory;
+    char displayText[CALC_TEXT_MAX];
+
+    // Exact and double-double modes keep operands, memory and the shown
+    // result in their own representation. The held display value is only
+    // trusted while a result is shown (waitingForOperand).
+    int numMode;
+    bool showFraction;
+    bool displayHeldValid;
+    Rational previousExact;
+    Rational memoryExact;
+    Rational displayExact;
+    DDouble previousDD;
+    DDouble memoryDD;
+    DDouble displayDD;
+    bool showPolar;
+    Complex previousC;
+    Complex memoryC;
+    Complex displayC;
+    
+    CalcState() : currentValue(0), previousValue(0), memoryValue(0),
+                  currentOp(0), waitingForOperand(false), hasMemory(false),
+                  numMode(NUM_DOUBLE), showFraction(true), displayHeldValid(false), showPolar(false) {
+        displayText[0] = '0';
+        displayText[1] = '\0';
+    }
+};
+
+struct CalcEngine {
+    CalcState state;
+    char lastHistory[CALC_HISTORY_MAX];         // Shown next to the memory indicator
+    CalcAllocator* values;         // NULL = heap
+    CalcArena* scratch;            // NULL = temporaries use values too
+    CalcAllocStats lastOp;         // Instrumented builds only
+    bool recordHistory;            // Off: no history lines are formatted or kept
+
+    // Host callbacks; either may be NULL
+    void (*onDisplay)(void* ctx);
+    void (*onHistory)(void* ctx, const char* line);
+    void* ctx;
+
+    CalcEngine(CalcAllocator* valueAllocator = NULL, CalcArena* scratchArena = NULL)
+        : state(MakeState(valueAllocator)), values(valueAllocator), scratch(scratchArena),
+          recordHistory(true), onDisplay(NULL), onHistory(NULL), ctx(NULL) {
+        lastHistory[0] = '\0';
+    }
+
+    // State whose big values keep their limbs in `a` for good; assignments
+    // copy into that storage instead of adopting the source's allocator
+    static CalcState MakeState(CalcAllocator* a) {
+        CalcAllocScope scope(a);
+        return CalcState();
+    }
+
+    // Brackets one operation: temporaries come from the scratch arena and
+    // are dropped when it ends. Operations may nest.
+    struct OpScope {
+        CalcEngine* engine;
+        CalcAllocScope allocScope;
+        size_t mark;
+        CalcAllocStats start;
+
+        explicit OpScope(CalcEngine* e)
+            : engine(e), allocScope(e->scratch ? e->scratch->Allocator() : e->values),
+              mark(e->scratch ? e->scratch->Mark() : 0), start(CalcAllocSnapshot()) {}
+        ~OpScope() {
+            if (engine->scratch) engine->scratch->Rewind(mark);
+            engine->lastOp = CalcAllocSnapshot().Since(start);
+        }
+    };
+
+    // Back to a cleared keypad in double mode
+    void Reset() {
+        OpScope op(this);
+        state = CalcState();
+        lastHistory[0] = '\0';
+    }
+
+    void UpdateDisplay() {
+        if (onDisplay) onDisplay(ctx);
+    }
+
+    void PushHistory(const char* expr) {
+        if (!expr || !recordHistory) return;
+        strncpy(lastHistory, expr, sizeof(lastHistory) - 1);
+        lastHistory[sizeof(lastHistory) - 1] = '\0';
+        if (onHistory) onHistory(ctx, expr);
+    }
+
+    // Replaces the entry with text (a paste or a recalled value)
+    void EnterText(const char* text, const char* historyLine) {
+        OpScope op(this);
+        strncpy(state.displayText, text, sizeof(state.displayText) - 1);
+        state.displayText[sizeof(state.displayText) - 1] = '\0';
+        state.waitingForOperand = false;
+        PushHistory(historyLine);
+        UpdateDisplay();
+    }
+
+    bool IsErrorDisplay() {
+        return strcmp(state.displayText, "Error") == 0;
+    }
+
+    double GetDisplayNumber() {
+        return atof(state.displayText);
+    }
+
+    // The memory of the current number mode, rounded to a double
+    double GetMemoryNumber() {
+        if (state.numMode == NUM_EXACT) return RatToDouble(state.memoryExact);
+        if (state.numMode == NUM_DDOUBLE) return DDToDouble(state.memoryDD);
+        return state.memoryValue;
+    }
+
+    void SetDisplayNumber(double value) {
+        if (value == floor(value)) sprintf(state.displayText, "%.0f", value);
+        else sprintf(state.displayText, "%.12g", value);
+    }
+
+    // --- Exact (fraction) mode ---
+
+    // Formats an exact value as "n/d" or as a 16-digit decimal depending on the view
+    void FormatExact(const Rational& value, char* buf, int size) {
+        if (!state.showFraction || !RatFormatFraction(value, buf, size)) {
+            RatFormatDecimal(value, buf, size, 16);
+        }
+    }
+
+    void SetDisplayExact(const Rational& value) {
+        state.displayExact = value;
+        state.displayHeldValid = true;
+        FormatExact(value, state.displayText, sizeof(state.displayText));
+    }
+
+    // Exact value of the display: the held result if one is shown, otherwise
+    // the typed text parsed without rounding
+    Rational GetDisplayExact() {
+        if (state.waitingForOperand && state.displayHeldValid) return state.displayExact;
+        Rational value;
+        if (!RatParse(state.displayText, &value)) value = RatFromDouble(GetDisplayNumber());
+        return value;
+    }
+
+    // --- Double-double (high precision) mode ---
+
+    void SetDisplayDD(const DDouble& value) {
+        // Store exactly what the 34 digits on screen say
+        state.displayDD = DDRound106(value);
+        state.displayHeldValid = true;
+        DDFormat(state.displayDD, state.displayText, sizeof(state.displayText));
+    }
+
+    DDouble GetDisplayDD() {
+        if (state.waitingForOperand && state.displayHeldValid) return state.displayDD;
+        DDouble value;
+        if (!DDParse(state.displayText, &value)) value = DDouble(GetDisplayNumber());
+        return value;
+    }
+
+    // Shortest round-trip text of a double-double read back as a rational
+    Rational RatFromDD(const DDouble& value) {
+        char buf[64];
+        DDFormat(value, buf, sizeof(buf));
+        Rational r;
+        if (!RatParse(buf, &r)) r = RatFromDouble(DDToDouble(value));
+        return r;
+    }
+
+    // --- Complex mode ---
+
+    void SetDisplayComplex(const Complex& value) {
+        state.displayC = value;
+        state.displayHeldValid = true;
+        CFormat(value, state.showPolar, state.displayText, sizeof(state.displayText));
+    }
+
+    Complex GetDisplayComplex() {
+        if (state.waitingForOperand && state.displayHeldValid) return state.displayC;
+        Complex value;
+        if (!CParse(state.displayText, &value)) value = Complex(GetDisplayNumber());
+        return value;
+    }
+
+    // Where typing goes in a complex entry: the angle after '<', the
+    // imaginary part before a trailing 'i', or the real part. Sets *start
+    // to the part's first character and *at to where new characters go.
+    void ComplexEntryPart(int* start, int* at) {
+        char* text = state.displayText;
+        int len = (int)strlen(text);
+        const char* angle = strchr(text, '<');
+        if (angle) {
+            *start = (int)(angle - text) + 1;
+            *at = len;
+            return;
+        }
+        if (len > 0 && text[len - 1] == 'i') {
+            int p = len - 1;
+            while (p > 0 && !((text[p - 1] == '+' || text[p - 1] == '-') && (p < 2 || (text[p - 2] != 'e' && text[p - 2] != 'E')))) p--;
+            *start = p;
+            *at = len - 1;
+            return;
+        }
+        *start = 0;
+        *at = len;
+    }
+
+    void InsertEntryText(int at, const char* insert) {
+        int len = (int)strlen(state.displayText);
+        int n = (int)strlen(insert);
+        if (len + n > MaxEntryLength()) return;
+        memmove(state.displayText + at + n, state.displayText + at, (size_t)(len - at + 1));
+        memcpy(state.displayText + at, insert, (size_t)n);
+    }
+
+    // The display as a double-double whatever the mode (for the host's
+    // memory registers)
+    DDouble GetDisplayValueDD() {
+        OpScope op(this);
+        if (state.numMode == NUM_EXACT) return DDFromRational(GetDisplayExact());
+        if (state.numMode == NUM_DDOUBLE) return GetDisplayDD();
+        if (state.numMode == NUM_COMPLEX) return DDouble(GetDisplayComplex().re);
+        return DDouble(GetDisplayNumber());
+    }
+
+    // Text for EnterText() that reads back as value in the current mode:
+    // the shortest round-trip double in double mode, otherwise every digit
+    void FormatForEntry(const DDouble& value, char* buf, int size) {
+        OpScope op(this);
+        if (state.numMode == NUM_EXACT || state.numMode == NUM_DDOUBLE) {
+            DDFormat(value, buf, size);
+            return;
+        }
+        double v = DDToDouble(value);
+        for (int digits = 15; digits <= 17; digits++) {
+            snprintf(buf, (size_t)size, "%.*g", digits, v);
+            if (strtod(buf, NULL) == v) break;
+        }
+    }
+
+    // Converts operands, memory and a shown result to another number mode.
+    // Values pass through rationals: doubles become their simplest fraction,
+    // double-doubles their shortest round-trip decimal. Leaving complex
+    // mode keeps the real parts.
+    void SetNumberMode(int mode) {
+        OpScope op(this);
+        if (mode == state.numMode) return;
+        bool showingResult = state.waitingForOperand && !IsErrorDisplay();
+
+        Rational prev, mem, shown;
+        if (state.numMode == NUM_EXACT) {
+            shown = GetDisplayExact();
+            prev = state.previousExact;
+            mem = state.memoryExact;
+        } else if (state.numMode == NUM_DDOUBLE) {
+            shown = RatFromDD(GetDisplayDD());
+            prev = RatFromDD(state.previousDD);
+            mem = RatFromDD(state.memoryDD);
+        } else if (state.numMode == NUM_COMPLEX) {
+            shown = RatFromDouble(GetDisplayComplex().re);
+            prev = RatFromDouble(state.previousC.re);
+            mem = RatFromDouble(state.memoryC.re);
+        } else {
+            shown = RatFromDouble(GetDisplayNumber());
+            prev = RatFromDouble(state.previousValue);
+            mem = RatFromDouble(state.memoryValue);
+        }
+
+        state.numMode = mode;
+        state.displayHeldValid = false;
+        if (mode == NUM_EXACT) {
+            state.previousExact = prev;
+            state.memoryExact = mem;
+            if (showingResult) SetDisplayExact(shown);
+        } else if (mode == NUM_DDOUBLE) {
+            state.previousDD = DDFromRational(prev);
+            state.memoryDD = DDFromRational(mem);
+            if (showingResult) SetDisplayDD(DDFromRational(shown));
+        } else if (mode == NUM_COMPLEX) {
+            state.previousC = Complex(RatToDouble(prev));
+            state.memoryC = Complex(RatToDouble(mem));
+            if (showingResult) SetDisplayComplex(Complex(RatToDouble(shown)));
+        } else {
+            state.previousValue = RatToDouble(prev);
+            state.memoryValue = RatToDouble(mem);
+            if (showingResult) SetDisplayNumber(RatToDouble(shown));
+        }
+    }
+
+    // Longest number the keypad accepts; double-double entry needs ~34
+    // digits and a complex one two numbers
+    int MaxEntryLength() {
+        if (state.numMode == NUM_COMPLEX) return 60;
+        return state.numMode == NUM_DDOUBLE ? 40 : 30;
+    }
+
+    // Switches the exact display between fraction and decimal views, and
+    // the complex display between a+bi and r<θ
+    void ToggleFractionView() {
+        OpScope op(this);
+        if (state.numMode == NUM_COMPLEX) {
+            // Converts a value being typed too, which ends its entry
+            state.showPolar = !state.showPolar;
+            if (IsErrorDisplay()) return;
+            SetDisplayComplex(GetDisplayComplex());
+            state.waitingForOperand = true;
+            return;
+        }
+        if (state.numMode != NUM_EXACT) return;
+        state.showFraction = !state.showFraction;
+        if (state.waitingForOperand && state.displayHeldValid && !IsErrorDisplay()) {
+            SetDisplayExact(state.displayExact);
+        }
+    }
+
+    // Handle digit input
+    void InputDigit(int digit) {
+        OpScope op(this);
+        if (digit < 0 || digit > 9) return;
+
+        if (state.waitingForOperand || IsErrorDisplay()) {
+            state.displayText[0] = '0' + digit;
+            state.displayText[1] = '\0';
+            state.waitingForOperand = false;
+        } else if (state.numMode == NUM_COMPLEX && strpbrk(state.displayText, "i<")) {
+            int start, at;
+            ComplexEntryPart(&start, &at);
+            char digitText[2] = {(char)('0' + digit), '\0'};
+            InsertEntryText(at, digitText);
+        } else {
+            int len = (int)strlen(state.displayText);
+            if (strcmp(state.displayText, "0") == 0) {
+                state.displayText[0] = '0' + digit;
+                state.displayText[1] = '\0';
+            } else if (len < MaxEntryLength()) {
+                state.displayText[len] = '0' + digit;
+                state.displayText[len + 1] = '\0';
+            }
+        }
+        UpdateDisplay();
+    }
+
+    // Exact counterpart of Calculate(): same operators, same error handling
+    void CalculateExact() {
+        Rational left = state.previousExact;
+        Rational right = GetDisplayExact();
+        Rational result;
+
+        switch (state.currentOp) {
+            case '+': result = RatAdd(left, right); break;
+            case '-': result = RatSub(left, right); break;
+            case '*': result = RatMul(left, right); break;
+            case '/':
+                if (!RatDiv(left, right, &result)) {
+                    strcpy(state.displayText, "Error");
+                    PushHistory("Divide by zero");
+                    state.waitingForOperand = true;
+                    UpdateDisplay();
+                    return;
+                }
+                break;
+            default: return;
+        }
+
+        state.previousExact = result;
+        SetDisplayExact(result);
+
+        if (recordHistory) {
+            char l[CALC_TEXT_MAX], r[CALC_TEXT_MAX];
+            FormatExact(left, l, sizeof(l));
+            FormatExact(right, r, sizeof(r));
+            char expr[CALC_HISTORY_MAX];
+            snprintf(expr, sizeof(expr), "%s %c %s = %s", l, state.currentOp, r, state.displayText);
+            PushHistory(expr);
+        }
+
+        state.waitingForOperand = true;
+        UpdateDisplay();
+    }
+
+    // Double-double counterpart of Calculate()
+    void CalculateDD() {
+        DDouble left = state.previousDD;
+        DDouble right = GetDisplayDD();
+        DDouble result;
+
+        switch (state.currentOp) {
+            case '+': result = DDAdd(left, right); break;
+            case '-': result = DDSub(left, right); break;
+            case '*': result = DDMul(left, right); break;
+            case '/':
+                if (!DDDiv(left, right, &result)) {
+                    strcpy(state.displayText, "Error");
+                    PushHistory("Divide by zero");
+                    state.waitingForOperand = true;
+                    UpdateDisplay();
+                    return;
+                }
+                break;
+            default: return;
+        }
+
+        SetDisplayDD(result);
+        state.previousDD = state.displayDD;
+
+        if (recordHistory) {
+            char l[CALC_TEXT_MAX], r[CALC_TEXT_MAX];
+            DDFormat(left, l, sizeof(l));
+            DDFormat(right, r, sizeof(r));
+            char expr[CALC_HISTORY_MAX];
+            snprintf(expr, sizeof(expr), "%s %c %s = %s", l, state.currentOp, r, state.displayText);
+            PushHistory(expr);
+        }
+
+        state.waitingForOperand = true;
+        UpdateDisplay();
+    }
+
+    // Complex counterpart of Calculate()
+    void CalculateComplex() {
+        Complex left = state.previousC;
+        Complex right = GetDisplayComplex();
+        Complex result;
+
+        switch (state.currentOp) {
+            case '+': result = CAdd(left, right); break;
+            case '-': result = CSub(left, right); break;
+            case '*': result = CMul(left, right); break;
+            case '/':
+                if (right.IsZero()) {
+                    strcpy(state.displayText, "Error");
+                    PushHistory("Divide by zero");
+                    state.waitingForOperand = true;
+                    UpdateDisplay();
+                    return;
+                }
+                result = CDiv(left, right);
+                break;
+            default: return;
+        }
+
+        state.previousC = result;
+        SetDisplayComplex(result);
+
+        if (recordHistory) {
+            char l[CALC_TEXT_MAX], r[CALC_TEXT_MAX];
+            CFormat(left, state.showPolar, l, sizeof(l));
+            CFormat(right, state.showPolar, r, sizeof(r));
+            char expr[CALC_HISTORY_MAX];
+            snprintf(expr, sizeof(expr), "(%s) %c (%s) = %s", l, state.currentOp, r, state.displayText);
+            PushHistory(expr);
+        }
+
+        state.waitingForOperand = true;
+        UpdateDisplay();
+    }
+
+    // Calculate result
+    void Calculate() {
+        if (state.currentOp == 0) return;
+        if (state.numMode == NUM_COMPLEX) {
+            CalculateComplex();
+            return;
+        }
+        if (state.numMode == NUM_EXACT) {
+            CalculateExact();
+            return;
+        }
+        if (state.numMode == NUM_DDOUBLE) {
+            CalculateDD();
+            return;
+        }
+
+        double left = state.previousValue;
+        double right = GetDisplayNumber();
+        double result = 0.0;
+
+        switch (state.currentOp) {
+            case '+': result = left + right; break;
+            case '-': result = left - right; break;
+            case '*': result = left * right; break;
+            case '/':
+                if (right == 0.0) {
+                    strcpy(state.displayText, "Error");
+                    PushHistory("Divide by zero");
+                    state.waitingForOperand = true;
+                    UpdateDisplay();
+                    return;
+                }
+                result = left / right;
+                break;
+            default: return;
+        }
+
+        state.previousValue = result;
+        SetDisplayNumber(result);
+
+        if (recordHistory) {
+            char expr[CALC_HISTORY_MAX];
+            snprintf(expr, sizeof(expr), "%.12g %c %.12g = %s", left, state.currentOp, right, state.displayText);
+            PushHistory(expr);
+        }
+
+        state.waitingForOperand = true;
+        UpdateDisplay();
+    }
+
+    // Memory and unary keys in exact mode. Returns false for keys that behave
+    // the same in both modes (digits, editing, operators).
+    bool HandleExactButton(int id) {
+        char expr[CALC_HISTORY_MAX];
+        char operand[CALC_TEXT_MAX];
+
+        if (id == BTN_MR) {
+            SetDisplayExact(state.memoryExact);
+        }
+        else if (id == BTN_MS || id == BTN_MPLUS || id == BTN_MMINUS) {
+            Rational value = GetDisplayExact();
+            if (id == BTN_MS) state.memoryExact = value;
+            else if (id == BTN_MPLUS) state.memoryExact = RatAdd(state.memoryExact, value);
+            else state.memoryExact = RatSub(state.memoryExact, value);
+            state.hasMemory = !state.memoryExact.IsZero();
+            // Keep the shown value exact after the operand is committed
+            SetDisplayExact(value);
+        }
+        else if (id == BTN_MC) {
+            state.memoryExact = Rational();
+            state.hasMemory = false;
+            UpdateDisplay();
+            return true;
+        }
+        else if (id == BTN_NEG) {
+            if (IsErrorDisplay()) return true;
+            if (!(state.waitingForOperand && state.displayHeldValid)) return false;
+            SetDisplayExact(RatNeg(state.displayExact));
+            UpdateDisplay();
+            return true;
+        }
+        else if (id == BTN_SQRT) {
+            Rational value = GetDisplayExact();
+            FormatExact(value, operand, sizeof(operand));
+            if (value.IsNegative()) {
+                strcpy(state.displayText, "Error");
+                PushHistory("sqrt of negative");
+            } else {
+                // Irrational roots fall back to the closest fraction of the double result
+                Rational root;
+                if (!RatSqrtExact(value, &root)) root = RatFromDouble(sqrt(RatToDouble(value)));
+                SetDisplayExact(root);
+                snprintf(expr, sizeof(expr), "sqrt(%s) = %s", operand, state.displayText);
+                PushHistory(expr);
+            }
+        }
+        else if (id == BTN_PERCENT) {
+            Rational value = GetDisplayExact();
+            FormatExact(value, operand, sizeof(operand));
+            SetDisplayExact(RatMul(value, RatMake(1, 100)));
+            snprintf(expr, sizeof(expr), "%s%% = %s", operand, state.displayText);
+            PushHistory(expr);
+        }
+        else if (id == BTN_RECIP) {
+            Rational value = GetDisplayExact();
+            FormatExact(value, operand, sizeof(operand));
+            if (!value.IsZero()) {
+                SetDisplayExact(RatRecip(value));
+                snprintf(expr, sizeof(expr), "1/(%s) = %s", operand, state.displayText);
+                PushHistory(expr);
+            } else {
+                strcpy(state.displayText, "Error");
+                PushHistory("1/0");
+            }
+        }
+        else {
+            return false;
+        }
+
+        state.waitingForOperand = true;
+        UpdateDisplay();
+        return true;
+    }
+
+    // Memory and unary keys in double-double mode, mirroring HandleExactButton()
+    bool HandleDDButton(int id) {
+        char expr[CALC_HISTORY_MAX];
+        char operand[CALC_TEXT_MAX];
+
+        if (id == BTN_MR) {
+            SetDisplayDD(state.memoryDD);
+        }
+        else if (id == BTN_MS || id == BTN_MPLUS || id == BTN_MMINUS) {
+            DDouble value = GetDisplayDD();
+            if (id == BTN_MS) state.memoryDD = value;
+            else if (id == BTN_MPLUS) state.memoryDD = DDAdd(state.memoryDD, value);
+            else state.memoryDD = DDSub(state.memoryDD, value);
+            state.hasMemory = !state.memoryDD.IsZero();
+            SetDisplayDD(value);
+        }
+        else if (id == BTN_MC) {
+            state.memoryDD = DDouble();
+            state.hasMemory = false;
+            UpdateDisplay();
+            return true;
+        }
+        else if (id == BTN_NEG) {
+            if (IsErrorDisplay()) return true;
+            if (!(state.waitingForOperand && state.displayHeldValid)) return false;
+            SetDisplayDD(DDNeg(state.displayDD));
+            UpdateDisplay();
+            return true;
+        }
+        else if (id == BTN_SQRT) {
+            DDouble value = GetDisplayDD();
+            DDouble root;
+            DDFormat(value, operand, sizeof(operand));
+            if (DDSqrt(value, &root)) {
+                SetDisplayDD(root);
+                snprintf(expr, sizeof(expr), "sqrt(%s) = %s", operand, state.displayText);
+                PushHistory(expr);
+            } else {
+                strcpy(state.displayText, "Error");
+                PushHistory("sqrt of negative");
+            }
+        }
+        else if (id == BTN_PERCENT) {
+            DDouble value = GetDisplayDD();
+            DDouble result;
+            DDFormat(value, operand, sizeof(operand));
+            DDDiv(value, DDouble(100.0), &result);
+            SetDisplayDD(result);
+            snprintf(expr, sizeof(expr), "%s%% = %s", operand, state.displayText);
+            PushHistory(expr);
+        }
+        else if (id == BTN_RECIP) {
+            DDouble value = GetDisplayDD();
+            DDouble result;
+            DDFormat(value, operand, sizeof(operand));
+            if (DDDiv(DDouble(1.0), value, &result)) {
+                SetDisplayDD(result);
+                snprintf(expr, sizeof(expr), "1/(%s) = %s", operand, state.displayText);
+                PushHistory(expr);
+            } else {
+                strcpy(state.displayText, "Error");
+                PushHistory("1/0");
+            }
+        }
+        else {
+            return false;
+        }
+
+        state.waitingForOperand = true;
+        UpdateDisplay();
+        return true;
+    }
+
+    // Entry keys of complex mode: 'i' starts the imaginary part and '<'
+    // the angle; the point, backspace and sign act on the part being typed
+    bool HandleComplexEntry(int id) {
+        char* text = state.displayText;
+        bool fresh = state.waitingForOperand || IsErrorDisplay();
+        if (id == BTN_I || id == BTN_ANGLE) {
+            const char* start = id == BTN_I ? "i" : "1<";
+            if (fresh || strcmp(text, "0") == 0) {
+                strcpy(text, start);
+                state.waitingForOperand = false;
+            } else if (!strpbrk(text, "i<")) {
+                InsertEntryText((int)strlen(text), id == BTN_I ? "+i" : "<");
+            }
+        }
+        else if (fresh || !strpbrk(text, "i<")) {
+            return false; // Plain real entry: the usual keys
+        }
+        else if (id == BTN_DOT) {
+            int start, at;
+            ComplexEntryPart(&start, &at);
+            if (!memchr(text + start, '.', (size_t)(at - start))) {
+                bool empty = at == start || text[at - 1] < '0' || text[at - 1] > '9';
+                InsertEntryText(at, empty ? "0." : ".");
+            }
+        }
+        else if (id == BTN_BACK) {
+            int start, at;
+            ComplexEntryPart(&start, &at);
+            int len = (int)strlen(text);
+            if (at > start && text[at - 1] != '+' && text[at - 1] != '-') {
+                memmove(text + at - 1, text + at, (size_t)(len - at + 1));
+            } else {
+                // An empty part goes with its 'i' or '<' and sign
+                int cut = start;
+                if (text[len - 1] == 'i' && cut > 0 && (text[cut - 1] == '+' || text[cut - 1] == '-')) cut--;
+                if (text[len - 1] != 'i' && cut > 0) cut--;
+                text[cut] = '\0';
+                if (!text[0]) strcpy(text, "0");
+            }
+        }
+        else if (id == BTN_NEG) {
+            int start, at;
+            ComplexEntryPart(&start, &at);
+            char* sign = start > 0 ? text + start - 1 : NULL;
+            if (sign && (*sign == '+' || *sign == '-') && text[strlen(text) - 1] == 'i') {
+                *sign = *sign == '+' ? '-' : '+';
+            } else if (text[start] == '-') {
+                memmove(text + start, text + start + 1, strlen(text + start));
+            } else {
+                InsertEntryText(start, "-");
+            }
+        }
+        else {
+            return false;
+        }
+        UpdateDisplay();
+        return true;
+    }
+
+    // Memory, unary and entry keys in complex mode, mirroring HandleExactButton()
+    bool HandleComplexButton(int id) {
+        if (HandleComplexEntry(id)) return true;
+
+        char expr[CALC_HISTORY_MAX];
+        char operand[CALC_TEXT_MAX];
+        Complex value;
+        const char* name = NULL;
+
+        if (id == BTN_MR) {
+            SetDisplayComplex(state.memoryC);
+        }
+        else if (id == BTN_MS || id == BTN_MPLUS || id == BTN_MMINUS) {
+            value = GetDisplayComplex();
+            if (id == BTN_MS) state.memoryC = value;
+            else if (id == BTN_MPLUS) state.memoryC = CAdd(state.memoryC, value);
+            else state.memoryC = CSub(state.memoryC, value);
+            state.hasMemory = !state.memoryC.IsZero();
+            SetDisplayComplex(value);
+        }
+        else if (id == BTN_MC) {
+            state.memoryC = Complex();
+            state.hasMemory = false;
+            UpdateDisplay();
+            return true;
+        }
+        else if (id == BTN_NEG) {
+            if (IsErrorDisplay()) return true;
+            if (!(state.waitingForOperand && state.displayHeldValid)) return false;
+            SetDisplayComplex(CNeg(state.displayC));
+            UpdateDisplay();
+            return true;
+        }
+        else if (id == BTN_SQRT || id == BTN_PERCENT || id == BTN_ABS || id == BTN_ARG || id == BTN_EXP || id == BTN_LN) {
+            value = GetDisplayComplex();
+            CFormat(value, state.showPolar, operand, sizeof(operand));
+            if (id == BTN_LN && value.IsZero()) {
+                strcpy(state.displayText, "Error");
+                PushHistory("ln 0");
+            } else {
+                Complex result;
+                switch (id) {
+                    case BTN_SQRT: result = CSqrt(value); name = "sqrt"; break;
+                    case BTN_ABS: result = Complex(CAbs(value)); name = "abs"; break;
+                    case BTN_ARG: result = Complex(CArgDeg(value)); name = "arg"; break;
+                    case BTN_EXP: result = CExp(value); name = "exp"; break;
+                    case BTN_LN: result = CLog(value); name = "ln"; break;
+                    default: result = CDiv(value, Complex(100)); break;
+                }
+                SetDisplayComplex(result);
+                if (name) snprintf(expr, sizeof(expr), "%s(%s) = %s", name, operand, state.displayText);
+                else snprintf(expr, sizeof(expr), "(%s)%% = %s", operand, state.displayText);
+                PushHistory(expr);
+            }
+        }
+        else if (id == BTN_RECIP) {
+            value = GetDisplayComplex();
+            CFormat(value, state.showPolar, operand, sizeof(operand));
+            if (!value.IsZero()) {
+                SetDisplayComplex(CDiv(Complex(1), value));
+                snprintf(expr, sizeof(expr), "1/(%s) = %s", operand, state.displayText);
+                PushHistory(expr);
+            } else {
+                strcpy(state.displayText, "Error");
+                PushHistory("1/0");
+            }
+        }
+        else {
+            return false;
+        }
+
+        state.waitingForOperand = true;
+        UpdateDisplay();
+        return true;
+    }
+
+    // Handle button click
+    void HandleButton(int id) {
+        OpScope op(this);
+        if (state.numMode == NUM_EXACT && HandleExactButton(id)) return;
+        if (state.numMode == NUM_DDOUBLE && HandleDDButton(id)) return;
+        if (state.numMode == NUM_COMPLEX && HandleComplexButton(id)) return;
+
+        if (id >= BTN_0 && id <= BTN_9) {
+            InputDigit(id - BTN_0);
+        }
+        else if (id >= BTN_ADD && id <= BTN_DIV) {
+            if (IsErrorDisplay()) strcpy(state.displayText, "0");
+
+            if (state.currentOp != 0 && !state.waitingForOperand) {
+                Calculate(); // 连续运算
+            } else {
+                state.previousValue = GetDisplayNumber();
+                if (state.numMode == NUM_EXACT) state.previousExact = GetDisplayExact();
+                else if (state.numMode == NUM_DDOUBLE) state.previousDD = GetDisplayDD();
+                else if (state.numMode == NUM_COMPLEX) state.previousC = GetDisplayComplex();
+            }
+
+            state.currentOp = (id == BTN_ADD) ? '+' :
+                                (id == BTN_SUB) ? '-' :
+                                (id == BTN_MUL) ? '*' : '/';
+            state.waitingForOperand = true;
+        }
+        else if (id == BTN_EQUAL) {
+            Calculate();
+            state.currentOp = 0;
+        }
+        else if (id == BTN_C) {
+            int numMode = state.numMode;
+            bool showFraction = state.showFraction;
+            bool showPolar = state.showPolar;
+            state = CalcState();
+            state.numMode = numMode;
+            state.showFraction = showFraction;
+            state.showPolar = showPolar;
+            lastHistory[0] = '\0';
+            UpdateDisplay();
+        }
+        else if (id == BTN_CE) {
+            strcpy(state.displayText, "0");
+            state.waitingForOperand = false;
+            UpdateDisplay();
+        }
+        else if (id == BTN_BACK) {
+            if (state.waitingForOperand || IsErrorDisplay()) {
+                strcpy(state.displayText, "0");
+            } else {
+                int len = (int)strlen(state.displayText);
+                if (len > 1) state.displayText[len - 1] = '\0';
+                else strcpy(state.displayText, "0");
+            }
+            UpdateDisplay();
+        }
+        else if (id == BTN_DOT) {
+            if (state.waitingForOperand || IsErrorDisplay()) {
+                strcpy(state.displayText, "0.");
+                state.waitingForOperand = false;
+            } else if (strchr(state.displayText, '.') == NULL) {
+                int len = (int)strlen(state.displayText);
+                if (len < MaxEntryLength()) {
+                    state.displayText[len] = '.';
+                    state.displayText[len + 1] = '\0';
+                }
+            }
+            UpdateDisplay();
+        }
+        else if (id == BTN_NEG) {
+            if (!IsErrorDisplay()) {
+                if (state.displayText[0] == '-') {
+                    memmove(state.displayText, state.displayText + 1, strlen(state.displayText));
+                } else if (strcmp(state.displayText, "0") != 0) {
+                    memmove(state.displayText + 1, state.displayText, strlen(state.displayText) + 1);
+                    state.displayText[0] = '-';
+                }
+                UpdateDisplay();
+            }
+        }
+        else if (id == BTN_MC) {
+            state.memoryValue = 0;
+            state.hasMemory = false;
+            UpdateDisplay();
+        }
+        else if (id == BTN_MR) {
+            SetDisplayNumber(state.memoryValue);
+            state.waitingForOperand = true;
+            UpdateDisplay();
+        }
+        else if (id == BTN_MS) {
+            state.memoryValue = GetDisplayNumber();
+            state.hasMemory = (state.memoryValue != 0);
+            state.waitingForOperand = true;
+            UpdateDisplay();
+        }
+        else if (id == BTN_MPLUS) {
+            state.memoryValue += GetDisplayNumber();
+            state.hasMemory = (state.memoryValue != 0);
+            state.waitingForOperand = true;
+            UpdateDisplay();
+        }
+        else if (id == BTN_MMINUS) {
+            state.memoryValue -= GetDisplayNumber();
+            state.hasMemory = (state.memoryValue != 0);
+            state.waitingForOperand = true;
+            UpdateDisplay();
+        }
+        else if (id == BTN_SQRT) {
+            double val = GetDisplayNumber();
+            if (val >= 0) {
+                SetDisplayNumber(sqrt(val));
+                char expr[CALC_HISTORY_MAX];
+                snprintf(expr, sizeof(expr), "sqrt(%.12g) = %s", val, state.displayText);
+                PushHistory(expr);
+            } else {
+                strcpy(state.displayText, "Error");
+                PushHistory("sqrt of negative");
+            }
+            state.waitingForOperand = true;
+            UpdateDisplay();
+        }
+        else if (id == BTN_PERCENT) {
+            double val = GetDisplayNumber();
+            SetDisplayNumber(val / 100.0);
+            char expr[CALC_HISTORY_MAX];
+            snprintf(expr, sizeof(expr), "%.12g%% = %s", val, state.displayText);
+            PushHistory(expr);
+            state.waitingForOperand = true;
+            UpdateDisplay();
+        }
+        else if (id == BTN_RECIP) {
+            double val = GetDisplayNumber();
+            if (val != 0) {
+                SetDisplayNumber(1.0 / val);
+                char expr[CALC_HISTORY_MAX];
+                snprintf(expr, sizeof(expr), "1/(%.12g) = %s", val, state.displayText);
+                PushHistory(expr);
+            } else {
+                strcpy(state.displayText, "Error");
+                PushHistory("1/0");
+            }
+            state.waitingForOperand = true;
+            UpdateDisplay();
+        }
+    }
+};
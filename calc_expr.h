@@ -0,0 +1,304 @@
+// Formulas with named variables (parameter sweeps and the like)
+// Portable C++ (no Win32). Text is compiled once into a small stack-machine
+// program that is then evaluated many times, either one point at a time or
+// a block of points per instruction so the dispatch cost is shared. Values
+// follow the keypad's double semantics: division by zero and the square
+// root of a negative number are errors, and x% is x / 100.
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Evaluation errors, per point
+#define EXPR_OK           0
+#define EXPR_ERR_DIVZERO  1
+#define EXPR_ERR_DOMAIN   2
+
+inline const char* ExprErrorText(int error) {
+    switch (error) {
+        case EXPR_ERR_DIVZERO: return "Divide by zero";
+        case EXPR_ERR_DOMAIN: return "Invalid input";
+        default: return "";
+    }
+}
+
+enum ExprOp {
+    EXPR_CONST, EXPR_VAR,
+    EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_POW, EXPR_MIN, EXPR_MAX,
+    EXPR_NEG, EXPR_PERCENT, EXPR_SQRT, EXPR_ABS, EXPR_EXP, EXPR_LN, EXPR_LOG10,
+    EXPR_FLOOR, EXPR_CEIL, EXPR_ROUND, EXPR_SIN, EXPR_COS, EXPR_TAN, EXPR_ATAN
+};
+
+struct ExprInstr {
+    int op;
+    int arg;  // Constant index for EXPR_CONST, variable slot for EXPR_VAR
+};
+
+struct ExprProgram {
+    enum { kMaxDepth = 64, kMaxVars = 16 };
+
+    std::vector<ExprInstr> code;
+    std::vector<double> constants;
+    std::vector<std::string> vars;  // Slot order is order of first use
+    int maxDepth;
+
+    ExprProgram() : maxDepth(0) {}
+
+    int VarSlot(const char* name) const {
+        for (size_t i = 0; i < vars.size(); i++) {
+            if (vars[i] == name) return (int)i;
+        }
+        return -1;
+    }
+
+    // Evaluates n points at once. columns[slot] holds n values for each
+    // variable; scratch must have room for maxDepth * n doubles. errors[i]
+    // receives the first error hit by point i (EXPR_OK if none).
+    void EvalBlock(const double* const* columns, int n, double* out, uint8_t* errors, double* scratch) const {
+        memset(errors, EXPR_OK, (size_t)n);
+        int sp = 0;
+        for (size_t pc = 0; pc < code.size(); pc++) {
+            const ExprInstr& ins = code[pc];
+            double* top = scratch + (size_t)(sp - 1) * n;  // Operand for unary ops
+            double* a = top - n;                            // Left operand for binary ops
+            switch (ins.op) {
+                case EXPR_CONST: {
+                    double c = constants[(size_t)ins.arg];
+                    double* d = scratch + (size_t)sp++ * n;
+                    for (int i = 0; i < n; i++) d[i] = c;
+                    break;
+                }
+                case EXPR_VAR:
+                    memcpy(scratch + (size_t)sp++ * n, columns[ins.arg], (size_t)n * sizeof(double));
+                    break;
+                case EXPR_ADD: for (int i = 0; i < n; i++) a[i] += top[i]; sp--; break;
+                case EXPR_SUB: for (int i = 0; i < n; i++) a[i] -= top[i]; sp--; break;
+                case EXPR_MUL: for (int i = 0; i < n; i++) a[i] *= top[i]; sp--; break;
+                case EXPR_DIV:
+                    for (int i = 0; i < n; i++) {
+                        if (top[i] == 0.0) { if (!errors[i]) errors[i] = EXPR_ERR_DIVZERO; a[i] = 0; }
+                        else a[i] /= top[i];
+                    }
+                    sp--;
+                    break;
+                case EXPR_POW:
+                    for (int i = 0; i < n; i++) {
+                        double r = pow(a[i], top[i]);
+                        if (r != r && a[i] == a[i] && top[i] == top[i]) { if (!errors[i]) errors[i] = EXPR_ERR_DOMAIN; r = 0; }
+                        else if (a[i] == 0.0 && top[i] < 0) { if (!errors[i]) errors[i] = EXPR_ERR_DIVZERO; r = 0; }
+                        a[i] = r;
+                    }
+                    sp--;
+                    break;
+                case EXPR_MIN: for (int i = 0; i < n; i++) a[i] = top[i] < a[i] ? top[i] : a[i]; sp--; break;
+                case EXPR_MAX: for (int i = 0; i < n; i++) a[i] = top[i] > a[i] ? top[i] : a[i]; sp--; break;
+                case EXPR_NEG: for (int i = 0; i < n; i++) top[i] = -top[i]; break;
+                case EXPR_PERCENT: for (int i = 0; i < n; i++) top[i] /= 100.0; break;
+                case EXPR_SQRT:
+                    for (int i = 0; i < n; i++) {
+                        if (top[i] < 0) { if (!errors[i]) errors[i] = EXPR_ERR_DOMAIN; top[i] = 0; }
+                        else top[i] = sqrt(top[i]);
+                    }
+                    break;
+                case EXPR_LN:
+                case EXPR_LOG10:
+                    for (int i = 0; i < n; i++) {
+                        if (top[i] <= 0) { if (!errors[i]) errors[i] = EXPR_ERR_DOMAIN; top[i] = 0; }
+                        else top[i] = ins.op == EXPR_LN ? log(top[i]) : log10(top[i]);
+                    }
+                    break;
+                case EXPR_ABS: for (int i = 0; i < n; i++) top[i] = fabs(top[i]); break;
+                case EXPR_EXP: for (int i = 0; i < n; i++) top[i] = exp(top[i]); break;
+                case EXPR_FLOOR: for (int i = 0; i < n; i++) top[i] = floor(top[i]); break;
+                case EXPR_CEIL: for (int i = 0; i < n; i++) top[i] = ceil(top[i]); break;
+                case EXPR_ROUND: for (int i = 0; i < n; i++) top[i] = floor(top[i] + 0.5); break;
+                case EXPR_SIN: for (int i = 0; i < n; i++) top[i] = sin(top[i]); break;
+                case EXPR_COS: for (int i = 0; i < n; i++) top[i] = cos(top[i]); break;
+                case EXPR_TAN: for (int i = 0; i < n; i++) top[i] = tan(top[i]); break;
+                case EXPR_ATAN: for (int i = 0; i < n; i++) top[i] = atan(top[i]); break;
+            }
+        }
+        memcpy(out, scratch, (size_t)n * sizeof(double));
+    }
+
+    // Single point; values[slot] per variable. Returns EXPR_OK or an error.
+    int Eval(const double* values, double* out) const {
+        const double* columns[kMaxVars];
+        for (size_t i = 0; i < vars.size(); i++) columns[i] = &values[i];
+        double scratch[kMaxDepth];
+        uint8_t error;
+        EvalBlock(columns, 1, out, &error, scratch);
+        return error;
+    }
+};
+
+// --- Compiler ---
+
+struct ExprParser {
+    enum { kMaxNesting = 256 };
+
+    const char* p;
+    ExprProgram* prog;
+    int depth;
+    int nesting;       // Active ParseUnary calls; bounds the C++ stack
+    char* message;
+    int messageSize;
+    bool failed;
+
+    void Fail(const char* what) {
+        if (!failed) snprintf(message, (size_t)messageSize, "%s", what);
+        failed = true;
+    }
+
+    void SkipSpace() { while (*p == ' ' || *p == '\t') p++; }
+
+    void Emit(int op, int arg, int stackChange) {
+        ExprInstr ins = {op, arg};
+        prog->code.push_back(ins);
+        depth += stackChange;
+        if (depth > prog->maxDepth) prog->maxDepth = depth;
+        if (depth > ExprProgram::kMaxDepth) Fail("Expression too deeply nested");
+    }
+
+    void EmitConst(double v) {
+        prog->constants.push_back(v);
+        Emit(EXPR_CONST, (int)prog->constants.size() - 1, 1);
+    }
+
+    bool Accept(char c) {
+        SkipSpace();
+        if (*p != c) return false;
+        p++;
+        return true;
+    }
+
+    // sum := product (('+' | '-') product)*
+    void ParseSum() {
+        ParseProduct();
+        while (!failed) {
+            if (Accept('+')) { ParseProduct(); Emit(EXPR_ADD, 0, -1); }
+            else if (Accept('-')) { ParseProduct(); Emit(EXPR_SUB, 0, -1); }
+            else break;
+        }
+    }
+
+    // product := unary (('*' | '/') unary)*
+    void ParseProduct() {
+        ParseUnary();
+        while (!failed) {
+            if (Accept('*')) { ParseUnary(); Emit(EXPR_MUL, 0, -1); }
+            else if (Accept('/')) { ParseUnary(); Emit(EXPR_DIV, 0, -1); }
+            else break;
+        }
+    }
+
+    // unary := ('-' | '+') unary | power ; so -2^2 is -(2^2)
+    // Every recursive path (signs, '^', parentheses, call arguments) comes
+    // back through here, so this one counter caps the recursion depth.
+    void ParseUnary() {
+        if (failed) return;
+        if (++nesting > kMaxNesting) {
+            Fail("Expression too deeply nested");
+            nesting--;
+            return;
+        }
+        if (Accept('-')) { ParseUnary(); Emit(EXPR_NEG, 0, 0); }
+        else if (Accept('+')) ParseUnary();
+        else ParsePower();
+        nesting--;
+    }
+
+    // power := postfix ('^' unary)? ; right associative
+    void ParsePower() {
+        ParsePostfix();
+        if (!failed && Accept('^')) { ParseUnary(); Emit(EXPR_POW, 0, -1); }
+    }
+
+    // postfix := primary '%'*
+    void ParsePostfix() {
+        ParsePrimary();
+        while (!failed && Accept('%')) Emit(EXPR_PERCENT, 0, 0);
+    }
+
+    void ParsePrimary() {
+        SkipSpace();
+        if (failed) return;
+        if ((*p >= '0' && *p <= '9') || *p == '.') {
+            char* end;
+            double v = strtod(p, &end);
+            if (end == p) { Fail("Bad number"); return; }
+            p = end;
+            EmitConst(v);
+            return;
+        }
+        if (Accept('(')) {
+            ParseSum();
+            if (!Accept(')')) Fail("Missing )");
+            return;
+        }
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_')) {
+            Fail(*p ? "Unexpected character" : "Unexpected end of expression");
+            return;
+        }
+        char name[32];
+        int len = 0;
+        while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_') {
+            if (len < (int)sizeof(name) - 1) name[len++] = *p;
+            p++;
+        }
+        name[len] = '\0';
+
+        if (Accept('(')) {
+            ParseCall(name);
+            return;
+        }
+        if (strcmp(name, "pi") == 0) { EmitConst(3.14159265358979323846); return; }
+        if (strcmp(name, "e") == 0) { EmitConst(2.71828182845904523536); return; }
+        int slot = prog->VarSlot(name);
+        if (slot < 0) {
+            if ((int)prog->vars.size() >= ExprProgram::kMaxVars) { Fail("Too many variables"); return; }
+            prog->vars.push_back(name);
+            slot = (int)prog->vars.size() - 1;
+        }
+        Emit(EXPR_VAR, slot, 1);
+    }
+
+    void ParseCall(const char* name) {
+        static const struct { const char* name; int op; int args; } funcs[] = {
+            {"sqrt", EXPR_SQRT, 1}, {"abs", EXPR_ABS, 1}, {"exp", EXPR_EXP, 1},
+            {"ln", EXPR_LN, 1}, {"log", EXPR_LOG10, 1}, {"floor", EXPR_FLOOR, 1},
+            {"ceil", EXPR_CEIL, 1}, {"round", EXPR_ROUND, 1},
+            {"sin", EXPR_SIN, 1}, {"cos", EXPR_COS, 1}, {"tan", EXPR_TAN, 1}, {"atan", EXPR_ATAN, 1},
+            {"pow", EXPR_POW, 2}, {"min", EXPR_MIN, 2}, {"max", EXPR_MAX, 2},
+        };
+        for (size_t i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++) {
+            if (strcmp(name, funcs[i].name) != 0) continue;
+            ParseSum();
+            for (int a = 1; a < funcs[i].args && !failed; a++) {
+                if (!Accept(',')) { Fail("Missing argument"); return; }
+                ParseSum();
+            }
+            if (!Accept(')')) { Fail("Missing )"); return; }
+            Emit(funcs[i].op, 0, 1 - funcs[i].args);
+            return;
+        }
+        Fail("Unknown function");
+    }
+};
+
+// Compiles text into prog. On failure returns false with a short reason.
+inline bool ExprCompile(const char* text, ExprProgram* prog, char* message, int messageSize) {
+    *prog = ExprProgram();
+    ExprParser parser = {text, prog, 0, 0, message, messageSize, false};
+    parser.ParseSum();
+    parser.SkipSpace();
+    if (!parser.failed && *parser.p) parser.Fail("Unexpected character");
+    if (!parser.failed && prog->code.empty()) parser.Fail("Empty expression");
+    return !parser.failed;
+}
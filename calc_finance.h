@@ -0,0 +1,473 @@
+// Loans, annuities and cash flows for the financial tab
+// Portable C++ (no Win32). Money is a whole number of cents in a long long.
+// Every amount that lands in a schedule is rounded exactly (half away from
+// zero) from its true decimal value: interest is the balance times a rate
+// held as an exact fraction, not a double. Doubles appear only where the
+// answer is irrational anyway (the level payment, solved rates, NPV and
+// IRR), and those results are rounded to the cent once.
+//
+// Schedules come from a streaming generator. It runs a block of loans
+// through each period together, with every step a plain loop over arrays,
+// and hands rows to a sink loan by loan. A whole portfolio can be written
+// out without its schedule ever being held in memory.
+
+#pragma once
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+// --- Exact decimal amounts ---
+
+// Parses "1234.5", "-0.07", "1,250,000" into *out scaled by 10^scale, with
+// extra digits rounded half away from zero. Returns false on junk.
+inline bool FinParseDecimal(const char* s, int scale, long long* out) {
+    while (*s == ' ' || *s == '\t') s++;
+    bool neg = false;
+    if (*s == '-' || *s == '+') { neg = *s == '-'; s++; }
+    long long v = 0;
+    int digits = 0, frac = -1;
+    bool roundUp = false;
+    for (; *s; s++) {
+        if (*s == ',' && frac < 0) continue;
+        if (*s == '.' && frac < 0) { frac = 0; continue; }
+        if (*s < '0' || *s > '9') break;
+        digits++;
+        if (frac >= scale) {
+            // First dropped digit decides the rounding
+            if (frac == scale) roundUp = *s >= '5';
+            frac++;
+            continue;
+        }
+        if (v > (LLONG_MAX - 9) / 10) return false;
+        v = v * 10 + (*s - '0');
+        if (frac >= 0) frac++;
+    }
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
+    if (!digits || *s) return false;
+    for (int f = frac < 0 ? 0 : frac; f < scale; f++) {
+        if (v > LLONG_MAX / 10) return false;
+        v *= 10;
+    }
+    if (roundUp) v++;
+    *out = neg ? -v : v;
+    return true;
+}
+
+inline bool FinParseMoney(const char* s, long long* cents) {
+    return FinParseDecimal(s, 2, cents);
+}
+
+// "00" "01" ... "99", for writing two digits per division
+inline const char* FinDigitPairs() {
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    return pairs;
+}
+
+// Writes u in decimal without a terminator and returns the length
+inline int FinFormatUnsigned(unsigned long long u, char* out) {
+    const char* pairs = FinDigitPairs();
+    char tmp[24];
+    int n = 24;
+    while (u >= 100) {
+        const char* d = pairs + (u % 100) * 2;
+        u /= 100;
+        tmp[--n] = d[1];
+        tmp[--n] = d[0];
+    }
+    if (u >= 10) { tmp[--n] = pairs[u * 2 + 1]; tmp[--n] = pairs[u * 2]; }
+    else tmp[--n] = (char)('0' + u);
+    memcpy(out, tmp + n, (size_t)(24 - n));
+    return 24 - n;
+}
+
+// Writes cents as "-1234.56" without a terminator and returns the length
+// (at most 22 characters). Used for bulk CSV, so no printf.
+inline int FinFormatCents(long long cents, char* out) {
+    unsigned long long u = cents < 0 ? 0ULL - (unsigned long long)cents : (unsigned long long)cents;
+    int n = 0;
+    if (cents < 0) out[n++] = '-';
+    n += FinFormatUnsigned(u / 100, out + n);
+    const char* d = FinDigitPairs() + (u % 100) * 2;
+    out[n++] = '.';
+    out[n++] = d[0];
+    out[n++] = d[1];
+    return n;
+}
+
+// Terminated form for labels and history
+inline void FinMoneyText(long long cents, char* buf) {
+    buf[FinFormatCents(cents, buf)] = '\0';
+}
+
+// --- Rates ---
+
+// A rate as the exact fraction num / den (den > 0) with its double value
+struct FinRate {
+    long long num;
+    long long den;
+    double value;
+};
+
+inline long long FinGcd(long long a, long long b) {
+    if (a < 0) a = -a;
+    while (b) { long long t = a % b; a = b; b = t; }
+    return a ? a : 1;
+}
+
+inline FinRate FinMakeRate(long long num, long long den) {
+    long long g = FinGcd(num, den);
+    FinRate r = {num / g, den / g, (double)(num / g) / (double)(den / g)};
+    return r;
+}
+
+#define FIN_RATE_DIGITS 8  // Decimals kept from a percentage
+
+// "5.125" (percent per year) -> 5.125 / 100. Rates are limited to +-1000%.
+inline bool FinParsePercent(const char* s, FinRate* out) {
+    long long v;
+    if (!FinParseDecimal(s, FIN_RATE_DIGITS, &v)) return false;
+    const long long one = 100000000LL;  // 10^FIN_RATE_DIGITS
+    if (v > 1000 * one || v < -1000 * one) return false;
+    *out = FinMakeRate(v, 100 * one);
+    return true;
+}
+
+// Annual rate split over periodsPerYear equal periods
+inline FinRate FinPeriodicRate(const FinRate& annual, int periodsPerYear) {
+    return FinMakeRate(annual.num, annual.den * periodsPerYear);
+}
+
+// Largest magnitude in cents a loan may start from: FinApplyRate, and with
+// it every schedule, is exact only below 2^53
+#define FIN_MAX_CENTS (1LL << 53)
+
+// round(a * rate) to whole units, half away from zero, exactly. A double
+// estimate is corrected with the exact residue a*num - c*den. The residue
+// is computed mod 2^64, which is exact because its true value is tiny,
+// even though a*num alone may not fit. Valid for |a| < 2^53.
+inline long long FinApplyRate(long long a, const FinRate& r) {
+    bool neg = a < 0;
+    unsigned long long ua = neg ? 0ULL - (unsigned long long)a : (unsigned long long)a;
+    long long c = (long long)floor((double)ua * r.value + 0.5);
+    long long diff = (long long)(ua * (unsigned long long)r.num - (unsigned long long)c * (unsigned long long)r.den);
+    // Want -den <= 2*diff < den (ties round up in magnitude)
+    while (2 * diff >= r.den) { c++; diff -= r.den; }
+    while (2 * diff < -r.den) { c--; diff += r.den; }
+    return neg ? -c : c;
+}
+
+// --- Annuities ---
+
+// Level payment that pays off principal over n periods at periodic rate r,
+// rounded to the cent. The final payment in a schedule absorbs the rounding.
+inline long long FinPayment(long long principal, double r, int n) {
+    if (n <= 0) return 0;
+    double p;
+    if (r == 0) p = (double)principal / n;
+    else p = (double)principal * r / -expm1(-n * log1p(r));
+    return (long long)floor(fabs(p) + 0.5) * (p < 0 ? -1 : 1);
+}
+
+// Present value of n level payments at periodic rate r
+inline double FinAnnuityPV(double payment, double r, int n) {
+    if (r == 0) return payment * n;
+    return payment * -expm1(-n * log1p(r)) / r;
+}
+
+// Periodic rate at which n payments of `payment` repay principal.
+// Returns false if no rate in (-100%, 1000%) per period does.
+inline bool FinSolveRate(double principal, double payment, int n, double* rate) {
+    if (n <= 0 || principal <= 0 || payment <= 0) return false;
+    // PV falls as the rate rises, so bisect on the sign of PV - principal
+    double lo = -0.9999, hi = 10.0;
+    if (FinAnnuityPV(payment, lo, n) < principal || FinAnnuityPV(payment, hi, n) > principal) return false;
+    for (int i = 0; i < 200 && hi - lo > 1e-15; i++) {
+        double mid = 0.5 * (lo + hi);
+        if (FinAnnuityPV(payment, mid, n) > principal) lo = mid;
+        else hi = mid;
+    }
+    *rate = 0.5 * (lo + hi);
+    return true;
+}
+
+// --- Cash flows ---
+
+// flows[0] is at time 0, flows[t] one period later each
+inline double FinNpv(double rate, const double* flows, int n) {
+    double v = 0, discount = 1, step = 1 / (1 + rate);
+    for (int t = 0; t < n; t++) {
+        v += flows[t] * discount;
+        discount *= step;
+    }
+    return v;
+}
+
+// Rate at which the NPV is zero. Scans for a sign change from -99% up,
+// then bisects; returns false if the flows never change the NPV's sign
+// (for instance when they are all the same sign).
+inline bool FinIrr(const double* flows, int n, double* irr) {
+    double lo = -0.99, flo = FinNpv(lo, flows, n);
+    double hi = lo, fhi = flo;
+    bool found = false;
+    for (double step = 0.01; hi < 100; step *= 1.5) {
+        hi = lo + step;
+        fhi = FinNpv(hi, flows, n);
+        if ((flo < 0) != (fhi < 0)) { found = true; break; }
+        lo = hi;
+        flo = fhi;
+    }
+    if (!found) return false;
+    for (int i = 0; i < 200 && hi - lo > 1e-15; i++) {
+        double mid = 0.5 * (lo + hi), fmid = FinNpv(mid, flows, n);
+        if ((fmid < 0) == (flo < 0)) { lo = mid; flo = fmid; }
+        else hi = mid;
+    }
+    *irr = 0.5 * (lo + hi);
+    return true;
+}
+
+// --- Amortization ---
+
+struct FinLoan {
+    long long principal;  // Cents
+    FinRate rate;         // Periodic
+    int periods;
+    long long payment;    // Cents; 0 = level payment from FinPayment
+};
+
+// Whether a loan's schedule stays where the generator is exact and its
+// totals fit: a periodic rate above -100%, a principal below FIN_MAX_CENTS,
+// interest below 2^50 cents and every sum below 2^62.
+inline bool FinLoanInRange(const FinLoan& l) {
+    double r = l.rate.value, b0 = fabs((double)l.principal);
+    if (r <= -1 || b0 >= (double)FIN_MAX_CENTS || l.periods < 1) return false;
+    double pmt = fabs((double)(l.payment ? l.payment : FinPayment(l.principal, r, l.periods)));
+    // The balance peaks at the start, unless the payments do not cover the
+    // interest and it grows until the last period
+    double peak = b0;
+    if (pmt < b0 * r) peak = (b0 - pmt / r) * pow(1 + r, l.periods - 1) + pmt / r;
+    double due = peak * (1 + fabs(r));
+    return peak * fabs(r) < (double)(1LL << 50) && (pmt + due) * l.periods < (double)(1LL << 62);
+}
+
+struct FinRow {
+    long long loan;       // Index in the batch
+    int period;           // 1-based
+    long long payment, interest, principal, balance;
+};
+
+// Receives rows in order, loan by loan. Returning false stops the stream.
+typedef bool (*FinRowSink)(void* ctx, const FinRow* rows, int count);
+
+// Each period: interest is the exact rounded balance * rate; the payment
+// is the level payment, except that the last period (or any period that
+// would overpay) pays the balance plus interest so the loan ends at zero.
+struct FinScheduleGen {
+    enum { kMaxBlock = 256, kBufferCells = 1 << 17, kRowBatch = 1024 };
+
+    // Block state, one entry per loan (structure of arrays)
+    long long balance[kMaxBlock], level[kMaxBlock], rateNum[kMaxBlock], rateDen[kMaxBlock];
+    double rate[kMaxBlock];
+    int periods[kMaxBlock];
+    // Period-major results for the block: cell [p * block + i]
+    std::vector<long long> pay, interest, bal;
+    FinRow rows[kRowBatch];
+
+    // One period for loans [0, n): the hot loop, kept branch-light
+    void Step(int p, int n, long long* outPay, long long* outInterest, long long* outBal) {
+        for (int i = 0; i < n; i++) {
+            // Exact interest as in FinApplyRate, written out so the loop
+            // stays free of calls. One correction step is enough while the
+            // interest is below 2^50 cents.
+            long long b = balance[i];
+            unsigned long long ub = b < 0 ? 0ULL - (unsigned long long)b : (unsigned long long)b;
+            long long c = (long long)floor((double)ub * rate[i] + 0.5);
+            long long diff = (long long)(ub * (unsigned long long)rateNum[i] - (unsigned long long)c * (unsigned long long)rateDen[i]);
+            c += (2 * diff >= rateDen[i]) - (2 * diff < -rateDen[i]);
+            long long in = b < 0 ? -c : c;
+
+            long long due = b + in;
+            long long pmt = (p >= periods[i] || level[i] > due) ? due : level[i];
+            if (p > periods[i]) { in = 0; pmt = 0; due = b; }  // Shorter loan in the block, already done
+            outPay[i] = pmt;
+            outInterest[i] = in;
+            outBal[i] = balance[i] = due - pmt;
+        }
+    }
+
+    // Streams the schedules of loans[0..count) to sink. Returns the number
+    // of rows delivered.
+    long long Run(const FinLoan* loans, long long count, FinRowSink sink, void* ctx) {
+        long long delivered = 0;
+        long long start = 0;
+        while (start < count) {
+            // Size the block so its period-major buffers stay bounded
+            int maxPeriods = 1;
+            int n = 0;
+            while (start + n < count && n < kMaxBlock) {
+                int np = loans[start + n].periods > maxPeriods ? loans[start + n].periods : maxPeriods;
+                if (n > 0 && (long long)np * (n + 1) > kBufferCells) break;
+                maxPeriods = np;
+                n++;
+            }
+            for (int i = 0; i < n; i++) {
+                const FinLoan& l = loans[start + i];
+                balance[i] = l.principal;
+                periods[i] = l.periods;
+                rateNum[i] = l.rate.num;
+                rateDen[i] = l.rate.den;
+                rate[i] = l.rate.value;
+                level[i] = l.payment ? l.payment : FinPayment(l.principal, l.rate.value, l.periods);
+            }
+            size_t cells = (size_t)maxPeriods * n;
+            if (pay.size() < cells) { pay.resize(cells); interest.resize(cells); bal.resize(cells); }
+            for (int p = 1; p <= maxPeriods; p++) {
+                size_t at = (size_t)(p - 1) * n;
+                Step(p, n, &pay[at], &interest[at], &bal[at]);
+            }
+
+            // Hand the block over loan by loan
+            int queued = 0;
+            for (int i = 0; i < n; i++) {
+                for (int p = 1; p <= periods[i]; p++) {
+                    size_t at = (size_t)(p - 1) * n + i;
+                    FinRow& r = rows[queued++];
+                    r.loan = start + i;
+                    r.period = p;
+                    r.payment = pay[at];
+                    r.interest = interest[at];
+                    r.principal = pay[at] - interest[at];
+                    r.balance = bal[at];
+                    if (queued == kRowBatch) {
+                        if (!sink(ctx, rows, queued)) return delivered;
+                        delivered += queued;
+                        queued = 0;
+                    }
+                }
+            }
+            if (queued) {
+                if (!sink(ctx, rows, queued)) return delivered;
+                delivered += queued;
+            }
+            start += n;
+        }
+        return delivered;
+    }
+};
+
+// Totals of one schedule
+struct FinSummary {
+    long long payments, totalPaid, totalInterest, lastPayment;
+};
+
+inline bool FinSummarySink(void* ctx, const FinRow* rows, int count) {
+    FinSummary* s = (FinSummary*)ctx;
+    for (int i = 0; i < count; i++) {
+        s->payments++;
+        s->totalPaid += rows[i].payment;
+        s->totalInterest += rows[i].interest;
+        s->lastPayment = rows[i].payment;
+    }
+    return true;
+}
+
+// Collects rows into a vector (a single loan for display)
+inline bool FinCollectSink(void* ctx, const FinRow* rows, int count) {
+    std::vector<FinRow>* v = (std::vector<FinRow>*)ctx;
+    v->insert(v->end(), rows, rows + count);
+    return true;
+}
+
+// Writes "loan,period,payment,interest,principal,balance" rows. Rows are
+// formatted by hand into a large buffer and written in big pieces.
+struct FinCsvSink {
+    FILE* file;
+    std::vector<char> buf;
+    size_t used;
+    long long rows;
+    bool failed;
+
+    explicit FinCsvSink(FILE* f) : file(f), buf(1 << 20), used(0), rows(0), failed(false) {}
+
+    void WriteHeader() {
+        static const char header[] = "loan,period,payment,interest,principal,balance\n";
+        Append(header, sizeof(header) - 1);
+    }
+
+    void Append(const char* s, size_t n) {
+        if (used + n > buf.size()) Flush();
+        memcpy(&buf[used], s, n);
+        used += n;
+    }
+
+    bool Flush() {
+        if (used && !failed && fwrite(&buf[0], 1, used, file) != used) failed = true;
+        used = 0;
+        return !failed;
+    }
+
+    static bool Write(void* ctx, const FinRow* r, int count) {
+        FinCsvSink* s = (FinCsvSink*)ctx;
+        for (int i = 0; i < count; i++) {
+            if (s->used + 128 > s->buf.size() && !s->Flush()) return false;
+            char* p = &s->buf[s->used];
+            char* q = p;
+            q += FinFormatUnsigned((unsigned long long)r[i].loan + 1, q); *q++ = ',';
+            q += FinFormatUnsigned((unsigned long long)r[i].period, q); *q++ = ',';
+            q += FinFormatCents(r[i].payment, q); *q++ = ',';
+            q += FinFormatCents(r[i].interest, q); *q++ = ',';
+            q += FinFormatCents(r[i].principal, q); *q++ = ',';
+            q += FinFormatCents(r[i].balance, q); *q++ = '\n';
+            s->used += (size_t)(q - p);
+        }
+        s->rows += count;
+        return !s->failed;
+    }
+};
+
+// Reads a loan list: one loan per line, "principal, annual rate %, years"
+// with an optional fourth column of payments per year (default 12).
+// Blank lines and lines that do not start with a number (a header) are
+// skipped. Returns the number of lines that could not be read or whose
+// loan is out of range (FinLoanInRange).
+inline long long FinReadLoans(FILE* f, int defaultPerYear, std::vector<FinLoan>* loans) {
+    char line[512];
+    long long bad = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char* fields[4] = {line, NULL, NULL, NULL};
+        int nf = 1;
+        for (char* p = line; *p && nf < 4; p++) {
+            if (*p == ',' || *p == ';' || *p == '\t') { *p = '\0'; fields[nf++] = p + 1; }
+        }
+        const char* first = fields[0];
+        while (*first == ' ') first++;
+        if (!*first || *first == '\r' || *first == '\n') continue;
+        if (!((*first >= '0' && *first <= '9') || *first == '.' || *first == '-')) continue;
+        long long principal, years100, perYear = defaultPerYear;
+        FinRate annual;
+        if (nf < 3 || !FinParseMoney(fields[0], &principal) || !FinParsePercent(fields[1], &annual) ||
+            !FinParseDecimal(fields[2], 2, &years100) ||
+            (nf > 3 && !FinParseDecimal(fields[3], 0, &perYear)) || perYear < 1 || perYear > 365) {
+            bad++;
+            continue;
+        }
+        long long periods = (years100 * perYear + 50) / 100;
+        if (periods < 1 || periods > 100000) { bad++; continue; }
+        FinLoan l;
+        l.principal = principal;
+        l.rate = FinPeriodicRate(annual, (int)perYear);
+        l.periods = (int)periods;
+        l.payment = 0;
+        if (!FinLoanInRange(l)) { bad++; continue; }
+        loans->push_back(l);
+    }
+    return bad;
+}
@@ -0,0 +1,271 @@
+// Glyph atlas text renderer for the calculator display
+// Portable C++ (no Win32). Each character is rasterized once per size into
+// an 8-bit coverage atlas; drawing a value is then a run of small alpha
+// blits into a CompSurface. Rasterizing is delegated to a callback (GDI on
+// Windows); a built-in stroke font covers the display's characters so the
+// renderer also runs headless and as a fallback.
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "calc_compositor.h"
+
+// A rasterized glyph cell: height is the font's line height, (originX, 0)
+// is the pen position at the top of the line, coverage is 0..255 per pixel.
+struct GlyphBitmap {
+    int width, height;
+    int originX;
+    int advance;
+    std::vector<uint8_t> coverage;
+};
+
+// Renders ch at a pixel height into out. Returns false if it cannot.
+typedef bool (*GlyphRasterFn)(void* ctx, int sizeIndex, int pixelHeight, char ch, GlyphBitmap* out);
+
+// --- Built-in stroke font ---
+
+// Segments on a 4 x 8 grid (baseline at y = 8), four digits "x0y0x1y1"
+// each. Only what the display can show; anything else is a blank cell.
+inline const char* GlyphStrokes(char ch) {
+    switch (ch) {
+        case '0': return "004040444448084804080004";
+        case '1': return "404444482040";
+        case '2': return "00404044044404080848";
+        case '3': return "00404044444804440848";
+        case '4': return "0004044440444448";
+        case '5': return "00400004044444480848";
+        case '6': return "004000040444444808480408";
+        case '7': return "004040444448";
+        case '8': return "0040404444480848040800040444";
+        case '9': return "004040444448084800040444";
+        case '-': return "1434";
+        case '+': return "14342226";
+        case '.': return "2828";
+        case ',': return "2819";
+        case '/': return "4008";
+        case 'e': return "06464644440404080848";
+        case 'E': return "00400004040808480434";
+        case 'r': return "040805141444";
+        case 'o': return "0444444848080804";
+        case 'n': return "040804444448";
+        case 'i': return "24282222";
+        case 'f': return "101804341030";
+        case 'a': return "04444448480808060646";
+        case '<': return "42080848";  // Drawn as the angle sign of polar values
+        default: return "";
+    }
+}
+
+// Anti-aliased strokes: coverage falls off linearly over one pixel at the
+// edge of each segment's capsule
+inline bool GlyphStrokeRaster(void*, int, int pixelHeight, char ch, GlyphBitmap* out) {
+    if (pixelHeight < 6) return false;
+    double unit = pixelHeight / 11.0;            // Grid units: 8 cap height + margins
+    double halfWidth = unit * 0.45 < 0.6 ? 0.6 : unit * 0.45;
+    double left = unit, top = unit * 1.5;
+    out->height = pixelHeight;
+    out->originX = 0;
+    out->advance = (int)(unit * 6 + 0.5);
+    out->width = out->advance;
+    out->coverage.assign((size_t)out->width * out->height, 0);
+
+    const char* s = GlyphStrokes(ch);
+    for (; s[0] && s[1] && s[2] && s[3]; s += 4) {
+        double x0 = left + (s[0] - '0') * unit, y0 = top + (s[1] - '0') * unit;
+        double x1 = left + (s[2] - '0') * unit, y1 = top + (s[3] - '0') * unit;
+        double dx = x1 - x0, dy = y1 - y0, len2 = dx * dx + dy * dy;
+        int minX = (int)floor((x0 < x1 ? x0 : x1) - halfWidth - 1), maxX = (int)ceil((x0 > x1 ? x0 : x1) + halfWidth + 1);
+        int minY = (int)floor((y0 < y1 ? y0 : y1) - halfWidth - 1), maxY = (int)ceil((y0 > y1 ? y0 : y1) + halfWidth + 1);
+        if (minX < 0) minX = 0;
+        if (minY < 0) minY = 0;
+        if (maxX > out->width) maxX = out->width;
+        if (maxY > out->height) maxY = out->height;
+        for (int y = minY; y < maxY; y++) {
+            for (int x = minX; x < maxX; x++) {
+                double px = x + 0.5 - x0, py = y + 0.5 - y0;
+                double t = len2 > 0 ? (px * dx + py * dy) / len2 : 0;
+                if (t < 0) t = 0;
+                if (t > 1) t = 1;
+                double ex = px - t * dx, ey = py - t * dy;
+                double c = halfWidth + 0.5 - sqrt(ex * ex + ey * ey);
+                if (c <= 0) continue;
+                int v = c >= 1 ? 255 : (int)(c * 255 + 0.5);
+                uint8_t& cell = out->coverage[(size_t)y * out->width + x];
+                if (v > cell) cell = (uint8_t)v;
+            }
+        }
+    }
+    return true;
+}
+
+// --- Atlas ---
+
+struct AtlasGlyph {
+    bool ready;
+    int x, y, w, h;     // Tight coverage box in the atlas plane
+    int offX, offY;     // Box position relative to the pen at the line top
+    int advance;
+};
+
+struct GlyphAtlas {
+    enum { kFirstChar = 32, kCharCount = 95, kMaxSizes = 5, kPlaneWidth = 512 };
+
+    GlyphRasterFn raster;
+    void* rasterCtx;
+    int dpi;
+    int sizeCount;
+    int sizes[kMaxSizes];        // Pixel heights, largest first
+    int lineHeight[kMaxSizes];   // 0 until the size is first used
+    AtlasGlyph glyphs[kMaxSizes][kCharCount];
+    std::vector<uint8_t> plane;  // kPlaneWidth wide, grows downward
+    int shelfX, shelfY, shelfH;
+    int rasterized;              // Glyphs rasterized since Reset, for tests and benchmarks
+
+    GlyphAtlas() { Reset(96, NULL, NULL); }
+
+    // Drops every cached glyph and sets the size steps for a DPI: the
+    // 28 px display font at 96 DPI and smaller steps for long values
+    void Reset(int newDpi, GlyphRasterFn fn, void* ctx) {
+        static const int baseSizes[kMaxSizes] = {28, 24, 20, 16, 13};
+        raster = fn;
+        rasterCtx = ctx;
+        dpi = newDpi > 0 ? newDpi : 96;
+        sizeCount = kMaxSizes;
+        for (int i = 0; i < kMaxSizes; i++) sizes[i] = (baseSizes[i] * dpi + 48) / 96;
+        Clear();
+    }
+
+    void Clear() {
+        memset(glyphs, 0, sizeof(glyphs));
+        memset(lineHeight, 0, sizeof(lineHeight));
+        plane.clear();
+        shelfX = shelfY = shelfH = 0;
+        rasterized = 0;
+    }
+
+    // The cached glyph, rasterized on first use. Characters outside
+    // printable ASCII map to '?'.
+    const AtlasGlyph& Glyph(int sizeIndex, char ch) {
+        if (ch < kFirstChar || ch >= kFirstChar + kCharCount) ch = '?';
+        AtlasGlyph& g = glyphs[sizeIndex][ch - kFirstChar];
+        if (!g.ready) Rasterize(sizeIndex, ch, &g);
+        return g;
+    }
+
+    int LineHeight(int sizeIndex) {
+        if (!lineHeight[sizeIndex]) Glyph(sizeIndex, '0');
+        return lineHeight[sizeIndex];
+    }
+
+    int MeasureText(int sizeIndex, const char* text, int length) {
+        int width = 0;
+        for (int i = 0; i < length; i++) width += Glyph(sizeIndex, text[i]).advance;
+        return width;
+    }
+
+    void Rasterize(int sizeIndex, char ch, AtlasGlyph* g) {
+        GlyphBitmap bmp;
+        int px = sizes[sizeIndex];
+        if (!(raster && raster(rasterCtx, sizeIndex, px, ch, &bmp)) && !GlyphStrokeRaster(NULL, sizeIndex, px, ch, &bmp)) {
+            bmp.width = bmp.height = bmp.originX = bmp.advance = 0;
+        }
+        rasterized++;
+        if (!lineHeight[sizeIndex]) lineHeight[sizeIndex] = bmp.height > 0 ? bmp.height : px;
+
+        // Trim to the covered pixels; blank glyphs (space) keep only an advance
+        int minX = bmp.width, minY = bmp.height, maxX = 0, maxY = 0;
+        for (int y = 0; y < bmp.height; y++) {
+            for (int x = 0; x < bmp.width; x++) {
+                if (!bmp.coverage[(size_t)y * bmp.width + x]) continue;
+                if (x < minX) minX = x;
+                if (x >= maxX) maxX = x + 1;
+                if (y < minY) minY = y;
+                if (y >= maxY) maxY = y + 1;
+            }
+        }
+        g->ready = true;
+        g->advance = bmp.advance;
+        g->w = maxX > minX ? maxX - minX : 0;
+        g->h = maxY > minY ? maxY - minY : 0;
+        g->offX = minX - bmp.originX;
+        g->offY = minY;
+        if (!g->w || !g->h) { g->w = g->h = 0; return; }
+        if (g->w > kPlaneWidth) g->w = kPlaneWidth;
+
+        // Shelf packing: glyphs go left to right, a new shelf starts below
+        if (shelfX + g->w > kPlaneWidth) {
+            shelfY += shelfH;
+            shelfX = shelfH = 0;
+        }
+        g->x = shelfX;
+        g->y = shelfY;
+        shelfX += g->w;
+        if (g->h > shelfH) shelfH = g->h;
+        if (plane.size() < (size_t)(shelfY + shelfH) * kPlaneWidth) plane.resize((size_t)(shelfY + shelfH) * kPlaneWidth, 0);
+        for (int y = 0; y < g->h; y++) {
+            memcpy(&plane[(size_t)(g->y + y) * kPlaneWidth + g->x], &bmp.coverage[(size_t)(minY + y) * bmp.width + minX], (size_t)g->w);
+        }
+    }
+};
+
+// --- Drawing ---
+
+// Blends color over dst through the glyph's coverage, inside clip
+inline void GlyphBlit(const GlyphAtlas& atlas, const AtlasGlyph& g, CompSurface& dst, int x, int y,
+                      const CompRect& clip, uint32_t color) {
+    CompRect r = CompIntersect(CompRect(x, y, x + g.w, y + g.h), clip);
+    if (r.IsEmpty()) return;
+    int sr = (int)(color >> 16) & 0xff, sg = (int)(color >> 8) & 0xff, sb = (int)color & 0xff;
+    for (int row = r.top; row < r.bottom; row++) {
+        const uint8_t* cov = &atlas.plane[(size_t)(g.y + row - y) * GlyphAtlas::kPlaneWidth + g.x + (r.left - x)];
+        uint32_t* out = dst.Row(row) + r.left;
+        for (int col = r.left; col < r.right; col++, cov++, out++) {
+            int a = *cov;
+            if (!a) continue;
+            if (a == 255) { *out = color; continue; }
+            uint32_t d = *out;
+            int dr = (int)(d >> 16) & 0xff, dg = (int)(d >> 8) & 0xff, db = (int)d & 0xff;
+            dr += ((sr - dr) * a + 127) / 255;
+            dg += ((sg - dg) * a + 127) / 255;
+            db += ((sb - db) * a + 127) / 255;
+            *out = (uint32_t)((dr << 16) | (dg << 8) | db);
+        }
+    }
+}
+
+// Draws text right-aligned in box, clipped to clip. The largest size whose
+// single line fits is used; if none fits, the smallest size wraps onto as
+// many lines as the box holds. Returns the size index used.
+inline int GlyphDrawText(GlyphAtlas& atlas, CompSurface& dst, const CompRect& box, const CompRect& clip,
+                         const char* text, uint32_t color) {
+    int length = (int)strlen(text);
+    int boxW = box.right - box.left, boxH = box.bottom - box.top;
+    int size = 0;
+    while (size + 1 < atlas.sizeCount && atlas.MeasureText(size, text, length) > boxW) size++;
+    int lineH = atlas.LineHeight(size);
+
+    // Break into lines that fit (a single line unless the smallest size overflows)
+    int starts[32], ends[32], lines = 0;
+    for (int i = 0; i < length && lines < 32;) {
+        int w = 0, j = i;
+        while (j < length && (j == i || w + atlas.Glyph(size, text[j]).advance <= boxW)) w += atlas.Glyph(size, text[j++]).advance;
+        starts[lines] = i;
+        ends[lines++] = j;
+        i = j;
+    }
+    int maxLines = boxH / lineH > 0 ? boxH / lineH : 1;
+    if (lines > maxLines) lines = maxLines;
+
+    CompRect bounds = CompIntersect(CompIntersect(clip, box), dst.Bounds());
+    int y = box.top + (boxH - lines * lineH) / 2;
+    for (int l = 0; l < lines; l++, y += lineH) {
+        int x = box.right - atlas.MeasureText(size, text + starts[l], ends[l] - starts[l]);
+        for (int i = starts[l]; i < ends[l]; i++) {
+            const AtlasGlyph& g = atlas.Glyph(size, text[i]);
+            if (g.w) GlyphBlit(atlas, g, dst, x + g.offX, y + g.offY, bounds, color);
+            x += g.advance;
+        }
+    }
+    return size;
+}
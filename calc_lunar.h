@@ -0,0 +1,292 @@
+// Chinese lunisolar calendar and the 24 solar terms, 1900-2100
+// Portable C++ (no Win32). Everything comes from two packed tables built
+// into the binary (about 2 KB), so there is no startup work and every
+// lookup is O(1): locate the lunar year from its new-year day, then walk
+// at most 13 months. Dates follow GB/T 33661-2017 (Beijing time; local
+// mean time before 1929) and match the Hong Kong Observatory tables.
+// Names are UTF-8.
+
+#pragma once
+
+#include "calc_dates.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#define LUNAR_FIRST_YEAR 1900
+#define LUNAR_LAST_YEAR  2100
+
+// One word per lunar year:
+//   bits 0-3    leap month (0 = none)
+//   bits 4-15   months 12..1 (bit 15 = month 1), set = 30 days, clear = 29
+//   bit  16     leap month has 30 days
+//   bits 17-22  lunar new year, in days after January 1 of the same year
+static const uint32_t kLunarInfo[LUNAR_LAST_YEAR - LUNAR_FIRST_YEAR + 1] = {
+    0x3c4bd8, 0x624ae0, 0x4ca570, 0x3854d5, 0x5cd260, 0x44d950, 0x316554, 0x5656a0,  // 1900
+    0x409ad0, 0x2a55d2, 0x504ae0, 0x3aa5b6, 0x60a4d0, 0x48d250, 0x33d255, 0x58b540,  // 1908
+    0x42d6a0, 0x2cada2, 0x5295b0, 0x3f4977, 0x644970, 0x4ca4b0, 0x36b4b5, 0x5c6a50,  // 1916
+    0x466d40, 0x2fab54, 0x562b60, 0x409570, 0x2c52f2, 0x504970, 0x3a6566, 0x5ed4a0,  // 1924
+    0x48ea50, 0x336a95, 0x585ad0, 0x442b60, 0x2f86e3, 0x5292e0, 0x3dc8d7, 0x62c950,  // 1932
+    0x4cd4a0, 0x35d8a6, 0x5ab550, 0x4656a0, 0x31a5b4, 0x5625d0, 0x4092d0, 0x2ad2b2,  // 1940
+    0x50a950, 0x38b557, 0x5e6ca0, 0x48b550, 0x355355, 0x584da0, 0x42a5b0, 0x2f4573,  // 1948
+    0x5452b0, 0x3ca9a8, 0x60e950, 0x4c6aa0, 0x36aea6, 0x5aab50, 0x464b60, 0x30aae4,  // 1956
+    0x56a570, 0x405260, 0x28f263, 0x4ed950, 0x3a5b57, 0x5e56a0, 0x4896d0, 0x344dd5,  // 1964
+    0x5a4ad0, 0x42a4d0, 0x2cd4d4, 0x52d250, 0x3cd558, 0x60b540, 0x4ab6a0, 0x3795a6,  // 1972
+    0x5c95b0, 0x4649b0, 0x30a974, 0x56a4b0, 0x40b27a, 0x646a50, 0x4e6d40, 0x38af46,  // 1980
+    0x5eab60, 0x489570, 0x344af5, 0x5a4970, 0x4464b0, 0x2c74a3, 0x50ea50, 0x3c6b58,  // 1988
+    0x625ac0, 0x4aab60, 0x3696d5, 0x5c92e0, 0x46c960, 0x2ed954, 0x54d4a0, 0x3eda50,  // 1996
+    0x2a7552, 0x4e56a0, 0x38abb7, 0x6025d0, 0x4a92d0, 0x32cab5, 0x58a950, 0x42b4a0,  // 2004
+    0x2cbaa4, 0x50ad50, 0x3c55d9, 0x624ba0, 0x4ca5b0, 0x375176, 0x5c52b0, 0x46a930,  // 2012
+    0x307954, 0x546aa0, 0x3ead50, 0x2a5b52, 0x504b60, 0x38a6e6, 0x5ea4e0, 0x48d260,  // 2020
+    0x32ea65, 0x56d530, 0x425aa0, 0x2c76a3, 0x5296d0, 0x3c4afb, 0x624ad0, 0x4ca4d0,  // 2028
+    0x37d0b6, 0x5ad250, 0x44d520, 0x2edd45, 0x54b5a0, 0x3e56d0, 0x2a55b2, 0x5049b0,  // 2036
+    0x3aa577, 0x5ea4b0, 0x48aa50, 0x33b255, 0x586d20, 0x40ada0, 0x2d4b63, 0x529370,  // 2044
+    0x3e49f8, 0x624970, 0x4c64b0, 0x3768a6, 0x5aea50, 0x446b20, 0x2fa6c4, 0x54aae0,  // 2052
+    0x4092e0, 0x28d2e3, 0x4ec960, 0x38d557, 0x5ed4a0, 0x46da50, 0x325d55, 0x5856a0,  // 2060
+    0x42a6d0, 0x2c55d4, 0x5252d0, 0x3ca9b8, 0x62a950, 0x4ab4a0, 0x34b6a6, 0x5aad50,  // 2068
+    0x4655a0, 0x2eaba4, 0x54a5b0, 0x4052b0, 0x2ab273, 0x4e6930, 0x387337, 0x5e6aa0,  // 2076
+    0x48ad50, 0x334b55, 0x584b60, 0x42a570, 0x2e54e4, 0x50d160, 0x3ae968, 0x60d520,  // 2084
+    0x4adaa0, 0x356aa6, 0x5a56d0, 0x464ae0, 0x30a9d4, 0x54a2d0, 0x3ed150, 0x28f252,  // 2092
+    0x4ed520,  // 2100
+};
+
+// Solar term i (0 = 小寒 ... 23 = 冬至) falls in month i / 2 + 1 on day
+// kSolarTermBase[i] + a 2-bit offset; word i / 8 holds term i in bits 2 * (i % 8)
+static const uint8_t kSolarTermBase[24] = {4, 19, 3, 18, 4, 19, 4, 19, 4, 20, 4, 20, 6, 22, 6, 22, 6, 22, 7, 22, 6, 21, 6, 21};
+
+static const uint16_t kSolarTermInfo[LUNAR_LAST_YEAR - LUNAR_FIRST_YEAR + 1][3] = {
+    {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaba, 0xaaaa}, {0xafaa, 0xbabb, 0xaaab},  // 1900
+    {0x5aab, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaaa, 0xaaaa}, {0xafaa, 0xbabb, 0xaaab},  // 1904
+    {0x5aab, 0x65a6, 0x5aa6}, {0x9a56, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaaa, 0xaaaa}, {0xafaa, 0xbaba, 0xaaab},  // 1908
+    {0x5aaa, 0x65a6, 0x5696}, {0x9a56, 0xa6aa, 0x6aa6}, {0x9a5a, 0xaaaa, 0xaaaa}, {0xaeaa, 0xaaba, 0xaaab},  // 1912
+    {0x5aaa, 0x65a6, 0x5696}, {0x9a56, 0xa6a6, 0x5aa6}, {0x9a5a, 0xaaaa, 0x6aaa}, {0xaeaa, 0xaaba, 0xaaab},  // 1916
+    {0x5aaa, 0x65a6, 0x5696}, {0x5a56, 0xa6a6, 0x5aa6}, {0x9a5a, 0xaaaa, 0x6aaa}, {0xaa6a, 0xaaba, 0xaaab},  // 1920
+    {0x5aaa, 0x65a6, 0x5696}, {0x5a56, 0xa6a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaba, 0xaaaa},  // 1924
+    {0x5aaa, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaba, 0xaaaa},  // 1928
+    {0x5aaa, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaaa, 0xaaaa},  // 1932
+    {0x5aaa, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaaa, 0xaaaa},  // 1936
+    {0x5aaa, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa}, {0xaa6a, 0xaaaa, 0xaaaa},  // 1940
+    {0x5aaa, 0x6565, 0x5556}, {0x5a56, 0x65a6, 0x5696}, {0x9a56, 0xa6aa, 0x6aa6}, {0x9a5a, 0xaaaa, 0xaaaa},  // 1944
+    {0x59aa, 0x5565, 0x5556}, {0x5a55, 0x65a6, 0x5696}, {0x5a56, 0xa6a6, 0x6aa6}, {0x9a5a, 0xaaaa, 0x6aaa},  // 1948
+    {0x59aa, 0x5565, 0x5556}, {0x5a55, 0x65a6, 0x5696}, {0x5a56, 0xa6a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa},  // 1952
+    {0x55aa, 0x5565, 0x5556}, {0x5a55, 0x65a6, 0x5696}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa},  // 1956
+    {0x556a, 0x5565, 0x5555}, {0x5a55, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa},  // 1960
+    {0x556a, 0x5565, 0x5555}, {0x5a55, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa},  // 1964
+    {0x556a, 0x5555, 0x5555}, {0x5a55, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aaa},  // 1968
+    {0x556a, 0x5555, 0x5555}, {0x5a55, 0x6565, 0x5556}, {0x5a56, 0x65a6, 0x5aa6}, {0x9a5a, 0xa6aa, 0x6aa6},  // 1972
+    {0x456a, 0x5555, 0x5555}, {0x5a55, 0x5565, 0x5556}, {0x5a56, 0x65a6, 0x5a96}, {0x9a56, 0xa6a6, 0x6aa6},  // 1976
+    {0x456a, 0x5555, 0x5555}, {0x5a55, 0x5565, 0x5556}, {0x5a56, 0x65a6, 0x5696}, {0x5a56, 0xa6a6, 0x6aa6},  // 1980
+    {0x455a, 0x5155, 0x5555}, {0x5955, 0x5565, 0x5556}, {0x5a55, 0x65a6, 0x5696}, {0x5a56, 0xa5a6, 0x5aa6},  // 1984
+    {0x455a, 0x5155, 0x1555}, {0x5555, 0x5565, 0x5555}, {0x5a55, 0x6566, 0x5696}, {0x5a56, 0x65a6, 0x5aa6},  // 1988
+    {0x455a, 0x5155, 0x1555}, {0x5515, 0x5565, 0x5555}, {0x5a55, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6},  // 1992
+    {0x455a, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555}, {0x5a55, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6},  // 1996
+    {0x455a, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555}, {0x5a55, 0x6566, 0x5556}, {0x5a56, 0x65a6, 0x5aa6},  // 2000
+    {0x455a, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555}, {0x5a55, 0x5565, 0x5556}, {0x5a56, 0x65a6, 0x5aa6},  // 2004
+    {0x455a, 0x5155, 0x1551}, {0x4515, 0x5555, 0x5555}, {0x5a55, 0x5565, 0x5556}, {0x5a56, 0x65a6, 0x5a96},  // 2008
+    {0x455a, 0x5151, 0x1551}, {0x4515, 0x5155, 0x5555}, {0x5a55, 0x5565, 0x5556}, {0x5a56, 0x65a6, 0x5696},  // 2012
+    {0x0556, 0x5151, 0x1551}, {0x4505, 0x5155, 0x5555}, {0x5955, 0x5565, 0x5556}, {0x5a55, 0x6566, 0x5696},  // 2016
+    {0x0556, 0x1051, 0x1551}, {0x4505, 0x5155, 0x1555}, {0x5555, 0x5565, 0x5555}, {0x5a55, 0x6566, 0x5696},  // 2020
+    {0x0556, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555}, {0x5a55, 0x6566, 0x5556},  // 2024
+    {0x0556, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555}, {0x5a55, 0x6566, 0x5556},  // 2028
+    {0x0556, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555}, {0x5a55, 0x5565, 0x5556},  // 2032
+    {0x0556, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555}, {0x5a55, 0x5565, 0x5556},  // 2036
+    {0x0556, 0x1051, 0x0551}, {0x4505, 0x5151, 0x1551}, {0x4515, 0x5555, 0x5555}, {0x5a55, 0x5565, 0x5556},  // 2040
+    {0x0556, 0x1051, 0x0541}, {0x0505, 0x5151, 0x1551}, {0x4515, 0x5155, 0x5555}, {0x5a55, 0x5565, 0x5556},  // 2044
+    {0x0556, 0x1011, 0x0141}, {0x0501, 0x1051, 0x1551}, {0x4505, 0x5155, 0x5555}, {0x5555, 0x5565, 0x5555},  // 2048
+    {0x0555, 0x1011, 0x0141}, {0x0501, 0x1051, 0x1551}, {0x4505, 0x5155, 0x5555}, {0x5555, 0x5555, 0x5555},  // 2052
+    {0x0555, 0x1011, 0x0141}, {0x0501, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555}, {0x5555, 0x5555, 0x5555},  // 2056
+    {0x0555, 0x1011, 0x0001}, {0x0501, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555},  // 2060
+    {0x0555, 0x1011, 0x0001}, {0x0501, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555}, {0x5515, 0x5555, 0x5555},  // 2064
+    {0x0555, 0x0010, 0x0001}, {0x0501, 0x1051, 0x0551}, {0x4505, 0x5151, 0x1551}, {0x5515, 0x5555, 0x5555},  // 2068
+    {0x0555, 0x0010, 0x0001}, {0x0501, 0x1051, 0x0541}, {0x4505, 0x5151, 0x1551}, {0x4515, 0x5155, 0x5555},  // 2072
+    {0x0555, 0x0010, 0x0001}, {0x0501, 0x1051, 0x0541}, {0x0505, 0x5051, 0x1551}, {0x4515, 0x5155, 0x5555},  // 2076
+    {0x0555, 0x0010, 0x0001}, {0x0501, 0x1011, 0x0141}, {0x0505, 0x1051, 0x1551}, {0x4505, 0x5155, 0x5555},  // 2080
+    {0x0055, 0x0010, 0x0000}, {0x0500, 0x1011, 0x0141}, {0x0501, 0x1051, 0x1551}, {0x4505, 0x5155, 0x5555},  // 2084
+    {0x0055, 0x0000, 0x0000}, {0x0500, 0x1011, 0x0141}, {0x0501, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555},  // 2088
+    {0x0055, 0x0000, 0x0000}, {0x0500, 0x1011, 0x0001}, {0x0501, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555},  // 2092
+    {0x0015, 0x0000, 0x0000}, {0x0500, 0x0011, 0x0001}, {0x0501, 0x1051, 0x0551}, {0x4505, 0x5155, 0x1555},  // 2096
+    {0x5515, 0x5555, 0x5555},  // 2100
+};
+
+struct LunarDate {
+    int year;       // Gregorian year the lunar year starts in
+    int month;      // 1..12
+    int day;        // 1..30
+    bool leap;      // Intercalary (闰) month
+};
+
+inline uint32_t LunarInfo(int year) { return kLunarInfo[year - LUNAR_FIRST_YEAR]; }
+
+// 0 when the year has no leap month
+inline int LunarLeapMonth(int year) { return (int)(LunarInfo(year) & 0xf); }
+
+inline int LunarMonthDays(int year, int month, bool leap) {
+    uint32_t info = LunarInfo(year);
+    if (leap) return (info & 0x10000) ? 30 : 29;
+    return (info & (0x10000 >> month)) ? 30 : 29;
+}
+
+inline int LunarYearDays(int year) {
+    uint32_t info = LunarInfo(year);
+    int days = 348;
+    for (uint32_t bit = 0x8000; bit > 0x8; bit >>= 1) days += (info & bit) ? 1 : 0;
+    if (info & 0xf) days += (info & 0x10000) ? 30 : 29;
+    return days;
+}
+
+// Day number (days since 1970-01-01) of 正月初一
+inline long long LunarNewYearDay(int year) {
+    CivilDate jan1 = {year, 1, 1};
+    return DaysFromCivil(jan1) + ((LunarInfo(year) >> 17) & 0x3f);
+}
+
+inline bool LunarInRange(long long z) {
+    return z >= LunarNewYearDay(LUNAR_FIRST_YEAR)
+        && z < LunarNewYearDay(LUNAR_LAST_YEAR) + LunarYearDays(LUNAR_LAST_YEAR);
+}
+
+// Gregorian day number -> lunar date. Returns false outside 1900-2100.
+inline bool LunarFromDays(long long z, LunarDate* out) {
+    if (!LunarInRange(z)) return false;
+    int year = CivilFromDays(z).year;
+    if (year > LUNAR_LAST_YEAR || z < LunarNewYearDay(year)) year--;
+    long long offset = z - LunarNewYearDay(year);
+    int leapMonth = LunarLeapMonth(year);
+    for (int month = 1; month <= 12; month++) {
+        int len = LunarMonthDays(year, month, false);
+        if (offset < len) {
+            out->year = year; out->month = month; out->day = (int)offset + 1; out->leap = false;
+            return true;
+        }
+        offset -= len;
+        if (month == leapMonth) {
+            len = LunarMonthDays(year, month, true);
+            if (offset < len) {
+                out->year = year; out->month = month; out->day = (int)offset + 1; out->leap = true;
+                return true;
+            }
+            offset -= len;
+        }
+    }
+    return false;
+}
+
+// Lunar date -> Gregorian day number. Returns false for dates that do not
+// exist (no such leap month, day 30 of a short month, out of range).
+inline bool DaysFromLunar(const LunarDate& d, long long* z) {
+    if (d.year < LUNAR_FIRST_YEAR || d.year > LUNAR_LAST_YEAR || d.month < 1 || d.month > 12) return false;
+    if (d.leap && LunarLeapMonth(d.year) != d.month) return false;
+    if (d.day < 1 || d.day > LunarMonthDays(d.year, d.month, d.leap)) return false;
+    int leapMonth = LunarLeapMonth(d.year);
+    long long offset = 0;
+    for (int month = 1; month < d.month; month++) {
+        offset += LunarMonthDays(d.year, month, false);
+        if (month == leapMonth) offset += LunarMonthDays(d.year, month, true);
+    }
+    if (d.leap) offset += LunarMonthDays(d.year, d.month, false);
+    *z = LunarNewYearDay(d.year) + offset + d.day - 1;
+    return true;
+}
+
+// Converts count consecutive days starting at firstDay. After the first
+// lookup each day is an increment, so whole ranges cost a few ns per day.
+// Returns how many were converted (fewer when the range runs past 2100).
+inline size_t LunarFromDaysRange(long long firstDay, size_t count, LunarDate* out) {
+    if (count == 0) return 0;
+    LunarDate d;
+    if (!LunarFromDays(firstDay, &d)) return 0;
+    int monthLen = LunarMonthDays(d.year, d.month, d.leap);
+    for (size_t i = 0; i < count; i++) {
+        out[i] = d;
+        if (++d.day <= monthLen) continue;
+        d.day = 1;
+        if (!d.leap && LunarLeapMonth(d.year) == d.month) {
+            d.leap = true;
+        } else {
+            d.leap = false;
+            if (++d.month > 12) {
+                d.month = 1;
+                if (++d.year > LUNAR_LAST_YEAR) return i + 1;
+            }
+        }
+        monthLen = LunarMonthDays(d.year, d.month, d.leap);
+    }
+    return count;
+}
+
+// --- Solar terms ---
+
+// Day number of solar term index (0 = 小寒 ... 23 = 冬至) in a Gregorian year
+inline long long SolarTermDay(int year, int index) {
+    int bits = (kSolarTermInfo[year - LUNAR_FIRST_YEAR][index / 8] >> (2 * (index % 8))) & 3;
+    CivilDate d = {year, index / 2 + 1, kSolarTermBase[index] + bits};
+    return DaysFromCivil(d);
+}
+
+// Index of the solar term falling on day z, or -1. Each month has one
+// term in its first half and one in its second.
+inline int SolarTermOn(long long z) {
+    CivilDate d = CivilFromDays(z);
+    if (d.year < LUNAR_FIRST_YEAR || d.year > LUNAR_LAST_YEAR) return -1;
+    int index = (d.month - 1) * 2 + (d.day >= 15 ? 1 : 0);
+    return SolarTermDay(d.year, index) == z ? index : -1;
+}
+
+// --- Names ---
+
+static const char* const kSolarTermNames[24] = {
+    "小寒", "大寒", "立春", "雨水", "惊蛰", "春分", "清明", "谷雨",
+    "立夏", "小满", "芒种", "夏至", "小暑", "大暑", "立秋", "处暑",
+    "白露", "秋分", "寒露", "霜降", "立冬", "小雪", "大雪", "冬至"
+};
+
+static const char* const kHeavenlyStems[10] = {"甲", "乙", "丙", "丁", "戊", "己", "庚", "辛", "壬", "癸"};
+static const char* const kEarthlyBranches[12] = {"子", "丑", "寅", "卯", "辰", "巳", "午", "未", "申", "酉", "戌", "亥"};
+static const char* const kZodiacNames[12] = {"鼠", "牛", "虎", "兔", "龙", "蛇", "马", "羊", "猴", "鸡", "狗", "猪"};
+
+// Position in the 60-year cycle (0 = 甲子); 1984 was 甲子
+inline int SexagenaryYear(int lunarYear) { return (int)FloorMod(lunarYear - 4, 60); }
+
+// Day cycle position: 1970-01-01 was 辛巳 (17)
+inline int SexagenaryDay(long long z) { return (int)FloorMod(z + 17, 60); }
+
+inline const char* LunarMonthName(int month) {
+    static const char* const names[13] = {"", "正", "二", "三", "四", "五", "六", "七", "八", "九", "十", "冬", "腊"};
+    return names[month];
+}
+
+// 初一 .. 初十, 十一 .. 二十, 廿一 .. 三十
+inline void LunarDayName(int day, char* buf, int size) {
+    static const char* const digits[11] = {"", "一", "二", "三", "四", "五", "六", "七", "八", "九", "十"};
+    static const char* const tens[4] = {"初", "十", "廿", "三"};
+    if (day == 10) snprintf(buf, (size_t)size, "初十");
+    else if (day == 20) snprintf(buf, (size_t)size, "二十");
+    else if (day == 30) snprintf(buf, (size_t)size, "三十");
+    else snprintf(buf, (size_t)size, "%s%s", tens[day / 10], digits[day % 10]);
+}
+
+// "甲辰龙年 闰二月初一"
+inline void FormatLunarDate(const LunarDate& d, char* buf, int size) {
+    int cycle = SexagenaryYear(d.year);
+    char day[16];
+    LunarDayName(d.day, day, sizeof(day));
+    snprintf(buf, (size_t)size, "%s%s%s年 %s%s月%s", kHeavenlyStems[cycle % 10], kEarthlyBranches[cycle % 12],
+             kZodiacNames[cycle % 12], d.leap ? "闰" : "", LunarMonthName(d.month), day);
+}
+
+// Traditional festival on a day, or NULL. Leap months carry none.
+inline const char* LunarFestival(const LunarDate& d) {
+    if (d.leap) return NULL;
+    struct Festival { int month, day; const char* name; };
+    static const Festival festivals[] = {
+        {1, 1, "春节"}, {1, 15, "元宵节"}, {2, 2, "龙抬头"}, {5, 5, "端午节"}, {7, 7, "七夕"},
+        {7, 15, "中元节"}, {8, 15, "中秋节"}, {9, 9, "重阳节"}, {12, 8, "腊八节"}, {12, 23, "小年"}
+    };
+    for (size_t i = 0; i < sizeof(festivals) / sizeof(festivals[0]); i++) {
+        if (festivals[i].month == d.month && festivals[i].day == d.day) return festivals[i].name;
+    }
+    // 除夕 is the last day of the twelfth month, 29th or 30th
+    if (d.month == 12 && d.day == LunarMonthDays(d.year, 12, false)) return "除夕";
+    return NULL;
+}
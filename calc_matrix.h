@@ -0,0 +1,569 @@
+// Matrices and vectors: entry, arithmetic, determinant, inverse and solve
+// Portable C++ (no Win32). Doubles are stored row-major and worked on by
+// cache-blocked kernels whose inner loops run along contiguous rows, so
+// the compiler vectorizes them; large problems split their rows (or right
+// hand side columns) across threads. Factoring is a blocked LU with
+// partial pivoting: each panel of kPanel columns is factored on its own
+// and the rest of the matrix is brought up to date with one multiply.
+//
+// Small systems typed in exactly (integers, decimals, fractions) are also
+// kept as rationals. When the double factorization says such a system is
+// singular or badly conditioned, it is solved again by exact elimination.
+// Multiply, factor and solve take an optional cancel flag, polled every
+// block of rows or panel, and return false soon after it is set.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "calc_rational.h"
+
+#define MAT_MAX_DIM      4096   // Rows or columns accepted from text
+#define MAT_EXACT_MAX    12     // Largest system redone in rational arithmetic
+#define MAT_COND_LIMIT   1e10   // Condition number beyond which doubles are not trusted
+#define MAT_PARALLEL_MIN 128    // Smallest dimension worth spreading across threads
+
+struct Matrix {
+    int rows, cols;
+    std::vector<double> a;  // Row-major
+
+    Matrix() : rows(0), cols(0) {}
+    Matrix(int r, int c) : rows(r), cols(c), a((size_t)r * c, 0.0) {}
+
+    double* Row(int r) { return &a[(size_t)r * cols]; }
+    const double* Row(int r) const { return &a[(size_t)r * cols]; }
+    double& At(int r, int c) { return a[(size_t)r * cols + c]; }
+    double At(int r, int c) const { return a[(size_t)r * cols + c]; }
+
+    static Matrix Identity(int n) {
+        Matrix m(n, n);
+        for (int i = 0; i < n; i++) m.At(i, i) = 1;
+        return m;
+    }
+};
+
+struct RatMatrix {
+    int rows, cols;
+    std::vector<Rational> a;
+
+    RatMatrix() : rows(0), cols(0) {}
+    RatMatrix(int r, int c) : rows(r), cols(c), a((size_t)r * c) {}
+
+    Rational& At(int r, int c) { return a[(size_t)r * cols + c]; }
+    const Rational& At(int r, int c) const { return a[(size_t)r * cols + c]; }
+};
+
+// --- Entry ---
+
+// Reads rows separated by ';' or newlines, entries by spaces, tabs or
+// commas. Entries are anything RatParse accepts ("2", "-0.125", "1e-3",
+// "3/4"). Fills exact as well when it is not NULL.
+inline bool MatParse(const char* text, Matrix* m, RatMatrix* exact, char* message, int messageSize) {
+    std::vector<Rational> values;
+    int rows = 0, cols = -1, inRow = 0;
+    const char* p = text;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r') p++;
+        if (*p == ';' || *p == '\n' || *p == '\0') {
+            if (inRow) {
+                if (cols >= 0 && inRow != cols) {
+                    snprintf(message, (size_t)messageSize, "Row %d has %d entries, not %d", rows + 1, inRow, cols);
+                    return false;
+                }
+                cols = inRow;
+                rows++;
+                inRow = 0;
+            }
+            if (!*p++) break;
+            continue;
+        }
+        char token[128];
+        int len = 0;
+        while (*p && *p != ' ' && *p != '\t' && *p != ',' && *p != ';' && *p != '\r' && *p != '\n') {
+            if (len < (int)sizeof(token) - 1) token[len++] = *p;
+            p++;
+        }
+        token[len] = '\0';
+        Rational r;
+        if (!RatParse(token, &r)) {
+            snprintf(message, (size_t)messageSize, "Not a number: %.40s", token);
+            return false;
+        }
+        values.push_back(r);
+        if (++inRow > MAT_MAX_DIM) {
+            snprintf(message, (size_t)messageSize, "Too many columns");
+            return false;
+        }
+    }
+    if (!rows) {
+        snprintf(message, (size_t)messageSize, "Empty matrix");
+        return false;
+    }
+    if (rows > MAT_MAX_DIM) {
+        snprintf(message, (size_t)messageSize, "Too many rows");
+        return false;
+    }
+    *m = Matrix(rows, cols);
+    for (size_t i = 0; i < values.size(); i++) m->a[i] = RatToDouble(values[i]);
+    if (exact) {
+        exact->rows = rows;
+        exact->cols = cols;
+        exact->a.swap(values);
+    }
+    return true;
+}
+
+// --- Threads ---
+
+#define MAT_CANCEL_ROWS 64   // Rows of work between polls of the cancel flag
+
+inline bool MatCancelled(const std::atomic<bool>* cancel) {
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+inline int MatThreads(int dim) {
+    if (dim < MAT_PARALLEL_MIN) return 1;
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? (int)hw : 1;
+}
+
+// Runs fn(begin, end) over [0, count) split into one chunk per thread
+template <typename F>
+inline void MatParallel(int count, int threads, F fn) {
+    if (threads > count) threads = count;
+    if (threads <= 1) {
+        if (count > 0) fn(0, count);
+        return;
+    }
+    std::vector<std::thread> pool;
+    int chunk = (count + threads - 1) / threads;
+    for (int t = 1; t < threads; t++) {
+        int b = t * chunk, e = std::min(count, b + chunk);
+        if (b < e) pool.push_back(std::thread(fn, b, e));
+    }
+    fn(0, std::min(count, chunk));
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+}
+
+// --- Kernels ---
+
+// C[i][j] += alpha * sum_k A[i][k] * B[k][j] for rows [i0, i1) of C and
+// columns [0, n). B is walked in kKc x kNc blocks that stay in cache while
+// four rows of C at a time stream over them.
+inline void MatGemmRows(const double* A, size_t lda, const double* B, size_t ldb, double* C, size_t ldc,
+                        int i0, int i1, int n, int depth, double alpha) {
+    enum { kKc = 128, kNc = 512 };
+    for (int k0 = 0; k0 < depth; k0 += kKc) {
+        int k1 = std::min(depth, k0 + kKc);
+        for (int j0 = 0; j0 < n; j0 += kNc) {
+            int w = std::min(n, j0 + kNc) - j0;
+            int i = i0;
+            for (; i + 4 <= i1; i += 4) {
+                double* __restrict c0 = C + (size_t)i * ldc + j0;
+                double* __restrict c1 = c0 + ldc;
+                double* __restrict c2 = c1 + ldc;
+                double* __restrict c3 = c2 + ldc;
+                const double* a0 = A + (size_t)i * lda;
+                for (int k = k0; k < k1; k++) {
+                    double x0 = alpha * a0[k], x1 = alpha * a0[lda + k];
+                    double x2 = alpha * a0[2 * lda + k], x3 = alpha * a0[3 * lda + k];
+                    const double* __restrict b = B + (size_t)k * ldb + j0;
+                    for (int j = 0; j < w; j++) {
+                        double bj = b[j];
+                        c0[j] += x0 * bj;
+                        c1[j] += x1 * bj;
+                        c2[j] += x2 * bj;
+                        c3[j] += x3 * bj;
+                    }
+                }
+            }
+            for (; i < i1; i++) {
+                double* __restrict c = C + (size_t)i * ldc + j0;
+                for (int k = k0; k < k1; k++) {
+                    double x = alpha * A[(size_t)i * lda + k];
+                    const double* __restrict b = B + (size_t)k * ldb + j0;
+                    for (int j = 0; j < w; j++) c[j] += x * b[j];
+                }
+            }
+        }
+    }
+}
+
+inline bool MatAdd(const Matrix& a, const Matrix& b, double sign, Matrix* out) {
+    if (a.rows != b.rows || a.cols != b.cols) return false;
+    *out = Matrix(a.rows, a.cols);
+    for (size_t i = 0; i < a.a.size(); i++) out->a[i] = a.a[i] + sign * b.a[i];
+    return true;
+}
+
+// False for mismatched shapes, or when cancelled (out is left alone)
+inline bool MatMultiply(const Matrix& a, const Matrix& b, Matrix* out, int threads,
+                        const std::atomic<bool>* cancel = NULL) {
+    if (a.cols != b.rows) return false;
+    Matrix c(a.rows, b.cols);
+    if (a.cols) {
+        MatParallel(a.rows, threads, [&](int i0, int i1) {
+            for (int r = i0; r < i1 && !MatCancelled(cancel); r += MAT_CANCEL_ROWS) {
+                MatGemmRows(&a.a[0], (size_t)a.cols, &b.a[0], (size_t)b.cols, &c.a[0], (size_t)c.cols,
+                            r, std::min(i1, r + MAT_CANCEL_ROWS), b.cols, a.cols, 1.0);
+            }
+        });
+    }
+    if (MatCancelled(cancel)) return false;
+    *out = c;
+    return true;
+}
+
+// Transposes in 32 x 32 tiles so both sides are read and written a few
+// cache lines at a time
+inline Matrix MatTranspose(const Matrix& m) {
+    enum { kTile = 32 };
+    Matrix t(m.cols, m.rows);
+    for (int i0 = 0; i0 < m.rows; i0 += kTile) {
+        for (int j0 = 0; j0 < m.cols; j0 += kTile) {
+            int i1 = std::min(m.rows, i0 + kTile), j1 = std::min(m.cols, j0 + kTile);
+            for (int i = i0; i < i1; i++) {
+                for (int j = j0; j < j1; j++) t.a[(size_t)j * m.rows + i] = m.a[(size_t)i * m.cols + j];
+            }
+        }
+    }
+    return t;
+}
+
+inline double MatNorm1(const Matrix& m) {
+    std::vector<double> sums((size_t)m.cols, 0.0);
+    for (int i = 0; i < m.rows; i++) {
+        const double* r = m.Row(i);
+        for (int j = 0; j < m.cols; j++) sums[(size_t)j] += fabs(r[j]);
+    }
+    double best = 0;
+    for (int j = 0; j < m.cols; j++) best = std::max(best, sums[(size_t)j]);
+    return best;
+}
+
+// --- LU factorization ---
+
+struct MatLU {
+    enum { kPanel = 64 };
+
+    Matrix lu;               // L below the diagonal (unit diagonal implied), U on and above
+    std::vector<int> perm;   // Row i of lu came from row perm[i] of A
+    int sign;                // Of the permutation
+    bool singular;           // A pivot was exactly zero
+
+    MatLU() : sign(1), singular(false) {}
+};
+
+// Factors the columns [k0, k1) of the rows from k0 down, swapping whole rows
+inline void MatFactorPanel(MatLU* f, int k0, int k1) {
+    Matrix& m = f->lu;
+    int n = m.rows;
+    for (int j = k0; j < k1; j++) {
+        int p = j;
+        double best = fabs(m.At(j, j));
+        for (int i = j + 1; i < n; i++) {
+            double v = fabs(m.At(i, j));
+            if (v > best) { best = v; p = i; }
+        }
+        if (p != j) {
+            std::swap_ranges(m.Row(j), m.Row(j) + n, m.Row(p));
+            std::swap(f->perm[(size_t)j], f->perm[(size_t)p]);
+            f->sign = -f->sign;
+        }
+        double pivot = m.At(j, j);
+        if (pivot == 0) {
+            f->singular = true;
+            continue;
+        }
+        const double* __restrict pr = m.Row(j);
+        for (int i = j + 1; i < n; i++) {
+            double* __restrict r = m.Row(i);
+            double l = r[j] /= pivot;
+            if (l == 0) continue;
+            for (int c = j + 1; c < k1; c++) r[c] -= l * pr[c];
+        }
+    }
+}
+
+// False when cancelled part way
+inline bool MatFactor(const Matrix& a, MatLU* f, int threads, const std::atomic<bool>* cancel = NULL) {
+    int n = a.rows;
+    f->lu = a;
+    f->perm.resize((size_t)n);
+    for (int i = 0; i < n; i++) f->perm[(size_t)i] = i;
+    f->sign = 1;
+    f->singular = false;
+    Matrix& m = f->lu;
+    for (int k0 = 0; k0 < n; k0 += MatLU::kPanel) {
+        if (MatCancelled(cancel)) return false;
+        int k1 = std::min(n, k0 + (int)MatLU::kPanel);
+        MatFactorPanel(f, k0, k1);
+        if (k1 == n) break;
+        // U12 = L11^-1 A12: the panel's rows of the columns to the right
+        for (int r = k0; r < k1; r++) {
+            const double* __restrict pr = m.Row(r) + k1;
+            for (int i = r + 1; i < k1; i++) {
+                double l = m.At(i, r);
+                if (l == 0) continue;
+                double* __restrict row = m.Row(i) + k1;
+                for (int c = 0; c < n - k1; c++) row[c] -= l * pr[c];
+            }
+        }
+        // A22 -= L21 * U12
+        MatParallel(n - k1, threads, [&](int i0, int i1) {
+            MatGemmRows(m.Row(k1) + k0, (size_t)n, m.Row(k0) + k1, (size_t)n, m.Row(k1) + k1, (size_t)n,
+                        i0, i1, n - k1, k1 - k0, -1.0);
+        });
+    }
+    return true;
+}
+
+// Solves A X = B in place for every column of b. Columns are split across
+// threads; each thread sweeps down and back up its own slice of rows.
+// False when cancelled (b is left alone).
+inline bool MatLUSolve(const MatLU& f, Matrix* b, int threads, const std::atomic<bool>* cancel = NULL) {
+    int n = f.lu.rows, m = b->cols;
+    Matrix x(n, m);
+    for (int i = 0; i < n; i++) memcpy(x.Row(i), b->Row(f.perm[(size_t)i]), (size_t)m * sizeof(double));
+    const Matrix& lu = f.lu;
+    MatParallel(m, m >= 64 ? threads : 1, [&](int c0, int c1) {
+        int w = c1 - c0;
+        for (int i = 1; i < n; i++) {
+            if (i % MAT_CANCEL_ROWS == 0 && MatCancelled(cancel)) return;
+            const double* l = lu.Row(i);
+            double* __restrict xi = x.Row(i) + c0;
+            for (int r = 0; r < i; r++) {
+                double v = l[r];
+                if (v == 0) continue;
+                const double* __restrict xr = x.Row(r) + c0;
+                for (int c = 0; c < w; c++) xi[c] -= v * xr[c];
+            }
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            if (i % MAT_CANCEL_ROWS == 0 && MatCancelled(cancel)) return;
+            const double* u = lu.Row(i);
+            double* __restrict xi = x.Row(i) + c0;
+            for (int r = i + 1; r < n; r++) {
+                double v = u[r];
+                if (v == 0) continue;
+                const double* __restrict xr = x.Row(r) + c0;
+                for (int c = 0; c < w; c++) xi[c] -= v * xr[c];
+            }
+            double d = 1 / u[i];
+            for (int c = 0; c < w; c++) xi[c] *= d;
+        }
+    });
+    if (MatCancelled(cancel)) return false;
+    *b = x;
+    return true;
+}
+
+// Determinant as mantissa * 2^exponent, which cannot overflow
+inline void MatLUDeterminant(const MatLU& f, double* mantissa, long long* exponent) {
+    double m = f.sign;
+    long long e = 0;
+    for (int i = 0; i < f.lu.rows && m != 0; i++) {
+        int k;
+        m = frexp(m * f.lu.At(i, i), &k);
+        e += k;
+    }
+    *mantissa = m;
+    *exponent = m == 0 ? 0 : e;
+}
+
+// 1-norm condition number from the explicit inverse. Used on the small
+// systems that may be handed to exact arithmetic; returns infinity when
+// singular.
+inline double MatCondition1(const Matrix& a, const MatLU& f) {
+    if (f.singular) return INFINITY;
+    Matrix inv = Matrix::Identity(a.rows);
+    MatLUSolve(f, &inv, 1);
+    double c = MatNorm1(a) * MatNorm1(inv);
+    return c == c ? c : INFINITY;
+}
+
+// --- Exact elimination ---
+
+// Gauss-Jordan on rationals: reduces a to the identity while applying the
+// same row operations to b (any number of columns, or none). Returns false
+// if a is singular. det receives the determinant either way.
+inline bool RatMatEliminate(RatMatrix a, RatMatrix* b, Rational* det) {
+    int n = a.rows, m = b ? b->cols : 0;
+    Rational d(1);
+    for (int j = 0; j < n; j++) {
+        int p = j;
+        while (p < n && a.At(p, j).IsZero()) p++;
+        if (p == n) {
+            *det = Rational(0);
+            return false;
+        }
+        if (p != j) {
+            for (int c = 0; c < n; c++) std::swap(a.At(j, c), a.At(p, c));
+            for (int c = 0; c < m; c++) std::swap(b->At(j, c), b->At(p, c));
+            d = RatNeg(d);
+        }
+        Rational pivot = a.At(j, j), inv = RatRecip(pivot);
+        d = RatMul(d, pivot);
+        for (int c = j; c < n; c++) a.At(j, c) = RatMul(a.At(j, c), inv);
+        for (int c = 0; c < m; c++) b->At(j, c) = RatMul(b->At(j, c), inv);
+        for (int i = 0; i < n; i++) {
+            if (i == j || a.At(i, j).IsZero()) continue;
+            Rational l = a.At(i, j);
+            for (int c = j; c < n; c++) a.At(i, c) = RatSub(a.At(i, c), RatMul(l, a.At(j, c)));
+            for (int c = 0; c < m; c++) b->At(i, c) = RatSub(b->At(i, c), RatMul(l, b->At(j, c)));
+        }
+    }
+    *det = d;
+    return true;
+}
+
+inline RatMatrix RatMatIdentity(int n) {
+    RatMatrix m(n, n);
+    for (int i = 0; i < n; i++) m.At(i, i) = Rational(1);
+    return m;
+}
+
+// --- Solving ---
+
+// What solve, inverse and determinant report
+struct MatSolution {
+    bool exact;              // From rational elimination rather than doubles
+    bool singular;
+    double condition;        // 1-norm condition number; 0 when not computed (large systems)
+    Matrix value;            // X, or the inverse
+    RatMatrix exactValue;
+    double detMantissa;      // Determinant is detMantissa * 2^detExponent ...
+    long long detExponent;
+    Rational exactDet;       // ... or exactDet when exact
+
+    MatSolution() : exact(false), singular(false), condition(0), detMantissa(0), detExponent(0) {}
+};
+
+// Factors a and decides whether doubles can be trusted: a small system
+// that is singular or worse conditioned than MAT_COND_LIMIT is handed to
+// exact elimination when its exact entries are known
+inline bool MatNeedsExact(const Matrix& a, const RatMatrix* exact, const MatLU& f, MatSolution* out) {
+    out->singular = f.singular;
+    MatLUDeterminant(f, &out->detMantissa, &out->detExponent);
+    if (a.rows > MAT_EXACT_MAX) return false;
+    out->condition = MatCondition1(a, f);
+    return exact && (f.singular || !(out->condition <= MAT_COND_LIMIT));
+}
+
+// Solves a X = b, or inverts a when b is NULL. exactA and exactB may be
+// NULL when the entries are not known exactly. Returns false with a
+// message for mismatched shapes, a singular matrix or a cancel.
+inline bool MatSolve(const Matrix& a, const RatMatrix* exactA, const Matrix* b, const RatMatrix* exactB,
+                     MatSolution* out, int threads, char* message, int messageSize,
+                     const std::atomic<bool>* cancel = NULL) {
+    if (a.rows != a.cols) {
+        snprintf(message, (size_t)messageSize, "A must be square");
+        return false;
+    }
+    if (b && b->rows != a.rows) {
+        snprintf(message, (size_t)messageSize, "B needs %d rows", a.rows);
+        return false;
+    }
+    MatLU f;
+    bool done = MatFactor(a, &f, threads, cancel);
+    if (done && MatNeedsExact(a, exactA, f, out) && (!b || exactB)) {
+        out->exact = true;
+        out->exactValue = b ? *exactB : RatMatIdentity(a.rows);
+        out->singular = !RatMatEliminate(*exactA, &out->exactValue, &out->exactDet);
+    } else if (done && !f.singular) {
+        out->value = b ? *b : Matrix::Identity(a.rows);
+        done = MatLUSolve(f, &out->value, threads, cancel);
+    }
+    if (!done) {
+        snprintf(message, (size_t)messageSize, "Cancelled");
+        return false;
+    }
+    if (out->singular) {
+        snprintf(message, (size_t)messageSize, "A is singular");
+        return false;
+    }
+    return true;
+}
+
+inline bool MatDeterminant(const Matrix& a, const RatMatrix* exactA, MatSolution* out, int threads,
+                           char* message, int messageSize, const std::atomic<bool>* cancel = NULL) {
+    if (a.rows != a.cols) {
+        snprintf(message, (size_t)messageSize, "A must be square");
+        return false;
+    }
+    MatLU f;
+    if (!MatFactor(a, &f, threads, cancel)) {
+        snprintf(message, (size_t)messageSize, "Cancelled");
+        return false;
+    }
+    if (MatNeedsExact(a, exactA, f, out)) {
+        out->exact = true;
+        RatMatEliminate(*exactA, NULL, &out->exactDet);
+        out->singular = out->exactDet.IsZero();
+    }
+    return true;
+}
+
+// --- Output ---
+
+inline void MatFormatValue(double v, char* buf, int size) {
+    if (v == 0) v = 0;  // No "-0"
+    snprintf(buf, (size_t)size, "%.12g", v);
+}
+
+// Fraction when it is short, otherwise 15 significant digits
+inline void MatFormatRational(const Rational& r, char* buf, int size) {
+    if (RatFormatFraction(r, buf, size) && strlen(buf) <= 24) return;
+    RatFormatDecimal(r, buf, size, 15);
+}
+
+inline void MatFormatDeterminant(double mantissa, long long exponent, char* buf, int size) {
+    if (mantissa == 0) {
+        snprintf(buf, (size_t)size, "0");
+        return;
+    }
+    if (exponent > -1000 && exponent < 1000) {
+        snprintf(buf, (size_t)size, "%.12g", ldexp(mantissa, (int)exponent));
+        return;
+    }
+    double l = log10(fabs(mantissa)) + (double)exponent * 0.30102999566398120;
+    double e = floor(l);
+    snprintf(buf, (size_t)size, "%s%.10fe%+.0f", mantissa < 0 ? "-" : "", pow(10.0, l - e), e);
+}
+
+// Rows as lines of tab-separated entries, at most maxRows x maxCols of them
+template <typename Format>
+inline std::string MatFormatGrid(int rows, int cols, int maxRows, int maxCols, Format cell) {
+    std::string s;
+    char buf[160];
+    for (int i = 0; i < rows && i < maxRows; i++) {
+        for (int j = 0; j < cols && j < maxCols; j++) {
+            cell(i, j, buf, (int)sizeof(buf));
+            if (j) s += '\t';
+            s += buf;
+        }
+        if (cols > maxCols) s += "\t...";
+        s += "\r\n";
+    }
+    if (rows > maxRows) s += "...\r\n";
+    return s;
+}
+
+inline std::string MatToText(const Matrix& m, int maxRows = 1 << 30, int maxCols = 1 << 30) {
+    return MatFormatGrid(m.rows, m.cols, maxRows, maxCols, [&](int i, int j, char* buf, int size) {
+        MatFormatValue(m.At(i, j), buf, size);
+    });
+}
+
+inline std::string RatMatToText(const RatMatrix& m, int maxRows = 1 << 30, int maxCols = 1 << 30) {
+    return MatFormatGrid(m.rows, m.cols, maxRows, maxCols, [&](int i, int j, char* buf, int size) {
+        MatFormatRational(m.At(i, j), buf, size);
+    });
+}
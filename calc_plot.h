@@ -0,0 +1,509 @@
+// Function plotting: y = f(x) sampled once and drawn into a pixel buffer
+// Portable C++ (no Win32). Samples sit on a grid x = k * 2^level, with the
+// level chosen from the view width and a sample budget. Because grid points
+// do not depend on where the view starts, a pan keeps every sample still in
+// view and evaluates only the newly exposed ends, and a zoom that changes
+// the level keeps every sample the new grid shares with the old one.
+// Missing samples are evaluated a block of x values at a time through
+// ExprProgram::EvalBlock.
+//
+// Between neighbouring samples the curve is refined by bisection wherever
+// it jumps more than a few pixels near the visible y range, or crosses the
+// edge of the function's domain. A jump that survives the deepest bisection
+// is a discontinuity and the curve is broken there instead of joined by a
+// vertical line. Refinements are kept while the y scale stays the same and
+// the view stays inside the band they were made for.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "calc_compositor.h"
+#include "calc_expr.h"
+
+#define PLOT_MISSING 0xff        // Sample not evaluated yet
+#define PLOT_UNEXAMINED 0xffffffffu
+#define PLOT_STEEP_PIXELS 3.0    // Refine segments that rise more than this
+
+struct PlotView {
+    double xMin, xMax, yMin, yMax;
+};
+
+// A point added by refinement inside one grid interval
+struct PlotPoint {
+    double x, y;
+    uint8_t error;         // EXPR_* for this point
+    uint8_t breakBefore;   // Not joined to the point before it
+};
+
+struct PlotInterval {
+    uint32_t extra;        // First refinement point in PlotTile::extra
+    uint32_t count;        // PLOT_UNEXAMINED until refinement has looked at it
+};
+
+// A run of kSize consecutive grid points. spans[i] lies between samples i
+// and i + 1; the last one reaches the first sample of the next tile.
+struct PlotTile {
+    enum { kSize = 4096 };
+
+    long long index;       // First grid point is index * kSize
+    int missing;           // Samples still PLOT_MISSING
+    bool examined;         // Every span has been looked at by refinement
+    double y[kSize];
+    uint8_t error[kSize];          // EXPR_* or PLOT_MISSING
+    uint8_t breakBefore[kSize];    // Sample not joined to the point before it
+    PlotInterval spans[kSize];
+    std::vector<PlotPoint> extra;
+
+    void Reset(long long i) {
+        index = i;
+        missing = kSize;
+        memset(error, PLOT_MISSING, sizeof(error));
+        ClearRefinement();
+    }
+
+    void ClearRefinement() {
+        examined = false;
+        memset(breakBefore, 0, sizeof(breakBefore));
+        for (int i = 0; i < kSize; i++) spans[i].count = PLOT_UNEXAMINED;
+        extra.clear();
+    }
+};
+
+struct PlotSampler {
+    enum { kBlock = 256, kMaxDepth = 10 };
+
+    ExprProgram program;   // At most one variable, used as x
+    int level;             // Grid step is 2^level
+    double step;
+    std::vector<PlotTile*> tiles;  // Consecutive, covering the view
+    std::vector<PlotTile*> spare;
+    double refineScale;    // Pixels per y unit the refinements were made for
+    double bandLo, bandHi; // y range they cover: the view and a view height either side
+
+    long long evaluated;   // Points evaluated by the last Update
+    long long refined;     // Refinement points held for the current tiles
+
+    // Reused between updates
+    std::vector<double> xs, ys, stack;
+    std::vector<uint8_t> es;
+    std::vector<PlotTile*> old;
+
+    PlotSampler() : level(0), step(1), refineScale(0), bandLo(0), bandHi(0), evaluated(0), refined(0) {}
+
+    ~PlotSampler() {
+        Clear();
+        for (size_t i = 0; i < spare.size(); i++) delete spare[i];
+    }
+
+    void Clear() {
+        spare.insert(spare.end(), tiles.begin(), tiles.end());
+        tiles.clear();
+    }
+
+    // Takes a compiled formula. The variable, if any, is x.
+    bool SetProgram(const ExprProgram& p, char* message, int messageSize) {
+        if (p.vars.size() > 1 || (p.vars.size() == 1 && p.vars[0] != "x")) {
+            snprintf(message, (size_t)messageSize, "Use x as the only variable");
+            return false;
+        }
+        program = p;
+        Clear();
+        return true;
+    }
+
+    long long Size() const { return (long long)tiles.size() * PlotTile::kSize; }
+    double XAt(long long k) const { return (double)k * step; }  // Exact: step is a power of two
+
+    // Grid level for at least `samples` points across the view
+    static int LevelFor(const PlotView& v, long long samples) {
+        int e;
+        frexp((v.xMax - v.xMin) / (double)(samples > 0 ? samples : 1), &e);
+        return e - 1;  // 2^(e-1) <= step
+    }
+
+    static long long FloorDiv(long long a, long long b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+
+    PlotTile* NewTile(long long index) {
+        PlotTile* t;
+        if (spare.empty()) t = new PlotTile;
+        else {
+            t = spare.back();
+            spare.pop_back();
+        }
+        t->Reset(index);
+        return t;
+    }
+
+    // Brings the cache to the view: samples for every grid point from just
+    // left of xMin to just right of xMax, and refinements for heightPx pixels
+    // over the y range. Returns false for a view the grid cannot represent.
+    bool Update(const PlotView& v, int heightPx, long long samples) {
+        double span = v.xMax - v.xMin;
+        if (!(span > 0) || !(v.yMax > v.yMin) || heightPx <= 0) return false;
+        int newLevel = LevelFor(v, samples);
+        double newStep = ldexp(1.0, newLevel);
+        // Grid indices must stay exact in a double
+        if (fabs(v.xMin) / newStep > 4.0e15 || fabs(v.xMax) / newStep > 4.0e15) return false;
+        long long firstTile = FloorDiv((long long)floor(v.xMin / newStep) - 1, PlotTile::kSize);
+        long long lastTile = FloorDiv((long long)ceil(v.xMax / newStep) + 1, PlotTile::kSize);
+
+        double scale = heightPx / (v.yMax - v.yMin);
+        if (!(scale == refineScale && v.yMin >= bandLo && v.yMax <= bandHi)) {
+            refineScale = scale;
+            bandLo = v.yMin - (v.yMax - v.yMin);
+            bandHi = v.yMax + (v.yMax - v.yMin);
+            for (size_t i = 0; i < tiles.size(); i++) tiles[i]->ClearRefinement();
+        }
+
+        old.swap(tiles);
+        tiles.clear();
+        if (newLevel == level) {
+            // Keep the tiles still in view; the rest go back to the spares
+            long long oldFirst = old.empty() ? 0 : old[0]->index;
+            for (long long t = firstTile; t <= lastTile; t++) {
+                long long at = t - oldFirst;
+                if (at >= 0 && at < (long long)old.size()) {
+                    tiles.push_back(old[(size_t)at]);
+                    old[(size_t)at] = NULL;
+                } else {
+                    tiles.push_back(NewTile(t));
+                }
+            }
+        } else {
+            for (long long t = firstTile; t <= lastTile; t++) tiles.push_back(NewTile(t));
+            CopyShared(newLevel);
+        }
+        for (size_t i = 0; i < old.size(); i++) {
+            if (old[i]) spare.push_back(old[i]);
+        }
+        old.clear();
+        // A span reaching into a tile that was just added is looked at again
+        for (size_t i = 0; i + 1 < tiles.size(); i++) {
+            if (tiles[i + 1]->examined || tiles[i + 1]->missing < PlotTile::kSize) continue;
+            tiles[i]->spans[PlotTile::kSize - 1].count = PLOT_UNEXAMINED;
+            tiles[i]->examined = false;
+        }
+        level = newLevel;
+        step = newStep;
+        // Spare tiles beyond a screenful are given back
+        while (spare.size() > tiles.size() + 4) {
+            delete spare.back();
+            spare.pop_back();
+        }
+
+        evaluated = 0;
+        EvaluateMissing();
+        Refine();
+        refined = 0;
+        for (size_t i = 0; i < tiles.size(); i++) refined += (long long)tiles[i]->extra.size();
+        return true;
+    }
+
+    // After a zoom to another level, fills the new tiles with the grid
+    // points the old tiles (still in `old`) already hold
+    void CopyShared(int newLevel) {
+        if (old.empty()) return;
+        long long oldFirst = old[0]->index * PlotTile::kSize;
+        long long oldEnd = oldFirst + (long long)old.size() * PlotTile::kSize;
+        for (size_t ti = 0; ti < tiles.size(); ti++) {
+            PlotTile* t = tiles[ti];
+            for (int i = 0; i < PlotTile::kSize; i++) {
+                long long k = t->index * PlotTile::kSize + i, o;
+                if (newLevel > level) {
+                    if (newLevel - level >= 40) return;  // No shared points in range
+                    o = k * (1LL << (newLevel - level));
+                } else {
+                    int shift = level - newLevel;
+                    if (shift >= 62 || k % (1LL << shift)) continue;
+                    o = k / (1LL << shift);
+                }
+                if (o < oldFirst || o >= oldEnd) continue;
+                const PlotTile* src = old[(size_t)((o - oldFirst) / PlotTile::kSize)];
+                int at = (int)((o - oldFirst) % PlotTile::kSize);
+                if (src->error[at] == PLOT_MISSING) continue;
+                t->y[i] = src->y[at];
+                t->error[i] = src->error[at];
+                t->missing--;
+            }
+        }
+    }
+
+    // Evaluates xs[0..count) into ys and es
+    void EvalPoints(size_t count) {
+        ys.resize(xs.size());
+        es.resize(xs.size());
+        stack.resize((size_t)(program.maxDepth > 0 ? program.maxDepth : 1) * kBlock);
+        for (size_t b = 0; b < count; b += kBlock) {
+            int m = count - b < (size_t)kBlock ? (int)(count - b) : kBlock;
+            const double* columns[1] = {&xs[b]};
+            program.EvalBlock(columns, m, &ys[b], &es[b], &stack[0]);
+        }
+        evaluated += (long long)count;
+    }
+
+    static uint8_t Classify(int error, double value) {
+        return (uint8_t)(error != EXPR_OK ? error : std::isfinite(value) ? EXPR_OK : EXPR_ERR_DOMAIN);
+    }
+
+    void EvaluateMissing() {
+        for (size_t ti = 0; ti < tiles.size(); ti++) {
+            PlotTile* t = tiles[ti];
+            if (!t->missing) continue;
+            long long base = t->index * PlotTile::kSize;
+            xs.clear();
+            for (int i = 0; i < PlotTile::kSize; i++) {
+                if (t->error[i] == PLOT_MISSING) xs.push_back(XAt(base + i));
+            }
+            EvalPoints(xs.size());
+            for (int i = 0, j = 0; i < PlotTile::kSize; i++) {
+                if (t->error[i] != PLOT_MISSING) continue;
+                t->y[i] = ys[(size_t)j];
+                t->error[i] = Classify(es[(size_t)j], ys[(size_t)j]);
+                j++;
+            }
+            t->missing = 0;
+        }
+    }
+
+    // Whether the segment from a to b needs a point in the middle
+    bool Steep(double ya, int ea, double yb, int eb) const {
+        if (ea != eb) return true;  // The domain ends in between
+        if (ea || (ya > bandHi && yb > bandHi) || (ya < bandLo && yb < bandLo)) return false;
+        return fabs(yb - ya) * refineScale > PLOT_STEEP_PIXELS;
+    }
+
+    struct Work {
+        PlotTile* tile;
+        int span;
+        double xa, ya, xb, yb;
+        int ea, eb;
+        long long right;       // Index in found of the right end, or -1 for a grid sample
+        uint8_t* rightBreak;   // The grid sample's break flag
+    };
+
+    struct Found {
+        PlotPoint point;
+        PlotTile* tile;
+        int span;
+    };
+
+    // Bisects steep spans level by level, so each level's midpoints are
+    // evaluated together
+    void Refine() {
+        std::vector<Work> work, next;
+        std::vector<Found> found;
+        for (size_t ti = 0; ti < tiles.size(); ti++) {
+            PlotTile* t = tiles[ti];
+            if (t->examined) continue;
+            PlotTile* right = ti + 1 < tiles.size() ? tiles[ti + 1] : NULL;
+            long long base = t->index * PlotTile::kSize;
+            for (int i = 0; i < PlotTile::kSize; i++) {
+                if (t->spans[i].count != PLOT_UNEXAMINED) continue;
+                bool last = i + 1 == PlotTile::kSize;
+                if (last && !right) break;  // Waits for the next tile
+                double yb = last ? right->y[0] : t->y[i + 1];
+                int eb = last ? right->error[0] : t->error[i + 1];
+                uint8_t* brk = last ? &right->breakBefore[0] : &t->breakBefore[i + 1];
+                t->spans[i].count = 0;
+                *brk = 0;
+                if (!Steep(t->y[i], t->error[i], yb, eb)) continue;
+                Work w = {t, i, XAt(base + i), t->y[i], XAt(base + i + 1), yb, t->error[i], eb, -1, brk};
+                work.push_back(w);
+            }
+            t->examined = right != NULL;
+        }
+        for (int depth = 1; depth <= (int)kMaxDepth && !work.empty(); depth++) {
+            xs.resize(work.size());
+            for (size_t j = 0; j < work.size(); j++) xs[j] = 0.5 * (work[j].xa + work[j].xb);
+            EvalPoints(work.size());
+            next.clear();
+            for (size_t j = 0; j < work.size(); j++) {
+                const Work& w = work[j];
+                PlotPoint m = {xs[j], ys[j], Classify(es[j], ys[j]), 0};
+                long long mid = (long long)found.size();
+                Found f = {m, w.tile, w.span};
+                found.push_back(f);
+                bool left = Steep(w.ya, w.ea, m.y, m.error), right = Steep(m.y, m.error, w.yb, w.eb);
+                if (depth == kMaxDepth) {
+                    // Still a jump with nothing left to bisect: a discontinuity
+                    if (left && w.ea == m.error) found[(size_t)mid].point.breakBefore = 1;
+                    if (right && m.error == w.eb) {
+                        if (w.right < 0) *w.rightBreak = 1;
+                        else found[(size_t)w.right].point.breakBefore = 1;
+                    }
+                    continue;
+                }
+                if (left) {
+                    Work l = {w.tile, w.span, w.xa, w.ya, m.x, m.y, w.ea, m.error, mid, NULL};
+                    next.push_back(l);
+                }
+                if (right) {
+                    Work r = {w.tile, w.span, m.x, m.y, w.xb, w.yb, m.error, w.eb, w.right, w.rightBreak};
+                    next.push_back(r);
+                }
+            }
+            work.swap(next);
+        }
+        if (found.empty()) return;
+
+        // Store each span's points in x order. Spans of one tile were queued
+        // in order, so sorting on x alone keeps them grouped.
+        std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.point.x < b.point.x; });
+        for (size_t j = 0; j < found.size(); j++) {
+            PlotTile* t = found[j].tile;
+            PlotInterval& s = t->spans[found[j].span];
+            if (!s.count) s.extra = (uint32_t)t->extra.size();
+            s.count++;
+            t->extra.push_back(found[j].point);
+        }
+    }
+
+private:
+    PlotSampler(const PlotSampler&);
+    PlotSampler& operator=(const PlotSampler&);
+};
+
+// --- Rendering ---
+
+// Draws a polyline whose x never decreases as one vertical run of pixels
+// per column, so a million points cost about as much as the columns they
+// cover. Coordinates are in pixels.
+struct PlotPen {
+    CompSurface* surface;
+    CompRect clip;
+    uint32_t color;
+    bool down;
+    double lastX, lastY;
+    int column;
+    double columnEnd;      // Left edge of the next column
+    double lo, hi;         // Extent of the curve within the column
+
+    PlotPen(CompSurface* s, const CompRect& r, uint32_t c) : surface(s), clip(r), color(c), down(false),
+        lastX(0), lastY(0), column(0), columnEnd(0), lo(0), hi(0) {}
+
+    void Flush() {
+        if (column < clip.left || column >= clip.right) return;
+        if (hi < clip.top || lo >= clip.bottom) return;
+        int top = lo < clip.top ? clip.top : (int)lo;
+        int bottom = hi >= clip.bottom ? clip.bottom - 1 : (int)hi;
+        uint32_t* p = surface->Row(top) + column;
+        for (int yy = top; yy <= bottom; yy++, p += surface->stride) *p = color;
+    }
+
+    void Start(int c, double yy) {
+        column = c;
+        columnEnd = c + 1.0;
+        lo = hi = yy;
+    }
+
+    void MoveTo(double x, double yy) {
+        Lift();
+        down = true;
+        lastX = x;
+        lastY = yy;
+        Start((int)floor(x), yy);
+    }
+
+    void LineTo(double x, double yy) {
+        if (!down) { MoveTo(x, yy); return; }
+        if (x >= columnEnd) Cross(x, yy);
+        if (yy < lo) lo = yy;
+        else if (yy > hi) hi = yy;
+        lastX = x;
+        lastY = yy;
+    }
+
+    // Ends the current column and every column the segment crosses;
+    // columns outside the clip are skipped
+    void Cross(double x, double yy) {
+        int c = (int)floor(x);
+        double slope = (yy - lastY) / (x - lastX);
+        int b = column + 1 > clip.left ? column + 1 : clip.left;
+        int end = c < clip.right ? c : clip.right;
+        for (; b <= end; b++) {
+            double yb = lastY + (b - lastX) * slope;
+            if (yb < lo) lo = yb;
+            if (yb > hi) hi = yb;
+            Flush();
+            Start(b, yb);
+        }
+        if (column != c) Start(c, yy);
+    }
+
+    void Lift() {
+        if (down) Flush();
+        down = false;
+    }
+};
+
+// Draws the cached curve for view v into rect of s
+inline void PlotDrawCurve(const PlotSampler& sampler, CompSurface& s, const CompRect& rect, const PlotView& v,
+                          uint32_t color) {
+    CompRect clip = CompIntersect(rect, s.Bounds());
+    if (clip.IsEmpty() || sampler.tiles.empty()) return;
+    double sx = (rect.right - rect.left) / (v.xMax - v.xMin);
+    double sy = (rect.bottom - rect.top) / (v.yMax - v.yMin);
+    double dx = sampler.step * sx, y0 = rect.top + v.yMax * sy;
+    // Pixel coordinates stay far inside int range
+    const double limit = 1e7;
+    PlotPen pen(&s, clip, color);
+    for (size_t ti = 0; ti < sampler.tiles.size(); ti++) {
+        const PlotTile* t = sampler.tiles[ti];
+        double x0 = rect.left + (sampler.XAt(t->index * PlotTile::kSize) - v.xMin) * sx;
+        for (int i = 0; i < PlotTile::kSize; i++) {
+            if (t->error[i]) pen.Lift();
+            else {
+                double px = x0 + i * dx;
+                double py = y0 - t->y[i] * sy;
+                py = py < -limit ? -limit : py > limit ? limit : py;
+                if (t->breakBefore[i]) pen.MoveTo(px, py);
+                else pen.LineTo(px, py);
+            }
+            const PlotInterval& span = t->spans[i];
+            if (span.count == PLOT_UNEXAMINED || !span.count) continue;
+            for (uint32_t j = 0; j < span.count; j++) {
+                const PlotPoint& p = t->extra[span.extra + j];
+                if (p.error) { pen.Lift(); continue; }
+                double qx = rect.left + (p.x - v.xMin) * sx;
+                double qy = y0 - p.y * sy;
+                qy = qy < -limit ? -limit : qy > limit ? limit : qy;
+                if (p.breakBefore) pen.MoveTo(qx, qy);
+                else pen.LineTo(qx, qy);
+            }
+        }
+    }
+    pen.Lift();
+}
+
+// Grid spacing of 1, 2 or 5 times a power of ten giving at most maxLines
+// lines across range
+inline double PlotGridStep(double range, int maxLines) {
+    double raw = range / (maxLines > 0 ? maxLines : 1);
+    double p = pow(10.0, floor(log10(raw)));
+    double m = raw / p;
+    return (m <= 1 ? 1 : m <= 2 ? 2 : m <= 5 ? 5 : 10) * p;
+}
+
+// Background, grid lines and the axes for view v
+inline void PlotDrawGrid(CompSurface& s, const CompRect& rect, const PlotView& v, uint32_t background,
+                         uint32_t grid, uint32_t axis) {
+    CompFillRect(s, rect, background);
+    int w = rect.right - rect.left, h = rect.bottom - rect.top;
+    if (w <= 0 || h <= 0) return;
+    double sx = w / (v.xMax - v.xMin), sy = h / (v.yMax - v.yMin);
+    double gx = PlotGridStep(v.xMax - v.xMin, w / 60), gy = PlotGridStep(v.yMax - v.yMin, h / 50);
+    // Lines are counted from zero so the axis lands exactly on a line
+    for (double k = ceil(v.xMin / gx), x; (x = k * gx) <= v.xMax && k * gx - v.xMin < 2 * (v.xMax - v.xMin); k++) {
+        int px = rect.left + (int)floor((x - v.xMin) * sx);
+        CompFillRect(s, CompRect(px, rect.top, px + 1, rect.bottom), k == 0 ? axis : grid);
+    }
+    for (double k = ceil(v.yMin / gy), y; (y = k * gy) <= v.yMax && k * gy - v.yMin < 2 * (v.yMax - v.yMin); k++) {
+        int py = rect.top + (int)floor((v.yMax - y) * sy);
+        CompFillRect(s, CompRect(rect.left, py, rect.right, py + 1), k == 0 ? axis : grid);
+    }
+}
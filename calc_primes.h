@@ -0,0 +1,1016 @@
+// Primality tests, factorization and modular arithmetic on BigInt
+// Portable C++ (no Win32). Numbers below 2^64 use Montgomery arithmetic on
+// single words: Miller-Rabin with a fixed set of seven bases is
+// deterministic there, and Pollard's rho (Brent's variant) splits them in
+// microseconds. Larger numbers run the same arithmetic on 32-bit limbs;
+// primality is the Baillie-PSW test (a strong base-2 Miller-Rabin test and
+// a strong Lucas test, with no known counterexample), and factors are
+// looked for by trial division, Pollard's rho and then the elliptic curve
+// method (ECM), with rho sequences and curves spread across threads.
+//
+// Factor jobs count their progress in atomics and stop early when cancel
+// is set, so a host can run them on a worker thread.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "calc_bigint.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#define PRIME_MAX_DIGITS  10000   // Longest input accepted
+#define PRIME_TRIAL_LIMIT 65536   // Trial division bound for big numbers
+#define PRIME_RHO_STEPS   (1 << 16)
+
+// Factor job stages, for progress
+#define PRIME_STAGE_TRIAL 0
+#define PRIME_STAGE_RHO   1
+#define PRIME_STAGE_ECM   2
+#define PRIME_STAGE_DONE  3
+
+// --- Small primes ---
+
+// Primes below limit by the sieve of Eratosthenes
+inline std::vector<uint32_t> PrimeList(uint32_t limit) {
+    std::vector<uint8_t> composite(limit, 0);
+    std::vector<uint32_t> primes;
+    for (uint32_t i = 2; i < limit; i++) {
+        if (composite[i]) continue;
+        primes.push_back(i);
+        for (unsigned long long j = (unsigned long long)i * i; j < limit; j += i) composite[(size_t)j] = 1;
+    }
+    return primes;
+}
+
+// The primes below PRIME_TRIAL_LIMIT, built once
+inline const std::vector<uint32_t>& PrimeSmall() {
+    static const std::vector<uint32_t> primes = PrimeList(PRIME_TRIAL_LIMIT);
+    return primes;
+}
+
+// |a| mod d without copying a
+inline uint32_t PrimeModSmall(const BigInt& a, uint32_t d) {
+    unsigned long long rem = 0;
+    for (size_t i = a.mag.size(); i-- > 0;) rem = ((rem << 32) | a.mag[i]) % d;
+    return (uint32_t)rem;
+}
+
+// --- 64-bit words ---
+
+// High word of a * b; the low word goes to *lo
+inline uint64_t PrimeMulHi(uint64_t a, uint64_t b, uint64_t* lo) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 p = (unsigned __int128)a * b;
+    *lo = (uint64_t)p;
+    return (uint64_t)(p >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t hi;
+    *lo = _umul128(a, b, &hi);
+    return hi;
+#else
+    uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    *lo = (mid << 32) | (uint32_t)p00;
+    return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+}
+
+inline uint64_t PrimeGcd64(uint64_t a, uint64_t b) {
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Montgomery arithmetic modulo an odd n with R = 2^64. Values stay below
+// n, in Montgomery form x R mod n.
+struct PrimeMont64 {
+    uint64_t n;
+    uint64_t ninv;  // -1/n mod 2^64
+    uint64_t one;   // R mod n
+    uint64_t r2;    // R^2 mod n
+
+    explicit PrimeMont64(uint64_t m) : n(m) {
+        uint64_t inv = m;  // Right to 3 bits; each Newton step doubles that
+        for (int i = 0; i < 5; i++) inv *= 2 - m * inv;
+        ninv = 0 - inv;
+        one = (0 - m) % m;
+        r2 = one;
+        for (int i = 0; i < 64; i++) r2 = Add(r2, r2);
+    }
+
+    uint64_t Add(uint64_t a, uint64_t b) const { return a >= n - b ? a - (n - b) : a + b; }
+    uint64_t Sub(uint64_t a, uint64_t b) const { return a >= b ? a - b : a + (n - b); }
+
+    // (hi:lo) / R mod n, for hi < n
+    uint64_t Reduce(uint64_t hi, uint64_t lo) const {
+        uint64_t mlo, m = lo * ninv;
+        uint64_t mhi = PrimeMulHi(m, n, &mlo);
+        // lo + mlo is 0 mod 2^64 and carries exactly when lo != 0
+        uint64_t t = hi + mhi;
+        bool over = t < hi;
+        uint64_t c = lo != 0;
+        t += c;
+        over = over || t < c;
+        return over || t >= n ? t - n : t;
+    }
+
+    uint64_t Mul(uint64_t a, uint64_t b) const {
+        uint64_t lo, hi = PrimeMulHi(a, b, &lo);
+        return Reduce(hi, lo);
+    }
+
+    uint64_t To(uint64_t a) const { return Mul(a % n, r2); }
+    uint64_t From(uint64_t a) const { return Reduce(0, a); }
+
+    uint64_t Pow(uint64_t base, uint64_t e) const {
+        uint64_t r = one;
+        for (; e; e >>= 1) {
+            if (e & 1) r = Mul(r, base);
+            base = Mul(base, base);
+        }
+        return r;
+    }
+};
+
+// Deterministic below 2^64: no composite passes the strong test for all
+// of Jim Sinclair's seven bases
+inline bool PrimeIsPrime64(uint64_t n) {
+    static const uint32_t small[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    if (n < 2) return false;
+    for (size_t i = 0; i < sizeof(small) / sizeof(small[0]); i++) {
+        if (n == small[i]) return true;
+        if (n % small[i] == 0) return false;
+    }
+    if (n < 37 * 37) return true;
+
+    static const uint64_t bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+    PrimeMont64 m(n);
+    uint64_t d = n - 1;
+    int s = 0;
+    while (!(d & 1)) { d >>= 1; s++; }
+    uint64_t minusOne = m.n - m.one;
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        uint64_t a = bases[i] % n;
+        if (a == 0) continue;
+        uint64_t x = m.Pow(m.To(a), d);
+        if (x == m.one || x == minusOne) continue;
+        bool witness = true;
+        for (int r = 1; r < s && witness; r++) {
+            x = m.Mul(x, x);
+            if (x == minusOne) witness = false;
+        }
+        if (witness) return false;
+    }
+    return true;
+}
+
+// A nontrivial factor of the odd composite n by Brent's variant of
+// Pollard's rho with x -> x^2 + c, multiplying 128 differences between
+// gcds. 0 when this c failed.
+inline uint64_t PrimeRho64(uint64_t n, uint64_t c) {
+    PrimeMont64 m(n);
+    c = m.To(c);
+    uint64_t y = m.To(2), x = y, q = m.one, ys = y, g = 1;
+    const uint64_t batch = 128;
+    for (uint64_t r = 1; g == 1 && r < (1ULL << 40); r <<= 1) {
+        x = y;
+        for (uint64_t i = 0; i < r; i++) y = m.Add(m.Mul(y, y), c);
+        for (uint64_t k = 0; k < r && g == 1; k += batch) {
+            ys = y;
+            for (uint64_t i = 0; i < batch && i < r - k; i++) {
+                y = m.Add(m.Mul(y, y), c);
+                q = m.Mul(q, x > y ? x - y : y - x);
+            }
+            g = PrimeGcd64(q, n);
+        }
+    }
+    if (g == n) {
+        // The batch overshot: step through it one difference at a time
+        do {
+            ys = m.Add(m.Mul(ys, ys), c);
+            g = PrimeGcd64(x > ys ? x - ys : ys - x, n);
+        } while (g == 1);
+    }
+    return g == n ? 0 : g;
+}
+
+// Prime factors of n in no particular order, with repeats
+inline void PrimeFactor64(uint64_t n, std::vector<uint64_t>* out) {
+    static const uint32_t small[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47};
+    for (size_t i = 0; i < sizeof(small) / sizeof(small[0]) && n > 1; i++) {
+        while (n % small[i] == 0) {
+            out->push_back(small[i]);
+            n /= small[i];
+        }
+    }
+    std::vector<uint64_t> pending;
+    if (n > 1) pending.push_back(n);
+    while (!pending.empty()) {
+        uint64_t v = pending.back();
+        pending.pop_back();
+        if (PrimeIsPrime64(v)) {
+            out->push_back(v);
+            continue;
+        }
+        uint64_t d = 0;
+        for (uint64_t c = 1; !d; c++) d = PrimeRho64(v, c);
+        pending.push_back(d);
+        pending.push_back(v / d);
+    }
+}
+
+// --- Multi-limb Montgomery arithmetic ---
+
+// Residues modulo an odd n > 1 as k little-endian 32-bit limbs in
+// Montgomery form (x R mod n, R = 2^32k). Mul and the rest take raw
+// pointers and a caller's scratch, so the inner loops never allocate and a
+// PrimeMont can be shared read-only between threads.
+struct PrimeMont {
+    int k;
+    uint32_t ninv;                 // -1/n mod 2^32
+    std::vector<uint32_t> n;
+    std::vector<uint32_t> one;     // R mod n
+    std::vector<uint32_t> r2;      // R^2 mod n
+    BigInt modulus;
+
+    PrimeMont() : k(0), ninv(0) {}
+
+    explicit PrimeMont(const BigInt& m) {
+        modulus = BigAbs(m);
+        k = (int)modulus.mag.size();
+        n.assign(modulus.mag.begin(), modulus.mag.end());
+        uint32_t inv = n[0];
+        for (int i = 0; i < 4; i++) inv *= 2 - n[0] * inv;
+        ninv = 0 - inv;
+        BigInt r = BigShiftLeft(BigInt(1), 32 * k) % modulus;
+        Limbs(r, &one);
+        Limbs(BigShiftLeft(BigInt(1), 64 * k) % modulus, &r2);
+    }
+
+    void Limbs(const BigInt& a, std::vector<uint32_t>* out) const {
+        out->assign((size_t)k, 0);
+        for (size_t i = 0; i < a.mag.size() && i < (size_t)k; i++) (*out)[i] = a.mag[i];
+    }
+
+    // out = a b / R mod n. t needs k + 2 limbs; out may alias a or b.
+    void Mul(const uint32_t* a, const uint32_t* b, uint32_t* out, uint32_t* t) const {
+        for (int i = 0; i < k + 2; i++) t[i] = 0;
+        for (int i = 0; i < k; i++) {
+            uint64_t c = 0, bi = b[i];
+            for (int j = 0; j < k; j++) {
+                c += (uint64_t)t[j] + (uint64_t)a[j] * bi;
+                t[j] = (uint32_t)c;
+                c >>= 32;
+            }
+            c += t[k];
+            t[k] = (uint32_t)c;
+            t[k + 1] = (uint32_t)(c >> 32);
+
+            uint64_t m = (uint32_t)(t[0] * ninv);
+            c = ((uint64_t)t[0] + m * n[0]) >> 32;
+            for (int j = 1; j < k; j++) {
+                c += (uint64_t)t[j] + m * n[j];
+                t[j - 1] = (uint32_t)c;
+                c >>= 32;
+            }
+            c += t[k];
+            t[k - 1] = (uint32_t)c;
+            t[k] = t[k + 1] + (uint32_t)(c >> 32);
+        }
+        if (t[k] || !Below(t)) SubN(t);
+        for (int i = 0; i < k; i++) out[i] = t[i];
+    }
+
+    bool Below(const uint32_t* a) const {
+        for (int i = k; i-- > 0;) {
+            if (a[i] != n[(size_t)i]) return a[i] < n[(size_t)i];
+        }
+        return false;
+    }
+
+    void SubN(uint32_t* a) const {
+        int64_t borrow = 0;
+        for (int i = 0; i < k; i++) {
+            int64_t d = (int64_t)a[i] - n[(size_t)i] - borrow;
+            borrow = d < 0;
+            a[i] = (uint32_t)d;
+        }
+    }
+
+    void Add(const uint32_t* a, const uint32_t* b, uint32_t* out) const {
+        uint64_t c = 0;
+        for (int i = 0; i < k; i++) {
+            c += (uint64_t)a[i] + b[i];
+            out[i] = (uint32_t)c;
+            c >>= 32;
+        }
+        if (c || !Below(out)) SubN(out);
+    }
+
+    void Sub(const uint32_t* a, const uint32_t* b, uint32_t* out) const {
+        int64_t borrow = 0;
+        for (int i = 0; i < k; i++) {
+            int64_t d = (int64_t)a[i] - b[i] - borrow;
+            borrow = d < 0;
+            out[i] = (uint32_t)d;
+        }
+        if (borrow) {
+            uint64_t c = 0;
+            for (int i = 0; i < k; i++) {
+                c += (uint64_t)out[i] + n[(size_t)i];
+                out[i] = (uint32_t)c;
+                c >>= 32;
+            }
+        }
+    }
+
+    // a / 2 mod n
+    void Half(const uint32_t* a, uint32_t* out) const {
+        uint64_t c = 0;
+        bool odd = a[0] & 1;
+        for (int i = 0; i < k; i++) {
+            c += (uint64_t)a[i] + (odd ? n[(size_t)i] : 0);
+            out[i] = (uint32_t)c;
+            c >>= 32;
+        }
+        for (int i = 0; i < k; i++) out[i] = (out[i] >> 1) | (i + 1 < k ? out[i + 1] << 31 : (uint32_t)c << 31);
+    }
+
+    bool IsZero(const uint32_t* a) const {
+        for (int i = 0; i < k; i++) {
+            if (a[i]) return false;
+        }
+        return true;
+    }
+
+    bool Equal(const uint32_t* a, const uint32_t* b) const {
+        for (int i = 0; i < k; i++) {
+            if (a[i] != b[i]) return false;
+        }
+        return true;
+    }
+
+    // a mod n (a may be negative) into Montgomery form
+    void To(const BigInt& a, uint32_t* out) const {
+        BigInt r = a % modulus;
+        if (r.neg) r = r + modulus;
+        std::vector<uint32_t> limbs, t((size_t)k + 2);
+        Limbs(r, &limbs);
+        Mul(&limbs[0], &r2[0], out, &t[0]);
+    }
+
+    BigInt From(const uint32_t* a) const {
+        std::vector<uint32_t> unit((size_t)k, 0), out((size_t)k), t((size_t)k + 2);
+        unit[0] = 1;
+        Mul(a, &unit[0], &out[0], &t[0]);
+        BigInt r;
+        r.mag.assign(out.begin(), out.end());
+        r.Trim();
+        return r;
+    }
+
+    // out = base^e with a 4-bit fixed window. False when cancelled.
+    bool Pow(const uint32_t* base, const BigInt& e, uint32_t* out, const std::atomic<bool>* cancel = NULL) const {
+        size_t K = (size_t)k;
+        std::vector<uint32_t> table(16 * K), t(K + 2);
+        for (size_t i = 0; i < K; i++) {
+            table[i] = one[i];
+            table[K + i] = base[i];
+        }
+        for (size_t w = 2; w < 16; w++) Mul(&table[(w - 1) * K], base, &table[w * K], &t[0]);
+        for (size_t i = 0; i < K; i++) out[i] = one[i];
+        int bits = e.BitLength();
+        for (int top = (bits + 3) / 4 * 4 - 4; top >= 0; top -= 4) {
+            if (cancel && (top & 255) == 0 && cancel->load(std::memory_order_relaxed)) return false;
+            for (int s = 0; s < 4; s++) Mul(out, out, out, &t[0]);
+            int w = (int)e.TestBit(top) | (int)e.TestBit(top + 1) << 1 | (int)e.TestBit(top + 2) << 2 | (int)e.TestBit(top + 3) << 3;
+            if (w) Mul(out, &table[(size_t)w * K], out, &t[0]);
+        }
+        return true;
+    }
+};
+
+// --- Modular arithmetic on BigInt ---
+
+// Least non-negative residue
+inline BigInt BigMod(const BigInt& a, const BigInt& m) {
+    BigInt r = a % m;
+    if (r.neg) r = r + BigAbs(m);
+    return r;
+}
+
+// Non-negative least common multiple; 0 when either is 0
+inline BigInt BigLcm(const BigInt& a, const BigInt& b) {
+    if (a.IsZero() || b.IsZero()) return BigInt();
+    return BigAbs(a / BigGcd(a, b) * b);
+}
+
+// 1/a mod m by the extended Euclidean algorithm. False when gcd(a, m) is
+// not 1; *gcd gets it either way.
+inline bool BigModInverse(const BigInt& a, const BigInt& m, BigInt* inverse, BigInt* gcd = NULL) {
+    BigInt r0 = BigAbs(m), r1 = BigMod(a, m), s0(0), s1(1);
+    while (!r1.IsZero()) {
+        BigInt q, r;
+        BigDivMod(r0, r1, &q, &r);
+        BigInt s = s0 - q * s1;
+        r0.mag.swap(r1.mag);
+        r1 = r;
+        s0 = s1;
+        s1 = s;
+    }
+    if (gcd) *gcd = r0;
+    if (r0 != BigInt(1)) return false;
+    *inverse = BigMod(s0, m);
+    return true;
+}
+
+// base^e mod m for m != 0. A negative exponent needs base invertible.
+// Odd moduli go through Montgomery form; even ones by square and multiply
+// with long division. False when m is 0, base is not invertible for a
+// negative e, or cancelled.
+inline bool BigPowMod(const BigInt& base, const BigInt& e, const BigInt& m, BigInt* out,
+                      const std::atomic<bool>* cancel = NULL) {
+    if (m.IsZero()) return false;
+    BigInt mod = BigAbs(m), b = BigMod(base, mod), exp = BigAbs(e);
+    if (e.neg && !BigModInverse(b, mod, &b)) return false;
+    if (mod == BigInt(1)) {
+        *out = BigInt();
+        return true;
+    }
+    if (mod.IsOdd()) {
+        PrimeMont mont(mod);
+        std::vector<uint32_t> x((size_t)mont.k), r((size_t)mont.k);
+        mont.To(b, &x[0]);
+        if (!mont.Pow(&x[0], exp, &r[0], cancel)) return false;
+        *out = mont.From(&r[0]);
+        return true;
+    }
+    BigInt r(1);
+    for (int i = exp.BitLength(); i-- > 0;) {
+        if (cancel && (i & 255) == 0 && cancel->load(std::memory_order_relaxed)) return false;
+        r = r * r % mod;
+        if (exp.TestBit(i)) r = r * b % mod;
+    }
+    *out = r;
+    return true;
+}
+
+// floor(a^(1/k)) for a >= 0 by Newton's method from above
+inline BigInt BigRoot(const BigInt& a, int k) {
+    if (a.IsZero() || k == 1) return a;
+    BigInt x = BigShiftLeft(BigInt(1), (a.BitLength() + k - 1) / k), kk(k), km1(k - 1);
+    for (;;) {
+        BigInt p(1);
+        for (int i = 1; i < k; i++) p = p * x;
+        BigInt y = (km1 * x + a / p) / kk;
+        if (y >= x) return x;
+        x = y;
+    }
+}
+
+// --- Baillie-PSW ---
+
+// Jacobi symbol (a / n) for odd n > 0 and a small
+inline int PrimeJacobi(long long a, const BigInt& n) {
+    int result = 1;
+    uint32_t n8 = PrimeModSmall(n, 8);
+    if (a < 0) {
+        a = -a;
+        if (n8 % 4 == 3) result = -result;
+    }
+    while (a % 2 == 0) {
+        a /= 2;
+        if (n8 == 3 || n8 == 5) result = -result;
+    }
+    if (a == 1) return result;
+    // Reciprocity brings it down to word size
+    uint64_t x = PrimeModSmall(n, (uint32_t)a), y = (uint64_t)a;
+    if (a % 4 == 3 && n8 % 4 == 3) result = -result;
+    while (x) {
+        while (x % 2 == 0) {
+            x /= 2;
+            if (y % 8 == 3 || y % 8 == 5) result = -result;
+        }
+        std::swap(x, y);
+        if (x % 4 == 3 && y % 4 == 3) result = -result;
+        x %= y;
+    }
+    return y == 1 ? result : 0;
+}
+
+// Strong Lucas probable prime test with Selfridge's parameters: D is the
+// first of 5, -7, 9, -11, ... with (D / n) = -1, P = 1, Q = (1 - D) / 4.
+// n must be odd, above 64 bits and not a perfect square.
+inline bool PrimeStrongLucas(const PrimeMont& m, const std::atomic<bool>* cancel) {
+    const BigInt& n = m.modulus;
+    long long D = 5;
+    for (;;) {
+        int j = PrimeJacobi(D, n);
+        if (j == 0) return false;
+        if (j < 0) break;
+        D = D > 0 ? -(D + 2) : -D + 2;
+    }
+    long long Q = (1 - D) / 4;
+
+    BigInt d = n + BigInt(1);
+    int s = 0;
+    while (d.IsEven()) {
+        d = BigShiftRight(d, 1);
+        s++;
+    }
+    size_t K = (size_t)m.k;
+    std::vector<uint32_t> U(m.one), V(m.one), Qk(K), Qm(K), Dm(K), t(K + 2), a(K), b(K), twoQ(K);
+    m.To(BigInt(Q), &Qm[0]);
+    m.To(BigInt(D), &Dm[0]);
+    Qk = Qm;
+    for (int i = d.BitLength() - 1; i-- > 0;) {
+        if (cancel && (i & 255) == 0 && cancel->load(std::memory_order_relaxed)) return false;
+        // U_2k = U_k V_k, V_2k = V_k^2 - 2 Q^k
+        m.Mul(&U[0], &V[0], &U[0], &t[0]);
+        m.Add(&Qk[0], &Qk[0], &twoQ[0]);
+        m.Mul(&V[0], &V[0], &V[0], &t[0]);
+        m.Sub(&V[0], &twoQ[0], &V[0]);
+        m.Mul(&Qk[0], &Qk[0], &Qk[0], &t[0]);
+        if (d.TestBit(i)) {
+            // U_k+1 = (U_k + V_k) / 2, V_k+1 = (D U_k + V_k) / 2
+            m.Add(&U[0], &V[0], &a[0]);
+            m.Mul(&Dm[0], &U[0], &b[0], &t[0]);
+            m.Add(&b[0], &V[0], &b[0]);
+            m.Half(&a[0], &U[0]);
+            m.Half(&b[0], &V[0]);
+            m.Mul(&Qk[0], &Qm[0], &Qk[0], &t[0]);
+        }
+    }
+    if (m.IsZero(&U[0]) || m.IsZero(&V[0])) return true;
+    for (int r = 1; r < s; r++) {
+        m.Add(&Qk[0], &Qk[0], &twoQ[0]);
+        m.Mul(&V[0], &V[0], &V[0], &t[0]);
+        m.Sub(&V[0], &twoQ[0], &V[0]);
+        if (m.IsZero(&V[0])) return true;
+        m.Mul(&Qk[0], &Qk[0], &Qk[0], &t[0]);
+    }
+    return false;
+}
+
+// Strong probable prime test to base 2
+inline bool PrimeStrongBase2(const PrimeMont& m, const std::atomic<bool>* cancel) {
+    const BigInt& n = m.modulus;
+    BigInt d = n - BigInt(1);
+    int s = 0;
+    while (d.IsEven()) {
+        d = BigShiftRight(d, 1);
+        s++;
+    }
+    size_t K = (size_t)m.k;
+    std::vector<uint32_t> two(K), x(K), minusOne(K), zero(K, 0), t(K + 2);
+    m.Add(&m.one[0], &m.one[0], &two[0]);
+    m.Sub(&zero[0], &m.one[0], &minusOne[0]);
+    if (!m.Pow(&two[0], d, &x[0], cancel)) return false;
+    if (m.Equal(&x[0], &m.one[0]) || m.Equal(&x[0], &minusOne[0])) return true;
+    for (int r = 1; r < s; r++) {
+        m.Mul(&x[0], &x[0], &x[0], &t[0]);
+        if (m.Equal(&x[0], &minusOne[0])) return true;
+        if (m.Equal(&x[0], &m.one[0])) return false;
+    }
+    return false;
+}
+
+// Prime test for any |n|: exact below 2^64, Baillie-PSW above. A cancelled
+// test returns false.
+inline bool PrimeIsProbablePrime(const BigInt& value, const std::atomic<bool>* cancel = NULL) {
+    BigInt n = BigAbs(value);
+    if (n.mag.size() <= 2) return PrimeIsPrime64(n.ToUint64Mag());
+    if (n.IsEven()) return false;
+    const std::vector<uint32_t>& small = PrimeSmall();
+    for (size_t i = 1; i < small.size() && small[i] < 2000; i++) {
+        if (PrimeModSmall(n, small[i]) == 0) return false;
+    }
+    PrimeMont m(n);
+    if (!PrimeStrongBase2(m, cancel)) return false;
+    BigInt root = BigRoot(n, 2);
+    if (root * root == n) return false;
+    return PrimeStrongLucas(m, cancel);
+}
+
+// The first probable prime >= n
+inline BigInt PrimeNext(const BigInt& n) {
+    BigInt p = n < BigInt(2) ? BigInt(2) : n;
+    if (p == BigInt(2)) return p;
+    if (p.IsEven()) p = p + BigInt(1);
+    while (!PrimeIsProbablePrime(p)) p = p + BigInt(2);
+    return p;
+}
+
+// --- Elliptic curves ---
+
+// Stage 1 bounds and how many curves to try at each, roughly what finds
+// a factor of 15, 20, 25, 30, 35 and 40 digits. Stage 2 runs to 50 B1.
+struct PrimeEcmLevel {
+    uint32_t b1;
+    int curves;
+};
+
+inline const PrimeEcmLevel* PrimeEcmLevels(int* count) {
+    static const PrimeEcmLevel levels[] = {
+        {2000, 30}, {11000, 110}, {50000, 350}, {250000, 800}, {1000000, 2000}, {3000000, 6000}};
+    *count = (int)(sizeof(levels) / sizeof(levels[0]));
+    return levels;
+}
+
+#define PRIME_ECM_B2_FACTOR 50
+#define PRIME_ECM_D         210  // Stage 2 giant step
+
+// A point (X : Z) on a Montgomery curve By^2 = x^3 + Ax^2 + x; only x
+// matters, so y is never kept
+struct PrimeEcmPoint {
+    std::vector<uint32_t> x, z;
+};
+
+// Scratch and curve constant for one thread's curves
+struct PrimeEcmCurve {
+    const PrimeMont* m;
+    std::vector<uint32_t> a24;  // (A + 2) / 4
+    std::vector<uint32_t> t, u, v, w, s;
+
+    explicit PrimeEcmCurve(const PrimeMont* mont) : m(mont) {
+        size_t K = (size_t)m->k;
+        a24.resize(K);
+        t.resize(K + 2);
+        u.resize(K);
+        v.resize(K);
+        w.resize(K);
+        s.resize(K);
+    }
+
+    void Init(PrimeEcmPoint* p) const {
+        p->x.assign((size_t)m->k, 0);
+        p->z.assign((size_t)m->k, 0);
+    }
+
+    // r = 2p
+    void Double(const PrimeEcmPoint& p, PrimeEcmPoint* r) {
+        uint32_t* T = &t[0];
+        m->Add(&p.x[0], &p.z[0], &u[0]);
+        m->Mul(&u[0], &u[0], &u[0], T);        // (x + z)^2
+        m->Sub(&p.x[0], &p.z[0], &v[0]);
+        m->Mul(&v[0], &v[0], &v[0], T);        // (x - z)^2
+        m->Sub(&u[0], &v[0], &w[0]);           // 4xz
+        m->Mul(&u[0], &v[0], &r->x[0], T);
+        m->Mul(&a24[0], &w[0], &s[0], T);
+        m->Add(&s[0], &v[0], &s[0]);
+        m->Mul(&w[0], &s[0], &r->z[0], T);
+    }
+
+    // r = p + q, given diff = p - q; r may alias p or q but not diff
+    void Add(const PrimeEcmPoint& p, const PrimeEcmPoint& q, const PrimeEcmPoint& diff, PrimeEcmPoint* r) {
+        uint32_t* T = &t[0];
+        m->Sub(&p.x[0], &p.z[0], &u[0]);
+        m->Add(&q.x[0], &q.z[0], &v[0]);
+        m->Mul(&u[0], &v[0], &u[0], T);
+        m->Add(&p.x[0], &p.z[0], &v[0]);
+        m->Sub(&q.x[0], &q.z[0], &w[0]);
+        m->Mul(&v[0], &w[0], &v[0], T);
+        m->Add(&u[0], &v[0], &w[0]);
+        m->Sub(&u[0], &v[0], &s[0]);
+        m->Mul(&w[0], &w[0], &w[0], T);
+        m->Mul(&s[0], &s[0], &s[0], T);
+        m->Mul(&diff.z[0], &w[0], &r->x[0], T);
+        m->Mul(&diff.x[0], &s[0], &r->z[0], T);
+    }
+
+    // p = e p by the Montgomery ladder
+    void Multiply(PrimeEcmPoint* p, uint64_t e, PrimeEcmPoint* r0, PrimeEcmPoint* r1) {
+        if (e < 2) return;
+        int bits = 0;
+        while ((e >> bits) > 1) bits++;
+        *r0 = *p;
+        Double(*p, r1);
+        for (int i = bits; i-- > 0;) {
+            if ((e >> i) & 1) {
+                Add(*r0, *r1, *p, r0);
+                Double(*r1, r1);
+            } else {
+                Add(*r1, *r0, *p, r1);
+                Double(*r0, r0);
+            }
+        }
+        std::swap(*p, *r0);
+    }
+};
+
+// A curve from Suyama's parametrization with parameter sigma, and a point
+// on it. Returns a factor of n when the setup itself stumbles on one
+// (a non-invertible denominator), else 1.
+inline BigInt PrimeEcmSetup(PrimeEcmCurve* c, uint32_t sigma, PrimeEcmPoint* p) {
+    const PrimeMont& m = *c->m;
+    const BigInt& n = m.modulus;
+    BigInt sg(sigma);
+    BigInt u = BigMod(sg * sg - BigInt(5), n), v = BigMod(BigInt(4) * sg, n);
+    BigInt u3 = u * u % n * u % n, v3 = v * v % n * v % n;
+    // A + 2 / 4 = (v - u)^3 (3u + v) / (16 u^3 v)
+    BigInt vu = BigMod(v - u, n);
+    BigInt num = vu * vu % n * vu % n * BigMod(BigInt(3) * u + v, n) % n;
+    BigInt den = BigInt(16) * u3 % n * v % n, inv, g;
+    if (!BigModInverse(den, n, &inv, &g)) return g.IsZero() ? n : g;
+    c->Init(p);
+    m.To(num * inv % n, &c->a24[0]);
+    m.To(u3, &p->x[0]);
+    m.To(v3, &p->z[0]);
+    return BigInt(1);
+}
+
+// gcd(x, n) for x in Montgomery form; x R and x share their gcd with n
+inline BigInt PrimeEcmGcd(const PrimeMont& m, const std::vector<uint32_t>& x) {
+    BigInt v;
+    v.mag.assign(x.begin(), x.end());
+    v.Trim();
+    return BigGcd(v, m.modulus);
+}
+
+// Runs one curve through stage 1 (multiply by every prime power up to b1)
+// and stage 2 (one prime q in (b1, b2] at a time, by baby and giant
+// steps). Returns a factor of n, n itself when the curve was unlucky
+// enough to find all of it, or 1.
+inline BigInt PrimeEcmCurveRun(PrimeEcmCurve* c, uint32_t sigma, uint32_t b1, const std::vector<uint32_t>& primes,
+                               const std::vector<bool>& isPrime, const std::atomic<bool>* cancel) {
+    const PrimeMont& m = *c->m;
+    PrimeEcmPoint p, r0, r1;
+    BigInt g = PrimeEcmSetup(c, sigma, &p);
+    if (g != BigInt(1)) return g;
+    c->Init(&r0);
+    c->Init(&r1);
+    for (size_t i = 0; i < primes.size() && primes[i] <= b1; i++) {
+        if ((i & 255) == 0 && cancel && cancel->load(std::memory_order_relaxed)) return BigInt(1);
+        uint64_t q = primes[i];
+        while (q * primes[i] <= b1) q *= primes[i];
+        c->Multiply(&p, q, &r0, &r1);
+    }
+    g = PrimeEcmGcd(m, p.z);
+    if (g != BigInt(1)) return g;
+
+    // Stage 2: q = kD +- j with j coprime to D takes one product term
+    // X(kD P) Z(j P) - X(j P) Z(kD P) that vanishes mod a factor when q P
+    // does
+    const uint32_t D = PRIME_ECM_D;
+    uint64_t b2 = (uint64_t)b1 * PRIME_ECM_B2_FACTOR;
+    std::vector<PrimeEcmPoint> baby(D / 2 + 1);
+    std::vector<bool> coprime(D / 2 + 1, false);
+    PrimeEcmPoint twoP, prev, cur, next;
+    c->Init(&twoP);
+    c->Double(p, &twoP);
+    prev = p;  // jP for odd j, stepping by 2P with difference (j - 2)P
+    cur = p;
+    c->Init(&next);
+    c->Add(p, twoP, p, &cur);  // 3P
+    baby[1] = p;
+    for (uint32_t j = 3; j < D / 2; j += 2) {
+        baby[j] = cur;
+        c->Add(cur, twoP, prev, &next);
+        prev = cur;
+        cur = next;
+    }
+    for (uint32_t j = 1; j < D / 2; j += 2) coprime[j] = PrimeGcd64(j, D) == 1;
+
+    // Giant steps (k + 1) D P = k D P + D P, with (k - 1) D P as the
+    // difference; the first two come from the ladder
+    uint64_t k = std::max<uint64_t>(1, b1 / D);
+    PrimeEcmPoint step = p, gCur = p, gNext = p, gNew;
+    c->Init(&gNew);
+    c->Multiply(&step, D, &r0, &r1);
+    c->Multiply(&gCur, k * D, &r0, &r1);
+    c->Multiply(&gNext, (k + 1) * D, &r0, &r1);
+
+    std::vector<uint32_t> acc(m.one), a((size_t)m.k), b((size_t)m.k);
+    for (; k * D <= b2 + D; k++) {
+        if ((k & 63) == 0 && cancel && cancel->load(std::memory_order_relaxed)) return BigInt(1);
+        uint64_t base = k * D;
+        for (uint32_t j = 1; j < D / 2; j += 2) {
+            if (!coprime[j]) continue;
+            uint64_t lo = base - j, hi = base + j;
+            bool want = (lo > b1 && lo <= b2 && isPrime[(size_t)lo]) || (hi > b1 && hi <= b2 && isPrime[(size_t)hi]);
+            if (!want) continue;
+            m.Mul(&gCur.x[0], &baby[j].z[0], &a[0], &c->t[0]);
+            m.Mul(&baby[j].x[0], &gCur.z[0], &b[0], &c->t[0]);
+            m.Sub(&a[0], &b[0], &a[0]);
+            m.Mul(&acc[0], &a[0], &acc[0], &c->t[0]);
+        }
+        c->Add(gNext, step, gCur, &gNew);
+        std::swap(gCur, gNext);
+        std::swap(gNext, gNew);
+    }
+    return PrimeEcmGcd(m, acc);
+}
+
+// --- Factoring ---
+
+struct PrimeFactorJob {
+    BigInt n;
+
+    std::atomic<bool> cancel;
+    std::atomic<int> stage;             // PRIME_STAGE_*
+    std::atomic<int> bits;              // Size of the composite being split
+    std::atomic<uint32_t> b1;           // ECM stage 1 bound in use
+    std::atomic<long long> curves;      // ECM curves finished, all numbers
+    std::vector<BigInt> factors;        // Prime factors, ascending, repeated
+    std::vector<BigInt> unfactored;     // Composite parts left by a cancel
+
+    PrimeFactorJob() : cancel(false), stage(PRIME_STAGE_DONE), bits(0), b1(0), curves(0) {}
+};
+
+// Brent's rho on a big composite for at most `steps` steps; stops early
+// once *found is set by another thread. Returns a factor, or 1.
+inline BigInt PrimeRhoBig(const PrimeMont& m, uint32_t c0, long long steps, const std::atomic<bool>* found,
+                          const std::atomic<bool>* cancel) {
+    size_t K = (size_t)m.k;
+    std::vector<uint32_t> c(K), x(K), y(K), ys(K), q(m.one), d(K), t(K + 2);
+    m.To(BigInt((long long)c0), &c[0]);
+    m.To(BigInt(2), &y[0]);
+    const long long batch = 128;
+    long long done = 0;
+    for (long long r = 1; done < steps; r <<= 1) {
+        x = y;
+        for (long long i = 0; i < r; i++) {
+            m.Mul(&y[0], &y[0], &y[0], &t[0]);
+            m.Add(&y[0], &c[0], &y[0]);
+        }
+        for (long long k = 0; k < r && done < steps; k += batch) {
+            if (found->load(std::memory_order_relaxed) || cancel->load(std::memory_order_relaxed)) return BigInt(1);
+            ys = y;
+            for (long long i = 0; i < batch && i < r - k; i++) {
+                m.Mul(&y[0], &y[0], &y[0], &t[0]);
+                m.Add(&y[0], &c[0], &y[0]);
+                m.Sub(&x[0], &y[0], &d[0]);
+                m.Mul(&q[0], &d[0], &q[0], &t[0]);
+            }
+            done += batch;
+            BigInt g = PrimeEcmGcd(m, q);
+            if (g == BigInt(1)) continue;
+            if (g != m.modulus) return g;
+            // The batch overshot: step through it one difference at a time
+            for (long long i = 0; i < batch; i++) {
+                m.Mul(&ys[0], &ys[0], &ys[0], &t[0]);
+                m.Add(&ys[0], &c[0], &ys[0]);
+                m.Sub(&x[0], &ys[0], &d[0]);
+                g = PrimeEcmGcd(m, d);
+                if (g != BigInt(1)) return g == m.modulus ? BigInt(1) : g;
+            }
+            return BigInt(1);
+        }
+    }
+    return BigInt(1);
+}
+
+// A nontrivial factor of the composite n (not a perfect power): rho
+// sequences on every thread, then ECM curves shared out one at a time
+// through the levels, staying at the last one until cancelled. Returns 1
+// when cancelled.
+inline BigInt PrimeFindFactor(PrimeFactorJob* job, const BigInt& n, int threads) {
+    PrimeMont m(n);
+    std::atomic<bool> found(false);
+    std::vector<BigInt> results((size_t)threads, BigInt(1));
+    std::vector<std::thread> pool;
+    auto pick = [&]() {
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i] != BigInt(1) && results[i] != n) return results[i];
+        }
+        return BigInt(1);
+    };
+
+    job->stage = PRIME_STAGE_RHO;
+    auto rho = [&](int self) {
+        BigInt g = PrimeRhoBig(m, (uint32_t)self + 1, PRIME_RHO_STEPS, &found, &job->cancel);
+        if (g != BigInt(1)) {
+            results[(size_t)self] = g;
+            found = true;
+        }
+    };
+    for (int t = 1; t < threads; t++) pool.push_back(std::thread(rho, t));
+    rho(0);
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    pool.clear();
+    BigInt d = pick();
+    if (d != BigInt(1) || job->cancel) return d;
+
+    job->stage = PRIME_STAGE_ECM;
+    int levelCount;
+    const PrimeEcmLevel* levels = PrimeEcmLevels(&levelCount);
+    uint32_t sigma = 6;
+    for (int level = 0; !job->cancel; level = std::min(level + 1, levelCount - 1)) {
+        uint32_t b1 = levels[level].b1;
+        uint64_t b2 = (uint64_t)b1 * PRIME_ECM_B2_FACTOR;
+        std::vector<uint32_t> primes = PrimeList(b1 + 1);
+        std::vector<bool> isPrime((size_t)b2 + 1, true);
+        isPrime[0] = isPrime[1] = false;
+        for (uint64_t i = 2; i * i <= b2; i++) {
+            if (!isPrime[(size_t)i]) continue;
+            for (uint64_t j = i * i; j <= b2; j += i) isPrime[(size_t)j] = false;
+        }
+        job->b1 = b1;
+        std::atomic<int> next(0);
+        int curves = levels[level].curves;
+        uint32_t firstSigma = sigma;
+        auto ecm = [&](int self) {
+            PrimeEcmCurve curve(&m);
+            for (;;) {
+                int i = next.fetch_add(1);
+                if (i >= curves || found.load() || job->cancel.load(std::memory_order_relaxed)) return;
+                BigInt g = PrimeEcmCurveRun(&curve, firstSigma + (uint32_t)i, b1, primes, isPrime, &job->cancel);
+                if (job->cancel.load(std::memory_order_relaxed)) return;
+                job->curves.fetch_add(1, std::memory_order_relaxed);
+                if (g != BigInt(1) && g != n) {
+                    results[(size_t)self] = g;
+                    found = true;
+                }
+            }
+        };
+        for (int t = 1; t < threads; t++) pool.push_back(std::thread(ecm, t));
+        ecm(0);
+        for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+        pool.clear();
+        sigma += (uint32_t)curves;
+        d = pick();
+        if (d != BigInt(1)) return d;
+    }
+    return BigInt(1);
+}
+
+// Splits job->n into primes on `threads` threads. Small factors come out
+// by trial division, words by PrimeFactor64, and the rest by
+// PrimeFindFactor until every part is prime or the job is cancelled.
+inline void PrimeFactor(PrimeFactorJob* job, int threads) {
+    if (threads < 1) threads = 1;
+    job->factors.clear();
+    job->unfactored.clear();
+    job->curves = 0;
+    job->stage = PRIME_STAGE_TRIAL;
+    BigInt n = BigAbs(job->n);
+    job->bits = n.BitLength();
+
+    if (n.mag.size() > 2) {
+        const std::vector<uint32_t>& small = PrimeSmall();
+        for (size_t i = 0; i < small.size() && n.mag.size() > 2; i++) {
+            while (PrimeModSmall(n, small[i]) == 0) {
+                BigDivSmall(n, small[i]);
+                job->factors.push_back(BigInt((long long)small[i]));
+            }
+        }
+    }
+
+    std::vector<BigInt> pending;
+    if (n > BigInt(1)) pending.push_back(n);
+    while (!pending.empty()) {
+        BigInt v = pending.back();
+        pending.pop_back();
+        if (v.mag.size() <= 2) {
+            std::vector<uint64_t> words;
+            PrimeFactor64(v.ToUint64Mag(), &words);
+            for (size_t i = 0; i < words.size(); i++) job->factors.push_back(BigInt::FromUint64(words[i]));
+            continue;
+        }
+        if (job->cancel) {
+            job->unfactored.push_back(v);
+            continue;
+        }
+        job->bits = v.BitLength();
+        if (PrimeIsProbablePrime(v, &job->cancel)) {
+            job->factors.push_back(v);
+            continue;
+        }
+        if (job->cancel) {
+            job->unfactored.push_back(v);
+            continue;
+        }
+        // Rho and ECM are slow on prime powers; every prime below the trial
+        // bound is gone, so an exponent k needs at least 16k bits
+        bool power = false;
+        for (int k = 2; !power && k <= v.BitLength() / 16; k++) {
+            BigInt r = BigRoot(v, k), p(1);
+            for (int i = 0; i < k; i++) p = p * r;
+            if (p != v) continue;
+            for (int i = 0; i < k; i++) pending.push_back(r);
+            power = true;
+        }
+        if (power) continue;
+        BigInt d = PrimeFindFactor(job, v, threads);
+        if (d == BigInt(1)) {
+            job->unfactored.push_back(v);
+            continue;
+        }
+        pending.push_back(d);
+        pending.push_back(v / d);
+    }
+    std::sort(job->factors.begin(), job->factors.end());
+    job->stage = PRIME_STAGE_DONE;
+}
@@ -0,0 +1,790 @@
+// calc_native: the keypad engine and date arithmetic as a CPython module
+// Portable C++ (no Win32). Wraps calc_engine.h, calc_dates.h and calc_tz.h
+// so Python front ends and data jobs use the same core as calc_win7.cpp.
+// Single calls (Engine.press, date_add) hold the GIL; the *_many batch
+// functions copy their input out of Python objects, release the GIL for
+// the whole batch and build the results afterwards, so several Python
+// threads can run batches at once. Build with build_native.py.
+//
+// date_diff and date_add work in whole civil days. datetime_diff and
+// datetime_add are what the date tab computes: naive datetimes are wall
+// clock times in a named zone, so time of day, zone offsets and DST
+// switches count. Zones come from the tz database (TZDIR or
+// /usr/share/zoneinfo); "UTC" and "UTC+hh:mm" always work.
+//
+// Key strings use the keypad tab's keyboard shortcuts:
+//   0-9 . + - * /    digits, point and operators
+//   = or newline     equals
+//   backspace        delete last digit     E   clear entry
+//   C or escape      clear                 N   negate
+//   R                square root           % or P  percent
+//   I                reciprocal            F   fraction (or polar) view
+//   J                imaginary unit        <   polar angle (complex mode)
+// The memory buttons and the complex functions (BTN_ABS, BTN_ARG,
+// BTN_EXP, BTN_LN) have no keys; press them with Engine.press(BTN_MS).
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <datetime.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "calc_engine.h"
+#include "calc_dates.h"
+#include "calc_tz.h"
+
+// --- Keys ---
+
+// Feeds one key character to the engine; false for characters that are
+// not keys
+static bool PressKey(CalcEngine* e, char c) {
+    int id;
+    if (c >= '0' && c <= '9') id = BTN_0 + (c - '0');
+    else {
+        switch (c) {
+            case '.': id = BTN_DOT; break;
+            case '+': id = BTN_ADD; break;
+            case '-': id = BTN_SUB; break;
+            case '*': id = BTN_MUL; break;
+            case '/': id = BTN_DIV; break;
+            case '=': case '\n': case '\r': id = BTN_EQUAL; break;
+            case '\b': id = BTN_BACK; break;
+            case 'E': case 'e': id = BTN_CE; break;
+            case 'C': case 'c': case '\x1b': id = BTN_C; break;
+            case 'N': case 'n': id = BTN_NEG; break;
+            case 'R': case 'r': id = BTN_SQRT; break;
+            case '%': case 'P': case 'p': id = BTN_PERCENT; break;
+            case 'I': case 'i': id = BTN_RECIP; break;
+            case 'J': case 'j': id = BTN_I; break;
+            case '<': id = BTN_ANGLE; break;
+            case 'F': case 'f': e->ToggleFractionView(); return true;
+            case ' ': return true;
+            default: return false;
+        }
+    }
+    e->HandleButton(id);
+    return true;
+}
+
+static void CollectHistory(void* ctx, const char* line) {
+    ((std::vector<std::string>*)ctx)->push_back(line);
+}
+
+static bool CheckMode(int mode) {
+    if (mode >= NUM_DOUBLE && mode <= NUM_COMPLEX) return true;
+    PyErr_SetString(PyExc_ValueError, "mode must be MODE_DOUBLE, MODE_EXACT, MODE_DDOUBLE or MODE_COMPLEX");
+    return false;
+}
+
+// --- Engine type ---
+
+struct PyEngine {
+    PyObject_HEAD
+    CalcEngine* engine;
+    std::vector<std::string>* history;
+};
+
+static int Engine_init(PyEngine* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"mode", NULL};
+    int mode = NUM_DOUBLE;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i", (char**)kwlist, &mode)) return -1;
+    if (!CheckMode(mode)) return -1;
+    if (!self->engine) {
+        self->engine = new (std::nothrow) CalcEngine;
+        self->history = new (std::nothrow) std::vector<std::string>;
+        if (!self->engine || !self->history) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->engine->onHistory = CollectHistory;
+        self->engine->ctx = self->history;
+    }
+    self->engine->Reset();
+    self->engine->SetNumberMode(mode);
+    self->history->clear();
+    return 0;
+}
+
+static void Engine_dealloc(PyEngine* self) {
+    delete self->engine;
+    delete self->history;
+    PyTypeObject* type = Py_TYPE(self);
+    type->tp_free((PyObject*)self);
+    Py_DECREF(type);
+}
+
+static bool EngineReady(PyEngine* self) {
+    if (self->engine) return true;
+    PyErr_SetString(PyExc_RuntimeError, "Engine.__init__ was not called");
+    return false;
+}
+
+static PyObject* Engine_press(PyEngine* self, PyObject* arg) {
+    if (!EngineReady(self)) return NULL;
+    long id = PyLong_AsLong(arg);
+    if (id == -1 && PyErr_Occurred()) return NULL;
+    if (id < BTN_0 || id > BTN_LN || id == BTN_TODAY) {
+        PyErr_Format(PyExc_ValueError, "unknown button %ld", id);
+        return NULL;
+    }
+    self->engine->HandleButton((int)id);
+    return PyUnicode_FromString(self->engine->state.displayText);
+}
+
+static PyObject* Engine_keys(PyEngine* self, PyObject* arg) {
+    if (!EngineReady(self)) return NULL;
+    Py_ssize_t len;
+    const char* text = PyUnicode_AsUTF8AndSize(arg, &len);
+    if (!text) return NULL;
+    for (Py_ssize_t i = 0; i < len; i++) {
+        if (!PressKey(self->engine, text[i])) {
+            PyErr_Format(PyExc_ValueError, "not a key at %zd", i);
+            return NULL;
+        }
+    }
+    return PyUnicode_FromString(self->engine->state.displayText);
+}
+
+static PyObject* Engine_set_mode(PyEngine* self, PyObject* arg) {
+    if (!EngineReady(self)) return NULL;
+    long mode = PyLong_AsLong(arg);
+    if (mode == -1 && PyErr_Occurred()) return NULL;
+    if (!CheckMode((int)mode)) return NULL;
+    self->engine->SetNumberMode((int)mode);
+    return PyUnicode_FromString(self->engine->state.displayText);
+}
+
+static PyObject* Engine_take_history(PyEngine* self, PyObject*) {
+    if (!EngineReady(self)) return NULL;
+    PyObject* list = PyList_New((Py_ssize_t)self->history->size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < self->history->size(); i++) {
+        PyObject* line = PyUnicode_FromString((*self->history)[i].c_str());
+        if (!line) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, line);
+    }
+    self->history->clear();
+    return list;
+}
+
+static PyObject* Engine_get_display(PyEngine* self, void*) {
+    if (!EngineReady(self)) return NULL;
+    return PyUnicode_FromString(self->engine->state.displayText);
+}
+
+static PyObject* Engine_get_mode(PyEngine* self, void*) {
+    if (!EngineReady(self)) return NULL;
+    return PyLong_FromLong(self->engine->state.numMode);
+}
+
+static PyObject* Engine_get_memory(PyEngine* self, void*) {
+    if (!EngineReady(self)) return NULL;
+    const CalcState& state = self->engine->state;
+    if (!state.hasMemory) Py_RETURN_NONE;
+    if (state.numMode == NUM_COMPLEX) return PyComplex_FromDoubles(state.memoryC.re, state.memoryC.im);
+    return PyFloat_FromDouble(self->engine->GetMemoryNumber());
+}
+
+static PyMethodDef Engine_methods[] = {
+    {"press", (PyCFunction)Engine_press, METH_O, "press(button) -> display. Presses one BTN_* button."},
+    {"keys", (PyCFunction)Engine_keys, METH_O, "keys(text) -> display. Types a key string."},
+    {"set_mode", (PyCFunction)Engine_set_mode, METH_O, "set_mode(mode) -> display. Switches the number mode."},
+    {"take_history", (PyCFunction)Engine_take_history, METH_NOARGS, "take_history() -> list of the history lines since the last call."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Engine_getset[] = {
+    {"display", (getter)Engine_get_display, NULL, "Display text", NULL},
+    {"mode", (getter)Engine_get_mode, NULL, "Number mode", NULL},
+    {"memory", (getter)Engine_get_memory, NULL, "Memory value (complex in MODE_COMPLEX), or None when empty", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot Engine_slots[] = {
+    {Py_tp_doc, (void*)"Engine(mode=MODE_DOUBLE): one keypad, as on the calculator tab"},
+    {Py_tp_new, (void*)PyType_GenericNew},
+    {Py_tp_init, (void*)Engine_init},
+    {Py_tp_dealloc, (void*)Engine_dealloc},
+    {Py_tp_methods, Engine_methods},
+    {Py_tp_getset, Engine_getset},
+    {0, NULL}
+};
+
+static PyType_Spec Engine_spec = {
+    "calc_native.Engine", sizeof(PyEngine), 0, Py_TPFLAGS_DEFAULT, Engine_slots
+};
+
+// --- Batches ---
+
+// Copies a sequence of str into strings while the GIL is held
+static bool ReadStrings(PyObject* seq, std::vector<std::string>* out) {
+    PyObject* fast = PySequence_Fast(seq, "expected a sequence of str");
+    if (!fast) return false;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    out->resize((size_t)n);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        Py_ssize_t len;
+        const char* text = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(fast, i), &len);
+        if (!text) {
+            Py_DECREF(fast);
+            return false;
+        }
+        (*out)[(size_t)i].assign(text, (size_t)len);
+    }
+    Py_DECREF(fast);
+    return true;
+}
+
+static PyObject* ListFromStrings(const std::vector<std::string>& lines) {
+    PyObject* list = PyList_New((Py_ssize_t)lines.size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < lines.size(); i++) {
+        PyObject* s = PyUnicode_FromStringAndSize(lines[i].data(), (Py_ssize_t)lines[i].size());
+        if (!s) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, s);
+    }
+    return list;
+}
+
+static PyObject* keys_many(PyObject*, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"sequences", "mode", "history", NULL};
+    PyObject* seq;
+    int mode = NUM_DOUBLE, withHistory = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|ip", (char**)kwlist, &seq, &mode, &withHistory)) return NULL;
+    if (!CheckMode(mode)) return NULL;
+    std::vector<std::string> inputs;
+    if (!ReadStrings(seq, &inputs)) return NULL;
+
+    // Each sequence starts from a cleared keypad; the engine is reused
+    std::vector<std::string> displays(inputs.size());
+    std::vector<std::vector<std::string> > histories(withHistory ? inputs.size() : 0);
+    std::vector<std::string> lines;
+    size_t bad = inputs.size(), badAt = 0;
+    bool oom = false;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        CalcEngine engine;
+        engine.recordHistory = withHistory != 0;
+        engine.onHistory = CollectHistory;
+        engine.ctx = &lines;
+        for (size_t i = 0; i < inputs.size() && bad == inputs.size(); i++) {
+            engine.Reset();
+            engine.SetNumberMode(mode);
+            lines.clear();
+            const std::string& keys = inputs[i];
+            for (size_t k = 0; k < keys.size(); k++) {
+                if (!PressKey(&engine, keys[k])) {
+                    bad = i;
+                    badAt = k;
+                    break;
+                }
+            }
+            displays[i] = engine.state.displayText;
+            if (withHistory) histories[i].swap(lines);
+        }
+    } catch (const std::bad_alloc&) {
+        oom = true;
+    }
+    Py_END_ALLOW_THREADS
+    if (oom) return PyErr_NoMemory();
+    if (bad < inputs.size()) {
+        PyErr_Format(PyExc_ValueError, "sequence %zu: not a key at %zu", bad, badAt);
+        return NULL;
+    }
+
+    if (!withHistory) return ListFromStrings(displays);
+    PyObject* list = PyList_New((Py_ssize_t)inputs.size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        PyObject* h = ListFromStrings(histories[i]);
+        PyObject* item = h ? Py_BuildValue("(s#N)", displays[i].data(), (Py_ssize_t)displays[i].size(), h) : NULL;
+        if (!item) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, item);
+    }
+    return list;
+}
+
+// The display text the keypad would show for each value
+static PyObject* format_many(PyObject*, PyObject* seq) {
+    PyObject* fast = PySequence_Fast(seq, "expected a sequence of numbers");
+    if (!fast) return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    std::vector<double> values((size_t)n);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        values[(size_t)i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, i));
+        if (values[(size_t)i] == -1.0 && PyErr_Occurred()) {
+            Py_DECREF(fast);
+            return NULL;
+        }
+    }
+    Py_DECREF(fast);
+
+    std::vector<std::string> texts((size_t)n);
+    Py_BEGIN_ALLOW_THREADS
+    CalcEngine engine;
+    for (size_t i = 0; i < values.size(); i++) {
+        engine.SetDisplayNumber(values[i]);
+        texts[i] = engine.state.displayText;
+    }
+    Py_END_ALLOW_THREADS
+    return ListFromStrings(texts);
+}
+
+// --- Dates ---
+
+static bool ReadDate(PyObject* obj, CivilDate* d) {
+    if (!PyDate_Check(obj)) {
+        PyErr_SetString(PyExc_TypeError, "expected a datetime.date");
+        return false;
+    }
+    d->year = PyDateTime_GET_YEAR(obj);
+    d->month = PyDateTime_GET_MONTH(obj);
+    d->day = PyDateTime_GET_DAY(obj);
+    return true;
+}
+
+static bool ReadDates(PyObject* seq, std::vector<long long>* days) {
+    PyObject* fast = PySequence_Fast(seq, "expected a sequence of datetime.date");
+    if (!fast) return false;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    days->resize((size_t)n);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        CivilDate d;
+        if (!ReadDate(PySequence_Fast_GET_ITEM(fast, i), &d)) {
+            Py_DECREF(fast);
+            return false;
+        }
+        (*days)[(size_t)i] = DaysFromCivil(d);
+    }
+    Py_DECREF(fast);
+    return true;
+}
+
+static bool CheckUnit(int unit) {
+    if (unit >= DATE_UNIT_DAYS && unit <= DATE_UNIT_YEARS) return true;
+    PyErr_SetString(PyExc_ValueError, "unit must be DAYS, WEEKS, MONTHS or YEARS");
+    return false;
+}
+
+static PyObject* DateFromCivil(const CivilDate& d) {
+    if (d.year < 1 || d.year > 9999) {
+        PyErr_SetString(PyExc_OverflowError, "date out of range");
+        return NULL;
+    }
+    return PyDate_FromDate(d.year, d.month, d.day);
+}
+
+static PyObject* date_diff(PyObject*, PyObject* args) {
+    PyObject *a, *b;
+    CivilDate da, db;
+    if (!PyArg_ParseTuple(args, "OO", &a, &b) || !ReadDate(a, &da) || !ReadDate(b, &db)) return NULL;
+    return PyLong_FromLongLong(DaysFromCivil(db) - DaysFromCivil(da));
+}
+
+static PyObject* date_add(PyObject*, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"date", "value", "unit", "end_of_month", NULL};
+    PyObject* obj;
+    long long value;
+    int unit = DATE_UNIT_DAYS, endOfMonth = 0;
+    CivilDate d;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OL|ip", (char**)kwlist, &obj, &value, &unit, &endOfMonth)) return NULL;
+    if (!ReadDate(obj, &d) || !CheckUnit(unit)) return NULL;
+    if (value > 4000000 || value < -4000000) return DateFromCivil(CivilDate{0, 1, 1});
+    return DateFromCivil(DateAddUnits(d, value, unit, endOfMonth != 0));
+}
+
+// Days from starts[i] to ends[i]
+static PyObject* date_diff_many(PyObject*, PyObject* args) {
+    PyObject *a, *b;
+    std::vector<long long> starts, ends;
+    if (!PyArg_ParseTuple(args, "OO", &a, &b) || !ReadDates(a, &starts) || !ReadDates(b, &ends)) return NULL;
+    if (starts.size() != ends.size()) {
+        PyErr_SetString(PyExc_ValueError, "starts and ends differ in length");
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    for (size_t i = 0; i < ends.size(); i++) ends[i] -= starts[i];
+    Py_END_ALLOW_THREADS
+    PyObject* list = PyList_New((Py_ssize_t)ends.size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < ends.size(); i++) {
+        PyObject* v = PyLong_FromLongLong(ends[i]);
+        if (!v) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, v);
+    }
+    return list;
+}
+
+// dates[i] + value units, for one value or a sequence of them
+static PyObject* date_add_many(PyObject*, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"dates", "value", "unit", "end_of_month", NULL};
+    PyObject *seq, *valueObj;
+    int unit = DATE_UNIT_DAYS, endOfMonth = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|ip", (char**)kwlist, &seq, &valueObj, &unit, &endOfMonth)) return NULL;
+    if (!CheckUnit(unit)) return NULL;
+    std::vector<long long> days;
+    if (!ReadDates(seq, &days)) return NULL;
+
+    std::vector<long long> values;
+    if (PyLong_Check(valueObj)) {
+        long long v = PyLong_AsLongLong(valueObj);
+        if (v == -1 && PyErr_Occurred()) return NULL;
+        values.assign(days.size(), v);
+    } else {
+        PyObject* fast = PySequence_Fast(valueObj, "value must be an int or a sequence of int");
+        if (!fast) return NULL;
+        Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+        if ((size_t)n != days.size()) {
+            Py_DECREF(fast);
+            PyErr_SetString(PyExc_ValueError, "dates and values differ in length");
+            return NULL;
+        }
+        values.resize((size_t)n);
+        for (Py_ssize_t i = 0; i < n; i++) {
+            values[(size_t)i] = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(fast, i));
+            if (values[(size_t)i] == -1 && PyErr_Occurred()) {
+                Py_DECREF(fast);
+                return NULL;
+            }
+        }
+        Py_DECREF(fast);
+    }
+
+    // Offsets beyond the date range would overflow the month arithmetic;
+    // they fail the range check below either way
+    std::vector<CivilDate> out(days.size());
+    Py_BEGIN_ALLOW_THREADS
+    for (size_t i = 0; i < days.size(); i++) {
+        long long v = values[i];
+        if (v > 4000000 || v < -4000000) out[i] = CivilDate{0, 1, 1};
+        else out[i] = DateAddUnits(CivilFromDays(days[i]), v, unit, endOfMonth != 0);
+    }
+    Py_END_ALLOW_THREADS
+
+    PyObject* list = PyList_New((Py_ssize_t)out.size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < out.size(); i++) {
+        PyObject* d = DateFromCivil(out[i]);
+        if (!d) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, d);
+    }
+    return list;
+}
+
+// --- Date and time in a zone ---
+
+// Zones load on first use and stay cached. Lookups happen with the GIL
+// held; the zones themselves are read-only once loaded.
+static TzDatabase g_tzdb;
+
+static const TimeZone* ReadZone(const char* name) {
+    const TimeZone* zone = g_tzdb.Get(name);
+    if (!zone) PyErr_Format(PyExc_ValueError, "unknown time zone \"%s\" (needs a tz database in TZDIR; UTC+hh:mm always works)", name);
+    return zone;
+}
+
+// A naive datetime, or a date at midnight, as wall clock fields. The zone
+// code counts milliseconds; the microseconds below that go to *subUs.
+static bool ReadDateTime(PyObject* obj, LocalDateTime* t, int* subUs) {
+    if (!PyDate_Check(obj)) {
+        PyErr_SetString(PyExc_TypeError, "expected a datetime.datetime or datetime.date");
+        return false;
+    }
+    if (PyDateTime_Check(obj) && _PyDateTime_HAS_TZINFO(obj)) {
+        PyErr_SetString(PyExc_ValueError, "expected a naive datetime; pass the zone by name");
+        return false;
+    }
+    t->date.year = PyDateTime_GET_YEAR(obj);
+    t->date.month = PyDateTime_GET_MONTH(obj);
+    t->date.day = PyDateTime_GET_DAY(obj);
+    t->hour = t->minute = t->second = t->millisecond = 0;
+    *subUs = 0;
+    if (PyDateTime_Check(obj)) {
+        int us = PyDateTime_DATE_GET_MICROSECOND(obj);
+        t->hour = PyDateTime_DATE_GET_HOUR(obj);
+        t->minute = PyDateTime_DATE_GET_MINUTE(obj);
+        t->second = PyDateTime_DATE_GET_SECOND(obj);
+        t->millisecond = us / 1000;
+        *subUs = us % 1000;
+    }
+    return true;
+}
+
+static bool ReadDateTimes(PyObject* seq, std::vector<LocalDateTime>* times, std::vector<int>* subUs) {
+    PyObject* fast = PySequence_Fast(seq, "expected a sequence of datetime.datetime");
+    if (!fast) return false;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    times->resize((size_t)n);
+    subUs->resize((size_t)n);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        if (!ReadDateTime(PySequence_Fast_GET_ITEM(fast, i), &(*times)[(size_t)i], &(*subUs)[(size_t)i])) {
+            Py_DECREF(fast);
+            return false;
+        }
+    }
+    Py_DECREF(fast);
+    return true;
+}
+
+// One number, or one per item
+static bool ReadNumbers(PyObject* obj, size_t n, std::vector<double>* out) {
+    if (PyNumber_Check(obj) && !PySequence_Check(obj)) {
+        double v = PyFloat_AsDouble(obj);
+        if (v == -1.0 && PyErr_Occurred()) return false;
+        out->assign(n, v);
+        return true;
+    }
+    PyObject* fast = PySequence_Fast(obj, "value must be a number or a sequence of numbers");
+    if (!fast) return false;
+    if ((size_t)PySequence_Fast_GET_SIZE(fast) != n) {
+        Py_DECREF(fast);
+        PyErr_SetString(PyExc_ValueError, "datetimes and values differ in length");
+        return false;
+    }
+    out->resize(n);
+    for (size_t i = 0; i < n; i++) {
+        (*out)[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, (Py_ssize_t)i));
+        if ((*out)[i] == -1.0 && PyErr_Occurred()) {
+            Py_DECREF(fast);
+            return false;
+        }
+    }
+    Py_DECREF(fast);
+    return true;
+}
+
+static bool CheckTimeUnit(int unit) {
+    if (unit >= DATE_UNIT_DAYS && unit <= DATE_UNIT_SECONDS) return true;
+    PyErr_SetString(PyExc_ValueError, "unit must be DAYS, WEEKS, MONTHS, YEARS, HOURS, MINUTES or SECONDS");
+    return false;
+}
+
+// Milliseconds from start to end, both wall clock times in their zones
+static long long DiffInZones(const TimeZone& z1, const LocalDateTime& t1, const TimeZone& z2, const LocalDateTime& t2) {
+    return TzLocalToUtcMs(z2, t2) - TzLocalToUtcMs(z1, t1);
+}
+
+// The date tab's add: calendar units move the wall clock and need a whole
+// value, hours and smaller add elapsed time. Returns 0 on success, 1 for a
+// fractional calendar step and 2 for a result outside years 1 to 9999.
+static int AddInZone(const TimeZone& zone, const LocalDateTime& t, double value, int unit, bool endOfMonth, LocalDateTime* out) {
+    bool calendar = unit <= DATE_UNIT_YEARS;
+    if (calendar && value != floor(value)) return 1;
+    // Larger steps would overflow the month arithmetic; they leave the range anyway
+    if (!(fabs(value) < (calendar ? 4000000.0 : 1e12))) return 2;
+    long long utc = TzAddUnits(zone, TzLocalToUtcMs(zone, t), value, unit, endOfMonth);
+    const long long lo = DaysFromCivil(CivilDate{1, 1, 1}) * MS_PER_DAY, hi = DaysFromCivil(CivilDate{10000, 1, 1}) * MS_PER_DAY;
+    if (utc < lo - MS_PER_DAY || utc >= hi + MS_PER_DAY) return 2;
+    *out = TzUtcToLocal(zone, utc);
+    return out->date.year >= 1 && out->date.year <= 9999 ? 0 : 2;
+}
+
+static PyObject* DeltaFromUs(long long us) {
+    long long sec = FloorDiv(us, 1000000);
+    long long days = FloorDiv(sec, 86400);
+    return PyDelta_FromDSU((int)days, (int)(sec - days * 86400), (int)(us - sec * 1000000));
+}
+
+static PyObject* DateTimeFromLocal(int status, const LocalDateTime& t, int subUs) {
+    if (status == 1) {
+        PyErr_SetString(PyExc_ValueError, "days to years need a whole number");
+        return NULL;
+    }
+    if (status) {
+        PyErr_SetString(PyExc_OverflowError, "datetime out of range");
+        return NULL;
+    }
+    return PyDateTime_FromDateAndTime(t.date.year, t.date.month, t.date.day, t.hour, t.minute, t.second,
+                                      t.millisecond * 1000 + subUs);
+}
+
+static PyObject* datetime_diff(PyObject*, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"start", "end", "start_zone", "end_zone", NULL};
+    PyObject *a, *b;
+    const char* startZone = "UTC";
+    const char* endZone = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|sz", (char**)kwlist, &a, &b, &startZone, &endZone)) return NULL;
+    LocalDateTime ta, tb;
+    int ua, ub;
+    if (!ReadDateTime(a, &ta, &ua) || !ReadDateTime(b, &tb, &ub)) return NULL;
+    const TimeZone* z1 = ReadZone(startZone);
+    const TimeZone* z2 = z1 ? ReadZone(endZone ? endZone : startZone) : NULL;
+    if (!z2) return NULL;
+    return DeltaFromUs(DiffInZones(*z1, ta, *z2, tb) * 1000 + (ub - ua));
+}
+
+static PyObject* datetime_add(PyObject*, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"datetime", "value", "unit", "zone", "end_of_month", NULL};
+    PyObject* obj;
+    double value;
+    int unit = DATE_UNIT_DAYS, endOfMonth = 0;
+    const char* zoneName = "UTC";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Od|isp", (char**)kwlist, &obj, &value, &unit, &zoneName, &endOfMonth)) return NULL;
+    LocalDateTime t, out;
+    int subUs;
+    if (!ReadDateTime(obj, &t, &subUs) || !CheckTimeUnit(unit)) return NULL;
+    const TimeZone* zone = ReadZone(zoneName);
+    if (!zone) return NULL;
+    int status = AddInZone(*zone, t, value, unit, endOfMonth != 0, &out);
+    return DateTimeFromLocal(status, out, subUs);
+}
+
+// ends[i] - starts[i] as timedeltas
+static PyObject* datetime_diff_many(PyObject*, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"starts", "ends", "start_zone", "end_zone", NULL};
+    PyObject *a, *b;
+    const char* startZone = "UTC";
+    const char* endZone = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|sz", (char**)kwlist, &a, &b, &startZone, &endZone)) return NULL;
+    std::vector<LocalDateTime> starts, ends;
+    std::vector<int> startUs, endUs;
+    if (!ReadDateTimes(a, &starts, &startUs) || !ReadDateTimes(b, &ends, &endUs)) return NULL;
+    if (starts.size() != ends.size()) {
+        PyErr_SetString(PyExc_ValueError, "starts and ends differ in length");
+        return NULL;
+    }
+    const TimeZone* z1 = ReadZone(startZone);
+    const TimeZone* z2 = z1 ? ReadZone(endZone ? endZone : startZone) : NULL;
+    if (!z2) return NULL;
+
+    std::vector<long long> us(ends.size());
+    Py_BEGIN_ALLOW_THREADS
+    for (size_t i = 0; i < ends.size(); i++) us[i] = DiffInZones(*z1, starts[i], *z2, ends[i]) * 1000 + (endUs[i] - startUs[i]);
+    Py_END_ALLOW_THREADS
+
+    PyObject* list = PyList_New((Py_ssize_t)us.size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < us.size(); i++) {
+        PyObject* d = DeltaFromUs(us[i]);
+        if (!d) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, d);
+    }
+    return list;
+}
+
+// datetimes[i] + value units in one zone, for one value or a sequence of them
+static PyObject* datetime_add_many(PyObject*, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"datetimes", "value", "unit", "zone", "end_of_month", NULL};
+    PyObject *seq, *valueObj;
+    int unit = DATE_UNIT_DAYS, endOfMonth = 0;
+    const char* zoneName = "UTC";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|isp", (char**)kwlist, &seq, &valueObj, &unit, &zoneName, &endOfMonth)) return NULL;
+    if (!CheckTimeUnit(unit)) return NULL;
+    std::vector<LocalDateTime> times;
+    std::vector<int> subUs;
+    std::vector<double> values;
+    if (!ReadDateTimes(seq, &times, &subUs) || !ReadNumbers(valueObj, times.size(), &values)) return NULL;
+    const TimeZone* zone = ReadZone(zoneName);
+    if (!zone) return NULL;
+
+    std::vector<LocalDateTime> out(times.size());
+    std::vector<int> status(times.size());
+    Py_BEGIN_ALLOW_THREADS
+    for (size_t i = 0; i < times.size(); i++) status[i] = AddInZone(*zone, times[i], values[i], unit, endOfMonth != 0, &out[i]);
+    Py_END_ALLOW_THREADS
+
+    PyObject* list = PyList_New((Py_ssize_t)out.size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < out.size(); i++) {
+        PyObject* d = DateTimeFromLocal(status[i], out[i], subUs[i]);
+        if (!d) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, d);
+    }
+    return list;
+}
+
+// --- Module ---
+
+static PyMethodDef module_methods[] = {
+    {"keys_many", (PyCFunction)(void (*)(void))keys_many, METH_VARARGS | METH_KEYWORDS,
+     "keys_many(sequences, mode=MODE_DOUBLE, history=False) -> list\n"
+     "Types each key string on a cleared keypad and returns the displays,\n"
+     "or (display, history lines) pairs. Releases the GIL."},
+    {"format_many", (PyCFunction)format_many, METH_O,
+     "format_many(values) -> list of the keypad's display text. Releases the GIL."},
+    {"date_diff", (PyCFunction)date_diff, METH_VARARGS,
+     "date_diff(start, end) -> whole days from start to end, ignoring time and zone"},
+    {"date_add", (PyCFunction)(void (*)(void))date_add, METH_VARARGS | METH_KEYWORDS,
+     "date_add(date, value, unit=DAYS, end_of_month=False) -> date\n"
+     "Month and year steps clamp the day (Jan 31 + 1 month -> Feb 28/29)."},
+    {"date_diff_many", (PyCFunction)date_diff_many, METH_VARARGS,
+     "date_diff_many(starts, ends) -> list of days. Releases the GIL."},
+    {"date_add_many", (PyCFunction)(void (*)(void))date_add_many, METH_VARARGS | METH_KEYWORDS,
+     "date_add_many(dates, value, unit=DAYS, end_of_month=False) -> list of dates\n"
+     "value is one int or one per date. Releases the GIL."},
+    {"datetime_diff", (PyCFunction)(void (*)(void))datetime_diff, METH_VARARGS | METH_KEYWORDS,
+     "datetime_diff(start, end, start_zone='UTC', end_zone=start_zone) -> timedelta\n"
+     "start and end are naive wall clock times in their zones, so offsets and DST count."},
+    {"datetime_add", (PyCFunction)(void (*)(void))datetime_add, METH_VARARGS | METH_KEYWORDS,
+     "datetime_add(datetime, value, unit=DAYS, zone='UTC', end_of_month=False) -> datetime\n"
+     "Days to years move the wall clock in the zone and need a whole value;\n"
+     "HOURS, MINUTES and SECONDS add elapsed time and may be fractional."},
+    {"datetime_diff_many", (PyCFunction)(void (*)(void))datetime_diff_many, METH_VARARGS | METH_KEYWORDS,
+     "datetime_diff_many(starts, ends, start_zone='UTC', end_zone=start_zone) -> list of timedelta.\n"
+     "Releases the GIL."},
+    {"datetime_add_many", (PyCFunction)(void (*)(void))datetime_add_many, METH_VARARGS | METH_KEYWORDS,
+     "datetime_add_many(datetimes, value, unit=DAYS, zone='UTC', end_of_month=False) -> list of datetimes\n"
+     "value is one number or one per datetime. Releases the GIL."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef calc_native_module = {
+    PyModuleDef_HEAD_INIT, "calc_native",
+    "Keypad engine, date and time zone arithmetic shared with the Win32 calculator",
+    -1, module_methods, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_calc_native(void) {
+    PyDateTime_IMPORT;
+    if (!PyDateTimeAPI) return NULL;
+    PyObject* m = PyModule_Create(&calc_native_module);
+    if (!m) return NULL;
+    PyObject* engineType = PyType_FromSpec(&Engine_spec);
+    if (!engineType || PyModule_AddObject(m, "Engine", engineType) < 0) {
+        Py_XDECREF(engineType);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    static const struct { const char* name; int value; } constants[] = {
+        {"MODE_DOUBLE", NUM_DOUBLE}, {"MODE_EXACT", NUM_EXACT}, {"MODE_DDOUBLE", NUM_DDOUBLE}, {"MODE_COMPLEX", NUM_COMPLEX},
+        {"DAYS", DATE_UNIT_DAYS}, {"WEEKS", DATE_UNIT_WEEKS}, {"MONTHS", DATE_UNIT_MONTHS}, {"YEARS", DATE_UNIT_YEARS},
+        {"HOURS", DATE_UNIT_HOURS}, {"MINUTES", DATE_UNIT_MINUTES}, {"SECONDS", DATE_UNIT_SECONDS},
+        {"BTN_0", BTN_0}, {"BTN_ADD", BTN_ADD}, {"BTN_SUB", BTN_SUB}, {"BTN_MUL", BTN_MUL}, {"BTN_DIV", BTN_DIV},
+        {"BTN_EQUAL", BTN_EQUAL}, {"BTN_DOT", BTN_DOT}, {"BTN_C", BTN_C}, {"BTN_CE", BTN_CE}, {"BTN_BACK", BTN_BACK},
+        {"BTN_NEG", BTN_NEG}, {"BTN_SQRT", BTN_SQRT}, {"BTN_PERCENT", BTN_PERCENT}, {"BTN_RECIP", BTN_RECIP},
+        {"BTN_MC", BTN_MC}, {"BTN_MR", BTN_MR}, {"BTN_MS", BTN_MS}, {"BTN_MPLUS", BTN_MPLUS}, {"BTN_MMINUS", BTN_MMINUS},
+        {"BTN_I", BTN_I}, {"BTN_ANGLE", BTN_ANGLE}, {"BTN_ABS", BTN_ABS}, {"BTN_ARG", BTN_ARG}, {"BTN_EXP", BTN_EXP},
+        {"BTN_LN", BTN_LN},
+    };
+    for (size_t i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+        if (PyModule_AddIntConstant(m, constants[i].name, constants[i].value) < 0) {
+            Py_DECREF(m);
+            return NULL;
+        }
+    }
+    return m;
+}
@@ -0,0 +1,387 @@
+// Exact rational arithmetic for the calculator's fraction mode
+// Numerator and denominator live in machine words and are reduced with a
+// binary GCD. Only when an intermediate overflows 64 bits does the value
+// promote to BigInt; results that fit again are demoted straight back, so
+// typical keypad fractions never touch the heap.
+
+#pragma once
+
+#include "calc_bigint.h"
+#include <climits>
+#include <cstdlib>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// --- Word helpers ---
+
+inline int CountTrailingZeros64(unsigned long long v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return (int)idx;
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    while (!(v & 1)) { v >>= 1; n++; }
+    return n;
+#endif
+}
+
+// Stein's binary GCD; gcd(0, v) == v
+inline unsigned long long BinaryGcd64(unsigned long long u, unsigned long long v) {
+    if (u == 0) return v;
+    if (v == 0) return u;
+    int shift = CountTrailingZeros64(u | v);
+    u >>= CountTrailingZeros64(u);
+    do {
+        v >>= CountTrailingZeros64(v);
+        if (u > v) { unsigned long long t = u; u = v; v = t; }
+        v -= u;
+    } while (v != 0);
+    return u << shift;
+}
+
+inline bool MulOverflow64(long long a, long long b, long long* r) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_mul_overflow(a, b, r);
+#else
+    if (a == 0 || b == 0) { *r = 0; return false; }
+    if (a == -1) { if (b == LLONG_MIN) return true; *r = -b; return false; }
+    if (b == -1) { if (a == LLONG_MIN) return true; *r = -a; return false; }
+    if (a > 0 ? (b > 0 ? a > LLONG_MAX / b : b < LLONG_MIN / a)
+              : (b > 0 ? a < LLONG_MIN / b : a < LLONG_MAX / b)) return true;
+    *r = a * b;
+    return false;
+#endif
+}
+
+inline bool AddOverflow64(long long a, long long b, long long* r) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_add_overflow(a, b, r);
+#else
+    if ((b > 0 && a > LLONG_MAX - b) || (b < 0 && a < LLONG_MIN - b)) return true;
+    *r = a + b;
+    return false;
+#endif
+}
+
+inline unsigned long long AbsU64(long long v) {
+    return v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+}
+
+// --- Rational ---
+
+struct Rational {
+    long long num;      // Small form: den > 0, gcd(|num|, den) == 1
+    long long den;
+    bool isBig;         // When set, bigNum/bigDen hold the value instead
+    BigInt bigNum;
+    BigInt bigDen;
+
+    Rational() : num(0), den(1), isBig(false) {}
+    Rational(long long n) : num(n), den(1), isBig(false) {}
+
+    bool IsZero() const { return isBig ? bigNum.IsZero() : num == 0; }
+    bool IsNegative() const { return isBig ? bigNum.neg : num < 0; }
+    bool IsInteger() const { return isBig ? (bigDen.mag.size() == 1 && bigDen.mag[0] == 1) : den == 1; }
+
+    BigInt Num() const { return isBig ? bigNum : BigInt(num); }
+    BigInt Den() const { return isBig ? bigDen : BigInt(den); }
+};
+
+// Drops back to the word form when both parts fit
+inline void RatDemote(Rational& r) {
+    if (!r.isBig) return;
+    if (r.bigNum.FitsInt64() && r.bigDen.FitsInt64()) {
+        long long n = r.bigNum.ToInt64();
+        long long d = r.bigDen.ToInt64();
+        // LLONG_MIN numerators stay big so negation is always safe
+        if (n != LLONG_MIN) {
+            r.num = n;
+            r.den = d;
+            r.isBig = false;
+            r.bigNum = BigInt();
+            r.bigDen = BigInt();
+        }
+    }
+}
+
+// Builds a reduced value from an arbitrary BigInt fraction (den != 0)
+inline Rational RatFromBig(BigInt n, BigInt d) {
+    Rational r;
+    if (d.neg) { n = -n; d = -d; }
+    BigInt g = BigGcd(n, d);
+    if (!(g.mag.size() == 1 && g.mag[0] == 1)) {
+        n = n / g;
+        d = d / g;
+    }
+    r.isBig = true;
+    r.bigNum = n;
+    r.bigDen = d;
+    RatDemote(r);
+    return r;
+}
+
+// Builds a reduced value from a word fraction (d != 0)
+inline Rational RatMake(long long n, long long d) {
+    if (n == LLONG_MIN || d == LLONG_MIN) return RatFromBig(BigInt(n), BigInt(d));
+    if (d < 0) { n = -n; d = -d; }
+    unsigned long long g = BinaryGcd64(AbsU64(n), (unsigned long long)d);
+    Rational r;
+    if (g > 1) { n /= (long long)g; d /= (long long)g; }
+    r.num = n;
+    r.den = d;
+    return r;
+}
+
+inline Rational RatNeg(const Rational& a) {
+    Rational r = a;
+    if (r.isBig) r.bigNum = -r.bigNum;
+    else r.num = -r.num;
+    return r;
+}
+
+inline Rational RatAdd(const Rational& a, const Rational& b) {
+    if (!a.isBig && !b.isBig) {
+        // Knuth 4.5.1: a/b + c/d with g = gcd(b, d) keeps intermediates small
+        unsigned long long g = BinaryGcd64((unsigned long long)a.den, (unsigned long long)b.den);
+        long long bg = a.den / (long long)g;
+        long long dg = b.den / (long long)g;
+        long long t1, t2, t, den;
+        if (!MulOverflow64(a.num, dg, &t1) && !MulOverflow64(b.num, bg, &t2) &&
+            !AddOverflow64(t1, t2, &t) && !MulOverflow64(bg, b.den, &den)) {
+            if (g == 1 || t == LLONG_MIN) return RatMake(t, den);
+            unsigned long long g2 = BinaryGcd64(AbsU64(t), g);
+            Rational r;
+            r.num = t / (long long)g2;
+            r.den = den / (long long)g2;
+            if (r.num == 0) r.den = 1;
+            return r;
+        }
+    }
+    return RatFromBig(a.Num() * b.Den() + b.Num() * a.Den(), a.Den() * b.Den());
+}
+
+inline Rational RatSub(const Rational& a, const Rational& b) {
+    return RatAdd(a, RatNeg(b));
+}
+
+inline Rational RatMul(const Rational& a, const Rational& b) {
+    if (!a.isBig && !b.isBig) {
+        // Cross-reduce first so the products rarely overflow
+        unsigned long long g1 = BinaryGcd64(AbsU64(a.num), (unsigned long long)b.den);
+        unsigned long long g2 = BinaryGcd64(AbsU64(b.num), (unsigned long long)a.den);
+        long long n, d;
+        if (!MulOverflow64(a.num / (long long)g1, b.num / (long long)g2, &n) &&
+            !MulOverflow64(a.den / (long long)g2, b.den / (long long)g1, &d) &&
+            n != LLONG_MIN) {
+            Rational r;
+            r.num = n;
+            r.den = n == 0 ? 1 : d;
+            return r;
+        }
+    }
+    return RatFromBig(a.Num() * b.Num(), a.Den() * b.Den());
+}
+
+inline Rational RatRecip(const Rational& a) {
+    Rational r;
+    if (!a.isBig) {
+        r.num = a.num < 0 ? -a.den : a.den;
+        r.den = a.num < 0 ? -a.num : a.num;
+        return r;
+    }
+    return RatFromBig(a.bigDen, a.bigNum);
+}
+
+// Returns false on division by zero
+inline bool RatDiv(const Rational& a, const Rational& b, Rational* out) {
+    if (b.IsZero()) return false;
+    *out = RatMul(a, RatRecip(b));
+    return true;
+}
+
+inline int RatCompare(const Rational& a, const Rational& b) {
+    Rational d = RatSub(a, b);
+    return d.IsZero() ? 0 : (d.IsNegative() ? -1 : 1);
+}
+
+inline double RatToDouble(const Rational& a) {
+    if (!a.isBig) return (double)a.num / (double)a.den;
+    // Divide with ~64 quotient bits, then rescale by the power of two
+    BigInt n = BigAbs(a.bigNum);
+    int k = 64 - (n.BitLength() - a.bigDen.BitLength());
+    BigInt q = k >= 0 ? BigShiftLeft(n, k) / a.bigDen : n / BigShiftLeft(a.bigDen, -k);
+    double r = ldexp(q.ToDouble(), -k);
+    return a.bigNum.neg ? -r : r;
+}
+
+// Best rational approximation of a double by continued fractions. Stops
+// once the convergent reproduces the double exactly or the denominator
+// would exceed maxDen.
+inline Rational RatFromDouble(double v, long long maxDen = 1000000000000LL) {
+    if (!(v == v) || fabs(v) > 9.0e18) return Rational();
+    if (v == floor(v)) return Rational((long long)v);
+    bool neg = v < 0;
+    double x = fabs(v);
+    long long h0 = 0, h1 = 1, k0 = 1, k1 = 0;
+    double frac = x;
+    for (int i = 0; i < 64; i++) {
+        double a = floor(frac);
+        if (a > 9.0e18) break;
+        long long ai = (long long)a;
+        long long h2, k2, t;
+        if (MulOverflow64(ai, h1, &t) || AddOverflow64(t, h0, &h2)) break;
+        if (MulOverflow64(ai, k1, &t) || AddOverflow64(t, k0, &k2)) break;
+        if (k2 > maxDen) break;
+        h0 = h1; h1 = h2; k0 = k1; k1 = k2;
+        if ((double)h1 / (double)k1 == x) break;
+        double rem = frac - a;
+        if (rem <= 0) break;
+        frac = 1.0 / rem;
+    }
+    if (k1 == 0) return Rational();
+    return RatMake(neg ? -h1 : h1, k1);
+}
+
+// Exact square root when both parts are perfect squares
+inline bool RatSqrtExact(const Rational& a, Rational* out) {
+    if (a.IsNegative() || a.isBig) return false;
+    unsigned long long n = (unsigned long long)a.num, d = (unsigned long long)a.den;
+    unsigned long long rn = (unsigned long long)sqrt((double)n);
+    unsigned long long rd = (unsigned long long)sqrt((double)d);
+    while (rn * rn > n) rn--;
+    while ((rn + 1) * (rn + 1) <= n) rn++;
+    while (rd * rd > d) rd--;
+    while ((rd + 1) * (rd + 1) <= d) rd++;
+    if (rn * rn != n || rd * rd != d) return false;
+    *out = RatMake((long long)rn, (long long)rd);
+    return true;
+}
+
+// Parses an unsigned decimal with optional fraction and exponent,
+// advancing s past it
+inline bool RatParseDecimal(const char*& s, Rational* out) {
+    bool neg = false;
+    if (*s == '-' || *s == '+') { neg = *s == '-'; s++; }
+    // Digits accumulate in a word until it would overflow, then in a BigInt
+    BigInt mant;
+    BigInt ten(10);
+    long long small = 0;
+    bool smallOk = true;
+    bool any = false;
+    int scale = 0;
+    bool seenDot = false;
+    for (;; s++) {
+        if (*s == '.' && !seenDot) { seenDot = true; continue; }
+        if (*s < '0' || *s > '9') break;
+        any = true;
+        if (seenDot) scale++;
+        if (smallOk && small < 100000000000000000LL) {
+            small = small * 10 + (*s - '0');
+        } else {
+            if (smallOk) { mant = BigInt(small); smallOk = false; }
+            mant = mant * ten + BigInt(*s - '0');
+        }
+    }
+    if (!any) return false;
+    if (smallOk) mant = BigInt(small);
+    if (*s == 'e' || *s == 'E') {
+        int e = atoi(s + 1);
+        if (e > 4000 || e < -4000) return false;
+        scale -= e;
+        s++;
+        if (*s == '-' || *s == '+') s++;
+        while (*s >= '0' && *s <= '9') s++;
+    }
+    if (neg) mant = -mant;
+    if (scale > 0) *out = RatFromBig(mant, BigPow10(scale));
+    else *out = RatFromBig(mant * BigPow10(-scale), BigInt(1));
+    return true;
+}
+
+// Parses "12", "-0.125", "1.5e-3", "3/4" or "-7/2" exactly. Returns false
+// if the text is not a number or the denominator is zero.
+inline bool RatParse(const char* s, Rational* out) {
+    while (*s == ' ') s++;
+    Rational r;
+    if (!RatParseDecimal(s, &r)) return false;
+    while (*s == ' ') s++;
+    if (*s == '/') {
+        s++;
+        while (*s == ' ') s++;
+        Rational d;
+        if (!RatParseDecimal(s, &d)) return false;
+        if (!RatDiv(r, d, &r)) return false;
+        while (*s == ' ') s++;
+    }
+    if (*s != '\0') return false;
+    *out = r;
+    return true;
+}
+
+// Formats as "n" or "n/d". Returns false if buf is too small.
+inline bool RatFormatFraction(const Rational& a, char* buf, int size) {
+    if (!a.isBig) {
+        int n = a.den == 1 ? snprintf(buf, (size_t)size, "%lld", a.num)
+                           : snprintf(buf, (size_t)size, "%lld/%lld", a.num, a.den);
+        return n >= 0 && n < size;
+    }
+    if (!BigToString(a.bigNum, buf, size)) return false;
+    if (a.IsInteger()) return true;
+    int len = (int)strlen(buf);
+    if (len + 2 >= size) return false;
+    buf[len] = '/';
+    return BigToString(a.bigDen, buf + len + 1, size - len - 1);
+}
+
+// Formats as a decimal rounded (half away from zero) to at most `digits`
+// significant digits, trailing zeros trimmed. Falls back to scientific
+// notation for very large or very small magnitudes.
+inline void RatFormatDecimal(const Rational& a, char* buf, int size, int digits) {
+    if (a.IsZero()) { snprintf(buf, (size_t)size, "0"); return; }
+    BigInt n = BigAbs(a.Num());
+    BigInt d = a.Den();
+    // Find e with 10^e <= |a| < 10^(e+1), starting from a bit-length estimate
+    int e = (int)floor((n.BitLength() - d.BitLength()) * 0.30102999566398120);
+    for (;;) {
+        bool ge = e >= 0 ? n >= d * BigPow10(e) : n * BigPow10(-e) >= d;
+        bool lt = e + 1 >= 0 ? n < d * BigPow10(e + 1) : n * BigPow10(-e - 1) < d;
+        if (ge && lt) break;
+        e += ge ? 1 : -1;
+    }
+    // Scaled integer with `digits` significant digits, rounded half-up
+    int shift = digits - 1 - e;
+    BigInt scaled = shift >= 0 ? n * BigPow10(shift) : n;
+    BigInt div = shift >= 0 ? d : d * BigPow10(-shift);
+    BigInt q, r;
+    BigDivMod(scaled, div, &q, &r);
+    if (BigShiftLeft(r, 1) >= div) q = q + BigInt(1);
+    char dig[96];
+    BigToString(q, dig, sizeof(dig));
+    int nd = (int)strlen(dig);
+    if (nd > digits) { e++; dig[digits] = '\0'; nd = digits; }
+    while (nd > 1 && dig[nd - 1] == '0') dig[--nd] = '\0';
+
+    char tmp[160];
+    int p = 0;
+    if (a.IsNegative()) tmp[p++] = '-';
+    if (e >= digits || e < -6) {
+        tmp[p++] = dig[0];
+        if (nd > 1) { tmp[p++] = '.'; for (int i = 1; i < nd; i++) tmp[p++] = dig[i]; }
+        p += snprintf(tmp + p, sizeof(tmp) - (size_t)p, "e%+d", e);
+    } else if (e < 0) {
+        tmp[p++] = '0'; tmp[p++] = '.';
+        for (int i = -1; i > e; i--) tmp[p++] = '0';
+        for (int i = 0; i < nd; i++) tmp[p++] = dig[i];
+        tmp[p] = '\0';
+    } else {
+        for (int i = 0; i <= e; i++) tmp[p++] = i < nd ? dig[i] : '0';
+        if (nd > e + 1) { tmp[p++] = '.'; for (int i = e + 1; i < nd; i++) tmp[p++] = dig[i]; }
+        tmp[p] = '\0';
+    }
+    snprintf(buf, (size_t)size, "%s", tmp);
+}
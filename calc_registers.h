@@ -0,0 +1,167 @@
+// Memory registers: hundreds of named slots beside the keypad's M key
+// Portable C++ (no Win32). Each slot holds a compensated sum: the running
+// total in value[] and the rounding error of every addition so far in
+// comp[], kept apart with TwoSum (Kahan-Babuska), so long runs of M+ and
+// M- lose nothing a double-double could hold. The file is one flat struct
+// of contiguous arrays; the struct is also the on-disk image, so a save
+// is one fwrite and a restore is one fread plus a checksum. Bulk adds
+// of a whole column run eight independent TwoSum lanes through SSE2 and
+// fold them into the slot at the end. Names are UTF-8.
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#include "calc_ddouble.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REG_SSE2 1
+#endif
+
+#define REG_COUNT    256
+#define REG_NAME_LEN 16   // Bytes, with the terminator
+#define REG_MAGIC    "CALCREG1"
+
+// Doubles and counts are stored in the machine's byte order (little-endian
+// on every target this builds for); the magic and sizes reject anything
+// written with another layout.
+struct CalcRegisterFile {
+    char magic[8];
+    uint32_t count;
+    uint32_t nameLen;
+    uint64_t checksum;                 // FNV-1a over everything after the header
+    double value[REG_COUNT];
+    double comp[REG_COUNT];
+    uint8_t used[REG_COUNT];
+    char name[REG_COUNT][REG_NAME_LEN];
+
+    void Reset() {
+        memset(this, 0, sizeof(*this));
+        memcpy(magic, REG_MAGIC, sizeof(magic));
+        count = REG_COUNT;
+        nameLen = REG_NAME_LEN;
+    }
+
+    static bool Valid(int k) { return k >= 0 && k < REG_COUNT; }
+
+    void Clear(int k) {
+        if (!Valid(k)) return;
+        value[k] = 0;
+        comp[k] = 0;
+        used[k] = 0;
+        name[k][0] = '\0';
+    }
+
+    // Truncates on a UTF-8 character boundary
+    void SetName(int k, const char* text) {
+        if (!Valid(k)) return;
+        size_t n = strlen(text);
+        if (n > REG_NAME_LEN - 1) {
+            n = REG_NAME_LEN - 1;
+            while (n > 0 && ((unsigned char)text[n] & 0xC0) == 0x80) n--;
+        }
+        memcpy(name[k], text, n);
+        name[k][n] = '\0';
+        if (n) used[k] = 1;
+    }
+
+    void Store(int k, const DDouble& v) {
+        if (!Valid(k)) return;
+        value[k] = v.hi;
+        comp[k] = v.lo;
+        used[k] = 1;
+    }
+
+    // M+ (M- adds the negation)
+    void Add(int k, const DDouble& v) {
+        if (!Valid(k)) return;
+        double err;
+        value[k] = TwoSum(value[k], v.hi, &err);
+        comp[k] += err + v.lo;
+        used[k] = 1;
+    }
+
+    // The slot as a normalized double-double
+    DDouble Get(int k) const {
+        if (!Valid(k)) return DDouble();
+        double hi = value[k], lo = comp[k];
+        if (!std::isfinite(hi) || !std::isfinite(lo)) return DDouble(hi + lo);
+        double err;
+        double s = TwoSum(hi, lo, &err);
+        return DDouble(s, err);
+    }
+
+    // Adds (or subtracts) a column of n values into slot k. Eight lanes
+    // each keep their own sum and error so the additions pipeline; the
+    // lanes are folded into the slot in order at the end.
+    void AddColumn(int k, const double* x, size_t n, bool subtract = false) {
+        if (!Valid(k)) return;
+        double sum[8] = {0}, err[8] = {0};
+        size_t i = 0;
+#ifdef REG_SSE2
+        const __m128d sign = _mm_set1_pd(subtract ? -0.0 : 0.0);
+        __m128d s[4], e[4];
+        for (int l = 0; l < 4; l++) s[l] = e[l] = _mm_setzero_pd();
+        size_t blocks = n & ~(size_t)7;
+        for (; i < blocks; i += 8) {
+            for (int l = 0; l < 4; l++) {
+                // TwoSum, two lanes at a time
+                __m128d v = _mm_xor_pd(_mm_loadu_pd(x + i + 2 * l), sign);
+                __m128d t = _mm_add_pd(s[l], v);
+                __m128d bp = _mm_sub_pd(t, s[l]);
+                __m128d ap = _mm_sub_pd(t, bp);
+                e[l] = _mm_add_pd(e[l], _mm_add_pd(_mm_sub_pd(s[l], ap), _mm_sub_pd(v, bp)));
+                s[l] = t;
+            }
+        }
+        for (int l = 0; l < 4; l++) {
+            _mm_storeu_pd(sum + 2 * l, s[l]);
+            _mm_storeu_pd(err + 2 * l, e[l]);
+        }
+#endif
+        for (; i < n; i++) {
+            double v = subtract ? -x[i] : x[i];
+            double t;
+            int l = (int)(i & 7);
+            sum[l] = TwoSum(sum[l], v, &t);
+            err[l] += t;
+        }
+        for (int l = 0; l < 8; l++) Add(k, DDouble(sum[l], err[l]));
+        used[k] = 1;
+    }
+
+    uint64_t Checksum() const {
+        const unsigned char* p = (const unsigned char*)value;
+        const unsigned char* end = (const unsigned char*)this + sizeof(*this);
+        uint64_t h = 14695981039346656037ULL;
+        for (; p < end; p++) {
+            h ^= *p;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    bool Save(FILE* f) {
+        checksum = Checksum();
+        return fwrite(this, sizeof(*this), 1, f) == 1;
+    }
+
+    // Leaves the registers untouched unless the whole file checks out
+    bool Load(FILE* f) {
+        CalcRegisterFile* in = new CalcRegisterFile;
+        bool ok = fread(in, sizeof(*in), 1, f) == 1 && memcmp(in->magic, REG_MAGIC, sizeof(in->magic)) == 0 &&
+                  in->count == REG_COUNT && in->nameLen == REG_NAME_LEN && in->checksum == in->Checksum();
+        if (ok) {
+            for (int k = 0; k < REG_COUNT; k++) in->name[k][REG_NAME_LEN - 1] = '\0';
+            *this = *in;
+        }
+        delete in;
+        return ok;
+    }
+};
+
+static_assert(sizeof(CalcRegisterFile) == 24 + REG_COUNT * (16 + 1 + REG_NAME_LEN), "no padding in the file image");
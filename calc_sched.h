@@ -0,0 +1,182 @@
+// Background jobs for long operations
+// Portable C++ (no Win32). A small pool of worker threads runs the slow
+// work (sweeps, batch exports, solves, factorizations) so the host's UI
+// thread never blocks; keystrokes and other cheap work stay inline.
+// Every job has a cancel flag its work polls and a progress counter it
+// may bump. Nothing is delivered on a worker: a finished job waits in a
+// queue, the pool calls the host's wake callback (a PostMessage on
+// Windows), and the host runs the done callbacks from Drain() on its own
+// thread. Pump() runs the progress callbacks the same way, on a timer.
+// stress_sched.cpp checks the delivery guarantees on any platform.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SCHED_MAX_WORKERS 8
+
+// Job states
+#define SCHED_QUEUED    0
+#define SCHED_RUNNING   1
+#define SCHED_FINISHED  2  // Work returned, done callback not run yet
+#define SCHED_DELIVERED 3
+
+struct SchedJob;
+typedef std::function<void(SchedJob*)> SchedFn;
+typedef std::shared_ptr<SchedJob> SchedHandle;
+
+struct SchedJob {
+    SchedFn run;                       // On a worker
+    SchedFn onDone;                    // On the host thread, from Drain()
+    SchedFn onProgress;                // On the host thread, from Pump()
+
+    std::atomic<int> state;
+    std::atomic<bool> ownCancel;
+    std::atomic<bool>* cancel;         // ownCancel, or a flag the work already polls
+    std::atomic<long long> current;    // Progress, as the work reports it
+    std::atomic<long long> total;
+    bool started;                      // False when cancelled while queued
+
+    SchedJob() : state(SCHED_QUEUED), ownCancel(false), cancel(&ownCancel), current(0), total(0), started(false) {}
+
+    bool Cancelled() const { return cancel->load(std::memory_order_relaxed); }
+    void Progress(long long done, long long of) {
+        total.store(of, std::memory_order_relaxed);
+        current.store(done, std::memory_order_relaxed);
+    }
+};
+
+struct Scheduler {
+    // Called from a worker when finished jobs are waiting; coalesced, so
+    // one call may stand for many jobs until the next Drain()
+    void (*onWake)(void* ctx);
+    void* wakeCtx;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<SchedHandle> queue;     // Waiting for a worker
+    std::vector<SchedHandle> finished; // Waiting for Drain()
+    std::vector<SchedHandle> active;   // Submitted, not delivered; host thread only
+    std::vector<std::thread> workers;
+    std::atomic<bool> wakePending;
+    bool stopping;
+
+    Scheduler() : onWake(NULL), wakeCtx(NULL), wakePending(false), stopping(false) {}
+    ~Scheduler() { Stop(); }
+
+    void Start(int threads, void (*wake)(void*), void* ctx) {
+        if (!workers.empty()) return;
+        onWake = wake;
+        wakeCtx = ctx;
+        stopping = false;
+        if (threads < 1) threads = 1;
+        if (threads > SCHED_MAX_WORKERS) threads = SCHED_MAX_WORKERS;
+        for (int i = 0; i < threads; i++) workers.push_back(std::thread(WorkerMain, this));
+    }
+
+    // Queues run for a worker. cancelFlag, when given, becomes the job's
+    // cancel flag so work that already polls one needs no changes.
+    SchedHandle Submit(const SchedFn& run, const SchedFn& onDone, const SchedFn& onProgress = SchedFn(),
+                       std::atomic<bool>* cancelFlag = NULL) {
+        SchedHandle job = std::make_shared<SchedJob>();
+        job->run = run;
+        job->onDone = onDone;
+        job->onProgress = onProgress;
+        if (cancelFlag) job->cancel = cancelFlag;
+        active.push_back(job);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queue.push_back(job);
+        }
+        ready.notify_one();
+        return job;
+    }
+
+    // Asks the job to stop. A queued job never starts; a running one stops
+    // when its work next polls the flag. Either way onDone still runs.
+    void Cancel(const SchedHandle& job) {
+        if (job) job->cancel->store(true);
+    }
+
+    void CancelAll() {
+        for (size_t i = 0; i < active.size(); i++) Cancel(active[i]);
+    }
+
+    // Runs the done callbacks of finished jobs; returns how many
+    int Drain() {
+        wakePending = false;
+        std::vector<SchedHandle> done;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            done.swap(finished);
+        }
+        for (size_t i = 0; i < done.size(); i++) {
+            SchedHandle& job = done[i];
+            for (size_t a = 0; a < active.size(); a++) {
+                if (active[a] == job) {
+                    active.erase(active.begin() + (long)a);
+                    break;
+                }
+            }
+            job->state = SCHED_DELIVERED;
+            if (job->onDone) job->onDone(job.get());
+        }
+        return (int)done.size();
+    }
+
+    // Runs the progress callbacks of jobs not yet delivered
+    void Pump() {
+        std::vector<SchedHandle> jobs(active);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (jobs[i]->onProgress && jobs[i]->state.load() < SCHED_FINISHED) jobs[i]->onProgress(jobs[i].get());
+        }
+    }
+
+    bool Busy() const { return !active.empty(); }
+
+    // Cancels everything and joins the workers. Jobs still queued finish
+    // without running; call Drain() afterwards to deliver them all.
+    void Stop() {
+        if (workers.empty()) return;
+        CancelAll();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+        workers.clear();
+    }
+
+    static void WorkerMain(Scheduler* s) {
+        for (;;) {
+            SchedHandle job;
+            {
+                std::unique_lock<std::mutex> guard(s->lock);
+                s->ready.wait(guard, [s]() { return s->stopping || !s->queue.empty(); });
+                // Stopping still empties the queue so every job is delivered
+                if (s->queue.empty()) return;
+                job = s->queue.front();
+                s->queue.pop_front();
+            }
+            if (!job->Cancelled()) {
+                job->started = true;
+                job->state = SCHED_RUNNING;
+                job->run(job.get());
+            }
+            job->state = SCHED_FINISHED;
+            {
+                std::lock_guard<std::mutex> guard(s->lock);
+                s->finished.push_back(job);
+            }
+            if (!s->wakePending.exchange(true) && s->onWake) s->onWake(s->wakeCtx);
+        }
+    }
+};
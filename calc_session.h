@@ -0,0 +1,199 @@
+// Session recording: a compact binary log of every input to the engine
+// Portable C++ (no Win32). A log is a header followed by one record per
+// input. Each record starts with varint(delta_ms * 8 + type), where
+// delta_ms is the time since the previous record, so a keystroke usually
+// costs two or three bytes. Varints are LEB128 (7 bits per byte, low
+// bits first).
+//
+//   header   "CSES" varint(version) varint(start time, Unix ms)
+//   BUTTON   varint(button id)
+//   KEY      varint(vk * 8 + modifiers)
+//   PASTE    varint(length) bytes       (the pasted text, not Ctrl+V)
+//   RECALL   varint(length) bytes       (the value recalled from history)
+//   TAB      varint(tab)
+//   NUMMODE  varint(mode)
+//   TOGGLE   (fraction/decimal or rectangular/polar view)
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define SESSION_VERSION 1
+
+// Record types (3 bits)
+#define SES_BUTTON  0
+#define SES_KEY     1
+#define SES_PASTE   2
+#define SES_RECALL  3
+#define SES_TAB     4
+#define SES_NUMMODE 5
+#define SES_TOGGLE  6
+
+// KEY modifiers
+#define SES_MOD_SHIFT 1
+#define SES_MOD_CTRL  2
+#define SES_MOD_ALT   4
+
+struct SessionEvent {
+    int type;
+    long long timeMs;   // Since the start of the session
+    int value;          // Button id, virtual key, tab or mode
+    int mods;           // SES_MOD_* for KEY
+    std::string text;   // PASTE and RECALL
+};
+
+inline void SessionPutVarint(std::vector<uint8_t>* out, uint64_t v) {
+    while (v >= 0x80) {
+        out->push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back((uint8_t)v);
+}
+
+inline bool SessionGetVarint(const uint8_t** p, const uint8_t* end, uint64_t* v) {
+    uint64_t r = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Appends records to a stdio stream. Each record is flushed as it is
+// written so a log survives the crash it is meant to explain.
+struct SessionWriter {
+    FILE* file;
+    long long lastMs;
+    std::vector<uint8_t> buf;
+    bool failed;
+
+    SessionWriter() : file(NULL), lastMs(0), failed(false) {}
+
+    bool IsOpen() const { return file != NULL && !failed; }
+
+    bool Begin(FILE* f, long long startUnixMs) {
+        file = f;
+        lastMs = 0;
+        failed = false;
+        buf.assign((const uint8_t*)"CSES", (const uint8_t*)"CSES" + 4);
+        SessionPutVarint(&buf, SESSION_VERSION);
+        SessionPutVarint(&buf, (uint64_t)startUnixMs);
+        return Flush();
+    }
+
+    // nowMs is the time since the session started; it never runs backwards
+    void Record(int type, long long nowMs, int value = 0, int mods = 0, const char* text = NULL) {
+        if (!IsOpen()) return;
+        long long delta = nowMs > lastMs ? nowMs - lastMs : 0;
+        lastMs += delta;
+        buf.clear();
+        SessionPutVarint(&buf, (uint64_t)delta * 8 + (uint64_t)type);
+        switch (type) {
+            case SES_KEY:
+                SessionPutVarint(&buf, (uint64_t)value * 8 + (uint64_t)(mods & 7));
+                break;
+            case SES_PASTE:
+            case SES_RECALL: {
+                size_t len = text ? strlen(text) : 0;
+                SessionPutVarint(&buf, len);
+                buf.insert(buf.end(), (const uint8_t*)text, (const uint8_t*)text + len);
+                break;
+            }
+            case SES_TOGGLE:
+                break;
+            default:
+                SessionPutVarint(&buf, (uint64_t)value);
+                break;
+        }
+        Flush();
+    }
+
+    bool Flush() {
+        if (fwrite(&buf[0], 1, buf.size(), file) != buf.size() || fflush(file) != 0) failed = true;
+        return !failed;
+    }
+
+    void Close() {
+        if (file) fclose(file);
+        file = NULL;
+    }
+};
+
+// Decodes a whole log held in memory
+struct SessionReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    long long timeMs;
+    long long startUnixMs;
+    int version;
+
+    SessionReader() : p(NULL), end(NULL), timeMs(0), startUnixMs(0), version(0) {}
+
+    bool Open(const uint8_t* data, size_t size) {
+        p = data;
+        end = data + size;
+        timeMs = 0;
+        uint64_t v, start;
+        if (size < 4 || memcmp(data, "CSES", 4) != 0) return false;
+        p += 4;
+        if (!SessionGetVarint(&p, end, &v) || v != SESSION_VERSION) return false;
+        if (!SessionGetVarint(&p, end, &start)) return false;
+        version = (int)v;
+        startUnixMs = (long long)start;
+        return true;
+    }
+
+    // Returns false at the end of the log or at a truncated record
+    bool Next(SessionEvent* e) {
+        uint64_t tag, v;
+        if (p >= end || !SessionGetVarint(&p, end, &tag)) return false;
+        e->type = (int)(tag & 7);
+        timeMs += (long long)(tag >> 3);
+        e->timeMs = timeMs;
+        e->value = 0;
+        e->mods = 0;
+        e->text.clear();
+        if (e->type == SES_TOGGLE) return true;
+        if (!SessionGetVarint(&p, end, &v)) return false;
+        switch (e->type) {
+            case SES_KEY:
+                e->value = (int)(v >> 3);
+                e->mods = (int)(v & 7);
+                break;
+            case SES_PASTE:
+            case SES_RECALL:
+                if (v > (uint64_t)(end - p)) return false;
+                e->text.assign((const char*)p, (size_t)v);
+                p += v;
+                break;
+            default:
+                e->value = (int)v;
+                break;
+        }
+        return true;
+    }
+};
+
+// Reads a log file into events. Returns false if it is not a session log;
+// a truncated tail (say, from a crash mid-write) is dropped.
+inline bool SessionLoad(FILE* f, std::vector<SessionEvent>* events, long long* startUnixMs) {
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+    SessionReader reader;
+    if (data.empty() || !reader.Open(&data[0], data.size())) return false;
+    if (startUnixMs) *startUnixMs = reader.startUnixMs;
+    events->clear();
+    SessionEvent e;
+    while (reader.Next(&e)) events->push_back(e);
+    return true;
+}
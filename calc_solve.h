@@ -0,0 +1,630 @@
+// Real roots of f(x) = 0 on an interval, and of polynomials
+// Portable C++ (no Win32). A function is scanned on an even grid, split
+// across threads, for sign changes and for dips of |f| that may touch
+// zero; every candidate is then refined on its own by Brent's method
+// (inverse quadratic interpolation and secant steps, with bisection as
+// the safeguard) or, for dips, by minimizing |f|. Polynomials are solved
+// whole by the Aberth-Ehrlich iteration, which finds every complex root at
+// once, finishing in double-double arithmetic where doubles run out of
+// digits, and the real ones are polished by Newton's method.
+//
+// Jobs count their work in done and stop early when cancel is set, so a
+// host can run them on a worker thread and show progress.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "calc_ddouble.h"
+#include "calc_expr.h"
+
+#define SOLVE_MAX_CELLS   100000000LL  // Grid cells a scan may use
+#define SOLVE_MAX_DEGREE  500
+#define SOLVE_MAX_ROOTS   100000       // Roots kept per solve
+#define SOLVE_TOUCH_TOL   1e-10        // |f| at a dip that counts as zero, relative to its sides
+
+// How a root was found
+#define SOLVE_ROOT_SIGN   0  // f changes sign across it
+#define SOLVE_ROOT_EXACT  1  // f is exactly zero on a grid point
+#define SOLVE_ROOT_TOUCH  2  // |f| dips to zero without a sign change (even multiplicity)
+#define SOLVE_ROOT_POLY   3  // Real root of a polynomial
+
+struct SolveRoot {
+    double x;
+    double fx;
+    int kind;
+    int multiplicity;  // Polynomial roots only; 1 otherwise
+};
+
+inline bool operator<(const SolveRoot& a, const SolveRoot& b) { return a.x < b.x; }
+
+// --- Entry ---
+
+// "lhs = rhs" becomes (lhs) - (rhs); the only variable must be x
+inline bool SolveCompile(const char* text, ExprProgram* program, char* message, int messageSize) {
+    std::string expr(text);
+    size_t eq = expr.find('=');
+    if (eq != std::string::npos) {
+        if (expr.find('=', eq + 1) != std::string::npos) {
+            snprintf(message, (size_t)messageSize, "More than one '='");
+            return false;
+        }
+        expr = "(" + expr.substr(0, eq) + ") - (" + expr.substr(eq + 1) + ")";
+    }
+    if (!ExprCompile(expr.c_str(), program, message, messageSize)) return false;
+    for (size_t i = 0; i < program->vars.size(); i++) {
+        if (program->vars[i] != "x") {
+            snprintf(message, (size_t)messageSize, "Unknown variable %.20s; use x", program->vars[i].c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Coefficients separated by spaces or commas, highest power first.
+// Leading zeros are dropped.
+inline bool SolveParsePolynomial(const char* text, std::vector<double>* coeffs, char* message, int messageSize) {
+    coeffs->clear();
+    const char* p = text;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r' || *p == '\n') p++;
+        if (!*p) break;
+        char* end;
+        double c = strtod(p, &end);
+        if (end == p || !(fabs(c) <= DBL_MAX)) {
+            snprintf(message, (size_t)messageSize, "Not a coefficient: %.20s", p);
+            return false;
+        }
+        if (!coeffs->empty() || c != 0) coeffs->push_back(c);
+        p = end;
+    }
+    if (coeffs->size() < 2) {
+        snprintf(message, (size_t)messageSize, coeffs->empty() ? "Enter coefficients, highest power first" : "A constant has no roots");
+        return false;
+    }
+    if ((int)coeffs->size() - 1 > SOLVE_MAX_DEGREE) {
+        snprintf(message, (size_t)messageSize, "Degree is limited to %d", SOLVE_MAX_DEGREE);
+        return false;
+    }
+    return true;
+}
+
+// --- Function roots ---
+
+// A stretch of the grid where a root may be: a sign change between a and
+// b, a dip of |f| centred between them, or an exact zero at a
+struct SolveCandidate {
+    double a, b;
+    double fa, fb;
+    int kind;
+};
+
+inline double SolveEval(const ExprProgram& program, double x, bool* ok) {
+    double v;
+    *ok = program.Eval(&x, &v) == EXPR_OK && v == v && fabs(v) <= DBL_MAX;
+    return v;
+}
+
+// Brent's method on a bracket with fa and fb of opposite signs
+inline double SolveBrent(const ExprProgram& program, double a, double b, double fa, double fb, double* fx,
+                         long long* evaluations) {
+    double c = a, fc = fa, d = b - a, e = d;
+    for (int iter = 0; iter < 200; iter++) {
+        if ((fb > 0) == (fc > 0)) {
+            c = a;
+            fc = fa;
+            d = e = b - a;
+        }
+        if (fabs(fc) < fabs(fb)) {
+            a = b; b = c; c = a;
+            fa = fb; fb = fc; fc = fa;
+        }
+        double tol = 2 * DBL_EPSILON * fabs(b) + 1e-300;
+        double m = (c - b) / 2;
+        if (fabs(m) <= tol || fb == 0) break;
+        if (fabs(e) >= tol && fabs(fa) > fabs(fb)) {
+            // Secant, or inverse quadratic interpolation through a, b, c
+            double s = fb / fa, p, q;
+            if (a == c) {
+                p = 2 * m * s;
+                q = 1 - s;
+            } else {
+                double r = fb / fc, t = fa / fc;
+                p = s * (2 * m * t * (t - r) - (b - a) * (r - 1));
+                q = (t - 1) * (r - 1) * (s - 1);
+            }
+            if (p > 0) q = -q;
+            else p = -p;
+            if (2 * p < std::min(3 * m * q - fabs(tol * q), fabs(e * q))) {
+                e = d;
+                d = p / q;
+            } else {
+                d = m;
+                e = m;
+            }
+        } else {
+            d = m;
+            e = m;
+        }
+        a = b;
+        fa = fb;
+        b += fabs(d) > tol ? d : (m > 0 ? tol : -tol);
+        bool ok;
+        fb = SolveEval(program, b, &ok);
+        ++*evaluations;
+        if (!ok) break;
+    }
+    *fx = fb;
+    return b;
+}
+
+// Golden-section search for the smallest |f| on [a, b]
+inline double SolveMinAbs(const ExprProgram& program, double a, double b, double* fx, long long* evaluations) {
+    const double g = 0.6180339887498949;
+    double x1 = b - g * (b - a), x2 = a + g * (b - a);
+    bool ok1, ok2;
+    double f1 = SolveEval(program, x1, &ok1), f2 = SolveEval(program, x2, &ok2);
+    *evaluations += 2;
+    for (int iter = 0; iter < 80 && b - a > 4 * DBL_EPSILON * std::max(fabs(a), fabs(b)); iter++) {
+        if (!ok1 || !ok2) break;
+        if (fabs(f1) <= fabs(f2)) {
+            b = x2; x2 = x1; f2 = f1;
+            x1 = b - g * (b - a);
+            f1 = SolveEval(program, x1, &ok1);
+        } else {
+            a = x1; x1 = x2; f1 = f2;
+            x2 = a + g * (b - a);
+            f2 = SolveEval(program, x2, &ok2);
+        }
+        ++*evaluations;
+    }
+    if (fabs(f1) <= fabs(f2)) {
+        *fx = f1;
+        return x1;
+    }
+    *fx = f2;
+    return x2;
+}
+
+// Turns one candidate into zero, one or two roots
+inline void SolveRefine(const ExprProgram& program, const SolveCandidate& c, std::vector<SolveRoot>* roots,
+                        long long* evaluations) {
+    SolveRoot r = {c.a, c.fa, c.kind, 1};
+    if (c.kind == SOLVE_ROOT_EXACT) {
+        roots->push_back(r);
+        return;
+    }
+    if (c.kind == SOLVE_ROOT_SIGN) {
+        r.x = SolveBrent(program, c.a, c.b, c.fa, c.fb, &r.fx, evaluations);
+        // A pole (tan x at pi/2) or a jump (floor x - 0.5) also changes
+        // sign, but |f| does not fall away there. Next to a root it is at
+        // most the bracket's slope times a few ulps of x, or in any case
+        // far below where the grid saw it.
+        double slope = fabs(c.fb - c.fa) / (c.b - c.a);
+        double limit = std::max(1e-6 * std::max(fabs(c.fa), fabs(c.fb)),
+                                1e4 * slope * (4 * DBL_EPSILON * fabs(r.x) + 1e-300));
+        if (fabs(r.fx) <= limit) roots->push_back(r);
+        return;
+    }
+    double fm;
+    double m = SolveMinAbs(program, c.a, c.b, &fm, evaluations);
+    if (fm == 0 || (fm > 0) != (c.fa > 0)) {
+        // The dip crosses zero: two close roots the grid did not resolve
+        if (fm == 0) {
+            r.x = m;
+            r.fx = 0;
+            r.kind = SOLVE_ROOT_TOUCH;
+            roots->push_back(r);
+            return;
+        }
+        SolveCandidate left = {c.a, m, c.fa, fm, SOLVE_ROOT_SIGN};
+        SolveCandidate right = {m, c.b, fm, c.fb, SOLVE_ROOT_SIGN};
+        SolveRefine(program, left, roots, evaluations);
+        SolveRefine(program, right, roots, evaluations);
+        return;
+    }
+    if (fabs(fm) <= SOLVE_TOUCH_TOL * std::max(1.0, std::min(fabs(c.fa), fabs(c.fb)))) {
+        r.x = m;
+        r.fx = fm;
+        r.kind = SOLVE_ROOT_TOUCH;
+        roots->push_back(r);
+    }
+}
+
+struct SolveJob {
+    enum { kBlock = 256 };
+
+    const ExprProgram* program;
+    double a, b;
+    long long cells;
+
+    std::atomic<long long> done;      // Grid points scanned plus candidates refined
+    std::atomic<long long> total;     // Grows once the scan knows its candidates
+    std::atomic<bool> cancel;
+    std::vector<SolveRoot> roots;     // Sorted by x
+    long long candidates;
+    long long evaluations;
+    bool truncated;                   // More than SOLVE_MAX_ROOTS roots
+
+    SolveJob() : program(NULL), a(0), b(0), cells(0), done(0), total(0), cancel(false),
+                 candidates(0), evaluations(0), truncated(false) {}
+
+    double X(long long i) const { return i == cells ? b : a + (b - a) * ((double)i / (double)cells); }
+};
+
+// Scans grid anchors [c0, c1) of cells + 1; anchor j owns an exact zero
+// at point j, the cell (j, j + 1) and a dip centred on point j
+inline void SolveScanRange(SolveJob* job, long long c0, long long c1, std::vector<SolveCandidate>* out) {
+    const ExprProgram& program = *job->program;
+    double xs[SolveJob::kBlock], fs[SolveJob::kBlock];
+    uint8_t errors[SolveJob::kBlock];
+    std::vector<double> scratch((size_t)std::max(1, program.maxDepth) * SolveJob::kBlock);
+    const double* columns[ExprProgram::kMaxVars];
+    for (size_t s = 0; s < program.vars.size(); s++) columns[s] = xs;
+
+    long long first = std::max(0LL, c0 - 1), last = std::min(job->cells, c1);
+    double f1 = 0, f2 = 0;
+    bool ok1 = false, ok2 = false;
+    for (long long i0 = first; i0 <= last; i0 += SolveJob::kBlock) {
+        if (job->cancel.load(std::memory_order_relaxed)) return;
+        int n = (int)std::min<long long>(SolveJob::kBlock, last - i0 + 1);
+        for (int k = 0; k < n; k++) xs[k] = job->X(i0 + k);
+        program.EvalBlock(columns, n, fs, errors, &scratch[0]);
+        for (int k = 0; k < n; k++) {
+            long long i = i0 + k;
+            double f = fs[k];
+            bool ok = errors[k] == EXPR_OK && f == f && fabs(f) <= DBL_MAX;
+            if (ok && f == 0 && i >= c0 && i < c1) {
+                SolveCandidate c = {xs[k], xs[k], 0, 0, SOLVE_ROOT_EXACT};
+                out->push_back(c);
+            }
+            long long j = i - 1;  // Anchor of the cell ending here and of the dip centred before
+            if (j >= c0 && j < c1 && ok && ok1 && f != 0 && f1 != 0) {
+                if ((f > 0) != (f1 > 0)) {
+                    SolveCandidate c = {job->X(j), xs[k], f1, f, SOLVE_ROOT_SIGN};
+                    out->push_back(c);
+                } else if (ok2 && (f2 > 0) == (f > 0) && fabs(f1) <= fabs(f2) && fabs(f1) < fabs(f)) {
+                    SolveCandidate c = {job->X(j - 1), xs[k], f2, f, SOLVE_ROOT_TOUCH};
+                    out->push_back(c);
+                }
+            }
+            f2 = f1; ok2 = ok1;
+            f1 = f; ok1 = ok;
+        }
+        job->done.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+// Scans and refines on `threads` threads; roots end up sorted in job->roots
+inline void SolveRun(SolveJob* job, int threads) {
+    if (threads < 1) threads = 1;
+    long long anchors = job->cells + 1;
+    if (threads > anchors / SolveJob::kBlock + 1) threads = (int)(anchors / SolveJob::kBlock + 1);
+    job->total = anchors;
+    job->done = 0;
+    job->roots.clear();
+    job->truncated = false;
+
+    std::vector<std::vector<SolveCandidate> > found((size_t)threads);
+    std::vector<std::thread> pool;
+    long long chunk = (anchors + threads - 1) / threads;
+    for (int t = 1; t < threads; t++) {
+        pool.push_back(std::thread(SolveScanRange, job, t * chunk, std::min(anchors, (t + 1) * chunk), &found[(size_t)t]));
+    }
+    SolveScanRange(job, 0, std::min(anchors, chunk), &found[0]);
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    pool.clear();
+
+    std::vector<SolveCandidate> candidates;
+    for (int t = 0; t < threads; t++) candidates.insert(candidates.end(), found[(size_t)t].begin(), found[(size_t)t].end());
+    job->candidates = (long long)candidates.size();
+    job->total += job->candidates;
+    job->evaluations = job->cells + 1;
+    if (job->cancel) return;
+
+    // Candidates cost very different amounts, so threads take them one at a time
+    std::atomic<long long> next(0);
+    std::vector<std::vector<SolveRoot> > roots((size_t)threads);
+    std::vector<long long> evaluations((size_t)threads, 0);
+    auto refine = [&](int self) {
+        for (;;) {
+            long long i = next.fetch_add(1);
+            if (i >= (long long)candidates.size() || job->cancel.load(std::memory_order_relaxed)) return;
+            SolveRefine(*job->program, candidates[(size_t)i], &roots[(size_t)self], &evaluations[(size_t)self]);
+            job->done.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+    for (int t = 1; t < threads; t++) pool.push_back(std::thread(refine, t));
+    refine(0);
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+
+    for (int t = 0; t < threads; t++) {
+        job->roots.insert(job->roots.end(), roots[(size_t)t].begin(), roots[(size_t)t].end());
+        job->evaluations += evaluations[(size_t)t];
+    }
+    std::sort(job->roots.begin(), job->roots.end());
+    // A root on a cell edge can be reached from both sides
+    size_t kept = 0;
+    for (size_t i = 0; i < job->roots.size(); i++) {
+        if (kept && fabs(job->roots[i].x - job->roots[kept - 1].x) <= 4 * DBL_EPSILON * std::max(1.0, fabs(job->roots[i].x))) continue;
+        job->roots[kept++] = job->roots[i];
+    }
+    job->roots.resize(kept);
+    if (job->roots.size() > SOLVE_MAX_ROOTS) {
+        job->roots.resize(SOLVE_MAX_ROOTS);
+        job->truncated = true;
+    }
+}
+
+// --- Polynomials ---
+
+typedef std::complex<double> SolveComplex;
+
+// p(z) / p'(z) for coefficients highest first. Beyond the unit circle the
+// reversed polynomial is evaluated at 1/z instead, so high degrees do not
+// overflow. *noisy is set when |p(z)| is within the running rounding
+// error bound of Horner's rule, where further steps only wander.
+inline SolveComplex SolveNewtonRatio(const std::vector<double>& c, SolveComplex z, bool* noisy) {
+    size_t n = c.size() - 1;
+    double r = std::abs(z);
+    if (r <= 1) {
+        SolveComplex p = c[0], d = 0;
+        double bound = std::abs(p) / 2;
+        for (size_t i = 1; i <= n; i++) {
+            d = d * z + p;
+            p = p * z + c[i];
+            bound = bound * r + std::abs(p);
+        }
+        *noisy = std::abs(p) <= 4 * DBL_EPSILON * (2 * bound - std::abs(p));
+        return p / d;
+    }
+    // p(z) = z^n q(w) with w = 1/z and q the reversed polynomial, so
+    // p / p' = 1 / (n w - w^2 q'(w) / q(w))
+    SolveComplex w = 1.0 / z, q = c[n], dq = 0;
+    double bound = std::abs(q) / 2;
+    for (size_t i = n; i-- > 0;) {
+        dq = dq * w + q;
+        q = q * w + c[i];
+        bound = bound / r + std::abs(q);
+    }
+    *noisy = std::abs(q) <= 4 * DBL_EPSILON * (2 * bound - std::abs(q));
+    return 1.0 / ((double)n * w - w * w * dq / q);
+}
+
+// A complex number with double-double parts, for the second pass
+struct SolveComplexDD {
+    DDouble re, im;
+};
+
+// a * z + b
+inline SolveComplexDD SolveMulAddDD(const SolveComplexDD& a, const SolveComplexDD& z, const SolveComplexDD& b) {
+    SolveComplexDD r;
+    r.re = DDAdd(DDSub(DDMul(a.re, z.re), DDMul(a.im, z.im)), b.re);
+    r.im = DDAdd(DDAdd(DDMul(a.re, z.im), DDMul(a.im, z.re)), b.im);
+    return r;
+}
+
+inline SolveComplex SolveRoundDD(const SolveComplexDD& a) {
+    return SolveComplex(DDToDouble(a.re), DDToDouble(a.im));
+}
+
+// SolveNewtonRatio with Horner's rule carried in double-double, so p is
+// only noisy some 30 digits down. Only the ratio needs to come back in
+// double: the roots themselves are stored as doubles.
+inline SolveComplex SolveNewtonRatioDD(const std::vector<double>& c, SolveComplex z, bool* noisy) {
+    size_t n = c.size() - 1;
+    double r = std::abs(z);
+    const double tol = 8 * DBL_EPSILON * DBL_EPSILON;
+    SolveComplexDD p, d, coeff, at;
+    if (r <= 1) {
+        at.re = DDouble(z.real());
+        at.im = DDouble(z.imag());
+        p.re = DDouble(c[0]);
+        double bound = fabs(c[0]) / 2;
+        for (size_t i = 1; i <= n; i++) {
+            d = SolveMulAddDD(d, at, p);
+            coeff.re = DDouble(c[i]);
+            p = SolveMulAddDD(p, at, coeff);
+            bound = bound * r + std::abs(SolveRoundDD(p));
+        }
+        double size = std::abs(SolveRoundDD(p));
+        *noisy = size <= tol * (2 * bound - size);
+        return SolveRoundDD(p) / SolveRoundDD(d);
+    }
+    // 1/z worked out in double-double too, or the rounding of w alone
+    // would keep p well above its noise level
+    double e1, e2;
+    double re2 = TwoProd(z.real(), z.real(), &e1);
+    double im2 = TwoProd(z.imag(), z.imag(), &e2);
+    DDouble mod = DDAdd(DDouble(re2, e1), DDouble(im2, e2));
+    DDDiv(DDouble(z.real()), mod, &at.re);
+    DDDiv(DDouble(-z.imag()), mod, &at.im);
+    p.re = DDouble(c[n]);
+    double bound = fabs(c[n]) / 2;
+    for (size_t i = n; i-- > 0;) {
+        d = SolveMulAddDD(d, at, p);
+        coeff.re = DDouble(c[i]);
+        p = SolveMulAddDD(p, at, coeff);
+        bound = bound / r + std::abs(SolveRoundDD(p));
+    }
+    double size = std::abs(SolveRoundDD(p));
+    *noisy = size <= tol * (2 * bound - size);
+    SolveComplex w = SolveRoundDD(at);
+    return 1.0 / ((double)n * w - w * w * SolveRoundDD(d) / SolveRoundDD(p));
+}
+
+// One Gauss-Seidel sweep of the Aberth-Ehrlich iteration over the roots
+// not yet frozen; a root freezes once its step is at rounding level of z
+// or p is noisy there. Returns how many froze.
+inline size_t SolveAberthSweep(const std::vector<double>& c, std::vector<SolveComplex>& z,
+                               std::vector<bool>& frozen, bool doubleDouble) {
+    size_t n = z.size(), count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (frozen[i]) continue;
+        bool noisy;
+        SolveComplex ratio = doubleDouble ? SolveNewtonRatioDD(c, z[i], &noisy) : SolveNewtonRatio(c, z[i], &noisy);
+        SolveComplex sum = 0;
+        for (size_t j = 0; j < n; j++) {
+            if (j != i) sum += 1.0 / (z[i] - z[j]);
+        }
+        SolveComplex step = ratio / (1.0 - ratio * sum);
+        if (!(std::abs(step) == std::abs(step))) step = ratio;
+        z[i] -= step;
+        if (noisy || std::abs(step) <= 4 * DBL_EPSILON * std::abs(z[i])) {
+            frozen[i] = true;
+            count++;
+        }
+    }
+    return count;
+}
+
+// All complex roots of the polynomial by the Aberth-Ehrlich iteration.
+// The first pass runs in double until p is noisy at every root. For an
+// ill-conditioned polynomial that can still be far out (Wilkinson's
+// product (x-1)...(x-20) is noisy a whole unit either side of 15), so the
+// roots that stopped on noise get a second pass with p evaluated in
+// double-double. Returns false when cancelled or when it failed to
+// converge.
+inline bool SolvePolynomial(const std::vector<double>& coeffs, std::vector<SolveComplex>* roots,
+                            const std::atomic<bool>* cancel, int* iterations) {
+    // Zero trailing coefficients are roots at 0
+    std::vector<double> c(coeffs);
+    roots->clear();
+    while (c.size() > 1 && c.back() == 0) {
+        c.pop_back();
+        roots->push_back(0.0);
+    }
+    size_t n = c.size() - 1;
+    *iterations = 0;
+    if (!n) return true;
+
+    // Start on a circle about the centroid whose radius is the geometric
+    // mean of the root moduli
+    double centre = -c[1] / c[0] / (double)n;
+    double radius = pow(fabs(c[n] / c[0]), 1.0 / (double)n);
+    if (!(radius > 0) || !(radius < DBL_MAX)) radius = 1;
+    radius += fabs(centre) * 0.5 + 0.5;
+    std::vector<SolveComplex> z(n);
+    for (size_t k = 0; k < n; k++) {
+        double angle = 6.283185307179586 * (double)k / (double)n + 0.4;
+        z[k] = SolveComplex(centre + radius * cos(angle), radius * sin(angle));
+    }
+
+    std::vector<bool> frozen(n, false);
+    size_t remaining = n;
+    for (int iter = 0; iter < 2000 && remaining; iter++) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) return false;
+        ++*iterations;
+        remaining -= SolveAberthSweep(c, z, frozen, false);
+    }
+    // Second pass: thaw every root whose last step was not already at
+    // rounding level
+    remaining = 0;
+    for (size_t i = 0; i < n; i++) {
+        bool noisy;
+        SolveComplex ratio = SolveNewtonRatio(c, z[i], &noisy);
+        frozen[i] = !(std::abs(ratio) > 4 * DBL_EPSILON * std::abs(z[i]));
+        if (!frozen[i]) remaining++;
+    }
+    for (int iter = 0; iter < 500 && remaining; iter++) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) return false;
+        ++*iterations;
+        remaining -= SolveAberthSweep(c, z, frozen, true);
+    }
+    roots->insert(roots->end(), z.begin(), z.end());
+    return remaining == 0;
+}
+
+inline double SolvePolyEval(const std::vector<double>& c, double x, double* derivative, bool* noisy = NULL) {
+    double p = c[0], d = 0, bound = fabs(p) / 2;
+    for (size_t i = 1; i < c.size(); i++) {
+        d = d * x + p;
+        p = p * x + c[i];
+        bound = bound * fabs(x) + fabs(p);
+    }
+    *derivative = d;
+    if (noisy) *noisy = fabs(p) <= 2 * DBL_EPSILON * (2 * bound - fabs(p));
+    return p;
+}
+
+// SolvePolyEval in double-double, rounded back at the end
+inline double SolvePolyEvalDD(const std::vector<double>& c, double x, double* derivative, bool* noisy = NULL) {
+    DDouble p(c[0]), d;
+    double bound = fabs(c[0]) / 2;
+    for (size_t i = 1; i < c.size(); i++) {
+        d = DDAdd(DDMulDouble(d, x), p);
+        p = DDAdd(DDMulDouble(p, x), DDouble(c[i]));
+        bound = bound * fabs(x) + fabs(p.hi);
+    }
+    *derivative = DDToDouble(d);
+    double value = DDToDouble(p);
+    if (noisy) *noisy = fabs(value) <= 8 * DBL_EPSILON * DBL_EPSILON * (2 * bound - fabs(value));
+    return value;
+}
+
+// Newton steps on c from x while they keep shrinking the residual
+inline double SolvePolyPolish(const std::vector<double>& c, double x) {
+    double d, f = SolvePolyEvalDD(c, x, &d);
+    for (int iter = 0; iter < 16 && d != 0 && f != 0; iter++) {
+        double next = x - f / d, dn;
+        double fn = SolvePolyEvalDD(c, next, &dn);
+        if (!(fabs(fn) < fabs(f))) break;
+        x = next; f = fn; d = dn;
+    }
+    return x;
+}
+
+// Real roots in [a, b]. Near a root of multiplicity k, double arithmetic
+// only resolves x to about eps^(1/k), so the copies of a multiple root
+// come out apart and slightly complex, and a double root whose
+// coefficients were rounded on entry (x^2 - 2.2x + 1.21) may really be a
+// pair 1e-8 off the axis. A root counts as real when its imaginary part
+// is at rounding level or p is noisy at its real part, and neighbours
+// count as one multiple root when p is noisy in double-double between
+// them, or in double unless both were cleanly real. A k-fold root is then
+// polished as a simple root of the (k-1)th derivative.
+inline void SolvePolyRealRoots(const std::vector<double>& coeffs, const std::vector<SolveComplex>& all,
+                               double a, double b, std::vector<SolveRoot>* out, int* complexCount) {
+    std::vector<std::pair<double, bool> > real;  // x, cleanly real
+    double d;
+    bool noisy;
+    *complexCount = 0;
+    for (size_t i = 0; i < all.size(); i++) {
+        double x = all[i].real();
+        bool clean = fabs(all[i].imag()) <= 4 * DBL_EPSILON * (1 + fabs(x));
+        SolvePolyEval(coeffs, x, &d, &noisy);
+        if (clean || noisy) real.push_back(std::make_pair(x, clean));
+        else ++*complexCount;
+    }
+    std::sort(real.begin(), real.end());
+    out->clear();
+    for (size_t i = 0; i < real.size();) {
+        size_t j = i + 1;
+        double sum = real[i].first;
+        for (; j < real.size(); j++) {
+            double mid = (real[j - 1].first + real[j].first) / 2;
+            SolvePolyEvalDD(coeffs, mid, &d, &noisy);
+            if (!noisy && !(real[j - 1].second && real[j].second)) SolvePolyEval(coeffs, mid, &d, &noisy);
+            if (!noisy && real[j].first != real[j - 1].first) break;
+            sum += real[j].first;
+        }
+        SolveRoot r = {sum / (double)(j - i), 0, SOLVE_ROOT_POLY, (int)(j - i)};
+        std::vector<double> c(coeffs);
+        for (int k = 1; k < r.multiplicity && c.size() > 2; k++) {
+            size_t n = c.size() - 1;
+            for (size_t t = 0; t < n; t++) c[t] *= (double)(n - t);
+            c.pop_back();
+        }
+        r.x = SolvePolyPolish(c, r.x);
+        r.fx = SolvePolyEval(coeffs, r.x, &d);
+        if (r.x >= a && r.x <= b) out->push_back(r);
+        i = j;
+    }
+}
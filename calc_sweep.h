@@ -0,0 +1,409 @@
+// Parameter sweeps: one formula evaluated over a grid of variable values
+// Portable C++ (no Win32). Each variable is an axis (a list or an evenly
+// stepped range) and the grid is their product, with the last axis varying
+// fastest. Points are split across threads by a work-stealing scheduler:
+// every worker owns a range of point indices and eats it from the front in
+// chunks; an idle worker steals the back half of the largest remaining
+// range. Results go to summary statistics and, optionally, to a sink.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "calc_expr.h"
+
+struct SweepAxis {
+    char name[32];
+    double start, step;        // Range: start + i * step, i < count
+    long long count;
+    std::vector<double> list;  // Explicit values instead of a range
+
+    double At(long long i) const { return list.empty() ? start + (double)i * step : list[(size_t)i]; }
+};
+
+// Parses one axis line:
+//   rate = 0.01..0.1 step 0.005     n = 12, 24, 36
+//   price = 1..100 count 1000       qty = 5
+inline bool SweepParseAxis(const char* line, SweepAxis* axis, char* message, int messageSize) {
+    const char* p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    int len = 0;
+    while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9' && len) || *p == '_') {
+        if (len < (int)sizeof(axis->name) - 1) axis->name[len++] = *p;
+        p++;
+    }
+    axis->name[len] = '\0';
+    while (*p == ' ' || *p == '\t') p++;
+    if (!len || *p != '=') {
+        snprintf(message, (size_t)messageSize, "Expected name = values in \"%.40s\"", line);
+        return false;
+    }
+    p++;
+
+    char* end;
+    double first = strtod(p, &end);
+    if (end > p + 1 && end[-1] == '.' && end[0] == '.') end--;  // "1..5" is not "1." then ".5"
+    if (end == p) {
+        snprintf(message, (size_t)messageSize, "%s: expected a number", axis->name);
+        return false;
+    }
+    p = end;
+    while (*p == ' ' || *p == '\t') p++;
+    axis->list.clear();
+
+    if (p[0] == '.' && p[1] == '.') {
+        double last = strtod(p + 2, &end);
+        if (end == p + 2) {
+            snprintf(message, (size_t)messageSize, "%s: expected the range end", axis->name);
+            return false;
+        }
+        p = end;
+        while (*p == ' ' || *p == '\t') p++;
+        axis->start = first;
+        if (strncmp(p, "count", 5) == 0) {
+            long long n = strtoll(p + 5, &end, 10);
+            if (end == p + 5 || n < 1) {
+                snprintf(message, (size_t)messageSize, "%s: count must be at least 1", axis->name);
+                return false;
+            }
+            axis->count = n;
+            axis->step = n > 1 ? (last - first) / (double)(n - 1) : 0;
+            p = end;
+        } else {
+            double step = 1;
+            if (strncmp(p, "step", 4) == 0) {
+                step = strtod(p + 4, &end);
+                if (end == p + 4) step = 0;
+                p = end;
+            }
+            if (step == 0 || (last - first) / step < 0) {
+                snprintf(message, (size_t)messageSize, "%s: step must move from start to end", axis->name);
+                return false;
+            }
+            // Tolerate rounding so 0..1 step 0.1 includes 1
+            double span = (last - first) / step;
+            if (span > 4e18) {
+                snprintf(message, (size_t)messageSize, "%s: too many values", axis->name);
+                return false;
+            }
+            axis->count = (long long)floor(span + 1e-9) + 1;
+            axis->step = step;
+        }
+    } else {
+        axis->list.push_back(first);
+        while (*p == ',') {
+            double v = strtod(p + 1, &end);
+            if (end == p + 1) {
+                snprintf(message, (size_t)messageSize, "%s: expected a number after ','", axis->name);
+                return false;
+            }
+            axis->list.push_back(v);
+            p = end;
+            while (*p == ' ' || *p == '\t') p++;
+        }
+        axis->count = (long long)axis->list.size();
+        axis->start = first;
+        axis->step = 0;
+    }
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p) {
+        snprintf(message, (size_t)messageSize, "%s: unexpected \"%.20s\"", axis->name, p);
+        return false;
+    }
+    return true;
+}
+
+// Count, mean, variance and extremes of the results, mergeable across
+// threads (Chan et al.'s pairwise update)
+struct SweepStats {
+    long long count;         // Points that evaluated without error
+    long long errors;
+    double mean, m2;
+    double min, max;
+    long long minIndex, maxIndex;
+    long long firstError;    // Index of the first failing point, or -1
+    int firstErrorCode;
+
+    SweepStats() : count(0), errors(0), mean(0), m2(0), min(0), max(0),
+                   minIndex(-1), maxIndex(-1), firstError(-1), firstErrorCode(EXPR_OK) {}
+
+    double Variance() const { return count > 1 ? m2 / (double)(count - 1) : 0; }
+
+    void Merge(const SweepStats& o) {
+        if (o.count) {
+            if (!count) {
+                mean = o.mean; m2 = o.m2;
+                min = o.min; max = o.max;
+                minIndex = o.minIndex; maxIndex = o.maxIndex;
+            } else {
+                double n = (double)(count + o.count);
+                double delta = o.mean - mean;
+                mean += delta * (double)o.count / n;
+                m2 += o.m2 + delta * delta * (double)count * (double)o.count / n;
+                if (o.min < min || (o.min == min && o.minIndex < minIndex)) { min = o.min; minIndex = o.minIndex; }
+                if (o.max > max || (o.max == max && o.maxIndex < maxIndex)) { max = o.max; maxIndex = o.maxIndex; }
+            }
+            count += o.count;
+        }
+        errors += o.errors;
+        if (o.firstError >= 0 && (firstError < 0 || o.firstError < firstError)) {
+            firstError = o.firstError;
+            firstErrorCode = o.firstErrorCode;
+        }
+    }
+
+    // Folds in a block of consecutive points starting at index first
+    void AddBlock(long long first, int n, const double* values, const uint8_t* errors) {
+        SweepStats b;
+        double sum = 0;
+        for (int i = 0; i < n; i++) {
+            if (errors[i]) {
+                if (b.firstError < 0) { b.firstError = first + i; b.firstErrorCode = errors[i]; }
+                b.errors++;
+                continue;
+            }
+            double v = values[i];
+            if (!b.count || v < b.min) { b.min = v; b.minIndex = first + i; }
+            if (!b.count || v > b.max) { b.max = v; b.maxIndex = first + i; }
+            sum += v;
+            b.count++;
+        }
+        if (b.count) {
+            b.mean = sum / (double)b.count;
+            for (int i = 0; i < n; i++) {
+                if (!errors[i]) b.m2 += (values[i] - b.mean) * (values[i] - b.mean);
+            }
+        }
+        Merge(b);
+    }
+};
+
+// Receives each evaluated block, from any worker thread and in completion
+// order; first is the grid index of values[0]
+typedef void (*SweepSinkFn)(void* ctx, long long first, int n, const double* values, const uint8_t* errors);
+
+struct SweepJob {
+    enum { kBlock = 256, kChunk = 16384 };
+
+    const ExprProgram* program;
+    std::vector<SweepAxis> axes;
+    std::vector<int> slotAxis;   // Program variable slot -> axis
+    long long total;
+    SweepSinkFn sink;
+    void* sinkCtx;
+
+    std::atomic<long long> done;
+    std::atomic<long long> steals;
+    std::atomic<bool> cancel;
+    SweepStats stats;
+
+    SweepJob() : program(NULL), total(0), sink(NULL), sinkCtx(NULL), done(0), steals(0), cancel(false) {}
+
+    // Axis positions of a grid index, last axis fastest
+    void Decode(long long index, long long* digits) const {
+        for (size_t a = axes.size(); a-- > 0;) {
+            digits[a] = index % axes[a].count;
+            index /= axes[a].count;
+        }
+    }
+};
+
+// Binds the program's variables to axes and sizes the grid
+inline bool SweepPrepare(SweepJob* job, const ExprProgram& program, const std::vector<SweepAxis>& axes,
+                         char* message, int messageSize) {
+    job->program = &program;
+    job->axes = axes;
+    job->slotAxis.assign(program.vars.size(), -1);
+    for (size_t s = 0; s < program.vars.size(); s++) {
+        for (size_t a = 0; a < axes.size(); a++) {
+            if (program.vars[s] == axes[a].name) job->slotAxis[s] = (int)a;
+        }
+        if (job->slotAxis[s] < 0) {
+            snprintf(message, (size_t)messageSize, "No values given for %s", program.vars[s].c_str());
+            return false;
+        }
+    }
+    job->total = 1;
+    for (size_t a = 0; a < axes.size(); a++) {
+        if (job->total > (long long)4e18 / axes[a].count) {
+            snprintf(message, (size_t)messageSize, "Grid too large");
+            return false;
+        }
+        job->total *= axes[a].count;
+    }
+    return true;
+}
+
+struct SweepRange {
+    std::mutex lock;
+    long long begin, end;
+};
+
+// Evaluates [begin, end) a block at a time into stats and the sink
+inline void SweepEvalRange(SweepJob* job, long long begin, long long end, SweepStats* stats,
+                           std::vector<double>* scratch) {
+    const int kBlock = SweepJob::kBlock;
+    size_t nAxes = job->axes.size(), nSlots = job->slotAxis.size();
+    scratch->resize((size_t)(job->program->maxDepth + nSlots + 1) * kBlock);
+    double* stack = &(*scratch)[0];
+    double* out = stack + (size_t)job->program->maxDepth * kBlock;
+    double* columnBase = out + kBlock;
+    std::vector<long long> digits(nAxes + 1);
+    double* column[ExprProgram::kMaxVars];
+    const double* columns[ExprProgram::kMaxVars];
+    for (size_t s = 0; s < nSlots; s++) columns[s] = column[s] = columnBase + s * kBlock;
+    uint8_t errors[SweepJob::kBlock];
+
+    job->Decode(begin, &digits[0]);
+    for (long long first = begin; first < end; first += kBlock) {
+        int n = end - first < kBlock ? (int)(end - first) : kBlock;
+        for (int i = 0; i < n; i++) {
+            for (size_t s = 0; s < nSlots; s++) {
+                int a = job->slotAxis[s];
+                column[s][i] = job->axes[(size_t)a].At(digits[(size_t)a]);
+            }
+            // Odometer step to the next point
+            for (size_t a = nAxes; a-- > 0;) {
+                if (++digits[a] < job->axes[a].count) break;
+                digits[a] = 0;
+            }
+        }
+        job->program->EvalBlock(columns, n, out, errors, stack);
+        stats->AddBlock(first, n, out, errors);
+        if (job->sink) job->sink(job->sinkCtx, first, n, out, errors);
+    }
+}
+
+// Takes the next chunk from a worker's own range
+inline bool SweepTakeChunk(SweepRange* r, long long* begin, long long* end) {
+    std::lock_guard<std::mutex> guard(r->lock);
+    if (r->begin >= r->end) return false;
+    *begin = r->begin;
+    *end = r->end - r->begin > SweepJob::kChunk ? r->begin + SweepJob::kChunk : r->end;
+    r->begin = *end;
+    return true;
+}
+
+// Moves the back half of the fullest other range into the thief's own.
+// Work is never created, so finding every range empty means we are done.
+inline bool SweepSteal(SweepRange* ranges, int count, int thief, long long* stolen) {
+    int victim = -1;
+    long long most = 0;
+    for (int k = 1; k < count; k++) {
+        int v = (thief + k) % count;
+        std::lock_guard<std::mutex> guard(ranges[v].lock);
+        if (ranges[v].end - ranges[v].begin > most) { most = ranges[v].end - ranges[v].begin; victim = v; }
+    }
+    if (victim < 0) return false;
+    long long begin, end;
+    {
+        std::lock_guard<std::mutex> guard(ranges[victim].lock);
+        long long left = ranges[victim].end - ranges[victim].begin;
+        if (left <= 0) return true;  // Raced with its owner; look again
+        end = ranges[victim].end;
+        begin = left <= SweepJob::kChunk ? ranges[victim].begin : end - left / 2;
+        ranges[victim].end = begin;
+    }
+    std::lock_guard<std::mutex> guard(ranges[thief].lock);
+    ranges[thief].begin = begin;
+    ranges[thief].end = end;
+    (*stolen)++;
+    return true;
+}
+
+// Runs the whole grid on the given number of threads (0 = one per core)
+// and leaves the merged statistics in job->stats. Blocks until finished
+// or job->cancel is set.
+inline void SweepRun(SweepJob* job, int threads) {
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    if ((long long)threads > job->total / SweepJob::kChunk + 1) threads = (int)(job->total / SweepJob::kChunk + 1);
+    job->done = 0;
+    job->steals = 0;
+    job->stats = SweepStats();
+
+    std::vector<SweepRange> ranges((size_t)threads);
+    for (int t = 0; t < threads; t++) {
+        ranges[(size_t)t].begin = job->total * t / threads;
+        ranges[(size_t)t].end = job->total * (t + 1) / threads;
+    }
+    std::vector<SweepStats> partial((size_t)threads);
+
+    auto worker = [&](int self) {
+        std::vector<double> scratch;
+        long long stolen = 0;
+        SweepStats& stats = partial[(size_t)self];
+        while (!job->cancel.load(std::memory_order_relaxed)) {
+            long long begin, end;
+            if (!SweepTakeChunk(&ranges[(size_t)self], &begin, &end)) {
+                if (!SweepSteal(&ranges[0], threads, self, &stolen)) break;
+                continue;
+            }
+            SweepEvalRange(job, begin, end, &stats, &scratch);
+            job->done.fetch_add(end - begin, std::memory_order_relaxed);
+        }
+        job->steals.fetch_add(stolen);
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) pool.push_back(std::thread(worker, t));
+    worker(0);
+    for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+    for (int t = 0; t < threads; t++) job->stats.Merge(partial[(size_t)t]);
+}
+
+// --- CSV sink ---
+
+// Writes "index,<axes...>,result" rows. Rows are formatted by the calling
+// worker and written under a lock, so they appear in completion order;
+// the index column gives the grid order.
+struct SweepCsvSink {
+    FILE* file;
+    const SweepJob* job;
+    std::mutex lock;
+    long long rows;
+    bool failed;
+
+    SweepCsvSink(FILE* f, const SweepJob* j) : file(f), job(j), rows(0), failed(false) {}
+
+    bool WriteHeader() {
+        std::string header = "index";
+        for (size_t a = 0; a < job->axes.size(); a++) {
+            header += ',';
+            header += job->axes[a].name;
+        }
+        header += ",result\n";
+        if (fputs(header.c_str(), file) < 0) failed = true;
+        return !failed;
+    }
+
+    static void Write(void* ctx, long long first, int n, const double* values, const uint8_t* errors) {
+        SweepCsvSink* self = (SweepCsvSink*)ctx;
+        const SweepJob* job = self->job;
+        std::vector<long long> digits(job->axes.size() + 1);
+        job->Decode(first, &digits[0]);
+        std::string text;
+        text.reserve((size_t)n * 48);
+        char cell[40];
+        for (int i = 0; i < n; i++) {
+            snprintf(cell, sizeof(cell), "%lld", first + i);
+            text += cell;
+            for (size_t a = 0; a < job->axes.size(); a++) {
+                snprintf(cell, sizeof(cell), ",%.12g", job->axes[a].At(digits[a]));
+                text += cell;
+            }
+            if (errors[i]) snprintf(cell, sizeof(cell), ",Error\n");
+            else snprintf(cell, sizeof(cell), ",%.12g\n", values[i]);
+            text += cell;
+            for (size_t a = job->axes.size(); a-- > 0;) {
+                if (++digits[a] < job->axes[a].count) break;
+                digits[a] = 0;
+            }
+        }
+        std::lock_guard<std::mutex> guard(self->lock);
+        if (self->failed) return;
+        if (fwrite(text.data(), 1, text.size(), self->file) != text.size()) self->failed = true;
+        else self->rows += n;
+    }
+};
@@ -0,0 +1,468 @@
+// Time zone support from the IANA tz database (TZif files)
+// Each zone file is memory-mapped once, parsed into a compact index
+// (sorted UTC transition times + one type byte each) and cached, so later
+// conversions are a binary search plus, past the last listed transition,
+// the zone's POSIX TZ footer rule evaluated in closed form.
+// Times are milliseconds since 1970-01-01 UTC; leap seconds are ignored.
+
+#pragma once
+
+#include "calc_dates.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define MS_PER_SECOND 1000LL
+#define MS_PER_MINUTE 60000LL
+#define MS_PER_HOUR   3600000LL
+#define MS_PER_DAY    86400000LL
+
+// --- Read-only file mapping ---
+
+struct MappedFile {
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE hFile;
+    HANDLE hMap;
+#endif
+    MappedFile() : data(NULL), size(0) {}
+};
+
+inline bool MapFileReadOnly(const char* path, MappedFile* mf) {
+#ifdef _WIN32
+    mf->hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mf->hFile == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mf->hFile, &size) || size.QuadPart == 0) { CloseHandle(mf->hFile); return false; }
+    mf->hMap = CreateFileMappingA(mf->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mf->hMap) { CloseHandle(mf->hFile); return false; }
+    mf->data = (const unsigned char*)MapViewOfFile(mf->hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!mf->data) { CloseHandle(mf->hMap); CloseHandle(mf->hFile); return false; }
+    mf->size = (size_t)size.QuadPart;
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    mf->data = (const unsigned char*)p;
+    mf->size = (size_t)st.st_size;
+    return true;
+#endif
+}
+
+inline void UnmapFile(MappedFile* mf) {
+    if (!mf->data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mf->data);
+    CloseHandle(mf->hMap);
+    CloseHandle(mf->hFile);
+#else
+    munmap((void*)mf->data, mf->size);
+#endif
+    mf->data = NULL;
+    mf->size = 0;
+}
+
+// --- POSIX TZ rules (the TZif footer) ---
+
+struct TzRuleDate {
+    char kind;      // 'J' (1..365, no Feb 29), 'N' (0..365), 'M' (month.week.day)
+    int month, week, day;
+    int timeSec;    // Local wall time of the switch, may be negative or > 24h
+};
+
+struct TzPosixRule {
+    int stdOffset;  // Seconds east of UTC
+    int dstOffset;
+    bool hasDst;
+    char stdAbbr[12];
+    char dstAbbr[12];
+    TzRuleDate start, end;
+};
+
+// Offset in seconds east of UTC plus whether DST is in effect
+struct TzType {
+    int32_t utoff;
+    bool isDst;
+    char abbr[12];
+};
+
+inline const char* TzParseAbbr(const char* p, char* out) {
+    int n = 0;
+    if (*p == '<') {
+        p++;
+        while (*p && *p != '>') { if (n < 11) out[n++] = *p; p++; }
+        if (*p == '>') p++;
+    } else {
+        while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) { if (n < 11) out[n++] = *p; p++; }
+    }
+    out[n] = '\0';
+    return p;
+}
+
+// [+-]hh[:mm[:ss]] in seconds
+inline const char* TzParseTime(const char* p, int* secs) {
+    int sign = 1;
+    if (*p == '+' || *p == '-') { sign = *p == '-' ? -1 : 1; p++; }
+    int parts[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        if (*p < '0' || *p > '9') break;
+        while (*p >= '0' && *p <= '9') parts[i] = parts[i] * 10 + (*p++ - '0');
+        if (*p != ':') break;
+        p++;
+    }
+    *secs = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+    return p;
+}
+
+inline const char* TzParseRuleDate(const char* p, TzRuleDate* r) {
+    r->timeSec = 7200;
+    if (*p == 'M') {
+        r->kind = 'M';
+        r->month = (int)strtol(p + 1, (char**)&p, 10);
+        if (*p == '.') r->week = (int)strtol(p + 1, (char**)&p, 10);
+        if (*p == '.') r->day = (int)strtol(p + 1, (char**)&p, 10);
+    } else if (*p == 'J') {
+        r->kind = 'J';
+        r->day = (int)strtol(p + 1, (char**)&p, 10);
+    } else {
+        r->kind = 'N';
+        r->day = (int)strtol(p, (char**)&p, 10);
+    }
+    if (*p == '/') p = TzParseTime(p + 1, &r->timeSec);
+    return p;
+}
+
+// Parses strings such as "CST-8" or "EST5EDT,M3.2.0,M11.1.0"
+inline bool TzParsePosix(const char* p, TzPosixRule* rule) {
+    memset(rule, 0, sizeof(*rule));
+    p = TzParseAbbr(p, rule->stdAbbr);
+    if (!rule->stdAbbr[0]) return false;
+    int off;
+    p = TzParseTime(p, &off);
+    rule->stdOffset = -off; // POSIX offsets count west of UTC
+    if (*p == '\0' || *p == '\n') return true;
+    p = TzParseAbbr(p, rule->dstAbbr);
+    if (!rule->dstAbbr[0]) return false;
+    rule->hasDst = true;
+    rule->dstOffset = rule->stdOffset + 3600;
+    if (*p != ',' && *p != '\0' && *p != '\n') {
+        p = TzParseTime(p, &off);
+        rule->dstOffset = -off;
+    }
+    // US rules are the POSIX default when none are given
+    rule->start.kind = 'M'; rule->start.month = 3; rule->start.week = 2; rule->start.day = 0; rule->start.timeSec = 7200;
+    rule->end.kind = 'M'; rule->end.month = 11; rule->end.week = 1; rule->end.day = 0; rule->end.timeSec = 7200;
+    if (*p == ',') {
+        p = TzParseRuleDate(p + 1, &rule->start);
+        if (*p != ',') return false;
+        p = TzParseRuleDate(p + 1, &rule->end);
+    }
+    return true;
+}
+
+// Day number (days since 1970-01-01) a rule date falls on in a year
+inline long long TzRuleDay(const TzRuleDate& r, int year) {
+    CivilDate jan1 = {year, 1, 1};
+    long long base = DaysFromCivil(jan1);
+    if (r.kind == 'J') {
+        long long d = base + r.day - 1;
+        if (IsLeapYear(year) && r.day >= 60) d++;
+        return d;
+    }
+    if (r.kind == 'N') return base + r.day;
+    // Day r.day of week r.week (5 = last) in month r.month
+    CivilDate first = {year, r.month, 1};
+    long long d = DaysFromCivil(first);
+    d += FloorMod(r.day - WeekdayFromDays(d), 7) + (long long)(r.week - 1) * 7;
+    int dim = DaysInMonth(year, r.month);
+    while (d >= DaysFromCivil(first) + dim) d -= 7;
+    return d;
+}
+
+inline TzType TzPosixTypeAt(const TzPosixRule& rule, long long utcSec) {
+    TzType t;
+    t.utoff = rule.stdOffset;
+    t.isDst = false;
+    memcpy(t.abbr, rule.stdAbbr, sizeof(t.abbr));
+    if (!rule.hasDst) return t;
+    int year = CivilFromDays(FloorDiv(utcSec + rule.stdOffset, 86400)).year;
+    // Transitions happen at local wall time of the offset in force before them
+    long long start = TzRuleDay(rule.start, year) * 86400 + rule.start.timeSec - rule.stdOffset;
+    long long end = TzRuleDay(rule.end, year) * 86400 + rule.end.timeSec - rule.dstOffset;
+    bool dst = start < end ? (utcSec >= start && utcSec < end)
+                           : !(utcSec >= end && utcSec < start);
+    if (dst) {
+        t.utoff = rule.dstOffset;
+        t.isDst = true;
+        memcpy(t.abbr, rule.dstAbbr, sizeof(t.abbr));
+    }
+    return t;
+}
+
+// --- Parsed zone ---
+
+struct TimeZone {
+    char name[64];
+    std::vector<int64_t> transitions;   // UTC seconds, ascending
+    std::vector<uint8_t> transType;     // Index into types per transition
+    std::vector<TzType> types;
+    bool hasFooter;
+    TzPosixRule footer;
+
+    TimeZone() : hasFooter(false) { name[0] = '\0'; }
+
+    TzType TypeAtUtc(long long utcSec) const {
+        if (transitions.empty() || utcSec < transitions[0]) {
+            if (transitions.empty() && hasFooter) return TzPosixTypeAt(footer, utcSec);
+            return types[0];
+        }
+        if (hasFooter && utcSec >= transitions.back()) return TzPosixTypeAt(footer, utcSec);
+        size_t i = (size_t)(std::upper_bound(transitions.begin(), transitions.end(), (int64_t)utcSec)
+                            - transitions.begin()) - 1;
+        return types[transType[i]];
+    }
+
+    int OffsetAtUtc(long long utcSec) const { return TypeAtUtc(utcSec).utoff; }
+
+    // Wall clock -> UTC. In a repeated hour the earlier instant wins; in a
+    // skipped hour the time moves forward by the gap, like most OS APIs.
+    long long LocalToUtc(long long localSec) const {
+        int before = OffsetAtUtc(localSec - 86400 * 2);
+        int after = OffsetAtUtc(localSec + 86400 * 2);
+        long long best = 0;
+        bool found = false;
+        int candidates[2] = {before, after};
+        for (int i = 0; i < 2; i++) {
+            long long utc = localSec - candidates[i];
+            if (OffsetAtUtc(utc) == candidates[i] && (!found || utc < best)) {
+                best = utc;
+                found = true;
+            }
+        }
+        if (!found) {
+            // Skipped wall time: the pre-transition offset lands past the gap
+            best = localSec - before;
+        }
+        return best;
+    }
+};
+
+inline uint32_t TzBE32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+inline int64_t TzBE64(const unsigned char* p) {
+    return (int64_t)(((uint64_t)TzBE32(p) << 32) | TzBE32(p + 4));
+}
+
+// Parses a TZif (RFC 8536) image. Version 2+ files use the 64-bit block
+// and the footer; version 1 files the 32-bit block only.
+inline bool TzParseTzif(const unsigned char* data, size_t size, TimeZone* zone) {
+    if (size < 44 || memcmp(data, "TZif", 4) != 0) return false;
+    const unsigned char* p = data;
+    const unsigned char* end = data + size;
+    char version = (char)data[4];
+    int timeSize = 4;
+
+    for (int pass = 0; pass < 2; pass++) {
+        if (end - p < 44 || memcmp(p, "TZif", 4) != 0) return false;
+        uint32_t isutcnt = TzBE32(p + 20), isstdcnt = TzBE32(p + 24), leapcnt = TzBE32(p + 28);
+        uint32_t timecnt = TzBE32(p + 32), typecnt = TzBE32(p + 36), charcnt = TzBE32(p + 40);
+        p += 44;
+        size_t blockSize = (size_t)timecnt * timeSize + timecnt + (size_t)typecnt * 6 + charcnt
+                         + (size_t)leapcnt * (timeSize + 4) + isstdcnt + isutcnt;
+        if ((size_t)(end - p) < blockSize || typecnt == 0 || typecnt > 256) return false;
+
+        if (pass == 0 && version >= '2') {
+            // Skip the legacy 32-bit block and read the 64-bit one
+            p += blockSize;
+            timeSize = 8;
+            continue;
+        }
+
+        zone->transitions.resize(timecnt);
+        zone->transType.resize(timecnt);
+        for (uint32_t i = 0; i < timecnt; i++) {
+            zone->transitions[i] = timeSize == 8 ? TzBE64(p) : (int32_t)TzBE32(p);
+            p += timeSize;
+        }
+        for (uint32_t i = 0; i < timecnt; i++) {
+            zone->transType[i] = p[i];
+            if (p[i] >= typecnt) return false;
+        }
+        p += timecnt;
+        const unsigned char* ttinfo = p;
+        p += typecnt * 6;
+        const char* abbrs = (const char*)p;
+        zone->types.resize(typecnt);
+        for (uint32_t i = 0; i < typecnt; i++) {
+            TzType& t = zone->types[i];
+            t.utoff = (int32_t)TzBE32(ttinfo + i * 6);
+            t.isDst = ttinfo[i * 6 + 4] != 0;
+            unsigned idx = ttinfo[i * 6 + 5];
+            int n = 0;
+            while (idx + n < charcnt && abbrs[idx + n] && n < 11) { t.abbr[n] = abbrs[idx + n]; n++; }
+            t.abbr[n] = '\0';
+        }
+        p += charcnt + (size_t)leapcnt * (timeSize + 4) + isstdcnt + isutcnt;
+        break;
+    }
+
+    // Footer: "\n<POSIX TZ string>\n"
+    zone->hasFooter = false;
+    if (timeSize == 8 && p < end && *p == '\n') {
+        char tz[64];
+        int n = 0;
+        for (p++; p < end && *p != '\n' && n < 63; p++) tz[n++] = (char)*p;
+        tz[n] = '\0';
+        if (n > 0) zone->hasFooter = TzParsePosix(tz, &zone->footer);
+    }
+    return true;
+}
+
+// Fixed offset zones ("UTC", "UTC+8", "UTC-03:30") need no database
+inline bool TzMakeFixed(const char* name, TimeZone* zone) {
+    if (strncmp(name, "UTC", 3) != 0 && strncmp(name, "GMT", 3) != 0) return false;
+    int off = 0;
+    const char* p = name + 3;
+    if (*p) {
+        if (*p != '+' && *p != '-') return false;
+        p = TzParseTime(p, &off);
+        if (*p) return false;
+    }
+    TzType t;
+    t.utoff = off;
+    t.isDst = false;
+    int a = off < 0 ? -off : off;
+    if (off == 0) snprintf(t.abbr, sizeof(t.abbr), "UTC");
+    else snprintf(t.abbr, sizeof(t.abbr), "%c%02d%02d", off < 0 ? '-' : '+', a / 3600, a / 60 % 60);
+    zone->types.assign(1, t);
+    zone->transitions.clear();
+    zone->transType.clear();
+    zone->hasFooter = false;
+    return true;
+}
+
+// --- Zone cache ---
+
+// Loads zones on first use from the first tz directory that has them and
+// keeps them for the life of the process.
+struct TzDatabase {
+    std::vector<TimeZone*> zones;
+    char dirs[4][260];
+    int dirCount;
+
+    TzDatabase() : dirCount(0) {
+        const char* env = getenv("TZDIR");
+        if (env && *env) AddDir(env);
+        AddDir("/usr/share/zoneinfo");
+        AddDir("/usr/lib/zoneinfo");
+    }
+
+    ~TzDatabase() {
+        for (size_t i = 0; i < zones.size(); i++) delete zones[i];
+    }
+
+    void AddDir(const char* dir) {
+        if (dirCount < 4) snprintf(dirs[dirCount++], sizeof(dirs[0]), "%s", dir);
+    }
+
+    // Returns NULL when the zone is unknown or the file is malformed
+    const TimeZone* Get(const char* name) {
+        for (size_t i = 0; i < zones.size(); i++) {
+            if (strcmp(zones[i]->name, name) == 0) return zones[i];
+        }
+        TimeZone* zone = new TimeZone();
+        bool ok = TzMakeFixed(name, zone);
+        // Zone names are relative paths; refuse anything that climbs out
+        bool safe = name[0] && name[0] != '/' && name[0] != '\\' && !strstr(name, "..");
+        for (int i = 0; !ok && safe && i < dirCount; i++) {
+            char path[400];
+            snprintf(path, sizeof(path), "%s/%s", dirs[i], name);
+            MappedFile mf;
+            if (!MapFileReadOnly(path, &mf)) continue;
+            ok = TzParseTzif(mf.data, mf.size, zone);
+            UnmapFile(&mf);
+        }
+        if (!ok) { delete zone; return NULL; }
+        snprintf(zone->name, sizeof(zone->name), "%s", name);
+        zones.push_back(zone);
+        return zone;
+    }
+};
+
+// --- Wall clock helpers ---
+
+struct LocalDateTime {
+    CivilDate date;
+    int hour, minute, second, millisecond;
+};
+
+inline long long LocalDateTimeToMs(const LocalDateTime& t) {
+    return DaysFromCivil(t.date) * MS_PER_DAY + t.hour * MS_PER_HOUR + t.minute * MS_PER_MINUTE
+         + t.second * MS_PER_SECOND + t.millisecond;
+}
+
+inline LocalDateTime LocalDateTimeFromMs(long long ms) {
+    LocalDateTime t;
+    long long days = FloorDiv(ms, MS_PER_DAY);
+    long long rem = ms - days * MS_PER_DAY;
+    t.date = CivilFromDays(days);
+    t.hour = (int)(rem / MS_PER_HOUR);
+    t.minute = (int)(rem / MS_PER_MINUTE % 60);
+    t.second = (int)(rem / MS_PER_SECOND % 60);
+    t.millisecond = (int)(rem % 1000);
+    return t;
+}
+
+// Wall clock in a zone -> UTC milliseconds
+inline long long TzLocalToUtcMs(const TimeZone& zone, const LocalDateTime& t) {
+    long long ms = LocalDateTimeToMs(t);
+    long long sec = FloorDiv(ms, 1000);
+    return zone.LocalToUtc(sec) * 1000 + (ms - sec * 1000);
+}
+
+// UTC milliseconds -> wall clock in a zone, optionally with the offset used
+inline LocalDateTime TzUtcToLocal(const TimeZone& zone, long long utcMs, TzType* type = NULL) {
+    TzType t = zone.TypeAtUtc(FloorDiv(utcMs, 1000));
+    if (type) *type = t;
+    return LocalDateTimeFromMs(utcMs + (long long)t.utoff * 1000);
+}
+
+// Sub-day units continue the DATE_UNIT_* list in calc_dates.h
+#define DATE_UNIT_HOURS   4
+#define DATE_UNIT_MINUTES 5
+#define DATE_UNIT_SECONDS 6
+
+// Adds value units to an instant. Calendar units move the wall clock in the
+// zone, so "+1 day" across a DST switch keeps the time of day; hours and
+// smaller add elapsed time and may be fractional (0.5 s -> 500 ms).
+inline long long TzAddUnits(const TimeZone& zone, long long utcMs, double value, int unit, bool endOfMonth) {
+    switch (unit) {
+        case DATE_UNIT_HOURS: return utcMs + llround(value * MS_PER_HOUR);
+        case DATE_UNIT_MINUTES: return utcMs + llround(value * MS_PER_MINUTE);
+        case DATE_UNIT_SECONDS: return utcMs + llround(value * MS_PER_SECOND);
+    }
+    LocalDateTime t = TzUtcToLocal(zone, utcMs);
+    t.date = DateAddUnits(t.date, (long long)value, unit, endOfMonth);
+    return TzLocalToUtcMs(zone, t);
+}
@@ -0,0 +1,209 @@
+// Unit conversion for the units tab
+// Portable C++ (no Win32). Units form a graph: each one is defined by an
+// affine step to a parent unit (1 ft = 12 in, 1 in = 2.54 cm, °F to °C),
+// ending at the base unit of its quantity. The graph is walked at compile
+// time, so every pair of units is one precomputed transform y = x * scale
+// + offset in kUnitTable and a conversion is a multiply and an add.
+// Batches run the same transform through an SSE2 kernel two doubles at a
+// time, with the same results as one at a time. Names are UTF-8.
+
+#pragma once
+
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UNIT_SSE2 1
+#endif
+
+// Quantities (order matches the category combo)
+enum UnitCategory {
+    UNIT_LENGTH, UNIT_MASS, UNIT_TEMPERATURE, UNIT_DATA, UNIT_TIME, UNIT_AREA,
+    UNIT_CATEGORY_COUNT
+};
+
+// Units, grouped by quantity; each group starts with its base unit
+enum UnitId {
+    UNIT_M, UNIT_KM, UNIT_CM, UNIT_MM, UNIT_UM, UNIT_NM,
+    UNIT_IN, UNIT_FT, UNIT_YD, UNIT_MI, UNIT_NMI,
+
+    UNIT_KG, UNIT_G, UNIT_MG, UNIT_T, UNIT_LB, UNIT_OZ, UNIT_ST,
+
+    UNIT_K, UNIT_C, UNIT_F, UNIT_R,
+
+    UNIT_BYTE, UNIT_BIT, UNIT_KB, UNIT_MB, UNIT_GB, UNIT_TB,
+    UNIT_KIB, UNIT_MIB, UNIT_GIB, UNIT_TIB,
+
+    UNIT_S, UNIT_MS, UNIT_US, UNIT_MIN, UNIT_H, UNIT_DAY, UNIT_WEEK, UNIT_YEAR,
+
+    UNIT_M2, UNIT_MM2, UNIT_CM2, UNIT_HA, UNIT_KM2,
+    UNIT_IN2, UNIT_FT2, UNIT_YD2, UNIT_ACRE, UNIT_MI2,
+
+    UNIT_COUNT
+};
+
+// One edge of the graph: value in parent = value * scale + offset. A base
+// unit is its own parent.
+struct UnitDef {
+    const char* name;
+    const char* symbol;
+    int category;
+    int parent;
+    double scale;
+    double offset;
+};
+
+// Indexed by UnitId
+constexpr UnitDef kUnits[UNIT_COUNT] = {
+    {"Meters", "m", UNIT_LENGTH, UNIT_M, 1, 0},
+    {"Kilometers", "km", UNIT_LENGTH, UNIT_M, 1000, 0},
+    {"Centimeters", "cm", UNIT_LENGTH, UNIT_M, 0.01, 0},
+    {"Millimeters", "mm", UNIT_LENGTH, UNIT_M, 0.001, 0},
+    {"Micrometers", "µm", UNIT_LENGTH, UNIT_M, 1e-6, 0},
+    {"Nanometers", "nm", UNIT_LENGTH, UNIT_M, 1e-9, 0},
+    {"Inches", "in", UNIT_LENGTH, UNIT_CM, 2.54, 0},
+    {"Feet", "ft", UNIT_LENGTH, UNIT_IN, 12, 0},
+    {"Yards", "yd", UNIT_LENGTH, UNIT_FT, 3, 0},
+    {"Miles", "mi", UNIT_LENGTH, UNIT_YD, 1760, 0},
+    {"Nautical miles", "nmi", UNIT_LENGTH, UNIT_M, 1852, 0},
+
+    {"Kilograms", "kg", UNIT_MASS, UNIT_KG, 1, 0},
+    {"Grams", "g", UNIT_MASS, UNIT_KG, 0.001, 0},
+    {"Milligrams", "mg", UNIT_MASS, UNIT_G, 0.001, 0},
+    {"Tonnes", "t", UNIT_MASS, UNIT_KG, 1000, 0},
+    {"Pounds", "lb", UNIT_MASS, UNIT_KG, 0.45359237, 0},
+    {"Ounces", "oz", UNIT_MASS, UNIT_LB, 1.0 / 16, 0},
+    {"Stones", "st", UNIT_MASS, UNIT_LB, 14, 0},
+
+    {"Kelvin", "K", UNIT_TEMPERATURE, UNIT_K, 1, 0},
+    {"Celsius", "°C", UNIT_TEMPERATURE, UNIT_K, 1, 273.15},
+    {"Fahrenheit", "°F", UNIT_TEMPERATURE, UNIT_C, 5.0 / 9, -160.0 / 9},
+    {"Rankine", "°R", UNIT_TEMPERATURE, UNIT_K, 5.0 / 9, 0},
+
+    {"Bytes", "B", UNIT_DATA, UNIT_BYTE, 1, 0},
+    {"Bits", "bit", UNIT_DATA, UNIT_BYTE, 0.125, 0},
+    {"Kilobytes", "kB", UNIT_DATA, UNIT_BYTE, 1000, 0},
+    {"Megabytes", "MB", UNIT_DATA, UNIT_KB, 1000, 0},
+    {"Gigabytes", "GB", UNIT_DATA, UNIT_MB, 1000, 0},
+    {"Terabytes", "TB", UNIT_DATA, UNIT_GB, 1000, 0},
+    {"Kibibytes", "KiB", UNIT_DATA, UNIT_BYTE, 1024, 0},
+    {"Mebibytes", "MiB", UNIT_DATA, UNIT_KIB, 1024, 0},
+    {"Gibibytes", "GiB", UNIT_DATA, UNIT_MIB, 1024, 0},
+    {"Tebibytes", "TiB", UNIT_DATA, UNIT_GIB, 1024, 0},
+
+    {"Seconds", "s", UNIT_TIME, UNIT_S, 1, 0},
+    {"Milliseconds", "ms", UNIT_TIME, UNIT_S, 0.001, 0},
+    {"Microseconds", "µs", UNIT_TIME, UNIT_MS, 0.001, 0},
+    {"Minutes", "min", UNIT_TIME, UNIT_S, 60, 0},
+    {"Hours", "h", UNIT_TIME, UNIT_MIN, 60, 0},
+    {"Days", "d", UNIT_TIME, UNIT_H, 24, 0},
+    {"Weeks", "wk", UNIT_TIME, UNIT_DAY, 7, 0},
+    {"Years (365.25 d)", "yr", UNIT_TIME, UNIT_DAY, 365.25, 0},
+
+    {"Square meters", "m²", UNIT_AREA, UNIT_M2, 1, 0},
+    {"Square millimeters", "mm²", UNIT_AREA, UNIT_M2, 1e-6, 0},
+    {"Square centimeters", "cm²", UNIT_AREA, UNIT_M2, 1e-4, 0},
+    {"Hectares", "ha", UNIT_AREA, UNIT_M2, 10000, 0},
+    {"Square kilometers", "km²", UNIT_AREA, UNIT_HA, 100, 0},
+    {"Square inches", "in²", UNIT_AREA, UNIT_CM2, 6.4516, 0},
+    {"Square feet", "ft²", UNIT_AREA, UNIT_IN2, 144, 0},
+    {"Square yards", "yd²", UNIT_AREA, UNIT_FT2, 9, 0},
+    {"Acres", "ac", UNIT_AREA, UNIT_YD2, 4840, 0},
+    {"Square miles", "mi²", UNIT_AREA, UNIT_ACRE, 640, 0},
+};
+
+struct UnitAffine {
+    double scale;
+    double offset;
+};
+
+// outer(inner(x))
+constexpr UnitAffine UnitCompose(UnitAffine inner, UnitAffine outer) {
+    return UnitAffine{inner.scale * outer.scale, inner.offset * outer.scale + outer.offset};
+}
+
+// Walks parent edges from u to its base unit
+constexpr UnitAffine UnitToBase(int u) {
+    UnitAffine t{1, 0};
+    for (int depth = 0; depth < UNIT_COUNT && kUnits[u].parent != u; depth++) {
+        t = UnitCompose(t, UnitAffine{kUnits[u].scale, kUnits[u].offset});
+        u = kUnits[u].parent;
+    }
+    return t;
+}
+
+// Every pair: to(from) = base-to-`to` after `from`-to-base. Pairs across
+// quantities are left as {0, 0}; UnitConvertible() tells them apart.
+struct UnitTable {
+    UnitAffine pair[UNIT_COUNT][UNIT_COUNT];
+};
+
+constexpr UnitTable UnitBuildTable() {
+    UnitTable table{};
+    UnitAffine base[UNIT_COUNT] = {};
+    for (int u = 0; u < UNIT_COUNT; u++) base[u] = UnitToBase(u);
+    for (int from = 0; from < UNIT_COUNT; from++) {
+        for (int to = 0; to < UNIT_COUNT; to++) {
+            if (kUnits[from].category != kUnits[to].category) continue;
+            if (from == to) {
+                table.pair[from][to] = UnitAffine{1, 0};
+                continue;
+            }
+            const UnitAffine& f = base[from];
+            const UnitAffine& t = base[to];
+            table.pair[from][to] = UnitAffine{f.scale / t.scale, (f.offset - t.offset) / t.scale};
+        }
+    }
+    return table;
+}
+
+constexpr UnitTable kUnitTable = UnitBuildTable();
+
+constexpr double UnitAbs(double x) { return x < 0 ? -x : x; }
+
+// The table really is built by the compiler
+static_assert(kUnitTable.pair[UNIT_IN][UNIT_CM].scale == 2.54, "1 in = 2.54 cm");
+static_assert(UnitAbs(kUnitTable.pair[UNIT_MI][UNIT_KM].scale - 1.609344) < 1e-15, "1 mi = 1.609344 km");
+static_assert(UnitAbs(212 * kUnitTable.pair[UNIT_F][UNIT_C].scale + kUnitTable.pair[UNIT_F][UNIT_C].offset - 100) < 1e-12,
+              "212 °F = 100 °C");
+static_assert(kUnitTable.pair[UNIT_GIB][UNIT_BYTE].scale == 1073741824.0, "1 GiB = 2^30 B");
+
+inline bool UnitConvertible(int from, int to) {
+    return from >= 0 && from < UNIT_COUNT && to >= 0 && to < UNIT_COUNT &&
+           kUnits[from].category == kUnits[to].category;
+}
+
+inline double UnitConvert(int from, int to, double x) {
+    const UnitAffine& t = kUnitTable.pair[from][to];
+    double y = x * t.scale;
+    return y + t.offset;
+}
+
+// out[i] = in[i] converted; in and out may be the same array
+inline void UnitConvertBatch(int from, int to, const double* in, double* out, size_t count) {
+    const UnitAffine& t = kUnitTable.pair[from][to];
+    size_t i = 0;
+#ifdef UNIT_SSE2
+    // Separate multiply and add, as in UnitConvert, so no FMA changes the bits
+    __m128d scale = _mm_set1_pd(t.scale), offset = _mm_set1_pd(t.offset);
+    size_t blocks = count & ~(size_t)3;
+    for (; i < blocks; i += 4) {
+        __m128d a = _mm_loadu_pd(in + i), b = _mm_loadu_pd(in + i + 2);
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(a, scale), offset));
+        _mm_storeu_pd(out + i + 2, _mm_add_pd(_mm_mul_pd(b, scale), offset));
+    }
+#endif
+    for (; i < count; i++) {
+        double y = in[i] * t.scale;
+        out[i] = y + t.offset;
+    }
+}
+
+// Units of one quantity, in table order; returns the count
+inline int UnitsOf(int category, int* out, int max) {
+    int n = 0;
+    for (int u = 0; u < UNIT_COUNT; u++) {
+        if (kUnits[u].category == category && n < max) out[n++] = u;
+    }
+    return n;
+}
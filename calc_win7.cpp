@@ -19,10 +19,28 @@
 #include <dwmapi.h>
 #include <shellapi.h>
 #include <strsafe.h>
+#include <commdlg.h>
 #include <cmath>
 #include <cstring>
 #include <ctime>
 
+#include "calc_engine.h"
+#include "calc_dates.h"
+#include "calc_tz.h"
+#include "calc_lunar.h"
+#include "calc_compositor.h"
+#include "calc_glyphs.h"
+#include "calc_sweep.h"
+#include "calc_session.h"
+#include "calc_finance.h"
+#include "calc_plot.h"
+#include "calc_matrix.h"
+#include "calc_solve.h"
+#include "calc_primes.h"
+#include "calc_sched.h"
+#include "calc_units.h"
+#include "calc_registers.h"
+
 #pragma comment(lib, "user32.lib")
 #pragma comment(lib, "gdi32.lib")
 #pragma comment(lib, "comctl32.lib")
@@ -54,6 +72,15 @@ processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 #define TAB_CALC        0
 #define TAB_CALENDAR    1
 #define TAB_DATECALC    2
+#define TAB_SWEEP       3
+#define TAB_FINANCE     4
+#define TAB_GRAPH       5
+#define TAB_MATRIX      6
+#define TAB_SOLVE       7
+#define TAB_INTEGER     8
+#define TAB_UNITS       9
+#define TAB_REGISTERS   10
+#define TAB_COMPLEX     11
 
 // Control IDs
 #define IDC_TAB         1
@@ -69,18 +96,115 @@ processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 #define IDC_RESULT      27
 #define IDC_DTP_BASE    28
 #define IDC_LIST_HISTORY 30
+#define IDC_DISPLAY     31
+#define IDC_COMBO_NUMMODE 32
+#define IDC_EDIT_COUNT  40
+#define IDC_CHECK_EOM   41
+#define IDC_COMBO_BIZ   42
+#define IDC_BTN_SCHEDULE 43
+#define IDC_BTN_EXPORT  44
+#define IDC_LIST_SCHEDULE 45
+#define IDC_TIME_START  46
+#define IDC_TIME_END    47
+#define IDC_TIME_BASE   48
+#define IDC_ZONE_START  49
+#define IDC_ZONE_END    50
+#define IDC_ZONE_BASE   51
+#define IDC_SWEEP_EXPR  52
+#define IDC_SWEEP_VARS  53
+#define IDC_SWEEP_OUTPUT 54
+#define IDC_SWEEP_THREADS 55
+#define IDC_BTN_SWEEP   56
+#define IDC_BTN_SWEEP_CANCEL 57
+#define IDC_FIN_PRINCIPAL 58
+#define IDC_FIN_RATE    59
+#define IDC_FIN_YEARS   60
+#define IDC_FIN_PERYEAR 61
+#define IDC_FIN_PAYMENT 62
+#define IDC_BTN_FIN_PAYMENT 63
+#define IDC_BTN_FIN_RATE 64
+#define IDC_BTN_FIN_SCHEDULE 65
+#define IDC_BTN_FIN_EXPORT 66
+#define IDC_LIST_FIN    67
+#define IDC_FIN_FLOWS   68
+#define IDC_FIN_DISCOUNT 69
+#define IDC_BTN_FIN_NPV 70
+#define IDC_BTN_FIN_IRR 71
+#define IDC_BTN_FIN_BATCH 72
+#define IDC_BTN_FIN_CANCEL 73
+#define IDC_GRAPH_EXPR  74
+#define IDC_GRAPH_SAMPLES 75
+#define IDC_BTN_GRAPH   76
+#define IDC_BTN_GRAPH_RESET 77
+#define IDC_GRAPH_VIEW  78
+#define IDC_MAT_A       79
+#define IDC_MAT_B       80
+#define IDC_BTN_MAT_ADD 81
+#define IDC_BTN_MAT_SUB 82
+#define IDC_BTN_MAT_MUL 83
+#define IDC_BTN_MAT_TRANSPOSE 84
+#define IDC_BTN_MAT_DET 85
+#define IDC_BTN_MAT_INV 86
+#define IDC_BTN_MAT_SOLVE 87
+#define IDC_BTN_MAT_TO_A 88
+#define IDC_MAT_RESULT  89
+#define IDC_SOLVE_MODE  90
+#define IDC_SOLVE_EQUATION 91
+#define IDC_SOLVE_FROM  92
+#define IDC_SOLVE_TO    93
+#define IDC_SOLVE_CELLS 94
+#define IDC_SOLVE_THREADS 95
+#define IDC_BTN_SOLVE   96
+#define IDC_BTN_SOLVE_CANCEL 97
+#define IDC_SOLVE_RESULT 98
+#define IDC_INT_A       99
+#define IDC_INT_B       100
+#define IDC_INT_M       101
+#define IDC_BTN_INT_FROM_KEYPAD 102
+#define IDC_BTN_INT_PRIME 103
+#define IDC_BTN_INT_FACTOR 104
+#define IDC_BTN_INT_NEXT 105
+#define IDC_BTN_INT_GCD 106
+#define IDC_BTN_INT_LCM 107
+#define IDC_BTN_INT_POWMOD 108
+#define IDC_BTN_INT_CANCEL 109
+#define IDC_BTN_INT_TO_KEYPAD 110
+#define IDC_INT_RESULT  111
+#define IDC_UNIT_CATEGORY 112
+#define IDC_UNIT_FROM   113
+#define IDC_UNIT_TO     114
+#define IDC_BTN_UNIT_SWAP 115
+#define IDC_UNIT_INPUT  116
+#define IDC_UNIT_RESULT 117
+#define IDC_BTN_UNIT_FROM_KEYPAD 118
+#define IDC_BTN_UNIT_TO_KEYPAD 119
+#define IDC_BTN_UNIT_TO_MEMORY 120
+#define IDC_REG_LIST    121
+#define IDC_REG_NAME    122
+#define IDC_BTN_REG_RENAME 123
+#define IDC_BTN_REG_MC  124
+#define IDC_BTN_REG_MR  125
+#define IDC_BTN_REG_MS  126
+#define IDC_BTN_REG_MPLUS 127
+#define IDC_BTN_REG_MMINUS 128
+#define IDC_BTN_REG_CLEAR_ALL 129
+#define IDC_REG_COLUMN  130
+#define IDC_BTN_REG_ADD_COLUMN 131
+#define IDC_BTN_REG_SUB_COLUMN 132
+#define IDC_BTN_REG_ADD_UNITS 133
+#define IDC_CPLX_OP     134
+#define IDC_CPLX_OPERAND 135
+#define IDC_CPLX_POLAR  136
+#define IDC_CPLX_INPUT  137
+#define IDC_CPLX_RESULT 138
+#define IDC_BTN_CPLX_FROM_KEYPAD 139
+#define IDC_BTN_CPLX_TO_KEYPAD 140
+#define IDC_BTN_MAT_CANCEL 141
 
-// Button IDs
-enum ButtonID {
-    BTN_0 = 100, BTN_1, BTN_2, BTN_3, BTN_4,
-    BTN_5, BTN_6, BTN_7, BTN_8, BTN_9,
-    BTN_ADD, BTN_SUB, BTN_MUL, BTN_DIV,
-    BTN_EQUAL, BTN_DOT,
-    BTN_C, BTN_CE, BTN_BACK, BTN_NEG, BTN_SQRT,
-    BTN_PERCENT, BTN_RECIP,
-    BTN_MC, BTN_MR, BTN_MS, BTN_MPLUS, BTN_MMINUS,
-    BTN_TODAY
-};
+// Timers and private messages
+#define IDT_JOB_PROGRESS 1
+#define IDT_REPLAY      2
+#define WM_JOB_WAKE     (WM_APP + 1)
 
 // Forward declarations
 void InitFonts();
@@ -90,6 +214,8 @@ static HWND hTab = NULL;
 static HWND hDisplay = NULL;
 static HWND hMemoryIndicator = NULL;
 static HWND hHistoryList = NULL;
+static HWND hNumModeCombo = NULL;
+static HWND hComplexKeys[6];
 static HFONT hFontDisplay = NULL;
 static HFONT hFontButton = NULL;
 static HFONT hFontNormal = NULL;
@@ -100,6 +226,7 @@ struct CalendarState {
     SYSTEMTIME today;
     HWND hMonthCal;
     HWND hInfoLabel;
+    HWND hLunarLabel;
     HWND hBtnToday;
     bool initialized;
     CalendarState() : initialized(false) {}
@@ -112,24 +239,14 @@ struct DateCalcState {
     DateCalcState() : calcMode(0) {}
 };
 
-// Calculator state
-struct CalcState {
-    double currentValue;
-    double previousValue;
-    double memoryValue;
-    char currentOp;
-    bool waitingForOperand;
-    bool hasMemory;
-    char displayText[256];
-    
-    CalcState() : currentValue(0), previousValue(0), memoryValue(0),
-                  currentOp(0), waitingForOperand(false), hasMemory(false) {
-        displayText[0] = '0';
-        displayText[1] = '\0';
-    }
-};
-
-static CalcState g_state;
+// The keypad engine keeps big values in a pool carved from a static
+// buffer and its temporaries in an arena, so typing never reaches the heap
+static char g_enginePoolBuffer[256 * 1024];
+static char g_engineScratchBuffer[64 * 1024];
+static CalcPool g_enginePool(g_enginePoolBuffer, sizeof(g_enginePoolBuffer));
+static CalcArena g_engineScratch(g_engineScratchBuffer, sizeof(g_engineScratchBuffer), g_enginePool.Allocator());
+static CalcEngine g_engine(g_enginePool.Allocator(), &g_engineScratch);
+static CalcState& g_state = g_engine.state;
 static CalendarState g_calState;
 static DateCalcState g_dateState;
 static int g_curTab = TAB_CALC;
@@ -158,15 +275,23 @@ void CreateCalendarUI(HWND hwnd);
 void CreateDateCalcUI(HWND hwnd);
 void SwitchTab(int tab);
 void UpdateDisplay();
-void HandleButton(int id);
-void Calculate();
 void UpdateCalendarInfo();
+void UpdateLunarInfo(const SYSTEMTIME& st);
 void CalcDateDiff();
 void CalcDateAdd();
+void ShowSchedule();
+void ExportSchedule(HWND hwnd);
+void CreateSweepUI(HWND hwnd);
+static void FinishSweep();
+static void FinishFinBatch();
+static void FinishSolve();
+static void FinishIntCommand();
+static void UpdateSweepProgress();
+static void UpdateFinBatchProgress();
+static void UpdateSolveProgress();
+static void UpdateIntProgress();
 int GetISOWeek(const SYSTEMTIME& st);
 int GetDayOfYear(const SYSTEMTIME& st);
-bool IsLeapYear(int year);
-int DaysInMonth(int year, int month);
 
 // Draw rounded rectangle
 void RoundRect(HDC hdc, RECT* rect, int radius) {
@@ -240,7 +365,7 @@ LRESULT CALLBACK ButtonProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam,
             } else if (id >= BTN_ADD && id <= BTN_DIV) {
                 start = RGB(240, 248, 255);
                 end = RGB(200, 230, 255);
-            } else if (id >= BTN_C && id <= BTN_RECIP) {
+            } else if ((id >= BTN_C && id <= BTN_RECIP) || (id >= BTN_I && id <= BTN_LN)) {
                 start = RGB(245, 245, 245);
                 end = RGB(230, 230, 230);
             } else {
@@ -296,10 +421,11 @@ HWND CreateCalcButton(HWND parent, int id, const WCHAR* text, int x, int y, int
 void CreateCalculatorUI(HWND hwnd) {
     // Create display
     // Width limited to allow space for history sidebar
+    // Owner-drawn: the compositor paints it over the cached background
     hDisplay = CreateWindowW(L"STATIC", L"0",
-        WS_VISIBLE | WS_CHILD | SS_RIGHT | SS_NOTIFY | WS_BORDER | SS_SUNKEN,
+        WS_VISIBLE | WS_CHILD | SS_OWNERDRAW | SS_NOTIFY | WS_BORDER | SS_SUNKEN,
         12, 45, 370, DISPLAY_HEIGHT, 
-        hwnd, NULL, GetModuleHandle(NULL), NULL);
+        hwnd, (HMENU)IDC_DISPLAY, GetModuleHandle(NULL), NULL);
     if (hCalcCount < 50) hCalcControls[hCalcCount++] = hDisplay;
 
     // Set display font
@@ -308,10 +434,22 @@ void CreateCalculatorUI(HWND hwnd) {
     // Memory indicator
     hMemoryIndicator = CreateWindowW(L"STATIC", L"",
         WS_VISIBLE | WS_CHILD | SS_LEFT,
-        12, 110, 300, 20, hwnd, NULL, GetModuleHandle(NULL), NULL);
+        12, 110, 280, 20, hwnd, NULL, GetModuleHandle(NULL), NULL);
     SendMessage(hMemoryIndicator, WM_SETFONT, (WPARAM)hFontNormal, TRUE);
     if (hCalcCount < 50) hCalcControls[hCalcCount++] = hMemoryIndicator;
 
+    // Number mode selector (double / exact fraction / double-double / complex)
+    hNumModeCombo = CreateWindowW(L"COMBOBOX", L"",
+        WS_VISIBLE | WS_CHILD | CBS_DROPDOWNLIST | WS_VSCROLL,
+        296, 106, 86, 120, hwnd, (HMENU)IDC_COMBO_NUMMODE, GetModuleHandle(NULL), NULL);
+    SendMessage(hNumModeCombo, WM_SETFONT, (WPARAM)hFontNormal, TRUE);
+    SendMessage(hNumModeCombo, CB_ADDSTRING, 0, (LPARAM)L"浮点");
+    SendMessage(hNumModeCombo, CB_ADDSTRING, 0, (LPARAM)L"分数");
+    SendMessage(hNumModeCombo, CB_ADDSTRING, 0, (LPARAM)L"高精度");
+    SendMessage(hNumModeCombo, CB_ADDSTRING, 0, (LPARAM)L"复数");
+    SendMessage(hNumModeCombo, CB_SETCURSEL, NUM_DOUBLE, 0);
+    if (hCalcCount < 50) hCalcControls[hCalcCount++] = hNumModeCombo;
+
     // History ListBox (Sidebar)
     // Positioned at X=390 (original width - padding), Y=45
     hHistoryList = CreateWindowW(L"LISTBOX", NULL,
@@ -375,33 +513,20 @@ void CreateCalculatorUI(HWND hwnd) {
     // Equal button
     CreateCalcButton(hwnd, BTN_EQUAL, L"=", startX + 4*(BUTTON_WIDTH+gap),
         numStartY + 2*(BUTTON_HEIGHT+gap), BUTTON_WIDTH, BUTTON_HEIGHT*2+gap);
-}
-
-static bool IsErrorDisplay() {
-    return strcmp(g_state.displayText, "Error") == 0;
-}
-
-static double GetDisplayNumber() {
-    return atof(g_state.displayText);
-}
 
-static void SetDisplayNumber(double value) {
-    if (value == floor(value)) sprintf(g_state.displayText, "%.0f", value);
-    else sprintf(g_state.displayText, "%.12g", value);
+    // Complex mode row, shown only in that mode (ShowComplexKeys)
+    const WCHAR* cplx[] = {L"i", L"\u2220", L"|z|", L"arg", L"e\u02e3", L"ln"};
+    int cplxY = numStartY + 4*(BUTTON_HEIGHT+gap);
+    int cplxW = (5*BUTTON_WIDTH + 4*gap - 5*4) / 6;
+    for (int i = 0; i < 6; i++) {
+        hComplexKeys[i] = CreateCalcButton(hwnd, BTN_I + i, cplx[i], startX + i*(cplxW+4), cplxY, cplxW, 32);
+    }
 }
 
-static char g_lastHistory[160] = "";
-
-static void PushHistory(const char* expr) {
-    if (!expr) return;
-    strncpy(g_lastHistory, expr, sizeof(g_lastHistory) - 1);
-    g_lastHistory[sizeof(g_lastHistory) - 1] = '\0';
-
-    if (hHistoryList) {
-        WCHAR wExpr[256];
-        MultiByteToWideChar(CP_ACP, 0, expr, -1, wExpr, 256);
-        int idx = SendMessage(hHistoryList, LB_ADDSTRING, 0, (LPARAM)wExpr);
-        SendMessage(hHistoryList, LB_SETCURSEL, idx, 0); // Auto scroll to bottom
+static void ShowComplexKeys() {
+    int show = (g_curTab == TAB_CALC && g_state.numMode == NUM_COMPLEX) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < 6; i++) {
+        if (hComplexKeys[i]) ShowWindow(hComplexKeys[i], show);
     }
 }
 
@@ -447,7 +572,7 @@ static bool PasteTextFromClipboard(HWND hwnd, char* outA, int outSize) {
     for (int i = 0; buf[i] != '\0' && j < outSize - 1; ++i) {
         char c = buf[i];
         if ((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+'
-            || c == 'e' || c == 'E') {
+            || c == 'e' || c == 'E' || c == '/' || c == 'i' || c == 'j' || c == '<') {
             outA[j++] = c;
         }
     }
@@ -457,227 +582,632 @@ static bool PasteTextFromClipboard(HWND hwnd, char* outA, int outSize) {
     return true;
 }
 
+// Setting a control's text repaints it, so unchanged text is skipped.
+// Headless replays have no controls at all.
+static void SetTextIfChanged(HWND h, const WCHAR* text) {
+    if (!h) return;
+    WCHAR old[256];
+    GetWindowTextW(h, old, 256);
+    if (wcscmp(old, text) != 0) SetWindowTextW(h, text);
+}
+
 // Update display
 void UpdateDisplay() {
     WCHAR wtext[256];
     MultiByteToWideChar(CP_ACP, 0, g_state.displayText, -1, wtext, 256);
-    SetWindowTextW(hDisplay, wtext);
+    SetTextIfChanged(hDisplay, wtext);
 
     // Update memory indicator + latest history
-    WCHAR wh[256];
-    if (g_lastHistory[0] != '\0') {
-        WCHAR whis[180];
-        MultiByteToWideChar(CP_ACP, 0, g_lastHistory, -1, whis, 180);
-        StringCchPrintfW(wh, 256, L"%s%s%s",
+    WCHAR wh[CALC_HISTORY_MAX + 8];
+    if (g_engine.lastHistory[0] != '\0') {
+        WCHAR whis[CALC_HISTORY_MAX];
+        if (!MultiByteToWideChar(CP_ACP, 0, g_engine.lastHistory, -1, whis, CALC_HISTORY_MAX)) whis[0] = L'\0';
+        StringCchPrintfW(wh, CALC_HISTORY_MAX + 8, L"%s%s%s",
             g_state.hasMemory ? L"M  |  " : L"",
             whis,
             L"");
-        SetWindowTextW(hMemoryIndicator, wh);
+        SetTextIfChanged(hMemoryIndicator, wh);
     } else {
-        SetWindowTextW(hMemoryIndicator, g_state.hasMemory ? L"M" : L"");
+        SetTextIfChanged(hMemoryIndicator, g_state.hasMemory ? L"M" : L"");
     }
 }
 
-// Handle digit input
-void InputDigit(int digit) {
-    if (digit < 0 || digit > 9) return;
+// Engine callbacks
+static void OnEngineDisplay(void*) {
+    UpdateDisplay();
+}
 
-    if (g_state.waitingForOperand || IsErrorDisplay()) {
-        g_state.displayText[0] = '0' + digit;
-        g_state.displayText[1] = '\0';
-        g_state.waitingForOperand = false;
-    } else {
-        int len = (int)strlen(g_state.displayText);
-        if (strcmp(g_state.displayText, "0") == 0) {
-            g_state.displayText[0] = '0' + digit;
-            g_state.displayText[1] = '\0';
-        } else if (len < 30) {
-            g_state.displayText[len] = '0' + digit;
-            g_state.displayText[len + 1] = '\0';
+static void OnEngineHistory(void*, const char* line) {
+    if (hHistoryList) {
+        WCHAR wExpr[CALC_HISTORY_MAX];
+        if (!MultiByteToWideChar(CP_ACP, 0, line, -1, wExpr, CALC_HISTORY_MAX)) return;
+        for (WCHAR* p = wExpr; *p; p++) {
+            if (*p == L'<') *p = L'\u2220';
         }
+        int idx = SendMessage(hHistoryList, LB_ADDSTRING, 0, (LPARAM)wExpr);
+        SendMessage(hHistoryList, LB_SETCURSEL, idx, 0); // Auto scroll to bottom
     }
-    UpdateDisplay();
 }
 
-// Calculate result
-void Calculate() {
-    if (g_state.currentOp == 0) return;
-
-    double left = g_state.previousValue;
-    double right = GetDisplayNumber();
-    double result = 0.0;
-
-    switch (g_state.currentOp) {
-        case '+': result = left + right; break;
-        case '-': result = left - right; break;
-        case '*': result = left * right; break;
-        case '/':
-            if (right == 0.0) {
-                strcpy(g_state.displayText, "Error");
-                PushHistory("Divide by zero");
-                g_state.waitingForOperand = true;
-                UpdateDisplay();
-                return;
-            }
-            result = left / right;
+// --- Session recording and replay ---
+// "/record <file>" logs every input to the engine (see calc_session.h).
+// "/replay <file>" runs a log headlessly at full speed and "/replay <file>
+// /realtime" plays it into the window with its recorded timing. Replayed
+// inputs go through the same handlers as live ones but are not recorded.
+static SessionWriter g_recorder;
+static ULONGLONG g_recordStart = 0;
+
+static void RecordInput(int type, int value = 0, int mods = 0, const char* text = NULL) {
+    if (g_recorder.IsOpen()) g_recorder.Record(type, (long long)(GetTickCount64() - g_recordStart), value, mods, text);
+}
+
+static bool StartRecording(const WCHAR* path) {
+    FILE* f = _wfopen(path, L"wb");
+    if (!f) return false;
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    ULONGLONG ticks = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    long long unixMs = (long long)(ticks / 10000) - 11644473600000LL; // FILETIME counts from 1601
+    g_recordStart = GetTickCount64();
+    if (g_recorder.Begin(f, unixMs)) return true;
+    g_recorder.Close();
+    return false;
+}
+
+static int CurrentKeyMods() {
+    return (GetKeyState(VK_SHIFT) < 0 ? SES_MOD_SHIFT : 0) |
+           (GetKeyState(VK_CONTROL) < 0 ? SES_MOD_CTRL : 0) |
+           (GetKeyState(VK_MENU) < 0 ? SES_MOD_ALT : 0);
+}
+
+static void ApplyPaste(const char* text) {
+    g_engine.EnterText(text, "Paste value");
+}
+
+// A value recalled from the history list becomes the display entry
+static void RecallValue(const char* text) {
+    g_engine.EnterText(text, NULL);
+}
+
+// Keyboard input on the calculator tab. mods stands in for GetKeyState so
+// a replayed key does what it did when it was recorded. Ctrl+V is handled
+// by the caller: the pasted text, not the key, is what gets recorded.
+static void HandleCalcKey(HWND hwnd, UINT vk, int mods) {
+    bool shift = (mods & SES_MOD_SHIFT) != 0;
+    // Ctrl+C / Ctrl+V
+    if (mods & SES_MOD_CTRL) {
+        if (vk == 'C') {
+            if (hwnd) CopyTextToClipboard(hwnd, g_state.displayText);
+            return;
+        } else if (vk == 'V') {
+            return;
+        }
+    }
+
+    // 运算（先处理 Shift+8 的 *，避免被当作数字 8）
+    if (vk == VK_MULTIPLY || (vk == '8' && shift)) g_engine.HandleButton(BTN_MUL);
+    else if (vk == VK_ADD || vk == VK_OEM_PLUS) g_engine.HandleButton(BTN_ADD);
+    else if (vk == VK_SUBTRACT || vk == VK_OEM_MINUS) g_engine.HandleButton(BTN_SUB);
+    else if (vk == VK_DIVIDE || vk == VK_OEM_2) g_engine.HandleButton(BTN_DIV);
+
+    // 顶排数字
+    else if (vk >= '0' && vk <= '9') g_engine.InputDigit((int)(vk - '0'));
+    // 小键盘数字
+    else if (vk >= VK_NUMPAD0 && vk <= VK_NUMPAD9) g_engine.InputDigit((int)(vk - VK_NUMPAD0));
+
+    // 结果与编辑
+    else if (vk == VK_RETURN) g_engine.HandleButton(BTN_EQUAL);
+    else if (vk == VK_BACK) g_engine.HandleButton(BTN_BACK);
+    else if (vk == VK_DELETE) g_engine.HandleButton(BTN_CE);
+    else if (vk == VK_ESCAPE) g_engine.HandleButton(BTN_C);
+
+    // 小数点
+    else if (vk == VK_DECIMAL || vk == VK_OEM_PERIOD) g_engine.HandleButton(BTN_DOT);
+
+    // 快捷功能键
+    else if (vk == 'C') g_engine.HandleButton(BTN_C);
+    else if (vk == 'N') g_engine.HandleButton(BTN_NEG);
+    else if (vk == 'R') g_engine.HandleButton(BTN_SQRT);
+    else if (vk == 'P' || (vk == '5' && shift)) g_engine.HandleButton(BTN_PERCENT);
+    else if (vk == 'F') { g_engine.ToggleFractionView(); UpdateDisplay(); }
+
+    // Complex mode
+    else if (vk == 'I' || vk == 'J') g_engine.HandleButton(BTN_I);
+    else if (vk == VK_OEM_COMMA && shift) g_engine.HandleButton(BTN_ANGLE);
+    else if (vk == 'E') g_engine.HandleButton(BTN_EXP);
+    else if (vk == 'L') g_engine.HandleButton(BTN_LN);
+}
+
+// Feeds one recorded input to the engine; hwnd is NULL when headless
+static void ApplySessionEvent(HWND hwnd, const SessionEvent& e) {
+    switch (e.type) {
+        case SES_BUTTON: g_engine.HandleButton(e.value); break;
+        case SES_KEY: if (g_curTab == TAB_CALC) HandleCalcKey(hwnd, (UINT)e.value, e.mods); break;
+        case SES_PASTE: ApplyPaste(e.text.c_str()); break;
+        case SES_RECALL: RecallValue(e.text.c_str()); break;
+        case SES_TAB:
+            if (e.value < TAB_CALC || e.value > TAB_COMPLEX) break;
+            if (hTab) TabCtrl_SetCurSel(hTab, e.value);
+            SwitchTab(e.value);
+            break;
+        case SES_NUMMODE:
+            if (e.value < NUM_DOUBLE || e.value > NUM_COMPLEX) break;
+            if (hNumModeCombo) SendMessage(hNumModeCombo, CB_SETCURSEL, e.value, 0);
+            g_engine.SetNumberMode(e.value);
+            ShowComplexKeys();
+            UpdateDisplay();
             break;
-        default: return;
+        case SES_TOGGLE: g_engine.ToggleFractionView(); UpdateDisplay(); break;
+    }
+}
+
+static bool LoadSession(const WCHAR* path, std::vector<SessionEvent>* events) {
+    FILE* f = _wfopen(path, L"rb");
+    if (!f) return false;
+    bool ok = SessionLoad(f, events, NULL);
+    fclose(f);
+    return ok;
+}
+
+// FNV-1a over the display text after every input, so two runs of the same
+// log can be compared with one number
+static unsigned long long DigestDisplay(unsigned long long h) {
+    for (const char* p = g_state.displayText; ; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+        if (!*p) return h;
+    }
+}
+
+// Headless, full-speed replay: the engine runs with no windows and the log
+// is played loops times from a fresh state each time
+static int RunSessionReplay(const WCHAR* path, int loops) {
+    std::vector<SessionEvent> events;
+    if (!LoadSession(path, &events)) {
+        MessageBoxW(NULL, L"Not a session log", L"Replay", MB_OK | MB_ICONERROR);
+        return 1;
     }
+    if (loops < 1) loops = 1;
 
-    g_state.previousValue = result;
-    SetDisplayNumber(result);
+    unsigned long long firstDigest = 0;
+    bool deterministic = true;
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    for (int loop = 0; loop < loops; loop++) {
+        g_engine.Reset();
+        g_curTab = TAB_CALC;
+        unsigned long long digest = 14695981039346656037ULL;
+        for (size_t i = 0; i < events.size(); i++) {
+            ApplySessionEvent(NULL, events[i]);
+            digest = DigestDisplay(digest);
+        }
+        if (loop == 0) firstDigest = digest;
+        else if (digest != firstDigest) deterministic = false;
+    }
+    QueryPerformanceCounter(&t1);
 
-    char expr[160];
-    snprintf(expr, sizeof(expr), "%.12g %c %.12g = %s", left, g_state.currentOp, right, g_state.displayText);
-    PushHistory(expr);
+    double seconds = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+    double total = (double)events.size() * loops;
+    WCHAR wdisplay[256];
+    MultiByteToWideChar(CP_ACP, 0, g_state.displayText, -1, wdisplay, 256);
+    WCHAR buf[512];
+    StringCchPrintfW(buf, 512,
+        L"%zu inputs (%.1f s recorded) x %d\n%.3f s, %.0f inputs/s\nFinal display: %s\nDigest: %016llx%s",
+        events.size(), events.empty() ? 0.0 : events.back().timeMs / 1000.0, loops,
+        seconds, seconds > 0 ? total / seconds : 0.0, wdisplay, firstDigest,
+        deterministic ? L"" : L"\nRuns DIFFER");
+    MessageBoxW(NULL, buf, L"Replay", MB_OK | (deterministic ? MB_ICONINFORMATION : MB_ICONERROR));
+    return deterministic ? 0 : 1;
+}
 
-    g_state.waitingForOperand = true;
-    UpdateDisplay();
+// Real-time replay into the window: a one-shot timer fires at each
+// input's recorded offset from the start
+static std::vector<SessionEvent> g_replayEvents;
+static size_t g_replayNext = 0;
+static ULONGLONG g_replayStart = 0;
+
+static void ScheduleReplay(HWND hwnd) {
+    if (g_replayNext >= g_replayEvents.size()) {
+        SetWindowTextW(hwnd, L"Calculator - replay finished");
+        return;
+    }
+    long long due = g_replayEvents[g_replayNext].timeMs - (long long)(GetTickCount64() - g_replayStart);
+    SetTimer(hwnd, IDT_REPLAY, due > 0 ? (UINT)due : USER_TIMER_MINIMUM, NULL);
+}
+
+static void StartRealtimeReplay(HWND hwnd) {
+    g_replayNext = 0;
+    g_replayStart = GetTickCount64();
+    SetWindowTextW(hwnd, L"Calculator - replaying");
+    ScheduleReplay(hwnd);
 }
 
-// Handle button click
-void HandleButton(int id) {
-    if (id >= BTN_0 && id <= BTN_9) {
-        InputDigit(id - BTN_0);
+static void ReplayDueEvents(HWND hwnd) {
+    KillTimer(hwnd, IDT_REPLAY);
+    long long now = (long long)(GetTickCount64() - g_replayStart);
+    while (g_replayNext < g_replayEvents.size() && g_replayEvents[g_replayNext].timeMs <= now) {
+        ApplySessionEvent(hwnd, g_replayEvents[g_replayNext++]);
     }
-    else if (id >= BTN_ADD && id <= BTN_DIV) {
-        if (IsErrorDisplay()) strcpy(g_state.displayText, "0");
+    ScheduleReplay(hwnd);
+}
 
-        if (g_state.currentOp != 0 && !g_state.waitingForOperand) {
-            Calculate(); // 连续运算
-        } else {
-            g_state.previousValue = GetDisplayNumber();
+// Keys of the check and benchmark workloads, one character each (spaces
+// are ignored)
+static int CheckKeyButton(char k) {
+    if (k >= '0' && k <= '9') return BTN_0 + (k - '0');
+    switch (k) {
+        case '+': return BTN_ADD;     case '-': return BTN_SUB;
+        case '*': return BTN_MUL;     case '/': return BTN_DIV;
+        case '=': return BTN_EQUAL;   case '.': return BTN_DOT;
+        case 'c': return BTN_C;       case 'e': return BTN_CE;
+        case 'b': return BTN_BACK;    case 'n': return BTN_NEG;
+        case 'r': return BTN_SQRT;    case '%': return BTN_PERCENT;
+        case 'i': return BTN_RECIP;   case 'X': return BTN_MC;
+        case 'R': return BTN_MR;      case 'S': return BTN_MS;
+        case 'P': return BTN_MPLUS;   case 'M': return BTN_MMINUS;
+    }
+    return 0;
+}
+
+// --- Allocation check ---
+// Builds with CALC_COUNT_ALLOCS count every heap allocation, including
+// plain operator new. "/check-alloc" plays a fixed keypad workload in each
+// number mode on a private engine and fails if, once warm, any key reaches
+// the heap: typing, the arithmetic, formatting the display and appending
+// history must all stay inside the engine's pool and arena.
+#ifdef CALC_COUNT_ALLOCS
+void* operator new(size_t size) {
+    CALC_COUNT_HEAP();
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// The host side of history: a fixed ring, like an embedder would keep
+static char g_checkHistory[32][CALC_HISTORY_MAX];
+static int g_checkHistoryCount = 0;
+
+static void CheckHistoryLine(void*, const char* line) {
+    char* slot = g_checkHistory[g_checkHistoryCount++ % 32];
+    strncpy(slot, line, CALC_HISTORY_MAX - 1);
+    slot[CALC_HISTORY_MAX - 1] = '\0';
+}
+
+static int RunAllocCheck() {
+    static const char* kWorkload =
+        "12.5+7= *3= r S 2/3= P 1i n % b 9-4.25= R M 7/0= c "
+        "3.75*8= e 5= 144r i 0.1+0.2= 1/7= S R P X 22/7*7= n c "
+        "99999999999*99999999999*99999999999= 1/3= S 123456789/987654321= P R r";
+    static const WCHAR* kModeNames[] = {L"Double", L"Exact", L"Double-double", L"Complex"};
+    static char poolBuffer[256 * 1024];
+    static char scratchBuffer[64 * 1024];
+    const int kWarmup = 3, kRuns = 200;
+
+    WCHAR report[2048] = L"";
+    bool pass = true;
+    for (int mode = NUM_DOUBLE; mode <= NUM_COMPLEX; mode++) {
+        CalcPool pool(poolBuffer, sizeof(poolBuffer));
+        CalcArena arena(scratchBuffer, sizeof(scratchBuffer), pool.Allocator());
+        CalcEngine engine(pool.Allocator(), &arena);
+        engine.onHistory = CheckHistoryLine;
+        engine.SetNumberMode(mode);
+
+        unsigned long long ops = 0, engineAllocs = 0, heapAllocs = 0;
+        char worstKey = 0;
+        unsigned long long worstHeap = 0;
+        for (int run = 0; run < kWarmup + kRuns; run++) {
+            // Exact mode alternates between the fraction and decimal views
+            if (mode == NUM_EXACT && run % 2 == 1) engine.ToggleFractionView();
+            for (const char* k = kWorkload; *k; k++) {
+                int id = CheckKeyButton(*k);
+                if (!id) continue;
+                engine.HandleButton(id);
+                if (run < kWarmup) continue;
+                ops++;
+                engineAllocs += engine.lastOp.allocs;
+                heapAllocs += engine.lastOp.heapAllocs;
+                if (engine.lastOp.heapAllocs > worstHeap) {
+                    worstHeap = engine.lastOp.heapAllocs;
+                    worstKey = *k;
+                }
+            }
         }
+        if (heapAllocs) pass = false;
 
-        g_state.currentOp = (id == BTN_ADD) ? '+' :
-                            (id == BTN_SUB) ? '-' :
-                            (id == BTN_MUL) ? '*' : '/';
-        g_state.waitingForOperand = true;
+        WCHAR line[256];
+        StringCchPrintfW(line, 256,
+            L"%s: %llu keys, %.2f pool/arena blocks per key, %llu heap allocations%s",
+            kModeNames[mode], ops, ops ? (double)engineAllocs / ops : 0.0, heapAllocs,
+            heapAllocs ? L"" : L"\n");
+        StringCchCatW(report, 2048, line);
+        if (heapAllocs) {
+            StringCchPrintfW(line, 256, L" (worst key '%c': %llu)\n", (WCHAR)worstKey, worstHeap);
+            StringCchCatW(report, 2048, line);
+        }
     }
-    else if (id == BTN_EQUAL) {
-        Calculate();
-        g_state.currentOp = 0;
+    StringCchCatW(report, 2048, pass ? L"\nPASS: steady state is allocation-free" : L"\nFAIL: the heap was used");
+    MessageBoxW(NULL, report, L"Allocation check", MB_OK | (pass ? MB_ICONINFORMATION : MB_ICONERROR));
+    return pass ? 0 : 1;
+}
+#else
+static int RunAllocCheck() {
+    MessageBoxW(NULL, L"Rebuild with CALC_COUNT_ALLOCS defined to count allocations.",
+                L"Allocation check", MB_OK | MB_ICONINFORMATION);
+    return 1;
+}
+#endif
+
+// --- Number mode benchmarks ---
+
+// Average ns per key for a workload typed repeatedly into a private engine
+// in one number mode. History is off so only the arithmetic and the display
+// formatting are timed.
+static double TimeKeypad(int mode, const char* keys, int runs, char* display, size_t displaySize) {
+    CalcEngine engine;
+    engine.recordHistory = false;
+    engine.SetNumberMode(mode);
+    int ids[256];
+    int n = 0;
+    for (const char* k = keys; *k && n < 256; k++) {
+        int id = CheckKeyButton(*k);
+        if (id) ids[n++] = id;
     }
-    else if (id == BTN_C) {
-        g_state = CalcState();
-        g_lastHistory[0] = '\0';
-        UpdateDisplay();
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    for (int run = 0; run < runs; run++) {
+        for (int i = 0; i < n; i++) engine.HandleButton(ids[i]);
     }
-    else if (id == BTN_CE) {
-        strcpy(g_state.displayText, "0");
-        g_state.waitingForOperand = false;
-        UpdateDisplay();
+    QueryPerformanceCounter(&t1);
+    if (display) snprintf(display, displaySize, "%s", engine.state.displayText);
+    return (double)(t1.QuadPart - t0.QuadPart) * 1e9 / (double)freq.QuadPart / ((double)runs * n);
+}
+
+// The display after typing keys once into a fresh engine
+static void KeypadResult(int mode, const char* keys, char* display, size_t displaySize) {
+    TimeKeypad(mode, keys, 1, display, displaySize);
+}
+
+// "calc.exe /bench-exact": what exact mode costs against double. Times
+// rational add, multiply and divide on small fractions (the word-sized
+// path) and on values past 64 bits (the BigInt path) against the same
+// double loop, times the keypad in both modes, and checks that exact mode
+// gets right what double gets wrong.
+static int RunExactBenchmark() {
+    const int kCount = 1024, kRuns = 200;
+    std::vector<Rational> a(kCount), b(kCount), big(kCount), r(kCount);
+    std::vector<double> da(kCount), db(kCount), dr(kCount);
+    for (int i = 0; i < kCount; i++) {
+        a[i] = RatMake(i % 97 + 1, i % 89 + 2);
+        b[i] = RatMake(i % 53 + 1, i % 61 + 3);
+        big[i] = RatMul(RatMake(4000000000000000000LL + i, 3), RatMake(1000000007, 1000000009));
+        da[i] = RatToDouble(a[i]);
+        db[i] = RatToDouble(b[i]);
     }
-    else if (id == BTN_BACK) {
-        if (g_state.waitingForOperand || IsErrorDisplay()) {
-            strcpy(g_state.displayText, "0");
-        } else {
-            int len = (int)strlen(g_state.displayText);
-            if (len > 1) g_state.displayText[len - 1] = '\0';
-            else strcpy(g_state.displayText, "0");
-        }
-        UpdateDisplay();
-    }
-    else if (id == BTN_DOT) {
-        if (g_state.waitingForOperand || IsErrorDisplay()) {
-            strcpy(g_state.displayText, "0.");
-            g_state.waitingForOperand = false;
-        } else if (strchr(g_state.displayText, '.') == NULL) {
-            int len = (int)strlen(g_state.displayText);
-            if (len < 30) {
-                g_state.displayText[len] = '.';
-                g_state.displayText[len + 1] = '\0';
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    double ops = (double)kCount * kRuns;
+    double ns[7];
+    double sink = 0;
+    for (int k = 0; k < 7; k++) {
+        QueryPerformanceCounter(&t0);
+        for (int run = 0; run < kRuns; run++) {
+            for (int i = 0; i < kCount; i++) {
+                switch (k) {
+                    case 0: dr[i] = da[i] + db[i]; break;
+                    case 1: dr[i] = da[i] * db[i]; break;
+                    case 2: dr[i] = da[i] / db[i]; break;
+                    case 3: r[i] = RatAdd(a[i], b[i]); break;
+                    case 4: r[i] = RatMul(a[i], b[i]); break;
+                    case 5: RatDiv(a[i], b[i], &r[i]); break;
+                    case 6: r[i] = RatMul(big[i], b[i]); break;
+                }
             }
+            sink += k < 3 ? dr[run % kCount] : (double)r[run % kCount].isBig;
         }
-        UpdateDisplay();
-    }
-    else if (id == BTN_NEG) {
-        if (!IsErrorDisplay()) {
-            if (g_state.displayText[0] == '-') {
-                memmove(g_state.displayText, g_state.displayText + 1, strlen(g_state.displayText));
-            } else if (strcmp(g_state.displayText, "0") != 0) {
-                memmove(g_state.displayText + 1, g_state.displayText, strlen(g_state.displayText) + 1);
-                g_state.displayText[0] = '-';
+        QueryPerformanceCounter(&t1);
+        ns[k] = (double)(t1.QuadPart - t0.QuadPart) * 1e9 / (double)freq.QuadPart / ops;
+    }
+
+    static const char* kWorkload = "12.5+7=*3=/8= 1/3=+2/7=*21= 0.1+0.2=*10= 22/7-3= 5/6*6/5= n c";
+    const int kKeyRuns = 20000;
+    double keyDouble = TimeKeypad(NUM_DOUBLE, kWorkload, kKeyRuns, NULL, 0);
+    double keyExact = TimeKeypad(NUM_EXACT, kWorkload, kKeyRuns, NULL, 0);
+
+    // Sums and quotients that double rounds and exact mode must not
+    static const struct { const char* keys; const char* exact; } kChecks[] = {
+        {"1/3*3=", "1"},
+        {"0.1+0.2-0.3=", "0"},
+        {"1/49*49=", "1"},
+        {"1.1*1.1-1.21=", "0"},
+        {"99999999999*99999999999/99999999999=", "99999999999"},
+    };
+    WCHAR checks[512] = L"";
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(kChecks) / sizeof(kChecks[0]); i++) {
+        char exact[64], dbl[64];
+        KeypadResult(NUM_EXACT, kChecks[i].keys, exact, sizeof(exact));
+        KeypadResult(NUM_DOUBLE, kChecks[i].keys, dbl, sizeof(dbl));
+        bool pass = strcmp(exact, kChecks[i].exact) == 0;
+        ok = ok && pass;
+        WCHAR line[160];
+        StringCchPrintfW(line, 160, L"%S\texact %S\tdouble %S%s\n", kChecks[i].keys, exact, dbl, pass ? L"" : L"  WRONG");
+        StringCchCatW(checks, 512, line);
+    }
+
+    WCHAR buf[1400];
+    StringCchPrintfW(buf, 1400,
+        L"%d values x %d runs, ns per operation\n\n"
+        L"\tdouble\texact\n"
+        L"Add\t%.1f\t%.1f\nMultiply\t%.1f\t%.1f\nDivide\t%.1f\t%.1f\n"
+        L"Multiply past 64 bits\t\t%.1f\n\n"
+        L"Keypad: %.0f ns/key in double mode, %.0f ns/key in exact mode\n\n%s\n%s%s",
+        kCount, kRuns, ns[0], ns[3], ns[1], ns[4], ns[2], ns[5], ns[6], keyDouble, keyExact, checks,
+        ok ? L"All exact results correct" : L"EXACT RESULT WRONG", sink == 12345.678 ? L" " : L"");
+    MessageBoxW(NULL, buf, L"Exact mode benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// "calc.exe /bench-ddouble": what double-double mode costs against double.
+// Times add, multiply, divide and square root against the double loop and
+// the keypad in both modes, then formats random double-doubles with
+// DDFormat and parses them back with DDParse; every value must come back
+// exactly as stored.
+static int RunDDoubleBenchmark() {
+    const int kCount = 1024, kRuns = 500, kTrips = 20000;
+    uint64_t seed = 88172645463325252ULL;
+    std::vector<DDouble> a(kCount), b(kCount), r(kCount);
+    std::vector<double> da(kCount), db(kCount), dr(kCount);
+    for (int i = 0; i < kCount; i++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        double x = 1 + (double)(seed >> 11) / 9007199254740992.0 * 1000;
+        double y = 1 + (double)(seed & 0xfffff) / 1048576.0 * 50;
+        DDDiv(DDouble(x), DDouble(3), &a[i]);  // A full low part
+        b[i] = DDouble(y, y * 1e-17);
+        da[i] = x;
+        db[i] = y;
+    }
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    double ops = (double)kCount * kRuns;
+    double ns[8];
+    double sink = 0;
+    for (int k = 0; k < 8; k++) {
+        QueryPerformanceCounter(&t0);
+        for (int run = 0; run < kRuns; run++) {
+            for (int i = 0; i < kCount; i++) {
+                switch (k) {
+                    case 0: dr[i] = da[i] + db[i]; break;
+                    case 1: dr[i] = da[i] * db[i]; break;
+                    case 2: dr[i] = da[i] / db[i]; break;
+                    case 3: dr[i] = sqrt(da[i]); break;
+                    case 4: r[i] = DDAdd(a[i], b[i]); break;
+                    case 5: r[i] = DDMul(a[i], b[i]); break;
+                    case 6: DDDiv(a[i], b[i], &r[i]); break;
+                    case 7: DDSqrt(a[i], &r[i]); break;
+                }
             }
-            UpdateDisplay();
+            sink += k < 4 ? dr[run % kCount] : r[run % kCount].hi;
         }
+        QueryPerformanceCounter(&t1);
+        ns[k] = (double)(t1.QuadPart - t0.QuadPart) * 1e9 / (double)freq.QuadPart / ops;
     }
-    else if (id == BTN_MC) {
-        g_state.memoryValue = 0;
-        g_state.hasMemory = false;
-        UpdateDisplay();
-    }
-    else if (id == BTN_MR) {
-        SetDisplayNumber(g_state.memoryValue);
-        g_state.waitingForOperand = true;
-        UpdateDisplay();
-    }
-    else if (id == BTN_MS) {
-        g_state.memoryValue = GetDisplayNumber();
-        g_state.hasMemory = (g_state.memoryValue != 0);
-        g_state.waitingForOperand = true;
-        UpdateDisplay();
-    }
-    else if (id == BTN_MPLUS) {
-        g_state.memoryValue += GetDisplayNumber();
-        g_state.hasMemory = (g_state.memoryValue != 0);
-        g_state.waitingForOperand = true;
-        UpdateDisplay();
-    }
-    else if (id == BTN_MMINUS) {
-        g_state.memoryValue -= GetDisplayNumber();
-        g_state.hasMemory = (g_state.memoryValue != 0);
-        g_state.waitingForOperand = true;
-        UpdateDisplay();
-    }
-    else if (id == BTN_SQRT) {
-        double val = GetDisplayNumber();
-        if (val >= 0) {
-            SetDisplayNumber(sqrt(val));
-            char expr[160];
-            snprintf(expr, sizeof(expr), "sqrt(%.12g) = %s", val, g_state.displayText);
-            PushHistory(expr);
-        } else {
-            strcpy(g_state.displayText, "Error");
-            PushHistory("sqrt of negative");
-        }
-        g_state.waitingForOperand = true;
-        UpdateDisplay();
-    }
-    else if (id == BTN_PERCENT) {
-        double val = GetDisplayNumber();
-        SetDisplayNumber(val / 100.0);
-        char expr[160];
-        snprintf(expr, sizeof(expr), "%.12g%% = %s", val, g_state.displayText);
-        PushHistory(expr);
-        g_state.waitingForOperand = true;
-        UpdateDisplay();
-    }
-    else if (id == BTN_RECIP) {
-        double val = GetDisplayNumber();
-        if (val != 0) {
-            SetDisplayNumber(1.0 / val);
-            char expr[160];
-            snprintf(expr, sizeof(expr), "1/(%.12g) = %s", val, g_state.displayText);
-            PushHistory(expr);
-        } else {
-            strcpy(g_state.displayText, "Error");
-            PushHistory("1/0");
-        }
-        g_state.waitingForOperand = true;
-        UpdateDisplay();
+
+    static const char* kWorkload = "12.5+7=*3=/8= 1/3=+2/7=*21= 0.1+0.2=*10= 2r 22/7-3= n c";
+    const int kKeyRuns = 2000;
+    double keyDouble = TimeKeypad(NUM_DOUBLE, kWorkload, kKeyRuns, NULL, 0);
+    double keyDD = TimeKeypad(NUM_DDOUBLE, kWorkload, kKeyRuns, NULL, 0);
+
+    // Round trip: values spread over many magnitudes, with a low part
+    // anywhere below the high part's last bit
+    int mismatches = 0;
+    char text[96];
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < kTrips; i++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        double hi = ldexp(1 + (double)(seed >> 11) / 9007199254740992.0, (int)(seed % 200) - 100);
+        if (seed & 1) hi = -hi;
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        double lo = ldexp(hi, -53 - (int)(seed % 60)) * ((double)(seed >> 11) / 9007199254740992.0);
+        DDouble value = DDRound106(DDouble(hi, lo));
+        DDFormat(value, text, sizeof(text));
+        DDouble back;
+        if (!DDParse(text, &back) || DDCompare(back, value) != 0) mismatches++;
     }
+    QueryPerformanceCounter(&t1);
+    double tripUs = (double)(t1.QuadPart - t0.QuadPart) * 1e6 / (double)freq.QuadPart / kTrips;
+
+    // The digits double-double mode exists for
+    char root[64];
+    KeypadResult(NUM_DDOUBLE, "2r", root, sizeof(root));
+    bool digits = strncmp(root, "1.414213562373095048801688724209", 32) == 0;  // 31 digits
+
+    bool ok = mismatches == 0 && digits;
+    WCHAR buf[1400];
+    StringCchPrintfW(buf, 1400,
+        L"%d values x %d runs, ns per operation\n\n"
+        L"\tdouble\tdouble-double\n"
+        L"Add\t%.1f\t%.1f\nMultiply\t%.1f\t%.1f\nDivide\t%.1f\t%.1f\nSquare root\t%.1f\t%.1f\n\n"
+        L"Keypad: %.0f ns/key in double mode, %.0f ns/key in double-double mode\n\n"
+        L"Format and parse back: %d values, %d mismatches, %.1f us each\n"
+        L"sqrt(2) = %S%s\n\n%s%s",
+        kCount, kRuns, ns[0], ns[4], ns[1], ns[5], ns[2], ns[6], ns[3], ns[7], keyDouble, keyDD,
+        kTrips, mismatches, tripUs, root, digits ? L"" : L"  WRONG",
+        ok ? L"All double-double checks pass" : L"DOUBLE-DOUBLE CHECK FAILED", sink == 12345.678 ? L" " : L"");
+    MessageBoxW(NULL, buf, L"Double-double benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// --- Background jobs ---
+// Anything that can take more than a moment (exports, sweeps, solves,
+// factoring) is submitted to g_jobs (calc_sched.h) rather than run in
+// WndProc. The pool wakes the window with WM_JOB_WAKE and the finished
+// jobs' done callbacks run here on the UI thread; while any job is
+// pending a timer calls their progress callbacks.
+static Scheduler g_jobs;
+static HWND g_jobWindow = NULL;
+
+static void WakeJobWindow(void* ctx) {
+    PostMessage((HWND)ctx, WM_JOB_WAKE, 0, 0);
+}
+
+static void StartJobs(HWND hwnd) {
+    unsigned hw = std::thread::hardware_concurrency();
+    g_jobWindow = hwnd;
+    g_jobs.Start(std::max(2, (int)hw), WakeJobWindow, hwnd);
+}
+
+static SchedHandle SubmitJob(const SchedFn& run, const SchedFn& onDone, const SchedFn& onProgress,
+                             std::atomic<bool>* cancel = NULL) {
+    SchedHandle job = g_jobs.Submit(run, onDone, onProgress, cancel);
+    SetTimer(g_jobWindow, IDT_JOB_PROGRESS, 200, NULL);
+    return job;
+}
+
+static void DeliverJobs(HWND hwnd) {
+    g_jobs.Drain();
+    if (!g_jobs.Busy()) KillTimer(hwnd, IDT_JOB_PROGRESS);
 }
 
 // --- Date Helpers ---
-bool IsLeapYear(int year) {
-    return (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
+// IsLeapYear, DaysInMonth and the civil day arithmetic live in calc_dates.h
+
+static CivilDate CivilFromSystemTime(const SYSTEMTIME& st) {
+    CivilDate d;
+    d.year = st.wYear;
+    d.month = st.wMonth;
+    d.day = st.wDay;
+    return d;
+}
+
+static SYSTEMTIME SystemTimeFromCivil(const CivilDate& d) {
+    SYSTEMTIME st = {0};
+    st.wYear = (WORD)d.year;
+    st.wMonth = (WORD)d.month;
+    st.wDay = (WORD)d.day;
+    st.wDayOfWeek = (WORD)WeekdayFromDays(DaysFromCivil(d));
+    return st;
 }
 
-int DaysInMonth(int year, int month) {
-    static const int days[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    if (month == 2 && IsLeapYear(year)) return 29;
-    return days[month];
+// Date from one picker, time of day from another
+static LocalDateTime LocalFromPickers(HWND hDate, HWND hTime) {
+    SYSTEMTIME sd, stime;
+    DateTime_GetSystemtime(hDate, &sd);
+    DateTime_GetSystemtime(hTime, &stime);
+    LocalDateTime t;
+    t.date = CivilFromSystemTime(sd);
+    t.hour = stime.wHour;
+    t.minute = stime.wMinute;
+    t.second = stime.wSecond;
+    t.millisecond = 0;
+    return t;
 }
 
 int GetDayOfYear(const SYSTEMTIME& st) {
@@ -703,7 +1233,7 @@ int GetISOWeek(const SYSTEMTIME& st) {
 void CreateTabControl(HWND hwnd) {
     INITCOMMONCONTROLSEX icex;
     icex.dwSize = sizeof(INITCOMMONCONTROLSEX);
-    icex.dwICC = ICC_TAB_CLASSES | ICC_DATE_CLASSES;
+    icex.dwICC = ICC_TAB_CLASSES | ICC_DATE_CLASSES | ICC_LISTVIEW_CLASSES;
     InitCommonControlsEx(&icex);
 
     hTab = CreateWindowW(WC_TABCONTROL, L"",
@@ -723,6 +1253,33 @@ void CreateTabControl(HWND hwnd) {
 
     tie.pszText = (LPWSTR)L"日期计算";
     TabCtrl_InsertItem(hTab, TAB_DATECALC, &tie);
+
+    tie.pszText = (LPWSTR)L"参数扫描";
+    TabCtrl_InsertItem(hTab, TAB_SWEEP, &tie);
+
+    tie.pszText = (LPWSTR)L"金融计算";
+    TabCtrl_InsertItem(hTab, TAB_FINANCE, &tie);
+
+    tie.pszText = (LPWSTR)L"函数图像";
+    TabCtrl_InsertItem(hTab, TAB_GRAPH, &tie);
+
+    tie.pszText = (LPWSTR)L"矩阵";
+    TabCtrl_InsertItem(hTab, TAB_MATRIX, &tie);
+
+    tie.pszText = (LPWSTR)L"方程求解";
+    TabCtrl_InsertItem(hTab, TAB_SOLVE, &tie);
+
+    tie.pszText = (LPWSTR)L"整数";
+    TabCtrl_InsertItem(hTab, TAB_INTEGER, &tie);
+
+    tie.pszText = (LPWSTR)L"单位换算";
+    TabCtrl_InsertItem(hTab, TAB_UNITS, &tie);
+
+    tie.pszText = (LPWSTR)L"寄存器";
+    TabCtrl_InsertItem(hTab, TAB_REGISTERS, &tie);
+
+    tie.pszText = (LPWSTR)L"复数";
+    TabCtrl_InsertItem(hTab, TAB_COMPLEX, &tie);
 }
 
 // --- Calendar UI ---
@@ -740,6 +1297,13 @@ void CreateCalendarUI(HWND hwnd) {
         hwnd, (HMENU)IDC_DATEINFO, GetModuleHandle(NULL), NULL);
     SendMessage(g_calState.hInfoLabel, WM_SETFONT, (WPARAM)hFontNormal, 0);
 
+    // Lunar calendar, solar terms and festivals
+    g_calState.hLunarLabel = CreateWindowW(L"STATIC", L"",
+        WS_CHILD | SS_LEFT,
+        410, 45, 280, 200,
+        hwnd, NULL, GetModuleHandle(NULL), NULL);
+    SendMessage(g_calState.hLunarLabel, WM_SETFONT, (WPARAM)hFontNormal, 0);
+
     // Today Button
     g_calState.hBtnToday = CreateWindowW(L"BUTTON", L"今天",
         WS_CHILD | BS_PUSHBUTTON,
@@ -765,195 +1329,3818 @@ void UpdateCalendarInfo() {
         GetDayOfYear(st));
         
     SetWindowTextW(g_calState.hInfoLabel, buf);
+    UpdateLunarInfo(st);
+}
+
+// Lunar date, year and day in the sexagenary cycle, solar term and festival
+void UpdateLunarInfo(const SYSTEMTIME& st) {
+    long long z = DaysFromCivil(CivilFromSystemTime(st));
+    LunarDate lunar;
+    if (!LunarFromDays(z, &lunar)) {
+        SetWindowTextW(g_calState.hLunarLabel, L"农历数据范围: 1900 - 2100");
+        return;
+    }
+
+    char text[512], date[64], term[96], leap[32];
+    FormatLunarDate(lunar, date, sizeof(date));
+    int cycle = SexagenaryDay(z);
+
+    int index = SolarTermOn(z);
+    if (index >= 0) {
+        snprintf(term, sizeof(term), "节气: %s", kSolarTermNames[index]);
+    } else {
+        // Next term within this Gregorian year or the next one
+        int year = st.wYear, next = year <= LUNAR_LAST_YEAR ? 0 : 24;
+        while (next < 24 && SolarTermDay(year, next) <= z) next++;
+        if (next == 24 && year < LUNAR_LAST_YEAR) { year++; next = 0; }
+        if (next < 24) {
+            CivilDate d = CivilFromDays(SolarTermDay(year, next));
+            snprintf(term, sizeof(term), "下一节气: %s %d-%02d-%02d (%lld天后)", kSolarTermNames[next],
+                     d.year, d.month, d.day, SolarTermDay(year, next) - z);
+        } else {
+            term[0] = '\0';
+        }
+    }
+
+    int leapMonth = LunarLeapMonth(lunar.year);
+    if (leapMonth) snprintf(leap, sizeof(leap), "本年闰%s月", LunarMonthName(leapMonth));
+    else snprintf(leap, sizeof(leap), "本年无闰月");
+
+    const char* festival = LunarFestival(lunar);
+    snprintf(text, sizeof(text), "农历 %s\n%s%s日\n%s\n%s%s%s", date,
+             kHeavenlyStems[cycle % 10], kEarthlyBranches[cycle % 12], term, leap,
+             festival ? "\n节日: " : "", festival ? festival : "");
+
+    WCHAR buf[512];
+    MultiByteToWideChar(CP_UTF8, 0, text, -1, buf, 512);
+    SetWindowTextW(g_calState.hLunarLabel, buf);
+}
+
+// Bolds solar terms and festivals in the visible months (MCS_DAYSTATE)
+static void FillCalendarDayState(NMDAYSTATE* ds) {
+    static MONTHDAYSTATE states[14];
+    int count = ds->cDayState < 14 ? ds->cDayState : 14;
+    CivilDate first = CivilFromSystemTime(ds->stStart);
+    first.day = 1;
+    LunarDate lunar[31];
+    for (int i = 0; i < count; i++) {
+        CivilDate month = AddMonthsClamped(first, i, false);
+        long long z = DaysFromCivil(month);
+        int days = DaysInMonth(month.year, month.month);
+        int converted = (int)LunarFromDaysRange(z, days, lunar);
+        states[i] = 0;
+        for (int d = 0; d < days; d++) {
+            if (SolarTermOn(z + d) >= 0 || (d < converted && LunarFestival(lunar[d]))) states[i] |= 1u << d;
+        }
+    }
+    ds->prgDayState = states;
+}
+
+// "calc.exe /bench-lunar": converts every day of 1900-2100 one lookup at a
+// time and then as one batch, and reports the cost per day
+static int RunLunarBenchmark() {
+    long long first = LunarNewYearDay(LUNAR_FIRST_YEAR);
+    long long last = LunarNewYearDay(LUNAR_LAST_YEAR) + LunarYearDays(LUNAR_LAST_YEAR);
+    size_t days = (size_t)(last - first);
+    std::vector<LunarDate> batch(days);
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    long long check = 0;
+    for (long long z = first; z < last; z++) {
+        LunarDate d;
+        LunarFromDays(z, &d);
+        check += d.day;
+    }
+    QueryPerformanceCounter(&t1);
+    size_t converted = LunarFromDaysRange(first, days, &batch[0]);
+    QueryPerformanceCounter(&t2);
+    for (size_t i = 0; i < converted; i++) check -= batch[i].day; // Zero when both paths agree
+
+    double single = (double)(t1.QuadPart - t0.QuadPart) * 1e9 / (double)freq.QuadPart / (double)days;
+    double ranged = (double)(t2.QuadPart - t1.QuadPart) * 1e9 / (double)freq.QuadPart / (double)days;
+    bool ok = check == 0 && converted == days;
+    WCHAR buf[256];
+    StringCchPrintfW(buf, 256, L"%zu days (1900-2100)\nSingle lookups: %.1f ns/day\nBatch: %.1f ns/day\n%s",
+        days, single, ranged, ok ? L"Results agree" : L"MISMATCH");
+    MessageBoxW(NULL, buf, L"Lunar calendar benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
 }
 
 // --- Date Calc UI ---
-static HWND hDateCtrls[30];
+static HWND hDateCtrls[40];
 static int hDateCount = 0;
 static HWND hDtpStart, hDtpEnd, hDtpBase, hComboOp, hEditVal, hComboUnit, hResDiff, hResAdd;
+static HWND hTimeStart, hTimeEnd, hTimeBase, hZoneStart, hZoneEnd, hZoneBase;
+static HWND hEditCount, hCheckEom, hComboBiz, hListSchedule, hSchedStatus, hBtnExport;
+
+// Schedule currently shown in the virtual list; rows are generated on demand
+static ScheduleSpec g_schedule;
+
+// Zones are loaded from the tz database on first use and cached
+static TzDatabase g_tzdb;
+
+void AddDateCtrl(HWND h) { if(hDateCount < 40) hDateCtrls[hDateCount++] = h; }
 
-void AddDateCtrl(HWND h) { if(hDateCount < 30) hDateCtrls[hDateCount++] = h; }
+// Editable zone combo prefilled with common IANA names. The default is the
+// current Windows offset, which works even without a tz database.
+static HWND CreateZoneCombo(HWND hwnd, int x, int y, int w, int id) {
+    static const WCHAR* zones[] = {
+        L"UTC", L"Asia/Shanghai", L"Asia/Tokyo", L"Asia/Kolkata", L"Asia/Dubai",
+        L"Europe/London", L"Europe/Paris", L"Europe/Moscow", L"America/New_York",
+        L"America/Chicago", L"America/Denver", L"America/Los_Angeles",
+        L"America/Sao_Paulo", L"Australia/Sydney", L"Pacific/Auckland"
+    };
+    HWND h = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWN|CBS_AUTOHSCROLL|WS_VSCROLL, x, y, w, 200, hwnd, (HMENU)(INT_PTR)id, NULL, NULL);
+    for (int i = 0; i < (int)(sizeof(zones) / sizeof(zones[0])); i++) SendMessage(h, CB_ADDSTRING, 0, (LPARAM)zones[i]);
+
+    TIME_ZONE_INFORMATION tzi;
+    DWORD mode = GetTimeZoneInformation(&tzi);
+    LONG bias = tzi.Bias + (mode == TIME_ZONE_ID_DAYLIGHT ? tzi.DaylightBias : 0);
+    LONG east = -bias;
+    WCHAR local[32];
+    if (east == 0) StringCchCopyW(local, 32, L"UTC");
+    else StringCchPrintfW(local, 32, L"UTC%c%02d:%02d", east < 0 ? L'-' : L'+', (east < 0 ? -east : east) / 60, (east < 0 ? -east : east) % 60);
+    SetWindowTextW(h, local);
+    return h;
+}
 
 void CreateDateCalcUI(HWND hwnd) {
+    // Windows ships no TZif files; TZDIR or a zoneinfo folder beside the exe supplies them
+    char dir[MAX_PATH];
+    DWORD len = GetModuleFileNameA(NULL, dir, MAX_PATH);
+    char* slash = len ? strrchr(dir, '\\') : NULL;
+    if (slash && (size_t)(slash - dir) + 10 < sizeof(dir)) {
+        strcpy(slash + 1, "zoneinfo");
+        g_tzdb.AddDir(dir);
+    }
+
     // 1. Date Difference
     AddDateCtrl(CreateWindowW(L"BUTTON", L"Calculate Difference", WS_CHILD|BS_GROUPBOX, 10, 40, 385, 200, hwnd, NULL, GetModuleHandle(NULL), NULL));
 
-    AddDateCtrl(CreateWindowW(L"STATIC", L"From:", WS_CHILD|SS_CENTERIMAGE, 20, 70, 40, 25, hwnd, NULL, NULL, NULL));
-    hDtpStart = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_SHORTDATEFORMAT, 70, 70, 120, 25, hwnd, (HMENU)IDC_DTP_START, NULL, NULL);
+    // Each end is a date, a time of day and a time zone
+    AddDateCtrl(CreateWindowW(L"STATIC", L"From:", WS_CHILD|SS_CENTERIMAGE, 20, 65, 40, 25, hwnd, NULL, NULL, NULL));
+    hDtpStart = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_SHORTDATEFORMAT, 60, 65, 95, 25, hwnd, (HMENU)IDC_DTP_START, NULL, NULL);
     AddDateCtrl(hDtpStart);
-        
-    AddDateCtrl(CreateWindowW(L"STATIC", L"To:", WS_CHILD|SS_CENTERIMAGE, 200, 70, 30, 25, hwnd, NULL, NULL, NULL));
-    hDtpEnd = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_SHORTDATEFORMAT, 240, 70, 120, 25, hwnd, (HMENU)IDC_DTP_END, NULL, NULL);
+    hTimeStart = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_TIMEFORMAT, 160, 65, 85, 25, hwnd, (HMENU)IDC_TIME_START, NULL, NULL);
+    AddDateCtrl(hTimeStart);
+    hZoneStart = CreateZoneCombo(hwnd, 250, 65, 135, IDC_ZONE_START);
+    AddDateCtrl(hZoneStart);
+
+    AddDateCtrl(CreateWindowW(L"STATIC", L"To:", WS_CHILD|SS_CENTERIMAGE, 20, 97, 40, 25, hwnd, NULL, NULL, NULL));
+    hDtpEnd = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_SHORTDATEFORMAT, 60, 97, 95, 25, hwnd, (HMENU)IDC_DTP_END, NULL, NULL);
     AddDateCtrl(hDtpEnd);
+    hTimeEnd = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_TIMEFORMAT, 160, 97, 85, 25, hwnd, (HMENU)IDC_TIME_END, NULL, NULL);
+    AddDateCtrl(hTimeEnd);
+    hZoneEnd = CreateZoneCombo(hwnd, 250, 97, 135, IDC_ZONE_END);
+    AddDateCtrl(hZoneEnd);
 
-    AddDateCtrl(CreateWindowW(L"BUTTON", L"Calculate Interval", WS_CHILD|BS_PUSHBUTTON, 130, 110, 140, 30, hwnd, (HMENU)IDC_BTN_CALCDIFF, NULL, NULL));
+    AddDateCtrl(CreateWindowW(L"BUTTON", L"Calculate Interval", WS_CHILD|BS_PUSHBUTTON, 130, 132, 140, 28, hwnd, (HMENU)IDC_BTN_CALCDIFF, NULL, NULL));
 
-    hResDiff = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_CENTER, 20, 150, 365, 80, hwnd, NULL, NULL, NULL);
+    hResDiff = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_CENTER, 20, 168, 365, 66, hwnd, NULL, NULL, NULL);
     AddDateCtrl(hResDiff);
 
     // 2. Date Add/Sub
     AddDateCtrl(CreateWindowW(L"BUTTON", L"Add/Subtract Date", WS_CHILD|BS_GROUPBOX, 10, 260, 385, 200, hwnd, NULL, GetModuleHandle(NULL), NULL));
 
-    hDtpBase = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_SHORTDATEFORMAT, 20, 290, 120, 25, hwnd, (HMENU)IDC_DTP_BASE, NULL, NULL);
+    hDtpBase = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_SHORTDATEFORMAT, 20, 285, 95, 25, hwnd, (HMENU)IDC_DTP_BASE, NULL, NULL);
     AddDateCtrl(hDtpBase);
+    hTimeBase = CreateWindowW(DATETIMEPICK_CLASS, L"", WS_CHILD|WS_BORDER|DTS_TIMEFORMAT, 120, 285, 85, 25, hwnd, (HMENU)IDC_TIME_BASE, NULL, NULL);
+    AddDateCtrl(hTimeBase);
+    hZoneBase = CreateZoneCombo(hwnd, 210, 285, 175, IDC_ZONE_BASE);
+    AddDateCtrl(hZoneBase);
 
-    hComboOp = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 150, 290, 40, 100, hwnd, NULL, NULL, NULL);
+    hComboOp = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 20, 318, 40, 100, hwnd, NULL, NULL, NULL);
     AddDateCtrl(hComboOp);
     SendMessage(hComboOp, CB_ADDSTRING, 0, (LPARAM)L"+");
     SendMessage(hComboOp, CB_ADDSTRING, 0, (LPARAM)L"-");
     SendMessage(hComboOp, CB_SETCURSEL, 0, 0);
 
-    hEditVal = CreateWindowW(L"EDIT", L"1", WS_CHILD|WS_BORDER|ES_NUMBER|ES_CENTER, 200, 290, 50, 25, hwnd, (HMENU)IDC_EDIT_VALUE, NULL, NULL);
+    // Not ES_NUMBER: hours, minutes and seconds may be fractional
+    hEditVal = CreateWindowW(L"EDIT", L"1", WS_CHILD|WS_BORDER|ES_CENTER, 70, 318, 80, 25, hwnd, (HMENU)IDC_EDIT_VALUE, NULL, NULL);
     AddDateCtrl(hEditVal);
 
-    hComboUnit = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 260, 290, 80, 100, hwnd, (HMENU)IDC_COMBO_UNIT, NULL, NULL);
+    hComboUnit = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 160, 318, 90, 160, hwnd, (HMENU)IDC_COMBO_UNIT, NULL, NULL);
     AddDateCtrl(hComboUnit);
     SendMessage(hComboUnit, CB_ADDSTRING, 0, (LPARAM)L"Days");
     SendMessage(hComboUnit, CB_ADDSTRING, 0, (LPARAM)L"Weeks");
     SendMessage(hComboUnit, CB_ADDSTRING, 0, (LPARAM)L"Months");
     SendMessage(hComboUnit, CB_ADDSTRING, 0, (LPARAM)L"Years");
+    SendMessage(hComboUnit, CB_ADDSTRING, 0, (LPARAM)L"Hours");
+    SendMessage(hComboUnit, CB_ADDSTRING, 0, (LPARAM)L"Minutes");
+    SendMessage(hComboUnit, CB_ADDSTRING, 0, (LPARAM)L"Seconds");
     SendMessage(hComboUnit, CB_SETCURSEL, 0, 0);
 
-    AddDateCtrl(CreateWindowW(L"BUTTON", L"Calculate Date", WS_CHILD|BS_PUSHBUTTON, 130, 330, 140, 30, hwnd, (HMENU)IDC_BTN_CALCADD, NULL, NULL));
+    AddDateCtrl(CreateWindowW(L"BUTTON", L"Calculate Date", WS_CHILD|BS_PUSHBUTTON, 260, 317, 125, 28, hwnd, (HMENU)IDC_BTN_CALCADD, NULL, NULL));
 
-    hResAdd = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_CENTER, 20, 370, 365, 80, hwnd, NULL, NULL, NULL);
+    hResAdd = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_CENTER, 20, 360, 365, 90, hwnd, NULL, NULL, NULL);
     AddDateCtrl(hResAdd);
+
+    // 3. Recurring schedule: every <value> <unit> from the base date above
+    AddDateCtrl(CreateWindowW(L"BUTTON", L"Schedule", WS_CHILD|BS_GROUPBOX, 405, 40, 285, 420, hwnd, NULL, GetModuleHandle(NULL), NULL));
+
+    AddDateCtrl(CreateWindowW(L"STATIC", L"Count:", WS_CHILD|SS_CENTERIMAGE, 415, 65, 45, 25, hwnd, NULL, NULL, NULL));
+    hEditCount = CreateWindowW(L"EDIT", L"12", WS_CHILD|WS_BORDER|ES_NUMBER|ES_CENTER, 465, 65, 80, 25, hwnd, (HMENU)IDC_EDIT_COUNT, NULL, NULL);
+    AddDateCtrl(hEditCount);
+
+    hCheckEom = CreateWindowW(L"BUTTON", L"Month end", WS_CHILD|BS_AUTOCHECKBOX, 560, 65, 120, 25, hwnd, (HMENU)IDC_CHECK_EOM, NULL, NULL);
+    AddDateCtrl(hCheckEom);
+
+    hComboBiz = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 415, 97, 165, 120, hwnd, (HMENU)IDC_COMBO_BIZ, NULL, NULL);
+    AddDateCtrl(hComboBiz);
+    SendMessage(hComboBiz, CB_ADDSTRING, 0, (LPARAM)L"No adjustment");
+    SendMessage(hComboBiz, CB_ADDSTRING, 0, (LPARAM)L"Following business day");
+    SendMessage(hComboBiz, CB_ADDSTRING, 0, (LPARAM)L"Modified following");
+    SendMessage(hComboBiz, CB_ADDSTRING, 0, (LPARAM)L"Preceding business day");
+    SendMessage(hComboBiz, CB_SETCURSEL, BIZ_NONE, 0);
+
+    AddDateCtrl(CreateWindowW(L"BUTTON", L"Generate", WS_CHILD|BS_PUSHBUTTON, 415, 130, 125, 28, hwnd, (HMENU)IDC_BTN_SCHEDULE, NULL, NULL));
+    hBtnExport = CreateWindowW(L"BUTTON", L"Export CSV...", WS_CHILD|BS_PUSHBUTTON, 555, 130, 125, 28, hwnd, (HMENU)IDC_BTN_EXPORT, NULL, NULL);
+    AddDateCtrl(hBtnExport);
+
+    // Owner-data list: the control asks for rows as they scroll into view
+    hListSchedule = CreateWindowW(WC_LISTVIEW, L"", WS_CHILD|WS_BORDER|LVS_REPORT|LVS_OWNERDATA|LVS_SHOWSELALWAYS,
+        415, 168, 265, 255, hwnd, (HMENU)IDC_LIST_SCHEDULE, NULL, NULL);
+    ListView_SetExtendedListViewStyle(hListSchedule, LVS_EX_FULLROWSELECT);
+    AddDateCtrl(hListSchedule);
+
+    LVCOLUMNW col = {0};
+    col.mask = LVCF_TEXT | LVCF_WIDTH;
+    col.cx = 70;  col.pszText = (LPWSTR)L"#";
+    ListView_InsertColumn(hListSchedule, 0, &col);
+    col.cx = 110; col.pszText = (LPWSTR)L"Date";
+    ListView_InsertColumn(hListSchedule, 1, &col);
+    col.cx = 60;  col.pszText = (LPWSTR)L"Day";
+    ListView_InsertColumn(hListSchedule, 2, &col);
+
+    hSchedStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 415, 430, 265, 22, hwnd, NULL, NULL, NULL);
+    AddDateCtrl(hSchedStatus);
 }
 
-void CalcDateDiff() {
-    SYSTEMTIME st1, st2;
-    DateTime_GetSystemtime(hDtpStart, &st1);
-    DateTime_GetSystemtime(hDtpEnd, &st2);
+// Looks up the zone typed or picked in a combo. On failure writes a
+// message to the result label and returns NULL.
+static const TimeZone* ReadZone(HWND hCombo, HWND hResult) {
+    WCHAR wname[64];
+    char name[64];
+    GetWindowTextW(hCombo, wname, 64);
+    WideCharToMultiByte(CP_UTF8, 0, wname, -1, name, sizeof(name), NULL, NULL);
+    const TimeZone* zone = g_tzdb.Get(name);
+    if (!zone) {
+        WCHAR buf[160];
+        StringCchPrintfW(buf, 160, L"Unknown time zone \"%s\"\n(needs a tz database in TZDIR or a zoneinfo\nfolder next to the program; UTC+hh:mm always works)", wname);
+        SetWindowTextW(hResult, buf);
+    }
+    return zone;
+}
 
-    FILETIME ft1, ft2;
-    SystemTimeToFileTime(&st1, &ft1);
-    SystemTimeToFileTime(&st2, &ft2);
+// "+05:30" style offset for a zone type
+static void FormatUtcOffset(int utoff, WCHAR* buf, int size) {
+    int a = utoff < 0 ? -utoff : utoff;
+    StringCchPrintfW(buf, size, L"UTC%c%02d:%02d", utoff < 0 ? L'-' : L'+', a / 3600, a / 60 % 60);
+}
 
-    ULARGE_INTEGER u1, u2;
-    u1.LowPart = ft1.dwLowDateTime; u1.HighPart = ft1.dwHighDateTime;
-    u2.LowPart = ft2.dwLowDateTime; u2.HighPart = ft2.dwHighDateTime;
+void CalcDateDiff() {
+    const TimeZone* z1 = ReadZone(hZoneStart, hResDiff);
+    const TimeZone* z2 = ReadZone(hZoneEnd, hResDiff);
+    if (!z1 || !z2) return;
 
-    long long diff = (long long)(u2.QuadPart - u1.QuadPart);
+    // Both ends go to UTC first, so DST switches and zone offsets count
+    long long t1 = TzLocalToUtcMs(*z1, LocalFromPickers(hDtpStart, hTimeStart));
+    long long t2 = TzLocalToUtcMs(*z2, LocalFromPickers(hDtpEnd, hTimeEnd));
+    long long diff = t2 - t1;
+    const WCHAR* sign = diff < 0 ? L"-" : L"";
     if (diff < 0) diff = -diff;
-    
-    // 100ns units to days: / 10,000,000 / 3600 / 24
-    long long days = diff / 864000000000LL;
+
+    long long days = diff / MS_PER_DAY;
+    long long rem = diff % MS_PER_DAY;
     long long weeks = days / 7;
-    int remDays = days % 7;
+    int remDays = (int)(days % 7);
+    int h = (int)(rem / MS_PER_HOUR), m = (int)(rem / MS_PER_MINUTE % 60), sec = (int)(rem / MS_PER_SECOND % 60);
+    int ms = (int)(rem % 1000);
 
-    WCHAR buf[128];
-    StringCchPrintfW(buf, 128, L"Difference:\n%lld days\n(%lld weeks, %d days)", days, weeks, remDays);
+    WCHAR buf[192];
+    StringCchPrintfW(buf, 192, L"Difference:\n%s%lld days %02d:%02d:%02d.%03d\n(%lld weeks, %d days)\n%s%lld.%03lld seconds",
+        sign, days, h, m, sec, ms, weeks, remDays, sign, diff / 1000, diff % 1000);
     SetWindowTextW(hResDiff, buf);
 }
 
-void CalcDateAdd() {
-    SYSTEMTIME st;
-    DateTime_GetSystemtime(hDtpBase, &st);
-    
+// Reads the Add/Subtract value: a number below 1e12 with nothing but
+// spaces after it. *whole tells whether it has a fractional part.
+static bool ReadStepValue(double* val, bool* whole) {
     WCHAR buf[128];
     GetWindowTextW(hEditVal, buf, 128);
-    int val = _wtoi(buf);
-    
+    WCHAR* end;
+    *val = wcstod(buf, &end);
+    bool number = end != buf;
+    while (*end == L' ') end++;
+    *whole = *val == floor(*val);
+    return number && !*end && fabs(*val) < 1e12;
+}
+
+void CalcDateAdd() {
+    const TimeZone* zone = ReadZone(hZoneBase, hResAdd);
+    if (!zone) return;
+
+    WCHAR buf[192];
+    double val;
+    bool whole;
+    int unit = (int)SendMessage(hComboUnit, CB_GETCURSEL, 0, 0);
+    bool valid = ReadStepValue(&val, &whole);
+    if (!valid || (unit <= DATE_UNIT_YEARS && !whole)) {
+        SetWindowTextW(hResAdd, valid ? L"Days to years need a whole number" : L"Invalid value");
+        return;
+    }
+
     int op = SendMessage(hComboOp, CB_GETCURSEL, 0, 0); // 0=+, 1=-
     if (op == 1) val = -val;
-    
-    int unit = SendMessage(hComboUnit, CB_GETCURSEL, 0, 0); // Day, Week, Month, Year
 
-    // Use FILETIME for Days/Weeks
-    if (unit == 0 || unit == 1) {
-        if (unit == 1) val *= 7;
-        
-        FILETIME ft;
-        SystemTimeToFileTime(&st, &ft);
-        ULARGE_INTEGER u;
-        u.LowPart = ft.dwLowDateTime; u.HighPart = ft.dwHighDateTime;
-        u.QuadPart += (long long)val * 864000000000LL;
-        
-        ft.dwLowDateTime = u.LowPart; ft.dwHighDateTime = u.HighPart;
-        FileTimeToSystemTime(&ft, &st);
-    } 
-    else if (unit == 2) { // Months
-        int totalMonths = st.wYear * 12 + (st.wMonth - 1) + val;
-        st.wYear = totalMonths / 12;
-        st.wMonth = (totalMonths % 12) + 1;
-        // Adjust days (e.g. Jan 31 + 1 month -> Feb 28/29)
-        int dim = DaysInMonth(st.wYear, st.wMonth);
-        if (st.wDay > dim) st.wDay = dim;
-    }
-    else if (unit == 3) { // Years
-        st.wYear += val;
-        // Adjust leap day
-        if (st.wMonth == 2 && st.wDay == 29 && !IsLeapYear(st.wYear)) st.wDay = 28;
+    LocalDateTime local = LocalFromPickers(hDtpBase, hTimeBase);
+    if (unit <= DATE_UNIT_YEARS && !DateStepsInRange(local.date.year, (long long)val, unit, 1)) {
+        StringCchPrintfW(buf, 192, L"The result would pass year %d", DATE_MAX_YEAR);
+        SetWindowTextW(hResAdd, buf);
+        return;
     }
 
+    // Month/year steps clamp the day (e.g. Jan 31 + 1 month -> Feb 28/29)
+    long long base = TzLocalToUtcMs(*zone, local);
+    long long utc = TzAddUnits(*zone, base, val, unit, false);
+    TzType type;
+    LocalDateTime t = TzUtcToLocal(*zone, utc, &type);
+    SYSTEMTIME st = SystemTimeFromCivil(t.date);
+
     const WCHAR* dayNames[] = {L"Sun", L"Mon", L"Tue", L"Wed", L"Thu", L"Fri", L"Sat"};
-    StringCchPrintfW(buf, 128, L"Result:\n%d-%02d-%02d (%s)\nWeek %d", 
-        st.wYear, st.wMonth, st.wDay, dayNames[st.wDayOfWeek], GetISOWeek(st));
+    WCHAR abbr[16], offset[16], frac[8] = L"";
+    MultiByteToWideChar(CP_UTF8, 0, type.abbr, -1, abbr, 16);
+    FormatUtcOffset(type.utoff, offset, 16);
+    if (t.millisecond) StringCchPrintfW(frac, 8, L".%03d", t.millisecond);
+    StringCchPrintfW(buf, 192, L"Result:\n%d-%02d-%02d %02d:%02d:%02d%s (%s)\n%s %s, Week %d",
+        t.date.year, t.date.month, t.date.day, t.hour, t.minute, t.second, frac, dayNames[st.wDayOfWeek],
+        abbr, offset, GetISOWeek(st));
     SetWindowTextW(hResAdd, buf);
 }
 
-void SwitchTab(int tab) {
-    g_curTab = tab;
-    
-    // 1. Calculator Controls
-    int showCalc = (tab == TAB_CALC) ? SW_SHOW : SW_HIDE;
-    for (int i = 0; i < hCalcCount; i++) ShowWindow(hCalcControls[i], showCalc);
+// Reads the Add/Subtract step and the schedule options into a spec
+static bool ReadScheduleSpec(ScheduleSpec* spec) {
+    SYSTEMTIME st;
+    DateTime_GetSystemtime(hDtpBase, &st);
+    WCHAR buf[32];
 
-    // 2. Calendar Controls
-    int showCal = (tab == TAB_CALENDAR) ? SW_SHOW : SW_HIDE;
-    ShowWindow(g_calState.hMonthCal, showCal);
-    ShowWindow(g_calState.hInfoLabel, showCal);
-    ShowWindow(g_calState.hBtnToday, showCal);
+    spec->base = CivilFromSystemTime(st);
+    double val;
+    bool whole;
+    if (!ReadStepValue(&val, &whole) || !whole) {
+        SetWindowTextW(hSchedStatus, L"The step must be a whole number");
+        return false;
+    }
+    spec->step = (long long)val;
+    if (SendMessage(hComboOp, CB_GETCURSEL, 0, 0) == 1) spec->step = -spec->step;
+    spec->unit = (int)SendMessage(hComboUnit, CB_GETCURSEL, 0, 0);
+    if (spec->unit > DATE_UNIT_YEARS) {
+        SetWindowTextW(hSchedStatus, L"Schedules step by days, weeks, months or years");
+        return false;
+    }
+    spec->endOfMonth = SendMessage(hCheckEom, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    spec->businessRule = (int)SendMessage(hComboBiz, CB_GETCURSEL, 0, 0);
+    GetWindowTextW(hEditCount, buf, 32);
+    WCHAR* end;
+    spec->count = wcstoll(buf, &end, 10);
+    if (end == buf || *end) spec->count = 0;  // A pasted "12abc" gets past ES_NUMBER
 
-    // 3. Date Calc Controls
-    int showDate = (tab == TAB_DATECALC) ? SW_SHOW : SW_HIDE;
-    for (int i = 0; i < hDateCount; i++) ShowWindow(hDateCtrls[i], showDate);
-    
-    // Refresh to clean artifacts
-    InvalidateRect(GetParent(g_calState.hMonthCal), NULL, TRUE);
+    if (spec->step == 0 || spec->count <= 0) {
+        SetWindowTextW(hSchedStatus, L"Step and count must be non-zero");
+        return false;
+    }
+    if (!ScheduleInRange(*spec)) {
+        WCHAR msg[64];
+        StringCchPrintfW(msg, 64, L"The schedule would pass year %d", DATE_MAX_YEAR);
+        SetWindowTextW(hSchedStatus, msg);
+        return false;
+    }
+    return true;
 }
 
-// Window procedure
-LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
-    switch (msg) {
-        case WM_CREATE: {
-            // Enable DWM
-            DWMNCRENDERINGPOLICY policy = DWMNCRP_ENABLED;
-            DwmSetWindowAttribute(hwnd, DWMWA_NCRENDERING_POLICY, &policy, sizeof(policy));
-            MARGINS margins = {0, 0, 30, 0};
-            DwmExtendFrameIntoClientArea(hwnd, &margins);
-            
-            InitFonts(); // Initialize fonts first
-            CreateTabControl(hwnd);
-            CreateCalculatorUI(hwnd);
-            CreateCalendarUI(hwnd);
-            CreateDateCalcUI(hwnd);
-            
-            // Initial state: Show calc, hide others
-            SwitchTab(TAB_CALC);
-            return 0;
-        }
-        
-        case WM_NOTIFY: {
-            NMHDR* pnm = (NMHDR*)lParam;
-            if (pnm->idFrom == IDC_TAB && pnm->code == TCN_SELCHANGE) {
-                SwitchTab(TabCtrl_GetCurSel(hTab));
-            }
-            else if (pnm->idFrom == IDC_MONTHCAL && (pnm->code == MCN_SELECT || pnm->code == MCN_SELCHANGE)) {
-                UpdateCalendarInfo();
-            }
-            return 0;
-        }
-        
-        case WM_CTLCOLORSTATIC: {
-            HDC hdc = (HDC)wParam;
+void ShowSchedule() {
+    ScheduleSpec spec;
+    if (!ReadScheduleSpec(&spec)) return;
+
+    // The list view caps item counts at int; export handles anything larger
+    const long long maxRows = 100000000;
+    if (spec.count > maxRows) spec.count = maxRows;
+    g_schedule = spec;
+    ListView_SetItemCountEx(hListSchedule, (int)spec.count, LVSICF_NOSCROLL);
+    InvalidateRect(hListSchedule, NULL, TRUE);
+
+    CivilDate last = ScheduleAt(spec, spec.count - 1);
+    WCHAR buf[96];
+    StringCchPrintfW(buf, 96, L"%lld dates, last %d-%02d-%02d", spec.count, last.year, last.month, last.day);
+    SetWindowTextW(hSchedStatus, buf);
+}
+
+// Supplies the text of one virtual list row straight from the spec
+static void FillScheduleItem(NMLVDISPINFOW* info) {
+    if (!(info->item.mask & LVIF_TEXT)) return;
+    static const WCHAR* dayNames[] = {L"Sun", L"Mon", L"Tue", L"Wed", L"Thu", L"Fri", L"Sat"};
+    long long k = info->item.iItem;
+    long long z = ScheduleDayAt(g_schedule, k);
+    CivilDate d = CivilFromDays(z);
+
+    switch (info->item.iSubItem) {
+        case 0: StringCchPrintfW(info->item.pszText, info->item.cchTextMax, L"%lld", k + 1); break;
+        case 1: StringCchPrintfW(info->item.pszText, info->item.cchTextMax, L"%d-%02d-%02d", d.year, d.month, d.day); break;
+        default: StringCchPrintfW(info->item.pszText, info->item.cchTextMax, L"%s", dayNames[WeekdayFromDays(z)]); break;
+    }
+}
+
+// The running export. Its job owns the spec and the file until the
+// done callback runs.
+static ScheduleSpec g_exportSpec;
+static FILE* g_exportFile = NULL;
+static std::atomic<long long> g_exportRows(0);
+static SchedHandle g_exportTask;
+
+static void UpdateExportProgress() {
+    long long rows = g_exportRows.load();
+    WCHAR buf[96];
+    StringCchPrintfW(buf, 96, L"Exporting %lld of %lld dates (%.0f%%)", rows, g_exportSpec.count,
+        100.0 * (double)rows / (double)g_exportSpec.count);
+    SetWindowTextW(hSchedStatus, buf);
+}
+
+static void FinishExport() {
+    if (!g_exportTask) return;
+    bool cancelled = g_exportTask->Cancelled();
+    g_exportTask.reset();
+    long long rows = g_exportRows.load();
+    bool ok = fclose(g_exportFile) == 0 && rows == g_exportSpec.count;
+    g_exportFile = NULL;
+    SetWindowTextW(hBtnExport, L"Export CSV...");
+
+    WCHAR buf[96];
+    StringCchPrintfW(buf, 96, ok ? L"Exported %lld dates" : cancelled ? L"Cancelled after %lld dates" :
+        L"Write failed after %lld dates", rows);
+    SetWindowTextW(hSchedStatus, buf);
+}
+
+// Streams the schedule to a CSV file without materializing it. Long
+// schedules take a while, so the writing runs as a background job and
+// the button cancels it until it is done.
+void ExportSchedule(HWND hwnd) {
+    if (g_exportTask) {
+        g_jobs.Cancel(g_exportTask);
+        return;
+    }
+    ScheduleSpec spec;
+    if (!ReadScheduleSpec(&spec)) return;
+
+    WCHAR path[MAX_PATH] = L"schedule.csv";
+    OPENFILENAMEW ofn = {0};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hwnd;
+    ofn.lpstrFilter = L"CSV Files (*.csv)\0*.csv\0All Files (*.*)\0*.*\0";
+    ofn.lpstrFile = path;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrDefExt = L"csv";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+    if (!GetSaveFileNameW(&ofn)) return;
+
+    FILE* f = _wfopen(path, L"w");
+    if (!f) {
+        SetWindowTextW(hSchedStatus, L"Cannot open file");
+        return;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 16);
+    g_exportSpec = spec;
+    g_exportFile = f;
+    g_exportRows = 0;
+    SetWindowTextW(hBtnExport, L"Cancel export");
+    g_exportTask = SubmitJob([](SchedJob* job) { WriteScheduleCsv(g_exportSpec, g_exportFile, &g_exportRows, job->cancel); },
+        [](SchedJob*) { FinishExport(); }, [](SchedJob*) { UpdateExportProgress(); });
+    UpdateExportProgress();
+}
+
+// --- Sweep UI ---
+static HWND hSweepCtrls[20];
+static int hSweepCount = 0;
+static HWND hSweepExpr, hSweepVars, hSweepOutput, hSweepThreads, hSweepStatus, hSweepResult;
+static HWND hBtnSweep, hBtnSweepCancel;
+
+// The running sweep. Its job owns the sweep, the program and the CSV sink
+// until the done callback runs.
+static ExprProgram g_sweepProgram;
+static SweepJob g_sweepJob;
+static SweepCsvSink* g_sweepCsv = NULL;
+static SchedHandle g_sweepTask;
+static int g_sweepThreadCount = 0;
+static int g_sweepOutput = 0;
+static LARGE_INTEGER g_sweepStart;
+
+#define SWEEP_OUT_SUMMARY 0
+#define SWEEP_OUT_HISTORY 1
+#define SWEEP_OUT_CSV     2
+
+#define SWEEP_HISTORY_POINTS 20
+
+void AddSweepCtrl(HWND h) { if (hSweepCount < 20) hSweepCtrls[hSweepCount++] = h; }
+
+void CreateSweepUI(HWND hwnd) {
+    AddSweepCtrl(CreateWindowW(L"STATIC", L"Expression:", WS_CHILD|SS_CENTERIMAGE, 20, 45, 80, 25, hwnd, NULL, NULL, NULL));
+    hSweepExpr = CreateWindowW(L"EDIT", L"principal * rate/12 / (1 - (1 + rate/12)^-n)", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL,
+        100, 45, 580, 25, hwnd, (HMENU)IDC_SWEEP_EXPR, NULL, NULL);
+    AddSweepCtrl(hSweepExpr);
+
+    AddSweepCtrl(CreateWindowW(L"STATIC", L"Variables, one per line:  name = a..b step s  |  a..b count n  |  v1, v2, ...",
+        WS_CHILD|SS_LEFT, 20, 80, 660, 20, hwnd, NULL, NULL, NULL));
+    hSweepVars = CreateWindowW(L"EDIT", L"principal = 1000..100000 count 100\r\nrate = 0.01..0.2 count 1000\r\nn = 12, 24, 36, 60, 120, 240, 360",
+        WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_WANTRETURN, 20, 102, 420, 150, hwnd, (HMENU)IDC_SWEEP_VARS, NULL, NULL);
+    AddSweepCtrl(hSweepVars);
+
+    AddSweepCtrl(CreateWindowW(L"STATIC", L"Output:", WS_CHILD|SS_CENTERIMAGE, 455, 102, 60, 25, hwnd, NULL, NULL, NULL));
+    hSweepOutput = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 520, 102, 160, 120, hwnd, (HMENU)IDC_SWEEP_OUTPUT, NULL, NULL);
+    AddSweepCtrl(hSweepOutput);
+    SendMessage(hSweepOutput, CB_ADDSTRING, 0, (LPARAM)L"Summary");
+    SendMessage(hSweepOutput, CB_ADDSTRING, 0, (LPARAM)L"Summary + history");
+    SendMessage(hSweepOutput, CB_ADDSTRING, 0, (LPARAM)L"CSV file...");
+    SendMessage(hSweepOutput, CB_SETCURSEL, SWEEP_OUT_SUMMARY, 0);
+
+    AddSweepCtrl(CreateWindowW(L"STATIC", L"Threads:", WS_CHILD|SS_CENTERIMAGE, 455, 134, 60, 25, hwnd, NULL, NULL, NULL));
+    WCHAR cores[16];
+    unsigned hw = std::thread::hardware_concurrency();
+    StringCchPrintfW(cores, 16, L"%u", hw ? hw : 1);
+    hSweepThreads = CreateWindowW(L"EDIT", cores, WS_CHILD|WS_BORDER|ES_NUMBER|ES_CENTER, 520, 134, 60, 25, hwnd, (HMENU)IDC_SWEEP_THREADS, NULL, NULL);
+    AddSweepCtrl(hSweepThreads);
+
+    hBtnSweep = CreateWindowW(L"BUTTON", L"Run", WS_CHILD|BS_PUSHBUTTON, 455, 170, 105, 28, hwnd, (HMENU)IDC_BTN_SWEEP, NULL, NULL);
+    AddSweepCtrl(hBtnSweep);
+    hBtnSweepCancel = CreateWindowW(L"BUTTON", L"Cancel", WS_CHILD|BS_PUSHBUTTON|WS_DISABLED, 575, 170, 105, 28, hwnd, (HMENU)IDC_BTN_SWEEP_CANCEL, NULL, NULL);
+    AddSweepCtrl(hBtnSweepCancel);
+
+    hSweepStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 455, 210, 225, 42, hwnd, NULL, NULL, NULL);
+    AddSweepCtrl(hSweepStatus);
+
+    AddSweepCtrl(CreateWindowW(L"BUTTON", L"Results", WS_CHILD|BS_GROUPBOX, 10, 262, 680, 198, hwnd, NULL, GetModuleHandle(NULL), NULL));
+    hSweepResult = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 284, 660, 168, hwnd, NULL, NULL, NULL);
+    AddSweepCtrl(hSweepResult);
+}
+
+// "name=value, ..." for the grid point at index
+static void FormatSweepPoint(long long index, char* buf, int size) {
+    std::vector<long long> digits(g_sweepJob.axes.size() + 1);
+    g_sweepJob.Decode(index, &digits[0]);
+    int len = 0;
+    buf[0] = '\0';
+    for (size_t a = 0; a < g_sweepJob.axes.size() && len < size; a++) {
+        int n = snprintf(buf + len, (size_t)(size - len), "%s%s=%.12g", a ? ", " : "",
+            g_sweepJob.axes[a].name, g_sweepJob.axes[a].At(digits[a]));
+        if (n < 0) break;
+        len += n;
+    }
+}
+
+// Compiles the expression and axes from the controls into g_sweepProgram
+// and g_sweepJob. On failure the reason goes to the status label.
+static bool ReadSweepSpec() {
+    char msg[128];
+    WCHAR wexpr[512];
+    char expr[512];
+    GetWindowTextW(hSweepExpr, wexpr, 512);
+    WideCharToMultiByte(CP_ACP, 0, wexpr, -1, expr, sizeof(expr), NULL, NULL);
+    if (!ExprCompile(expr, &g_sweepProgram, msg, sizeof(msg))) {
+        WCHAR w[160];
+        StringCchPrintfW(w, 160, L"Expression: %S", msg);
+        SetWindowTextW(hSweepStatus, w);
+        return false;
+    }
+
+    int wlen = GetWindowTextLengthW(hSweepVars);
+    std::vector<WCHAR> wvars((size_t)wlen + 1);
+    GetWindowTextW(hSweepVars, &wvars[0], wlen + 1);
+    std::vector<char> vars((size_t)wlen * 2 + 1);
+    WideCharToMultiByte(CP_ACP, 0, &wvars[0], -1, &vars[0], (int)vars.size(), NULL, NULL);
+
+    std::vector<SweepAxis> axes;
+    for (char* line = strtok(&vars[0], "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        const char* p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) continue;
+        SweepAxis axis;
+        bool ok = SweepParseAxis(line, &axis, msg, sizeof(msg));
+        for (size_t a = 0; ok && a < axes.size(); a++) {
+            if (strcmp(axes[a].name, axis.name) == 0) {
+                snprintf(msg, sizeof(msg), "%s is given twice", axis.name);
+                ok = false;
+            }
+        }
+        if (!ok) {
+            WCHAR w[160];
+            StringCchPrintfW(w, 160, L"%S", msg);
+            SetWindowTextW(hSweepStatus, w);
+            return false;
+        }
+        axes.push_back(axis);
+    }
+    if (!SweepPrepare(&g_sweepJob, g_sweepProgram, axes, msg, sizeof(msg))) {
+        WCHAR w[160];
+        StringCchPrintfW(w, 160, L"%S", msg);
+        SetWindowTextW(hSweepStatus, w);
+        return false;
+    }
+    return true;
+}
+
+static void StartSweep(HWND hwnd) {
+    if (g_sweepTask || !ReadSweepSpec()) return;
+
+    g_sweepOutput = (int)SendMessage(hSweepOutput, CB_GETCURSEL, 0, 0);
+    g_sweepJob.sink = NULL;
+    g_sweepJob.sinkCtx = NULL;
+    if (g_sweepOutput == SWEEP_OUT_CSV) {
+        WCHAR path[MAX_PATH] = L"sweep.csv";
+        OPENFILENAMEW ofn = {0};
+        ofn.lStructSize = sizeof(ofn);
+        ofn.hwndOwner = hwnd;
+        ofn.lpstrFilter = L"CSV Files (*.csv)\0*.csv\0All Files (*.*)\0*.*\0";
+        ofn.lpstrFile = path;
+        ofn.nMaxFile = MAX_PATH;
+        ofn.lpstrDefExt = L"csv";
+        ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+        if (!GetSaveFileNameW(&ofn)) return;
+        FILE* f = _wfopen(path, L"w");
+        if (!f) {
+            SetWindowTextW(hSweepStatus, L"Cannot open file");
+            return;
+        }
+        setvbuf(f, NULL, _IOFBF, 1 << 16);
+        g_sweepCsv = new SweepCsvSink(f, &g_sweepJob);
+        g_sweepCsv->WriteHeader();
+        g_sweepJob.sink = SweepCsvSink::Write;
+        g_sweepJob.sinkCtx = g_sweepCsv;
+    }
+
+    WCHAR wthreads[16];
+    GetWindowTextW(hSweepThreads, wthreads, 16);
+    g_sweepThreadCount = _wtoi(wthreads);
+    g_sweepJob.cancel = false;
+    g_sweepJob.done = 0;
+    EnableWindow(hBtnSweep, FALSE);
+    EnableWindow(hBtnSweepCancel, TRUE);
+    SetWindowTextW(hSweepResult, L"");
+    QueryPerformanceCounter(&g_sweepStart);
+
+    int threads = g_sweepThreadCount;
+    g_sweepTask = SubmitJob([threads](SchedJob*) { SweepRun(&g_sweepJob, threads); },
+        [](SchedJob*) { FinishSweep(); }, [](SchedJob*) { UpdateSweepProgress(); }, &g_sweepJob.cancel);
+}
+
+static void UpdateSweepProgress() {
+    long long done = g_sweepJob.done.load();
+    WCHAR buf[128];
+    StringCchPrintfW(buf, 128, L"Evaluated %lld of %lld points (%.0f%%)",
+        done, g_sweepJob.total, g_sweepJob.total ? 100.0 * (double)done / (double)g_sweepJob.total : 100.0);
+    SetWindowTextW(hSweepStatus, buf);
+}
+
+// Reports a finished sweep: summary in the results box, plus the first
+// points and the summary in the history or the CSV row count
+static void FinishSweep() {
+    if (!g_sweepTask) return;
+    g_sweepTask.reset();
+    EnableWindow(hBtnSweep, TRUE);
+    EnableWindow(hBtnSweepCancel, FALSE);
+
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    double seconds = (double)(now.QuadPart - g_sweepStart.QuadPart) / (double)freq.QuadPart;
+    const SweepStats& st = g_sweepJob.stats;
+    long long done = g_sweepJob.done.load();
+    bool cancelled = done < g_sweepJob.total;
+
+    char text[1024], minAt[256], maxAt[256], errAt[256];
+    FormatSweepPoint(st.minIndex, minAt, sizeof(minAt));
+    FormatSweepPoint(st.maxIndex, maxAt, sizeof(maxAt));
+    int len = snprintf(text, sizeof(text), "%s%lld points in %.2f s (%.1f M points/s, %lld steals)\n",
+        cancelled ? "Cancelled after " : "", done, seconds, seconds > 0 ? (double)done / seconds / 1e6 : 0.0,
+        g_sweepJob.steals.load());
+    if (st.count) {
+        len += snprintf(text + len, sizeof(text) - (size_t)len,
+            "Min: %.12g  at %s\nMax: %.12g  at %s\nMean: %.12g   Std dev: %.6g\n",
+            st.min, minAt, st.max, maxAt, st.mean, sqrt(st.Variance()));
+    }
+    if (st.errors) {
+        FormatSweepPoint(st.firstError, errAt, sizeof(errAt));
+        len += snprintf(text + len, sizeof(text) - (size_t)len, "Errors: %lld, first: %s  at %s\n",
+            st.errors, ExprErrorText(st.firstErrorCode), errAt);
+    }
+
+    if (g_sweepCsv) {
+        FILE* f = g_sweepCsv->file;
+        bool ok = !g_sweepCsv->failed && fclose(f) == 0;
+        snprintf(text + len, sizeof(text) - (size_t)len, ok ? "Wrote %lld rows" : "Write failed after %lld rows", g_sweepCsv->rows);
+        delete g_sweepCsv;
+        g_sweepCsv = NULL;
+    }
+
+    if (g_sweepOutput == SWEEP_OUT_HISTORY) {
+        // The first points in grid order, then the summary line
+        std::vector<double> values(g_sweepProgram.vars.size() + 1);
+        std::vector<long long> digits(g_sweepJob.axes.size() + 1);
+        char line[160], at[128];
+        for (long long i = 0; i < g_sweepJob.total && i < SWEEP_HISTORY_POINTS; i++) {
+            g_sweepJob.Decode(i, &digits[0]);
+            for (size_t s = 0; s < g_sweepProgram.vars.size(); s++) {
+                int a = g_sweepJob.slotAxis[s];
+                values[s] = g_sweepJob.axes[(size_t)a].At(digits[(size_t)a]);
+            }
+            double v;
+            int err = g_sweepProgram.Eval(&values[0], &v);
+            FormatSweepPoint(i, at, sizeof(at));
+            if (err) snprintf(line, sizeof(line), "[%s] = Error", at);
+            else snprintf(line, sizeof(line), "[%s] = %.12g", at, v);
+            g_engine.PushHistory(line);
+        }
+        snprintf(line, sizeof(line), "Sweep: %lld points, min %.12g, max %.12g, mean %.12g, %lld errors",
+            done, st.min, st.max, st.mean, st.errors);
+        g_engine.PushHistory(line);
+    }
+
+    WCHAR wtext[1024];
+    MultiByteToWideChar(CP_ACP, 0, text, -1, wtext, 1024);
+    SetWindowTextW(hSweepResult, wtext);
+    UpdateSweepProgress();
+}
+
+static void CancelSweep() {
+    g_jobs.Cancel(g_sweepTask);
+}
+
+// "calc.exe /bench-sweep": the loan payment over a 12 million point grid
+// on 1, 2, 4, ... threads up to one per core, with the speedup over one
+static int RunSweepBenchmark() {
+    char msg[128];
+    ExprProgram program;
+    ExprCompile("principal * rate/12 / (1 - (1 + rate/12)^-n)", &program, msg, sizeof(msg));
+    std::vector<SweepAxis> axes(3);
+    SweepParseAxis("principal = 1000..100000 count 200", &axes[0], msg, sizeof(msg));
+    SweepParseAxis("rate = 0..0.2 count 2000", &axes[1], msg, sizeof(msg));
+    SweepParseAxis("n = 12..360 step 12", &axes[2], msg, sizeof(msg));
+    SweepJob job;
+    if (!SweepPrepare(&job, program, axes, msg, sizeof(msg))) return 1;
+
+    int cores = (int)std::thread::hardware_concurrency();
+    if (cores < 1) cores = 1;
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    WCHAR buf[1024];
+    int len = 0;
+    StringCchPrintfW(buf, 1024, L"%lld points, %d cores\n", job.total, cores);
+    len = (int)wcslen(buf);
+    double base = 0;
+    SweepStats first;
+    bool agree = true;
+    for (int t = 1;; t = t * 2 > cores && t < cores ? cores : t * 2) {
+        LARGE_INTEGER t0, t1;
+        QueryPerformanceCounter(&t0);
+        SweepRun(&job, t);
+        QueryPerformanceCounter(&t1);
+        double s = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+        if (t == 1) { base = s; first = job.stats; }
+        agree = agree && job.stats.count == first.count && job.stats.errors == first.errors &&
+                job.stats.min == first.min && job.stats.max == first.max;
+        StringCchPrintfW(buf + len, 1024 - len, L"%2d threads: %.3f s, %.1f M points/s, x%.2f, %lld steals\n",
+            t, s, (double)job.total / s / 1e6, base / s, job.steals.load());
+        len = (int)wcslen(buf);
+        if (t >= cores) break;
+    }
+    StringCchPrintfW(buf + len, 1024 - len, L"%s", agree ? L"Results agree" : L"MISMATCH");
+    MessageBoxW(NULL, buf, L"Parameter sweep benchmark", MB_OK | (agree ? MB_ICONINFORMATION : MB_ICONERROR));
+    return agree ? 0 : 1;
+}
+
+// --- Finance UI ---
+static HWND hFinCtrls[30];
+static int hFinCount = 0;
+static HWND hFinPrincipal, hFinRate, hFinYears, hFinPerYear, hFinPayment, hFinList, hFinStatus;
+static HWND hFinFlows, hFinDiscount, hFinCashResult, hBtnFinBatch, hBtnFinCancel, hFinBatchStatus;
+
+// Payments per year offered by the combo, in combo order
+static const int kFinPerYear[] = {12, 4, 2, 1, 26, 52};
+static const WCHAR* kFinPerYearNames[] = {L"Monthly", L"Quarterly", L"Semiannual", L"Annual", L"Biweekly", L"Weekly"};
+
+// The schedule shown in the list (a single loan is at most a few
+// thousand rows, so it is kept whole)
+static std::vector<FinRow> g_finRows;
+static FinScheduleGen g_finGen;
+
+// The running batch export. Its job owns the loans, the generator and
+// the CSV sink until the done callback runs.
+static std::vector<FinLoan> g_finBatchLoans;
+static FinScheduleGen g_finBatchGen;
+static FinCsvSink* g_finBatchCsv = NULL;
+static SchedHandle g_finBatchTask;
+static std::atomic<long long> g_finBatchRows(0);
+static std::atomic<bool> g_finBatchCancel(false);
+static long long g_finBatchTotal = 0;
+static LARGE_INTEGER g_finBatchStart;
+
+void AddFinCtrl(HWND h) { if (hFinCount < 30) hFinCtrls[hFinCount++] = h; }
+
+void CreateFinanceUI(HWND hwnd) {
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"Loan", WS_CHILD|BS_GROUPBOX, 10, 38, 395, 422, hwnd, NULL, GetModuleHandle(NULL), NULL));
+
+    AddFinCtrl(CreateWindowW(L"STATIC", L"Principal:", WS_CHILD|SS_CENTERIMAGE, 20, 58, 75, 25, hwnd, NULL, NULL, NULL));
+    hFinPrincipal = CreateWindowW(L"EDIT", L"250000", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 100, 58, 100, 25, hwnd, (HMENU)IDC_FIN_PRINCIPAL, NULL, NULL);
+    AddFinCtrl(hFinPrincipal);
+    AddFinCtrl(CreateWindowW(L"STATIC", L"Rate %/year:", WS_CHILD|SS_CENTERIMAGE, 215, 58, 85, 25, hwnd, NULL, NULL, NULL));
+    hFinRate = CreateWindowW(L"EDIT", L"6.5", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 305, 58, 90, 25, hwnd, (HMENU)IDC_FIN_RATE, NULL, NULL);
+    AddFinCtrl(hFinRate);
+
+    AddFinCtrl(CreateWindowW(L"STATIC", L"Years:", WS_CHILD|SS_CENTERIMAGE, 20, 90, 75, 25, hwnd, NULL, NULL, NULL));
+    hFinYears = CreateWindowW(L"EDIT", L"30", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 100, 90, 100, 25, hwnd, (HMENU)IDC_FIN_YEARS, NULL, NULL);
+    AddFinCtrl(hFinYears);
+    AddFinCtrl(CreateWindowW(L"STATIC", L"Payments:", WS_CHILD|SS_CENTERIMAGE, 215, 90, 85, 25, hwnd, NULL, NULL, NULL));
+    hFinPerYear = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 305, 90, 90, 150, hwnd, (HMENU)IDC_FIN_PERYEAR, NULL, NULL);
+    AddFinCtrl(hFinPerYear);
+    for (int i = 0; i < (int)(sizeof(kFinPerYear) / sizeof(kFinPerYear[0])); i++) {
+        SendMessage(hFinPerYear, CB_ADDSTRING, 0, (LPARAM)kFinPerYearNames[i]);
+    }
+    SendMessage(hFinPerYear, CB_SETCURSEL, 0, 0);
+
+    AddFinCtrl(CreateWindowW(L"STATIC", L"Payment:", WS_CHILD|SS_CENTERIMAGE, 20, 122, 75, 25, hwnd, NULL, NULL, NULL));
+    hFinPayment = CreateWindowW(L"EDIT", L"", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 100, 122, 100, 25, hwnd, (HMENU)IDC_FIN_PAYMENT, NULL, NULL);
+    AddFinCtrl(hFinPayment);
+    AddFinCtrl(CreateWindowW(L"STATIC", L"(blank = level payment)", WS_CHILD|SS_CENTERIMAGE, 215, 122, 180, 25, hwnd, NULL, NULL, NULL));
+
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"Payment", WS_CHILD|BS_PUSHBUTTON, 20, 156, 86, 28, hwnd, (HMENU)IDC_BTN_FIN_PAYMENT, NULL, NULL));
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"Solve rate", WS_CHILD|BS_PUSHBUTTON, 116, 156, 86, 28, hwnd, (HMENU)IDC_BTN_FIN_RATE, NULL, NULL));
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"Schedule", WS_CHILD|BS_PUSHBUTTON, 212, 156, 86, 28, hwnd, (HMENU)IDC_BTN_FIN_SCHEDULE, NULL, NULL));
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"Export CSV...", WS_CHILD|BS_PUSHBUTTON, 308, 156, 87, 28, hwnd, (HMENU)IDC_BTN_FIN_EXPORT, NULL, NULL));
+
+    // Owner-data list, filled from g_finRows as rows scroll into view
+    hFinList = CreateWindowW(WC_LISTVIEW, L"", WS_CHILD|WS_BORDER|LVS_REPORT|LVS_OWNERDATA|LVS_SHOWSELALWAYS,
+        20, 192, 375, 218, hwnd, (HMENU)IDC_LIST_FIN, NULL, NULL);
+    ListView_SetExtendedListViewStyle(hFinList, LVS_EX_FULLROWSELECT);
+    AddFinCtrl(hFinList);
+    LVCOLUMNW col = {0};
+    col.mask = LVCF_TEXT | LVCF_WIDTH;
+    static const WCHAR* names[] = {L"#", L"Payment", L"Interest", L"Principal", L"Balance"};
+    static const int widths[] = {45, 75, 75, 75, 85};
+    for (int i = 0; i < 5; i++) {
+        col.cx = widths[i];
+        col.pszText = (LPWSTR)names[i];
+        ListView_InsertColumn(hFinList, i, &col);
+    }
+
+    hFinStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 414, 375, 40, hwnd, NULL, NULL, NULL);
+    AddFinCtrl(hFinStatus);
+
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"Cash flows", WS_CHILD|BS_GROUPBOX, 415, 38, 275, 250, hwnd, NULL, GetModuleHandle(NULL), NULL));
+    AddFinCtrl(CreateWindowW(L"STATIC", L"One per period, the first is now:", WS_CHILD|SS_LEFT, 425, 58, 255, 20, hwnd, NULL, NULL, NULL));
+    hFinFlows = CreateWindowW(L"EDIT", L"-10000\r\n3000\r\n4200\r\n6800",
+        WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_WANTRETURN, 425, 80, 255, 110, hwnd, (HMENU)IDC_FIN_FLOWS, NULL, NULL);
+    AddFinCtrl(hFinFlows);
+    AddFinCtrl(CreateWindowW(L"STATIC", L"Discount %/period:", WS_CHILD|SS_CENTERIMAGE, 425, 198, 120, 25, hwnd, NULL, NULL, NULL));
+    hFinDiscount = CreateWindowW(L"EDIT", L"10", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 550, 198, 130, 25, hwnd, (HMENU)IDC_FIN_DISCOUNT, NULL, NULL);
+    AddFinCtrl(hFinDiscount);
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"NPV", WS_CHILD|BS_PUSHBUTTON, 425, 230, 80, 26, hwnd, (HMENU)IDC_BTN_FIN_NPV, NULL, NULL));
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"IRR", WS_CHILD|BS_PUSHBUTTON, 515, 230, 80, 26, hwnd, (HMENU)IDC_BTN_FIN_IRR, NULL, NULL));
+    hFinCashResult = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 425, 262, 255, 20, hwnd, NULL, NULL, NULL);
+    AddFinCtrl(hFinCashResult);
+
+    AddFinCtrl(CreateWindowW(L"BUTTON", L"Loan portfolio", WS_CHILD|BS_GROUPBOX, 415, 296, 275, 164, hwnd, NULL, GetModuleHandle(NULL), NULL));
+    AddFinCtrl(CreateWindowW(L"STATIC", L"CSV of principal, rate %, years [, payments/year] to one CSV of schedules",
+        WS_CHILD|SS_LEFT, 425, 316, 255, 36, hwnd, NULL, NULL, NULL));
+    hBtnFinBatch = CreateWindowW(L"BUTTON", L"Run...", WS_CHILD|BS_PUSHBUTTON, 425, 356, 120, 28, hwnd, (HMENU)IDC_BTN_FIN_BATCH, NULL, NULL);
+    AddFinCtrl(hBtnFinBatch);
+    hBtnFinCancel = CreateWindowW(L"BUTTON", L"Cancel", WS_CHILD|BS_PUSHBUTTON|WS_DISABLED, 560, 356, 120, 28, hwnd, (HMENU)IDC_BTN_FIN_CANCEL, NULL, NULL);
+    AddFinCtrl(hBtnFinCancel);
+    hFinBatchStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 425, 392, 255, 60, hwnd, NULL, NULL, NULL);
+    AddFinCtrl(hFinBatchStatus);
+}
+
+static bool ReadFinText(HWND h, char* buf, int size) {
+    WCHAR w[128];
+    GetWindowTextW(h, w, 128);
+    return WideCharToMultiByte(CP_ACP, 0, w, -1, buf, size, NULL, NULL) > 0;
+}
+
+static void SetFinText(HWND h, const char* text) {
+    WCHAR w[256];
+    MultiByteToWideChar(CP_ACP, 0, text, -1, w, 256);
+    SetWindowTextW(h, w);
+}
+
+// Reads the loan fields. payment is 0 when the field is blank.
+static bool ReadFinLoan(FinLoan* loan, FinRate* annual, int* perYear) {
+    char text[128];
+    long long years100;
+    int sel = (int)SendMessage(hFinPerYear, CB_GETCURSEL, 0, 0);
+    *perYear = kFinPerYear[sel >= 0 && sel < (int)(sizeof(kFinPerYear) / sizeof(kFinPerYear[0])) ? sel : 0];
+
+    ReadFinText(hFinPrincipal, text, sizeof(text));
+    if (!FinParseMoney(text, &loan->principal) || loan->principal <= 0 || loan->principal >= FIN_MAX_CENTS) {
+        SetWindowTextW(hFinStatus, L"Invalid principal");
+        return false;
+    }
+    ReadFinText(hFinRate, text, sizeof(text));
+    // A periodic rate of -100% or less has no level payment
+    if (!FinParsePercent(text, annual) || FinPeriodicRate(*annual, *perYear).value <= -1) {
+        SetWindowTextW(hFinStatus, L"Invalid rate");
+        return false;
+    }
+    ReadFinText(hFinYears, text, sizeof(text));
+    long long periods = FinParseDecimal(text, 2, &years100) ? (years100 * *perYear + 50) / 100 : 0;
+    if (periods < 1 || periods > 100000) {
+        SetWindowTextW(hFinStatus, L"Invalid term");
+        return false;
+    }
+    loan->periods = (int)periods;
+    loan->rate = FinPeriodicRate(*annual, *perYear);
+    loan->payment = 0;
+    ReadFinText(hFinPayment, text, sizeof(text));
+    if (text[0] && (!FinParseMoney(text, &loan->payment) || loan->payment < 0)) {
+        SetWindowTextW(hFinStatus, L"Invalid payment");
+        return false;
+    }
+    if (!FinLoanInRange(*loan)) {
+        SetWindowTextW(hFinStatus, L"The balance would grow too large");
+        return false;
+    }
+    return true;
+}
+
+// Level payment, shown and added to the history
+static void FinShowPayment() {
+    FinLoan loan;
+    FinRate annual;
+    int perYear;
+    if (!ReadFinLoan(&loan, &annual, &perYear)) return;
+    long long pmt = FinPayment(loan.principal, loan.rate.value, loan.periods);
+    char p[32], a[32], line[160];
+    FinMoneyText(loan.principal, a);
+    FinMoneyText(pmt, p);
+    snprintf(line, sizeof(line), "PMT(%s, %.8g%%, %d x %d/yr) = %s", a, annual.value * 100, loan.periods, perYear, p);
+    g_engine.PushHistory(line);
+    snprintf(line, sizeof(line), "Payment %s for %d payments", p, loan.periods);
+    SetFinText(hFinStatus, line);
+}
+
+// Annual rate that makes the entered payment repay the principal
+static void FinShowSolvedRate() {
+    FinLoan loan;
+    FinRate annual;
+    int perYear;
+    if (!ReadFinLoan(&loan, &annual, &perYear)) return;
+    double r;
+    if (!loan.payment || !FinSolveRate((double)loan.principal, (double)loan.payment, loan.periods, &r)) {
+        SetWindowTextW(hFinStatus, loan.payment ? L"No rate repays the principal with that payment" : L"Enter a payment to solve for the rate");
+        return;
+    }
+    char p[32], a[32], line[160];
+    FinMoneyText(loan.principal, a);
+    FinMoneyText(loan.payment, p);
+    snprintf(line, sizeof(line), "RATE(%s, %s, %d x %d/yr) = %.6f%%", a, p, loan.periods, perYear, r * perYear * 100);
+    g_engine.PushHistory(line);
+    snprintf(line, sizeof(line), "Rate %.6f%% per year (%.8f%% per period)", r * perYear * 100, r * 100);
+    SetFinText(hFinStatus, line);
+}
+
+static void FinShowSchedule() {
+    FinLoan loan;
+    FinRate annual;
+    int perYear;
+    if (!ReadFinLoan(&loan, &annual, &perYear)) return;
+    g_finRows.clear();
+    g_finGen.Run(&loan, 1, FinCollectSink, &g_finRows);
+    ListView_SetItemCountEx(hFinList, (int)g_finRows.size(), LVSICF_NOSCROLL);
+    InvalidateRect(hFinList, NULL, TRUE);
+
+    FinSummary sum = {0, 0, 0, 0};
+    FinSummarySink(&sum, g_finRows.empty() ? NULL : &g_finRows[0], (int)g_finRows.size());
+    char paid[32], interest[32], last[32], line[192];
+    FinMoneyText(sum.totalPaid, paid);
+    FinMoneyText(sum.totalInterest, interest);
+    FinMoneyText(sum.lastPayment, last);
+    snprintf(line, sizeof(line), "%lld payments, total %s, interest %s\nLast payment %s",
+        sum.payments, paid, interest, last);
+    SetFinText(hFinStatus, line);
+}
+
+static void FillFinItem(NMLVDISPINFOW* info) {
+    if (!(info->item.mask & LVIF_TEXT)) return;
+    if (info->item.iItem < 0 || info->item.iItem >= (int)g_finRows.size()) return;
+    const FinRow& r = g_finRows[(size_t)info->item.iItem];
+    char text[32];
+    switch (info->item.iSubItem) {
+        case 0: snprintf(text, sizeof(text), "%d", r.period); break;
+        case 1: FinMoneyText(r.payment, text); break;
+        case 2: FinMoneyText(r.interest, text); break;
+        case 3: FinMoneyText(r.principal, text); break;
+        default: FinMoneyText(r.balance, text); break;
+    }
+    MultiByteToWideChar(CP_ACP, 0, text, -1, info->item.pszText, info->item.cchTextMax);
+}
+
+static bool AskCsvPath(HWND hwnd, WCHAR* path, bool save) {
+    OPENFILENAMEW ofn = {0};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hwnd;
+    ofn.lpstrFilter = L"CSV Files (*.csv)\0*.csv\0All Files (*.*)\0*.*\0";
+    ofn.lpstrFile = path;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrDefExt = L"csv";
+    if (save) {
+        ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+        return GetSaveFileNameW(&ofn) != 0;
+    }
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+    return GetOpenFileNameW(&ofn) != 0;
+}
+
+static void ExportFinSchedule(HWND hwnd) {
+    FinLoan loan;
+    FinRate annual;
+    int perYear;
+    if (!ReadFinLoan(&loan, &annual, &perYear)) return;
+    WCHAR path[MAX_PATH] = L"amortization.csv";
+    if (!AskCsvPath(hwnd, path, true)) return;
+    FILE* f = _wfopen(path, L"wb");
+    if (!f) {
+        SetWindowTextW(hFinStatus, L"Cannot open file");
+        return;
+    }
+    FinCsvSink sink(f);
+    sink.WriteHeader();
+    g_finGen.Run(&loan, 1, FinCsvSink::Write, &sink);
+    bool ok = sink.Flush() && fclose(f) == 0;
+    WCHAR buf[96];
+    StringCchPrintfW(buf, 96, ok ? L"Exported %lld rows" : L"Write failed after %lld rows", sink.rows);
+    SetWindowTextW(hFinStatus, buf);
+}
+
+// Cash flows from the edit box, one amount per line
+static bool ReadFinFlows(std::vector<double>* flows) {
+    int len = GetWindowTextLengthW(hFinFlows);
+    std::vector<WCHAR> w((size_t)len + 1);
+    GetWindowTextW(hFinFlows, &w[0], len + 1);
+    std::vector<char> text((size_t)len * 2 + 2);
+    WideCharToMultiByte(CP_ACP, 0, &w[0], -1, &text[0], (int)text.size(), NULL, NULL);
+    flows->clear();
+    for (char* line = strtok(&text[0], "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        long long cents;
+        if (strspn(line, " \t") == strlen(line)) continue;
+        if (!FinParseMoney(line, &cents)) {
+            SetWindowTextW(hFinCashResult, L"Invalid cash flow");
+            return false;
+        }
+        flows->push_back((double)cents / 100);
+    }
+    if (flows->size() < 2) {
+        SetWindowTextW(hFinCashResult, L"Enter at least two cash flows");
+        return false;
+    }
+    return true;
+}
+
+static void FinShowNpv() {
+    std::vector<double> flows;
+    if (!ReadFinFlows(&flows)) return;
+    char text[64], line[160], npv[32];
+    FinRate rate;
+    ReadFinText(hFinDiscount, text, sizeof(text));
+    if (!FinParsePercent(text, &rate) || rate.value <= -1) {
+        SetWindowTextW(hFinCashResult, L"Invalid discount rate");
+        return;
+    }
+    double v = FinNpv(rate.value, &flows[0], (int)flows.size());
+    FinMoneyText((long long)floor(fabs(v) * 100 + 0.5) * (v < 0 ? -1 : 1), npv);
+    snprintf(line, sizeof(line), "NPV(%.8g%%, %d flows) = %s", rate.value * 100, (int)flows.size(), npv);
+    g_engine.PushHistory(line);
+    snprintf(line, sizeof(line), "NPV = %s", npv);
+    SetFinText(hFinCashResult, line);
+}
+
+static void FinShowIrr() {
+    std::vector<double> flows;
+    if (!ReadFinFlows(&flows)) return;
+    double irr;
+    if (!FinIrr(&flows[0], (int)flows.size(), &irr)) {
+        SetWindowTextW(hFinCashResult, L"No IRR: the NPV never changes sign");
+        return;
+    }
+    char line[160];
+    snprintf(line, sizeof(line), "IRR(%d flows) = %.6f%%", (int)flows.size(), irr * 100);
+    g_engine.PushHistory(line);
+    snprintf(line, sizeof(line), "IRR = %.6f%% per period", irr * 100);
+    SetFinText(hFinCashResult, line);
+}
+
+// Counts rows for the progress display and stops on Cancel
+static bool FinBatchSink(void* ctx, const FinRow* rows, int count) {
+    if (!FinCsvSink::Write(ctx, rows, count)) return false;
+    g_finBatchRows += count;
+    return !g_finBatchCancel;
+}
+
+// Reads a loan list and streams every schedule into one CSV as a
+// background job
+static void StartFinBatch(HWND hwnd) {
+    if (g_finBatchTask) return;
+    WCHAR inPath[MAX_PATH] = L"";
+    if (!AskCsvPath(hwnd, inPath, false)) return;
+    FILE* in = _wfopen(inPath, L"r");
+    if (!in) {
+        SetWindowTextW(hFinBatchStatus, L"Cannot open the loan list");
+        return;
+    }
+    int sel = (int)SendMessage(hFinPerYear, CB_GETCURSEL, 0, 0);
+    g_finBatchLoans.clear();
+    long long bad = FinReadLoans(in, kFinPerYear[sel >= 0 ? sel : 0], &g_finBatchLoans);
+    fclose(in);
+    if (g_finBatchLoans.empty()) {
+        SetWindowTextW(hFinBatchStatus, L"No loans in the file");
+        return;
+    }
+
+    WCHAR outPath[MAX_PATH] = L"schedules.csv";
+    if (!AskCsvPath(hwnd, outPath, true)) return;
+    FILE* out = _wfopen(outPath, L"wb");
+    if (!out) {
+        SetWindowTextW(hFinBatchStatus, L"Cannot create the output file");
+        return;
+    }
+    g_finBatchCsv = new FinCsvSink(out);
+    g_finBatchCsv->WriteHeader();
+    g_finBatchTotal = 0;
+    for (size_t i = 0; i < g_finBatchLoans.size(); i++) g_finBatchTotal += g_finBatchLoans[i].periods;
+    g_finBatchRows = 0;
+    g_finBatchCancel = false;
+    EnableWindow(hBtnFinBatch, FALSE);
+    EnableWindow(hBtnFinCancel, TRUE);
+    if (bad) {
+        WCHAR buf[96];
+        StringCchPrintfW(buf, 96, L"Skipped %lld unreadable lines", bad);
+        SetWindowTextW(hFinStatus, buf);
+    }
+    QueryPerformanceCounter(&g_finBatchStart);
+
+    g_finBatchTask = SubmitJob([](SchedJob*) {
+            g_finBatchGen.Run(&g_finBatchLoans[0], (long long)g_finBatchLoans.size(), FinBatchSink, g_finBatchCsv);
+        },
+        [](SchedJob*) { FinishFinBatch(); }, [](SchedJob*) { UpdateFinBatchProgress(); }, &g_finBatchCancel);
+}
+
+static void UpdateFinBatchProgress() {
+    long long rows = g_finBatchRows.load();
+    WCHAR buf[128];
+    StringCchPrintfW(buf, 128, L"%zu loans\n%lld of %lld rows (%.0f%%)", g_finBatchLoans.size(), rows, g_finBatchTotal,
+        g_finBatchTotal ? 100.0 * (double)rows / (double)g_finBatchTotal : 100.0);
+    SetWindowTextW(hFinBatchStatus, buf);
+}
+
+static void FinishFinBatch() {
+    if (!g_finBatchTask) return;
+    g_finBatchTask.reset();
+    EnableWindow(hBtnFinBatch, TRUE);
+    EnableWindow(hBtnFinCancel, FALSE);
+
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    double seconds = (double)(now.QuadPart - g_finBatchStart.QuadPart) / (double)freq.QuadPart;
+    FILE* f = g_finBatchCsv->file;
+    bool ok = g_finBatchCsv->Flush() && fclose(f) == 0;
+    long long rows = g_finBatchCsv->rows;
+    delete g_finBatchCsv;
+    g_finBatchCsv = NULL;
+
+    WCHAR buf[192];
+    StringCchPrintfW(buf, 192, L"%s%lld rows for %zu loans\nin %.2f s (%.1f M rows/s)",
+        !ok ? L"Write failed after " : rows < g_finBatchTotal ? L"Cancelled after " : L"Wrote ",
+        rows, g_finBatchLoans.size(), seconds, seconds > 0 ? (double)rows / seconds / 1e6 : 0.0);
+    SetWindowTextW(hFinBatchStatus, buf);
+    std::vector<FinLoan>().swap(g_finBatchLoans);
+}
+
+static void CancelFinBatch() {
+    g_jobs.Cancel(g_finBatchTask);
+}
+
+// Checks every schedule as it streams by: the balance reaches zero on the
+// last period and the principal parts add up to the amount borrowed
+struct FinBenchCheck {
+    const FinLoan* loans;
+    long long principalPaid;
+    long long badLoans;
+    long long interest;
+};
+
+static bool FinBenchCheckSink(void* ctx, const FinRow* rows, int count) {
+    FinBenchCheck* c = (FinBenchCheck*)ctx;
+    for (int i = 0; i < count; i++) {
+        const FinRow& r = rows[i];
+        c->principalPaid += r.principal;
+        c->interest += r.interest;
+        if (r.period == c->loans[r.loan].periods) {
+            if (r.balance != 0 || c->principalPaid != c->loans[r.loan].principal) c->badLoans++;
+            c->principalPaid = 0;
+        }
+    }
+    return true;
+}
+
+// "calc.exe /bench-finance": 40-year monthly schedules for a million loans,
+// generated and checked, then generated and formatted as CSV to NUL
+static int RunFinanceBenchmark() {
+    const long long kLoans = 1000000;
+    std::vector<FinLoan> loans((size_t)kLoans);
+    for (long long i = 0; i < kLoans; i++) {
+        // 2% to 9% in steps of 1/8 point, 50,000.00 to about 1,050,000.00
+        FinRate annual = FinMakeRate(200 + (i % 57) * 125 / 10, 10000);
+        loans[(size_t)i].principal = 5000000 + (i % 1000) * 9999137 / 100;
+        loans[(size_t)i].rate = FinPeriodicRate(annual, 12);
+        loans[(size_t)i].periods = 480;
+        loans[(size_t)i].payment = 0;
+    }
+    FinScheduleGen* gen = new FinScheduleGen;
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    FinBenchCheck check = {&loans[0], 0, 0, 0};
+    QueryPerformanceCounter(&t0);
+    long long rows = gen->Run(&loans[0], kLoans, FinBenchCheckSink, &check);
+    QueryPerformanceCounter(&t1);
+
+    FILE* nul = fopen("NUL", "wb");
+    long long csvRows = 0;
+    if (nul) {
+        FinCsvSink sink(nul);
+        sink.WriteHeader();
+        csvRows = gen->Run(&loans[0], kLoans, FinCsvSink::Write, &sink);
+        sink.Flush();
+        fclose(nul);
+    }
+    QueryPerformanceCounter(&t2);
+    delete gen;
+
+    double genSec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+    double csvSec = (double)(t2.QuadPart - t1.QuadPart) / (double)freq.QuadPart;
+    bool ok = check.badLoans == 0 && rows == kLoans * 480 && csvRows == rows;
+    WCHAR buf[512];
+    StringCchPrintfW(buf, 512,
+        L"%lld loans x 480 periods = %lld rows\nGenerate + check: %.2f s, %.1f M rows/s\n"
+        L"Generate + CSV: %.2f s, %.1f M rows/s\nTotal interest %.2f\n%s",
+        kLoans, rows, genSec, (double)rows / genSec / 1e6, csvSec, csvSec > 0 ? (double)csvRows / csvSec / 1e6 : 0.0,
+        (double)check.interest / 100, ok ? L"All schedules end at zero" : L"SCHEDULE MISMATCH");
+    MessageBoxW(NULL, buf, L"Amortization benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// --- Compositor glue ---
+// The gradient lives in a cached DIB section; paints copy only the invalid
+// rectangles out of it instead of re-running GradientFill over the window.
+static Compositor g_comp;
+static HDC g_compDC = NULL;          // Memory DC with the frame selected
+static HBITMAP g_compFrameBmp = NULL;
+static HBITMAP g_compBackBmp = NULL;
+static HBRUSH g_backBrush = NULL;    // The background as a brush for statics
+
+static HBITMAP CreateSurfaceBitmap(int w, int h, uint32_t** bits) {
+    BITMAPINFO bmi = {0};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h; // Top-down, matching CompSurface rows
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    return CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, (void**)bits, NULL, 0);
+}
+
+static void ReleaseCompositor() {
+    if (g_compDC) DeleteDC(g_compDC);
+    if (g_compFrameBmp) DeleteObject(g_compFrameBmp);
+    if (g_compBackBmp) DeleteObject(g_compBackBmp);
+    if (g_backBrush) DeleteObject(g_backBrush);
+    g_compDC = NULL;
+    g_compFrameBmp = g_compBackBmp = NULL;
+    g_backBrush = NULL;
+}
+
+// Builds the surfaces for the client size; a no-op until the size changes
+static void EnsureCompositor(HWND hwnd) {
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    if (rc.right <= 0 || rc.bottom <= 0) return;
+    if (g_compDC && rc.right == g_comp.frame.width && rc.bottom == g_comp.frame.height) return;
+
+    ReleaseCompositor();
+    uint32_t* frameBits = NULL;
+    uint32_t* backBits = NULL;
+    g_compFrameBmp = CreateSurfaceBitmap(rc.right, rc.bottom, &frameBits);
+    g_compBackBmp = CreateSurfaceBitmap(rc.right, rc.bottom, &backBits);
+    if (!g_compFrameBmp || !g_compBackBmp) {
+        ReleaseCompositor();
+        return;
+    }
+    g_comp.Resize(rc.right, rc.bottom, frameBits, backBits);
+    g_compDC = CreateCompatibleDC(NULL);
+    SelectObject(g_compDC, g_compFrameBmp);
+    g_backBrush = CreatePatternBrush(g_compBackBmp);
+
+    // The display is drawn by the compositor; track its client area
+    RECT dr;
+    GetClientRect(hDisplay, &dr);
+    MapWindowPoints(hDisplay, hwnd, (POINT*)&dr, 2);
+    g_comp.SetWidget(IDC_DISPLAY, CompRect(dr.left, dr.top, dr.right, dr.bottom));
+}
+
+static void DrawNoWidgets(const CompWidget&, const CompRect&) {}
+
+// --- Display glyph atlas ---
+// The display text is drawn from glyphs rasterized once per size and DPI
+// with GDI (grayscale antialiasing, since coverage is blended as one alpha)
+static GlyphAtlas g_glyphs;
+static HFONT g_glyphFonts[GlyphAtlas::kMaxSizes];
+
+static void ReleaseGlyphFonts() {
+    for (int i = 0; i < GlyphAtlas::kMaxSizes; i++) {
+        if (g_glyphFonts[i]) DeleteObject(g_glyphFonts[i]);
+        g_glyphFonts[i] = NULL;
+    }
+}
+
+static bool RasterGdiGlyph(void*, int sizeIndex, int pixelHeight, char ch, GlyphBitmap* out) {
+    if (!g_glyphFonts[sizeIndex]) {
+        g_glyphFonts[sizeIndex] = CreateFontW(pixelHeight, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
+            DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+            ANTIALIASED_QUALITY, DEFAULT_PITCH | FF_SWISS, L"Segoe UI");
+        if (!g_glyphFonts[sizeIndex]) return false;
+    }
+    HDC dc = CreateCompatibleDC(NULL);
+    if (!dc) return false;
+    HGDIOBJ oldFont = SelectObject(dc, g_glyphFonts[sizeIndex]);
+    TEXTMETRICW tm;
+    GetTextMetricsW(dc, &tm);
+    // Complex mode writes polar values as "r<θ"; the display shows the angle sign
+    WCHAR wch = ch == '<' ? L'\u2220' : (WCHAR)(unsigned char)ch;
+    ABC abc;
+    if (!GetCharABCWidthsW(dc, wch, wch, &abc)) {
+        SIZE ext;
+        GetTextExtentPoint32W(dc, &wch, 1, &ext);
+        abc.abcA = 0;
+        abc.abcB = (UINT)ext.cx;
+        abc.abcC = 0;
+    }
+    // Overhanging glyphs get room on both sides of the advance
+    out->originX = abc.abcA < 0 ? -abc.abcA : 0;
+    out->advance = abc.abcA + (int)abc.abcB + abc.abcC;
+    int inkRight = abc.abcA + (int)abc.abcB;
+    out->width = out->originX + (inkRight > out->advance ? inkRight : out->advance) + 1;
+    out->height = tm.tmHeight;
+
+    uint32_t* bits = NULL;
+    HBITMAP bmp = CreateSurfaceBitmap(out->width, out->height, &bits);
+    bool ok = bmp != NULL;
+    if (ok) {
+        HGDIOBJ oldBmp = SelectObject(dc, bmp);
+        memset(bits, 0, (size_t)out->width * out->height * sizeof(uint32_t));
+        SetBkMode(dc, TRANSPARENT);
+        SetTextColor(dc, RGB(255, 255, 255));
+        TextOutW(dc, out->originX, 0, &wch, 1);
+        GdiFlush();
+        // White on black: any channel is the coverage
+        out->coverage.resize((size_t)out->width * out->height);
+        for (size_t i = 0; i < out->coverage.size(); i++) out->coverage[i] = (uint8_t)(bits[i] & 0xff);
+        SelectObject(dc, oldBmp);
+        DeleteObject(bmp);
+    }
+    SelectObject(dc, oldFont);
+    DeleteDC(dc);
+    return ok;
+}
+
+// Rebuilds the atlas when the DPI changes; glyphs fill in lazily
+static void EnsureGlyphAtlas() {
+    HDC screen = GetDC(NULL);
+    int dpi = screen ? GetDeviceCaps(screen, LOGPIXELSY) : 96;
+    if (screen) ReleaseDC(NULL, screen);
+    if (g_glyphs.raster == RasterGdiGlyph && g_glyphs.dpi == dpi) return;
+    ReleaseGlyphFonts();
+    g_glyphs.Reset(dpi, RasterGdiGlyph, NULL);
+}
+
+static void DrawDisplayWidget(const CompWidget& w, const CompRect& clip) {
+    EnsureGlyphAtlas();
+    uint32_t color = g_engine.IsErrorDisplay() ? CompRgb(200, 20, 20) : CompRgb(50, 50, 50); // Error 红色高亮
+    CompRect box(w.rect.left + 6, w.rect.top, w.rect.right - 6, w.rect.bottom);
+    GlyphDrawText(g_glyphs, g_comp.frame, box, clip, g_state.displayText, color);
+}
+
+// "calc.exe /bench-display": redraws the display for a stream of typed
+// and computed values, once with DrawTextW into a DIB and once from the
+// glyph atlas into a plain pixel buffer, and reports frames per second
+static int RunDisplayBenchmark() {
+    InitFonts();
+    const int w = 370, h = DISPLAY_HEIGHT, frames = 20000;
+    static const char* values[] = {"0", "7", "78", "789", "789.5", "1234567.25", "-0.000123456789",
+        "3.141592653589793238462643383279503", "22/7", "Error", "1.7976931348623157e+308"};
+    const int nValues = (int)(sizeof(values) / sizeof(values[0]));
+
+    CompSurface background;
+    background.Allocate(w, h);
+    CompFillVerticalGradient(background, CompRgb(232, 244, 252), CompRgb(196, 224, 240));
+    CompRect bounds = background.Bounds();
+    CompRect box(6, 0, w - 6, h);
+
+    // GDI text into a DIB section, as the display was drawn before
+    uint32_t* bits = NULL;
+    HBITMAP bmp = CreateSurfaceBitmap(w, h, &bits);
+    if (!bmp) return 1;
+    CompSurface gdiFrame;
+    gdiFrame.Attach(bits, w, h, w);
+    HDC dc = CreateCompatibleDC(NULL);
+    HGDIOBJ oldBmp = SelectObject(dc, bmp);
+    SelectObject(dc, hFontDisplay);
+    SetBkMode(dc, TRANSPARENT);
+    SetTextColor(dc, RGB(50, 50, 50));
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < frames; i++) {
+        CompCopyRect(gdiFrame, background, bounds);
+        WCHAR text[64];
+        MultiByteToWideChar(CP_ACP, 0, values[i % nValues], -1, text, 64);
+        RECT rc = {box.left, box.top, box.right, box.bottom};
+        DrawTextW(dc, text, -1, &rc, DT_RIGHT | DT_WORDBREAK | DT_NOPREFIX);
+        GdiFlush();
+    }
+    QueryPerformanceCounter(&t1);
+
+    // Atlas blits into a headless buffer; the first frames fill the cache
+    CompSurface frame;
+    frame.Allocate(w, h);
+    EnsureGlyphAtlas();
+    for (int i = 0; i < frames; i++) {
+        CompCopyRect(frame, background, bounds);
+        GlyphDrawText(g_glyphs, frame, box, bounds, values[i % nValues], CompRgb(50, 50, 50));
+    }
+    QueryPerformanceCounter(&t2);
+
+    SelectObject(dc, oldBmp);
+    DeleteDC(dc);
+    DeleteObject(bmp);
+    ReleaseGlyphFonts();
+
+    double gdiFps = frames * (double)freq.QuadPart / (double)(t1.QuadPart - t0.QuadPart);
+    double atlasFps = frames * (double)freq.QuadPart / (double)(t2.QuadPart - t1.QuadPart);
+    WCHAR buf[256];
+    StringCchPrintfW(buf, 256, L"%d display updates (%dx%d)\nDrawTextW: %.0f fps\nGlyph atlas: %.0f fps\n%d glyphs cached at %d DPI",
+        frames, w, h, gdiFps, atlasFps, g_glyphs.rasterized, g_glyphs.dpi);
+    MessageBoxW(NULL, buf, L"Display benchmark", MB_OK | MB_ICONINFORMATION);
+    return 0;
+}
+
+// Recomposes the pending damage and copies it to hdc, whose origin is at
+// (originX, originY) in main window coordinates
+static void ComposeAndPresent(HDC hdc, int originX, int originY, void (*draw)(const CompWidget&, const CompRect&)) {
+    std::vector<CompRect> changed;
+    GdiFlush(); // Pending GDI work on the frame must land before the raw pixel writes
+    g_comp.Compose(draw, &changed);
+    GdiFlush();
+    for (size_t i = 0; i < changed.size(); i++) {
+        const CompRect& r = changed[i];
+        BitBlt(hdc, r.left - originX, r.top - originY, r.right - r.left, r.bottom - r.top,
+               g_compDC, r.left, r.top, SRCCOPY);
+    }
+}
+
+// Feeds the rectangles of the window's update region to the damage list;
+// the coalesced list is usually far smaller than their bounding box
+static void InvalidateCompRegion(HRGN rgn, const RECT& bounds) {
+    DWORD size = GetRegionData(rgn, 0, NULL);
+    if (size) {
+        std::vector<char> buf(size);
+        RGNDATA* data = (RGNDATA*)&buf[0];
+        if (GetRegionData(rgn, size, data)) {
+            const RECT* r = (const RECT*)data->Buffer;
+            for (DWORD i = 0; i < data->rdh.nCount; i++) g_comp.Invalidate(CompRect(r[i].left, r[i].top, r[i].right, r[i].bottom));
+            return;
+        }
+    }
+    g_comp.Invalidate(CompRect(bounds.left, bounds.top, bounds.right, bounds.bottom));
+}
+
+// Keeps the background off visible children so they are not painted
+// twice. Group boxes are hollow and the background shows through them.
+static void ExcludeChildWindows(HWND hwnd, HDC hdc) {
+    for (HWND c = GetWindow(hwnd, GW_CHILD); c; c = GetWindow(c, GW_HWNDNEXT)) {
+        if (!IsWindowVisible(c)) continue;
+        WCHAR cls[16];
+        GetClassNameW(c, cls, 16);
+        if (_wcsicmp(cls, L"Button") == 0 && (GetWindowLongW(c, GWL_STYLE) & BS_TYPEMASK) == BS_GROUPBOX) continue;
+        RECT rc;
+        GetWindowRect(c, &rc);
+        MapWindowPoints(NULL, hwnd, (POINT*)&rc, 2);
+        ExcludeClipRect(hdc, rc.left, rc.top, rc.right, rc.bottom);
+    }
+}
+
+// --- Graph UI ---
+// y = f(x) drawn by calc_plot.h into a DIB section that the plot window
+// blits; drag pans and the wheel zooms about the cursor
+static HWND hGraphCtrls[10];
+static int hGraphCount = 0;
+static HWND hGraphExpr, hGraphSamples, hGraphStatus, hGraphView;
+
+// Sample budgets offered by the combo; 0 = two per pixel
+static const long long kGraphSamples[] = {0, 10000, 100000, 1000000};
+static const WCHAR* kGraphSampleNames[] = {L"2 per pixel", L"10,000", L"100,000", L"1,000,000"};
+
+static PlotSampler g_plot;
+static bool g_plotReady = false;
+static PlotView g_plotView;
+static CompSurface g_plotSurface;
+static HBITMAP g_plotBmp = NULL;
+static HDC g_plotDC = NULL;
+static bool g_plotDragging = false;
+static POINT g_plotDragFrom;
+static PlotView g_plotDragView;
+
+void AddGraphCtrl(HWND h) { if (hGraphCount < 10) hGraphCtrls[hGraphCount++] = h; }
+
+static void ResetPlotView() {
+    RECT rc;
+    GetClientRect(hGraphView, &rc);
+    double half = rc.right > 0 ? 10.0 * rc.bottom / rc.right : 6.0;  // Equal scales on both axes
+    g_plotView.xMin = -10;
+    g_plotView.xMax = 10;
+    g_plotView.yMin = -half;
+    g_plotView.yMax = half;
+}
+
+// Builds the plot surface for the view's client size
+static bool EnsurePlotSurface() {
+    RECT rc;
+    GetClientRect(hGraphView, &rc);
+    if (rc.right <= 0 || rc.bottom <= 0) return false;
+    if (g_plotDC && rc.right == g_plotSurface.width && rc.bottom == g_plotSurface.height) return true;
+    if (g_plotDC) DeleteDC(g_plotDC);
+    if (g_plotBmp) DeleteObject(g_plotBmp);
+    g_plotDC = NULL;
+    uint32_t* bits = NULL;
+    g_plotBmp = CreateSurfaceBitmap(rc.right, rc.bottom, &bits);
+    if (!g_plotBmp) return false;
+    g_plotSurface.Attach(bits, rc.right, rc.bottom, rc.right);
+    g_plotDC = CreateCompatibleDC(NULL);
+    SelectObject(g_plotDC, g_plotBmp);
+    return true;
+}
+
+static void ReleasePlotSurface() {
+    if (g_plotDC) DeleteDC(g_plotDC);
+    if (g_plotBmp) DeleteObject(g_plotBmp);
+    g_plotDC = NULL;
+    g_plotBmp = NULL;
+}
+
+static long long PlotSampleBudget() {
+    int sel = (int)SendMessage(hGraphSamples, CB_GETCURSEL, 0, 0);
+    long long n = kGraphSamples[sel >= 0 && sel < (int)(sizeof(kGraphSamples) / sizeof(kGraphSamples[0])) ? sel : 0];
+    return n ? n : 2LL * g_plotSurface.width;
+}
+
+// Brings the samples up to the view and redraws the surface
+static void RenderPlot() {
+    if (!EnsurePlotSurface()) return;
+    LARGE_INTEGER t0, t1, freq;
+    QueryPerformanceCounter(&t0);
+    CompRect rect = g_plotSurface.Bounds();
+    PlotDrawGrid(g_plotSurface, rect, g_plotView, CompRgb(255, 255, 255), CompRgb(226, 232, 238), CompRgb(110, 120, 130));
+    bool ok = true;
+    if (g_plotReady) {
+        ok = g_plot.Update(g_plotView, g_plotSurface.height, PlotSampleBudget());
+        if (ok) PlotDrawCurve(g_plot, g_plotSurface, rect, g_plotView, CompRgb(0, 70, 190));
+    }
+    QueryPerformanceCounter(&t1);
+    QueryPerformanceFrequency(&freq);
+    double ms = (double)(t1.QuadPart - t0.QuadPart) * 1000.0 / (double)freq.QuadPart;
+
+    WCHAR buf[200];
+    if (!g_plotReady) buf[0] = L'\0';
+    else if (!ok) StringCchPrintfW(buf, 200, L"Cannot zoom further here");
+    else {
+        StringCchPrintfW(buf, 200, L"%lld samples, %lld refined, %lld evaluated this frame, %.1f ms    x %.6g .. %.6g",
+            g_plot.Size(), g_plot.refined, g_plot.evaluated, ms, g_plotView.xMin, g_plotView.xMax);
+    }
+    SetWindowTextW(hGraphStatus, buf);
+    InvalidateRect(hGraphView, NULL, FALSE);
+}
+
+static void PlotExpression() {
+    WCHAR w[256];
+    char text[256], msg[64];
+    GetWindowTextW(hGraphExpr, w, 256);
+    WideCharToMultiByte(CP_ACP, 0, w, -1, text, sizeof(text), NULL, NULL);
+    ExprProgram program;
+    if (!ExprCompile(text, &program, msg, sizeof(msg)) || !g_plot.SetProgram(program, msg, sizeof(msg))) {
+        g_plotReady = false;
+        RenderPlot();
+        WCHAR wmsg[64];
+        MultiByteToWideChar(CP_ACP, 0, msg, -1, wmsg, 64);
+        SetWindowTextW(hGraphStatus, wmsg);
+        return;
+    }
+    g_plotReady = true;
+    RenderPlot();
+}
+
+// Scales the view by f about the client point (px, py)
+static void ZoomPlot(double f, int px, int py) {
+    PlotView& v = g_plotView;
+    double cx = v.xMin + (v.xMax - v.xMin) * px / g_plotSurface.width;
+    double cy = v.yMax - (v.yMax - v.yMin) * py / g_plotSurface.height;
+    PlotView z = {cx + (v.xMin - cx) * f, cx + (v.xMax - cx) * f, cy + (v.yMin - cy) * f, cy + (v.yMax - cy) * f};
+    double scale = fabs(cx) > 1 ? fabs(cx) : 1;
+    if (z.xMax - z.xMin < scale * 1e-12 || z.xMax - z.xMin > 1e12) return;
+    v = z;
+    RenderPlot();
+}
+
+// Tick labels are drawn with GDI over the blitted surface, beside the axes
+// or along the edge when an axis is out of view
+static void DrawPlotLabels(HDC hdc) {
+    const PlotView& v = g_plotView;
+    int w = g_plotSurface.width, h = g_plotSurface.height;
+    double gx = PlotGridStep(v.xMax - v.xMin, w / 60), gy = PlotGridStep(v.yMax - v.yMin, h / 50);
+    int axisY = (int)floor(v.yMax * h / (v.yMax - v.yMin));
+    int axisX = (int)floor(-v.xMin * w / (v.xMax - v.xMin));
+    axisY = axisY < 0 ? 0 : axisY > h - 16 ? h - 16 : axisY;
+    axisX = axisX < 0 ? 0 : axisX > w - 48 ? w - 48 : axisX;
+    HFONT oldFont = (HFONT)SelectObject(hdc, hFontNormal);
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, RGB(100, 110, 120));
+    WCHAR text[32];
+    for (double k = ceil(v.xMin / gx); k * gx <= v.xMax && k * gx - v.xMin < 2 * (v.xMax - v.xMin); k++) {
+        if (k == 0) continue;
+        int px = (int)floor((k * gx - v.xMin) * w / (v.xMax - v.xMin));
+        StringCchPrintfW(text, 32, L"%g", k * gx);
+        TextOutW(hdc, px + 2, axisY + 1, text, (int)wcslen(text));
+    }
+    for (double k = ceil(v.yMin / gy); k * gy <= v.yMax && k * gy - v.yMin < 2 * (v.yMax - v.yMin); k++) {
+        if (k == 0) continue;
+        int py = (int)floor((v.yMax - k * gy) * h / (v.yMax - v.yMin));
+        StringCchPrintfW(text, 32, L"%g", k * gy);
+        TextOutW(hdc, axisX + 3, py - 15, text, (int)wcslen(text));
+    }
+    SelectObject(hdc, oldFont);
+}
+
+static LRESULT CALLBACK PlotWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    switch (msg) {
+        case WM_ERASEBKGND:
+            return 1;
+
+        case WM_PAINT: {
+            PAINTSTRUCT ps;
+            HDC hdc = BeginPaint(hwnd, &ps);
+            if (g_plotDC) {
+                BitBlt(hdc, 0, 0, g_plotSurface.width, g_plotSurface.height, g_plotDC, 0, 0, SRCCOPY);
+                DrawPlotLabels(hdc);
+            }
+            EndPaint(hwnd, &ps);
+            return 0;
+        }
+
+        case WM_LBUTTONDOWN:
+            SetFocus(hwnd);
+            SetCapture(hwnd);
+            g_plotDragging = true;
+            g_plotDragFrom.x = GET_X_LPARAM(lParam);
+            g_plotDragFrom.y = GET_Y_LPARAM(lParam);
+            g_plotDragView = g_plotView;
+            return 0;
+
+        case WM_MOUSEMOVE:
+            if (g_plotDragging && g_plotSurface.width > 0) {
+                const PlotView& d = g_plotDragView;
+                double dx = (GET_X_LPARAM(lParam) - g_plotDragFrom.x) * (d.xMax - d.xMin) / g_plotSurface.width;
+                double dy = (GET_Y_LPARAM(lParam) - g_plotDragFrom.y) * (d.yMax - d.yMin) / g_plotSurface.height;
+                g_plotView.xMin = d.xMin - dx;
+                g_plotView.xMax = d.xMax - dx;
+                g_plotView.yMin = d.yMin + dy;
+                g_plotView.yMax = d.yMax + dy;
+                RenderPlot();
+                UpdateWindow(hwnd);
+            }
+            return 0;
+
+        case WM_LBUTTONUP:
+            if (g_plotDragging) ReleaseCapture();
+            return 0;
+
+        case WM_CAPTURECHANGED:
+            g_plotDragging = false;
+            return 0;
+
+        case WM_MOUSEWHEEL: {
+            POINT pt = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
+            ScreenToClient(hwnd, &pt);
+            ZoomPlot(pow(0.8, GET_WHEEL_DELTA_WPARAM(wParam) / (double)WHEEL_DELTA), pt.x, pt.y);
+            return 0;
+        }
+    }
+    return DefWindowProcW(hwnd, msg, wParam, lParam);
+}
+
+void CreateGraphUI(HWND hwnd) {
+    AddGraphCtrl(CreateWindowW(L"STATIC", L"y =", WS_CHILD|SS_CENTERIMAGE, 20, 45, 30, 25, hwnd, NULL, NULL, NULL));
+    hGraphExpr = CreateWindowW(L"EDIT", L"tan(x) + sin(5*x)/4", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL,
+        55, 45, 355, 25, hwnd, (HMENU)IDC_GRAPH_EXPR, NULL, NULL);
+    AddGraphCtrl(hGraphExpr);
+    hGraphSamples = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 420, 45, 110, 120, hwnd, (HMENU)IDC_GRAPH_SAMPLES, NULL, NULL);
+    AddGraphCtrl(hGraphSamples);
+    for (int i = 0; i < (int)(sizeof(kGraphSamples) / sizeof(kGraphSamples[0])); i++) {
+        SendMessage(hGraphSamples, CB_ADDSTRING, 0, (LPARAM)kGraphSampleNames[i]);
+    }
+    SendMessage(hGraphSamples, CB_SETCURSEL, 0, 0);
+    AddGraphCtrl(CreateWindowW(L"BUTTON", L"Plot", WS_CHILD|BS_PUSHBUTTON, 540, 44, 70, 27, hwnd, (HMENU)IDC_BTN_GRAPH, NULL, NULL));
+    AddGraphCtrl(CreateWindowW(L"BUTTON", L"Reset view", WS_CHILD|BS_PUSHBUTTON, 615, 44, 75, 27, hwnd, (HMENU)IDC_BTN_GRAPH_RESET, NULL, NULL));
+
+    hGraphStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 77, 670, 20, hwnd, NULL, NULL, NULL);
+    AddGraphCtrl(hGraphStatus);
+
+    hGraphView = CreateWindowW(L"CalcPlotClass", L"", WS_CHILD|WS_BORDER, 10, 100, 680, 405, hwnd, (HMENU)IDC_GRAPH_VIEW, NULL, NULL);
+    AddGraphCtrl(hGraphView);
+    ResetPlotView();
+}
+
+// "calc.exe /bench-plot": a million-sample curve on a 1920x1080 surface.
+// Times the first frame, then pans and zooms that reuse the samples, and
+// a redraw of the cached curve, against a 60 fps frame budget.
+static int RunPlotBenchmark() {
+    const char* text = "tan(x) + sin(50*x)/4";
+    const long long kSamples = 1000000;
+    const int kFrames = 60;
+    ExprProgram program;
+    char msg[64];
+    if (!ExprCompile(text, &program, msg, sizeof(msg))) return 1;
+    PlotSampler* sampler = new PlotSampler;
+    sampler->SetProgram(program, msg, sizeof(msg));
+    CompSurface surface;
+    surface.Allocate(1920, 1080);
+    CompRect rect = surface.Bounds();
+    PlotView v = {-20, 20, -8, 8};
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    double worst[4] = {0, 0, 0, 0}, total[4] = {0, 0, 0, 0};
+    long long evaluated[4] = {0, 0, 0, 0};
+    for (int f = 0; f <= 3 * kFrames; f++) {
+        // Frame 0 is cold; then pans, zooms in and out, and plain redraws
+        int kind = f == 0 ? 0 : 1 + (f - 1) / kFrames;
+        if (kind == 1) {
+            double d = (v.xMax - v.xMin) * 0.01 * ((f % 20) < 10 ? 1 : -1);
+            v.xMin += d;
+            v.xMax += d;
+        } else if (kind == 2) {
+            double z = (f % 20) < 10 ? 0.9 : 1 / 0.9, cx = (v.xMin + v.xMax) / 2, cy = (v.yMin + v.yMax) / 2;
+            v.xMin = cx + (v.xMin - cx) * z;
+            v.xMax = cx + (v.xMax - cx) * z;
+            v.yMin = cy + (v.yMin - cy) * z;
+            v.yMax = cy + (v.yMax - cy) * z;
+        }
+        QueryPerformanceCounter(&t0);
+        if (kind != 3) sampler->Update(v, surface.height, kSamples);
+        PlotDrawGrid(surface, rect, v, CompRgb(255, 255, 255), CompRgb(226, 232, 238), CompRgb(110, 120, 130));
+        PlotDrawCurve(*sampler, surface, rect, v, CompRgb(0, 70, 190));
+        QueryPerformanceCounter(&t1);
+        double ms = (double)(t1.QuadPart - t0.QuadPart) * 1000.0 / (double)freq.QuadPart;
+        total[kind] += ms;
+        if (ms > worst[kind]) worst[kind] = ms;
+        if (kind != 3) evaluated[kind] += sampler->evaluated;
+    }
+    long long samples = sampler->Size();
+    delete sampler;
+
+    const double kBudget = 1000.0 / 60;
+    bool ok = worst[1] <= kBudget && worst[3] <= kBudget;
+    WCHAR buf[600];
+    StringCchPrintfW(buf, 600,
+        L"y = tan(x) + sin(50*x)/4, %lld samples, 1920x1080\n\n"
+        L"First frame: %.1f ms (%lld evaluated)\n"
+        L"Pan: avg %.1f ms, worst %.1f ms (%lld evaluated per frame)\n"
+        L"Zoom: avg %.1f ms, worst %.1f ms (%lld evaluated per frame)\n"
+        L"Redraw: avg %.1f ms, worst %.1f ms\n\n"
+        L"Pan and redraw %s the %.1f ms frame budget",
+        samples, total[0], evaluated[0],
+        total[1] / kFrames, worst[1], evaluated[1] / kFrames,
+        total[2] / kFrames, worst[2], evaluated[2] / kFrames,
+        total[3] / kFrames, worst[3], ok ? L"fit" : L"exceed", kBudget);
+    MessageBoxW(NULL, buf, L"Plot benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONWARNING));
+    return ok ? 0 : 1;
+}
+
+// --- Matrix UI ---
+// Matrices typed as rows of numbers and worked on by calc_matrix.h. Big
+// results are cut short on screen but kept whole for "Result -> A".
+// Multiply, determinant, inverse and solve at MAT_PARALLEL_MIN and up run
+// as a background job, since a few thousand rows take seconds.
+static HWND hMatCtrls[16];
+static int hMatCount = 0;
+static HWND hMatA, hMatB, hMatResult, hMatStatus, hBtnMatCancel;
+
+#define MAT_SHOW_MAX 20  // Rows and columns shown in the result box
+
+// The last result; exact when it came from rational elimination
+static Matrix g_matResult;
+static RatMatrix g_matResultExact;
+static bool g_matResultIsExact = false;
+static bool g_matHasResult = false;
+
+// One command: its inputs and what it produced. A background job owns it
+// until the done callback runs.
+struct MatCommand {
+    int id;
+    Matrix a, b, r;
+    RatMatrix ea, eb;
+    MatSolution s;
+    int threads;
+    bool ok;
+    char msg[96];
+    double ms;
+};
+static MatCommand g_matCmd;
+static std::atomic<bool> g_matCancel(false);
+static SchedHandle g_matTask;
+static LARGE_INTEGER g_matStart;
+
+void AddMatCtrl(HWND h) { if (hMatCount < 16) hMatCtrls[hMatCount++] = h; }
+
+void CreateMatrixUI(HWND hwnd) {
+    AddMatCtrl(CreateWindowW(L"STATIC", L"A  (rows on lines or split by ';', entries like 2, -0.5, 3/4)",
+        WS_CHILD|SS_LEFT, 20, 42, 420, 20, hwnd, NULL, NULL, NULL));
+    hMatA = CreateWindowW(L"EDIT", L"4 -2 1\r\n3 6 -4\r\n2 1 8",
+        WS_CHILD|WS_BORDER|WS_VSCROLL|WS_HSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_AUTOHSCROLL|ES_WANTRETURN,
+        20, 64, 325, 150, hwnd, (HMENU)IDC_MAT_A, NULL, NULL);
+    AddMatCtrl(hMatA);
+    AddMatCtrl(CreateWindowW(L"STATIC", L"B", WS_CHILD|SS_LEFT, 355, 42, 100, 20, hwnd, NULL, NULL, NULL));
+    hMatB = CreateWindowW(L"EDIT", L"12\r\n-25\r\n32",
+        WS_CHILD|WS_BORDER|WS_VSCROLL|WS_HSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_AUTOHSCROLL|ES_WANTRETURN,
+        355, 64, 325, 150, hwnd, (HMENU)IDC_MAT_B, NULL, NULL);
+    AddMatCtrl(hMatB);
+    SendMessage(hMatA, EM_SETLIMITTEXT, 0, 0);
+    SendMessage(hMatB, EM_SETLIMITTEXT, 0, 0);
+
+    static const WCHAR* names[] = {L"A + B", L"A - B", L"A × B", L"Aᵀ", L"det A", L"A⁻¹", L"Solve AX = B", L"Result → A"};
+    for (int i = 0; i < 8; i++) {
+        AddMatCtrl(CreateWindowW(L"BUTTON", names[i], WS_CHILD|BS_PUSHBUTTON, 20 + i * 83, 224, i >= 6 ? 86 : 78, 27,
+            hwnd, (HMENU)(INT_PTR)(IDC_BTN_MAT_ADD + i), NULL, NULL));
+    }
+
+    hMatResult = CreateWindowW(L"EDIT", L"",
+        WS_CHILD|WS_BORDER|WS_VSCROLL|WS_HSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_AUTOHSCROLL|ES_READONLY,
+        20, 262, 660, 180, hwnd, (HMENU)IDC_MAT_RESULT, NULL, NULL);
+    AddMatCtrl(hMatResult);
+    hMatStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 448, 570, 20, hwnd, NULL, NULL, NULL);
+    AddMatCtrl(hMatStatus);
+    hBtnMatCancel = CreateWindowW(L"BUTTON", L"Cancel", WS_CHILD|BS_PUSHBUTTON|WS_DISABLED, 610, 445, 70, 25, hwnd, (HMENU)IDC_BTN_MAT_CANCEL, NULL, NULL);
+    AddMatCtrl(hBtnMatCancel);
+}
+
+// Result text is ASCII apart from a few signs (±, ×), written as UTF-8
+static void SetMatText(HWND h, const std::string& text) {
+    std::vector<WCHAR> w(text.size() + 1);
+    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, &w[0], (int)w.size());
+    SetWindowTextW(h, &w[0]);
+}
+
+static bool ReadMatrix(HWND h, const char* name, Matrix* m, RatMatrix* exact) {
+    int len = GetWindowTextLengthW(h);
+    std::vector<WCHAR> w((size_t)len + 1);
+    GetWindowTextW(h, &w[0], len + 1);
+    std::vector<char> text((size_t)len * 2 + 2);
+    WideCharToMultiByte(CP_ACP, 0, &w[0], -1, &text[0], (int)text.size(), NULL, NULL);
+    char msg[96], line[128];
+    if (MatParse(&text[0], m, exact, msg, sizeof(msg))) return true;
+    snprintf(line, sizeof(line), "%s: %s", name, msg);
+    SetMatText(hMatStatus, line);
+    return false;
+}
+
+// How a solve or determinant was done, for the status line
+static void DescribeMatMethod(const MatSolution& s, int threads, char* buf, int size) {
+    if (s.exact && s.singular) snprintf(buf, (size_t)size, "exact elimination (singular in doubles)");
+    else if (s.exact) snprintf(buf, (size_t)size, "exact elimination (cond %.3g > %.0e)", s.condition, MAT_COND_LIMIT);
+    else if (s.condition > 0) snprintf(buf, (size_t)size, "LU, cond %.3g", s.condition);
+    else snprintf(buf, (size_t)size, "blocked LU, %d thread%s", threads, threads == 1 ? "" : "s");
+}
+
+// Runs g_matCmd, on the UI thread or on a worker
+static void MatCompute() {
+    MatCommand& c = g_matCmd;
+    const std::atomic<bool>* cancel = &g_matCancel;
+    c.ok = true;
+    c.msg[0] = '\0';
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    switch (c.id) {
+        case IDC_BTN_MAT_ADD:
+        case IDC_BTN_MAT_SUB:
+            c.ok = MatAdd(c.a, c.b, c.id == IDC_BTN_MAT_ADD ? 1 : -1, &c.r);
+            if (!c.ok) snprintf(c.msg, sizeof(c.msg), "A is %dx%d but B is %dx%d", c.a.rows, c.a.cols, c.b.rows, c.b.cols);
+            break;
+        case IDC_BTN_MAT_MUL:
+            c.ok = MatMultiply(c.a, c.b, &c.r, c.threads, cancel);
+            if (!c.ok && c.a.cols != c.b.rows) snprintf(c.msg, sizeof(c.msg), "A has %d columns but B has %d rows", c.a.cols, c.b.rows);
+            else if (!c.ok) snprintf(c.msg, sizeof(c.msg), "Cancelled");
+            break;
+        case IDC_BTN_MAT_TRANSPOSE: c.r = MatTranspose(c.a); break;
+        case IDC_BTN_MAT_DET: c.ok = MatDeterminant(c.a, &c.ea, &c.s, c.threads, c.msg, sizeof(c.msg), cancel); break;
+        case IDC_BTN_MAT_INV: c.ok = MatSolve(c.a, &c.ea, NULL, NULL, &c.s, c.threads, c.msg, sizeof(c.msg), cancel); break;
+        case IDC_BTN_MAT_SOLVE: c.ok = MatSolve(c.a, &c.ea, &c.b, &c.eb, &c.s, c.threads, c.msg, sizeof(c.msg), cancel); break;
+    }
+    QueryPerformanceCounter(&t1);
+    c.ms = (double)(t1.QuadPart - t0.QuadPart) * 1000.0 / (double)freq.QuadPart;
+}
+
+// Shows what g_matCmd produced; UI thread
+static void MatShowResult() {
+    MatCommand& c = g_matCmd;
+    char method[96] = "double", line[256];
+    if (!c.ok) {
+        if (g_matCancel.load()) snprintf(line, sizeof(line), "Cancelled after %.0f ms", c.ms);
+        else snprintf(line, sizeof(line), "%s", c.msg);
+        SetMatText(hMatStatus, line);
+        return;
+    }
+    MatSolution& s = c.s;
+    if (c.id == IDC_BTN_MAT_DET || c.id == IDC_BTN_MAT_INV || c.id == IDC_BTN_MAT_SOLVE) DescribeMatMethod(s, c.threads, method, sizeof(method));
+
+    if (c.id == IDC_BTN_MAT_DET) {
+        char det[160];
+        if (s.exact) MatFormatRational(s.exactDet, det, sizeof(det));
+        else MatFormatDeterminant(s.detMantissa, s.detExponent, det, sizeof(det));
+        snprintf(line, sizeof(line), "det(%dx%d) = %s", c.a.rows, c.a.cols, det);
+        g_engine.PushHistory(line);
+        SetMatText(hMatResult, det);
+        snprintf(line, sizeof(line), "Determinant of %dx%d A, %s, %.2f ms", c.a.rows, c.a.cols, method, c.ms);
+        SetMatText(hMatStatus, line);
+        return;
+    }
+
+    g_matResultIsExact = s.exact;
+    if (s.exact) g_matResultExact = s.exactValue;
+    else if (c.id == IDC_BTN_MAT_INV || c.id == IDC_BTN_MAT_SOLVE) std::swap(g_matResult, s.value);
+    else std::swap(g_matResult, c.r);
+    g_matHasResult = true;
+    int rows = s.exact ? g_matResultExact.rows : g_matResult.rows;
+    int cols = s.exact ? g_matResultExact.cols : g_matResult.cols;
+    SetMatText(hMatResult, s.exact ? RatMatToText(g_matResultExact, MAT_SHOW_MAX, MAT_SHOW_MAX)
+                                   : MatToText(g_matResult, MAT_SHOW_MAX, MAT_SHOW_MAX));
+    snprintf(line, sizeof(line), "%dx%d result%s, %s, %.2f ms", rows, cols,
+        rows > MAT_SHOW_MAX || cols > MAT_SHOW_MAX ? " (corner shown)" : "", method, c.ms);
+    SetMatText(hMatStatus, line);
+}
+
+static void UpdateMatProgress() {
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    char line[96];
+    snprintf(line, sizeof(line), "Working on %dx%d A, %d threads... %.1f s", g_matCmd.a.rows, g_matCmd.a.cols,
+        g_matCmd.threads, (double)(now.QuadPart - g_matStart.QuadPart) / (double)freq.QuadPart);
+    SetMatText(hMatStatus, line);
+}
+
+// The inputs can be large; they are dropped once shown
+static void ReleaseMatCommand() {
+    g_matCmd.a = Matrix();
+    g_matCmd.b = Matrix();
+    g_matCmd.r = Matrix();
+    g_matCmd.ea = RatMatrix();
+    g_matCmd.eb = RatMatrix();
+    g_matCmd.s = MatSolution();
+}
+
+static void FinishMatCommand() {
+    if (!g_matTask) return;
+    g_matTask.reset();
+    EnableWindow(hBtnMatCancel, FALSE);
+    MatShowResult();
+    ReleaseMatCommand();
+}
+
+static void MatRunCommand(int id) {
+    if (g_matTask) return;
+    MatCommand& c = g_matCmd;
+    if (!ReadMatrix(hMatA, "A", &c.a, &c.ea)) return;
+    bool needB = id == IDC_BTN_MAT_ADD || id == IDC_BTN_MAT_SUB || id == IDC_BTN_MAT_MUL || id == IDC_BTN_MAT_SOLVE;
+    if (needB && !ReadMatrix(hMatB, "B", &c.b, &c.eb)) return;
+    c.id = id;
+    c.threads = MatThreads(std::max(c.a.rows, c.a.cols));
+    c.s = MatSolution();
+    g_matCancel = false;
+
+    // Additions and transposes are a single pass; so are small problems
+    bool heavy = id == IDC_BTN_MAT_MUL || id == IDC_BTN_MAT_DET || id == IDC_BTN_MAT_INV || id == IDC_BTN_MAT_SOLVE;
+    if (!heavy || std::max(c.a.rows, c.a.cols) < MAT_PARALLEL_MIN) {
+        MatCompute();
+        MatShowResult();
+        ReleaseMatCommand();
+        return;
+    }
+    EnableWindow(hBtnMatCancel, TRUE);
+    QueryPerformanceCounter(&g_matStart);
+    UpdateMatProgress();
+    g_matTask = SubmitJob([](SchedJob*) { MatCompute(); },
+        [](SchedJob*) { FinishMatCommand(); }, [](SchedJob*) { UpdateMatProgress(); }, &g_matCancel);
+}
+
+static void CancelMatCommand() {
+    g_jobs.Cancel(g_matTask);
+}
+
+static void MatResultToA() {
+    if (!g_matHasResult) return;
+    SetMatText(hMatA, g_matResultIsExact ? RatMatToText(g_matResultExact) : MatToText(g_matResult));
+}
+
+// "calc.exe /bench-matrix": multiply and solve from 4x4 to 2000x2000,
+// against a plain triple loop where that finishes in reasonable time,
+// then a 10x10 Hilbert system solved in doubles and exactly.
+static void FillBenchMatrix(Matrix* m, int rows, int cols, unsigned long long* seed) {
+    *m = Matrix(rows, cols);
+    for (size_t i = 0; i < m->a.size(); i++) {
+        *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        m->a[i] = (double)(*seed >> 11) / 9007199254740992.0 * 2 - 1;
+    }
+}
+
+static int RunMatrixBenchmark() {
+    static const int kSizes[] = {4, 16, 64, 256, 512, 1000, 2000};
+    const int kNaiveMax = 512;
+    unsigned long long seed = 1;
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    WCHAR buf[2048], row[200];
+    StringCchPrintfW(buf, 2048, L"n\tmultiply\tGFLOP/s\tnaive\tLU solve\tresidual\n");
+    double worstResidual = 0;
+    for (int s = 0; s < (int)(sizeof(kSizes) / sizeof(kSizes[0])); s++) {
+        int n = kSizes[s], threads = MatThreads(n);
+        Matrix a, b, c, x, rhs;
+        FillBenchMatrix(&a, n, n, &seed);
+        FillBenchMatrix(&b, n, n, &seed);
+        FillBenchMatrix(&x, n, 1, &seed);
+        double flops = 2.0 * n * n * n;
+        int reps = (int)std::max(1.0, std::min(100000.0, 2e8 / flops));
+
+        QueryPerformanceCounter(&t0);
+        for (int r = 0; r < reps; r++) MatMultiply(a, b, &c, threads);
+        QueryPerformanceCounter(&t1);
+        double mulSec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart / reps;
+
+        double naiveGflops = 0;
+        if (n <= kNaiveMax) {
+            Matrix d(n, n);
+            QueryPerformanceCounter(&t0);
+            for (int r = 0; r < reps; r++) {
+                for (int i = 0; i < n; i++) {
+                    for (int j = 0; j < n; j++) {
+                        double sum = 0;
+                        for (int k = 0; k < n; k++) sum += a.At(i, k) * b.At(k, j);
+                        d.At(i, j) = sum;
+                    }
+                }
+            }
+            QueryPerformanceCounter(&t1);
+            naiveGflops = flops * reps / ((double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart) / 1e9;
+        }
+
+        // Scaled residual |Ax - b| / (|A| |x| n eps) of the computed x
+        MatMultiply(a, x, &rhs, threads);
+        MatSolution sol;
+        char msg[64];
+        QueryPerformanceCounter(&t0);
+        for (int r = 0; r < reps; r++) {
+            sol = MatSolution();
+            MatSolve(a, NULL, &rhs, NULL, &sol, threads, msg, sizeof(msg));
+        }
+        QueryPerformanceCounter(&t1);
+        double solveSec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart / reps;
+        Matrix check;
+        MatMultiply(a, sol.value, &check, threads);
+        double err = 0, normA = 0, normX = 0;
+        for (int i = 0; i < n; i++) {
+            double rowSum = 0;
+            for (int j = 0; j < n; j++) rowSum += fabs(a.At(i, j));
+            normA = std::max(normA, rowSum);
+            normX = std::max(normX, fabs(sol.value.a[i]));
+            err = std::max(err, fabs(check.a[i] - rhs.a[i]));
+        }
+        double residual = err / (normA * normX * n * 2.220446049250313e-16);
+        worstResidual = std::max(worstResidual, residual);
+
+        WCHAR naive[32] = L"-";
+        if (naiveGflops > 0) StringCchPrintfW(naive, 32, L"%.2f", naiveGflops);
+        StringCchPrintfW(row, 200, L"%d\t%.3f ms\t%.2f\t%s\t%.3f ms\t%.2g\n",
+            n, mulSec * 1000, flops / mulSec / 1e9, naive, solveSec * 1000, residual);
+        StringCchCatW(buf, 2048, row);
+    }
+
+    // Hilbert 10x10 with b = 1: every entry of x is an integer, and doubles
+    // lose most of their digits (cond ~ 3.5e13)
+    std::string text, ones;
+    char cell[16];
+    for (int i = 0; i < 10; i++) {
+        for (int j = 0; j < 10; j++) {
+            snprintf(cell, sizeof(cell), "1/%d ", i + j + 1);
+            text += cell;
+        }
+        text += "\n";
+        ones += "1\n";
+    }
+    Matrix h, one;
+    RatMatrix eh, eone;
+    char msg[64];
+    MatParse(text.c_str(), &h, &eh, msg, sizeof(msg));
+    MatParse(ones.c_str(), &one, &eone, msg, sizeof(msg));
+    MatSolution exact, approx;
+    bool exactOk = MatSolve(h, &eh, &one, &eone, &exact, 1, msg, sizeof(msg)) && exact.exact;
+    MatSolve(h, NULL, &one, NULL, &approx, 1, msg, sizeof(msg));
+    double hilbertErr = 0;
+    for (int i = 0; exactOk && i < 10; i++) {
+        double want = RatToDouble(exact.exactValue.a[i]);
+        hilbertErr = std::max(hilbertErr, fabs(approx.value.a[i] - want) / fabs(want));
+    }
+
+    bool ok = worstResidual < 100 && exactOk;
+    StringCchPrintfW(row, 200, L"\nHilbert 10x10: cond %.2g, doubles off by %.1e, exact fallback %s\n",
+        exact.condition, hilbertErr, exactOk ? L"used" : L"NOT USED");
+    StringCchCatW(buf, 2048, row);
+    StringCchCatW(buf, 2048, worstResidual < 100 ? L"All residuals within bounds" : L"RESIDUAL TOO LARGE");
+    MessageBoxW(NULL, buf, L"Matrix benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// --- Solve UI ---
+// Real roots of f(x) = 0 or of a polynomial on [From, To], found by
+// calc_solve.h on a worker thread so a long scan can be watched and
+// cancelled.
+static HWND hSolveCtrls[20];
+static int hSolveCount = 0;
+static HWND hSolveMode, hSolveEquation, hSolveHint, hSolveFrom, hSolveTo, hSolveCells, hSolveThreads;
+static HWND hSolveResult, hSolveStatus, hBtnSolve, hBtnSolveCancel;
+
+#define SOLVE_MODE_FUNCTION 0
+#define SOLVE_MODE_POLY     1
+
+#define SOLVE_SHOW_MAX       1000  // Roots listed in the result box
+#define SOLVE_HISTORY_ROOTS  10
+
+// The running solve. Its job owns the solve, the program and the
+// polynomial until the done callback runs; the solve's cancel flag stops
+// either kind.
+static ExprProgram g_solveProgram;
+static SolveJob g_solveJob;
+static std::vector<double> g_solveCoeffs;
+static std::vector<SolveComplex> g_solvePolyRoots;
+static bool g_solvePolyConverged = false;
+static int g_solveIterations = 0;
+static int g_solveMode = SOLVE_MODE_FUNCTION;
+static int g_solveThreadCount = 0;
+static SchedHandle g_solveTask;
+static LARGE_INTEGER g_solveStart;
+
+static const WCHAR* kSolveHints[] = {
+    L"f(x) in x, or lhs = rhs. Sign changes and touching zeros on the grid are refined to roots.",
+    L"Coefficients, highest power first: 1 0 -2 -5 is x³ - 2x - 5. Complex roots are listed too."
+};
+
+void AddSolveCtrl(HWND h) { if (hSolveCount < 20) hSolveCtrls[hSolveCount++] = h; }
+
+void CreateSolveUI(HWND hwnd) {
+    hSolveMode = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 20, 45, 130, 100, hwnd, (HMENU)IDC_SOLVE_MODE, NULL, NULL);
+    AddSolveCtrl(hSolveMode);
+    SendMessage(hSolveMode, CB_ADDSTRING, 0, (LPARAM)L"f(x) = 0");
+    SendMessage(hSolveMode, CB_ADDSTRING, 0, (LPARAM)L"Polynomial");
+    SendMessage(hSolveMode, CB_SETCURSEL, SOLVE_MODE_FUNCTION, 0);
+    hSolveEquation = CreateWindowW(L"EDIT", L"sin(x) = x/10", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL,
+        160, 45, 520, 25, hwnd, (HMENU)IDC_SOLVE_EQUATION, NULL, NULL);
+    AddSolveCtrl(hSolveEquation);
+    SendMessage(hSolveEquation, EM_SETLIMITTEXT, 0, 0);
+
+    AddSolveCtrl(CreateWindowW(L"STATIC", L"From:", WS_CHILD|SS_CENTERIMAGE, 20, 80, 40, 25, hwnd, NULL, NULL, NULL));
+    hSolveFrom = CreateWindowW(L"EDIT", L"-20", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 60, 80, 80, 25, hwnd, (HMENU)IDC_SOLVE_FROM, NULL, NULL);
+    AddSolveCtrl(hSolveFrom);
+    AddSolveCtrl(CreateWindowW(L"STATIC", L"To:", WS_CHILD|SS_CENTERIMAGE, 150, 80, 25, 25, hwnd, NULL, NULL, NULL));
+    hSolveTo = CreateWindowW(L"EDIT", L"20", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 175, 80, 80, 25, hwnd, (HMENU)IDC_SOLVE_TO, NULL, NULL);
+    AddSolveCtrl(hSolveTo);
+    AddSolveCtrl(CreateWindowW(L"STATIC", L"Grid:", WS_CHILD|SS_CENTERIMAGE, 265, 80, 35, 25, hwnd, NULL, NULL, NULL));
+    hSolveCells = CreateWindowW(L"EDIT", L"100000", WS_CHILD|WS_BORDER|ES_NUMBER|ES_AUTOHSCROLL, 300, 80, 80, 25, hwnd, (HMENU)IDC_SOLVE_CELLS, NULL, NULL);
+    AddSolveCtrl(hSolveCells);
+    AddSolveCtrl(CreateWindowW(L"STATIC", L"Threads:", WS_CHILD|SS_CENTERIMAGE, 390, 80, 55, 25, hwnd, NULL, NULL, NULL));
+    WCHAR cores[16];
+    unsigned hw = std::thread::hardware_concurrency();
+    StringCchPrintfW(cores, 16, L"%u", hw ? hw : 1);
+    hSolveThreads = CreateWindowW(L"EDIT", cores, WS_CHILD|WS_BORDER|ES_NUMBER|ES_CENTER, 445, 80, 40, 25, hwnd, (HMENU)IDC_SOLVE_THREADS, NULL, NULL);
+    AddSolveCtrl(hSolveThreads);
+
+    hBtnSolve = CreateWindowW(L"BUTTON", L"Solve", WS_CHILD|BS_PUSHBUTTON, 495, 79, 90, 27, hwnd, (HMENU)IDC_BTN_SOLVE, NULL, NULL);
+    AddSolveCtrl(hBtnSolve);
+    hBtnSolveCancel = CreateWindowW(L"BUTTON", L"Cancel", WS_CHILD|BS_PUSHBUTTON|WS_DISABLED, 590, 79, 90, 27, hwnd, (HMENU)IDC_BTN_SOLVE_CANCEL, NULL, NULL);
+    AddSolveCtrl(hBtnSolveCancel);
+
+    hSolveHint = CreateWindowW(L"STATIC", kSolveHints[SOLVE_MODE_FUNCTION], WS_CHILD|SS_LEFT, 20, 114, 660, 20, hwnd, NULL, NULL, NULL);
+    AddSolveCtrl(hSolveHint);
+    hSolveResult = CreateWindowW(L"EDIT", L"",
+        WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_READONLY,
+        20, 140, 660, 300, hwnd, (HMENU)IDC_SOLVE_RESULT, NULL, NULL);
+    AddSolveCtrl(hSolveResult);
+    hSolveStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 448, 660, 20, hwnd, NULL, NULL, NULL);
+    AddSolveCtrl(hSolveStatus);
+}
+
+static void SolveModeChanged() {
+    int mode = (int)SendMessage(hSolveMode, CB_GETCURSEL, 0, 0);
+    SetWindowTextW(hSolveHint, kSolveHints[mode == SOLVE_MODE_POLY ? SOLVE_MODE_POLY : SOLVE_MODE_FUNCTION]);
+}
+
+static bool ReadSolveNumber(HWND h, const char* name, double* out) {
+    char text[128], line[160];
+    ReadFinText(h, text, sizeof(text));
+    char* end;
+    *out = strtod(text, &end);
+    while (*end == ' ') end++;
+    if (end != text && !*end && fabs(*out) <= DBL_MAX) return true;
+    snprintf(line, sizeof(line), "%s is not a number", name);
+    SetFinText(hSolveStatus, line);
+    return false;
+}
+
+// Compiles the equation and range from the controls into g_solveJob and
+// g_solveProgram or g_solveCoeffs. On failure the reason goes to the
+// status line.
+static bool ReadSolveSpec() {
+    char msg[128];
+    g_solveMode = (int)SendMessage(hSolveMode, CB_GETCURSEL, 0, 0);
+    int len = GetWindowTextLengthW(hSolveEquation);
+    std::vector<WCHAR> w((size_t)len + 1);
+    GetWindowTextW(hSolveEquation, &w[0], len + 1);
+    std::vector<char> text((size_t)len * 2 + 2);
+    WideCharToMultiByte(CP_ACP, 0, &w[0], -1, &text[0], (int)text.size(), NULL, NULL);
+    bool ok = g_solveMode == SOLVE_MODE_POLY ? SolveParsePolynomial(&text[0], &g_solveCoeffs, msg, sizeof(msg))
+                                            : SolveCompile(&text[0], &g_solveProgram, msg, sizeof(msg));
+    if (!ok) {
+        SetFinText(hSolveStatus, msg);
+        return false;
+    }
+
+    double a, b, cells;
+    if (!ReadSolveNumber(hSolveFrom, "From", &a) || !ReadSolveNumber(hSolveTo, "To", &b)) return false;
+    if (!(a < b)) {
+        SetWindowTextW(hSolveStatus, L"From must be below To");
+        return false;
+    }
+    if (!ReadSolveNumber(hSolveCells, "Grid", &cells)) return false;
+    if (g_solveMode == SOLVE_MODE_FUNCTION && !(cells >= 1 && cells <= (double)SOLVE_MAX_CELLS)) {
+        snprintf(msg, sizeof(msg), "Grid cells must be 1 to %lld", SOLVE_MAX_CELLS);
+        SetFinText(hSolveStatus, msg);
+        return false;
+    }
+    g_solveJob.program = &g_solveProgram;
+    g_solveJob.a = a;
+    g_solveJob.b = b;
+    g_solveJob.cells = (long long)cells;
+    return true;
+}
+
+static void StartSolve() {
+    if (g_solveTask || !ReadSolveSpec()) return;
+
+    WCHAR wthreads[16];
+    GetWindowTextW(hSolveThreads, wthreads, 16);
+    g_solveThreadCount = std::max(1, _wtoi(wthreads));
+    g_solveJob.cancel = false;
+    g_solveJob.done = 0;
+    g_solveJob.total = 0;
+    EnableWindow(hBtnSolve, FALSE);
+    EnableWindow(hBtnSolveCancel, TRUE);
+    SetWindowTextW(hSolveResult, L"");
+    QueryPerformanceCounter(&g_solveStart);
+
+    int threads = g_solveThreadCount;
+    bool poly = g_solveMode == SOLVE_MODE_POLY;
+    g_solveTask = SubmitJob([threads, poly](SchedJob*) {
+            if (poly) g_solvePolyConverged = SolvePolynomial(g_solveCoeffs, &g_solvePolyRoots, &g_solveJob.cancel, &g_solveIterations);
+            else SolveRun(&g_solveJob, threads);
+        },
+        [](SchedJob*) { FinishSolve(); }, [](SchedJob*) { UpdateSolveProgress(); }, &g_solveJob.cancel);
+}
+
+static void UpdateSolveProgress() {
+    WCHAR buf[128];
+    if (g_solveMode == SOLVE_MODE_POLY) {
+        StringCchPrintfW(buf, 128, L"Solving a polynomial of degree %zu...", g_solveCoeffs.size() - 1);
+    } else {
+        long long done = g_solveJob.done.load(), total = g_solveJob.total.load();
+        StringCchPrintfW(buf, 128, L"Scanned and refined %lld of %lld (%.0f%%)",
+            done, total, total ? 100.0 * (double)done / (double)total : 100.0);
+    }
+    SetWindowTextW(hSolveStatus, buf);
+}
+
+// Lists the roots of a finished solve, the first few also going to the
+// history
+static void FinishSolve() {
+    if (!g_solveTask) return;
+    g_solveTask.reset();
+    EnableWindow(hBtnSolve, TRUE);
+    EnableWindow(hBtnSolveCancel, FALSE);
+
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    double ms = (double)(now.QuadPart - g_solveStart.QuadPart) * 1000.0 / (double)freq.QuadPart;
+    bool cancelled = g_solveJob.cancel.load();
+    char line[256];
+    if (cancelled) {
+        snprintf(line, sizeof(line), "Cancelled after %.0f ms", ms);
+        SetFinText(hSolveStatus, line);
+        return;
+    }
+
+    std::vector<SolveRoot> roots;
+    int complexCount = 0;
+    bool poly = g_solveMode == SOLVE_MODE_POLY;
+    if (poly) SolvePolyRealRoots(g_solveCoeffs, g_solvePolyRoots, g_solveJob.a, g_solveJob.b, &roots, &complexCount);
+    else roots.swap(g_solveJob.roots);
+
+    static const char* kKinds[] = {"sign change", "exact", "touches zero", ""};
+    std::string text;
+    for (size_t i = 0; i < roots.size() && i < SOLVE_SHOW_MAX; i++) {
+        const SolveRoot& r = roots[i];
+        int n = snprintf(line, sizeof(line), "x = %-24.15g f(x) = %-12.3g ", r.x, r.fx);
+        if (r.kind == SOLVE_ROOT_POLY && r.multiplicity > 1) snprintf(line + n, sizeof(line) - (size_t)n, "multiplicity %d", r.multiplicity);
+        else snprintf(line + n, sizeof(line) - (size_t)n, "%s", kKinds[r.kind]);
+        text += line;
+        text += "\r\n";
+    }
+    if (roots.size() > SOLVE_SHOW_MAX) {
+        snprintf(line, sizeof(line), "... %zu more\r\n", roots.size() - SOLVE_SHOW_MAX);
+        text += line;
+    }
+    if (poly && complexCount) {
+        // Conjugates come in pairs; list the upper one of each
+        text += "\r\nComplex roots:\r\n";
+        int shown = 0;
+        for (size_t i = 0; i < g_solvePolyRoots.size() && shown < SOLVE_SHOW_MAX; i++) {
+            const SolveComplex& z = g_solvePolyRoots[i];
+            double d;
+            bool noisy;
+            SolvePolyEval(g_solveCoeffs, z.real(), &d, &noisy);
+            if (z.imag() <= 4 * DBL_EPSILON * (1 + fabs(z.real())) || noisy) continue;
+            snprintf(line, sizeof(line), "x = %.15g ± %.15gi\r\n", z.real(), z.imag());
+            text += line;
+            shown++;
+        }
+    }
+    if (text.empty()) text = "No roots";
+    SetMatText(hSolveResult, text);
+
+    for (size_t i = 0; i < roots.size() && i < SOLVE_HISTORY_ROOTS; i++) {
+        snprintf(line, sizeof(line), "Root: x = %.15g", roots[i].x);
+        g_engine.PushHistory(line);
+    }
+
+    if (poly) {
+        snprintf(line, sizeof(line), "Degree %zu: %zu real root%s in range, %d complex, %d Aberth iterations%s, %.2f ms",
+            g_solveCoeffs.size() - 1, roots.size(), roots.size() == 1 ? "" : "s", complexCount, g_solveIterations,
+            g_solvePolyConverged ? "" : " (not all converged)", ms);
+    } else {
+        snprintf(line, sizeof(line), "%zu root%s%s from %lld candidates, %lld evaluations, %d thread%s, %.2f ms",
+            roots.size(), roots.size() == 1 ? "" : "s", g_solveJob.truncated ? " (more not kept)" : "",
+            g_solveJob.candidates, g_solveJob.evaluations, g_solveThreadCount, g_solveThreadCount == 1 ? "" : "s", ms);
+    }
+    SetFinText(hSolveStatus, line);
+}
+
+static void CancelSolve() {
+    g_jobs.Cancel(g_solveTask);
+}
+
+// "calc.exe /bench-solve": a standard suite of equations, each solved
+// repeatedly, with solves per second, the roots found against the known
+// count and the largest |f| at a root
+struct SolveBenchCase {
+    const char* name;
+    const char* text;  // The equation; empty for a polynomial
+    int degree;        // (x - 1)(x - 2)...(x - n) when positive, x^n - 1 when negative
+    double a, b;
+    int expected;
+};
+
+static int RunSolveBenchmark() {
+    static const SolveBenchCase kCases[] = {
+        {"x^3 - 2x - 5", "x^3 - 2*x - 5", 0, -10, 10, 1},
+        {"cos x = x", "cos(x) = x", 0, -10, 10, 1},
+        {"sin x, -100..100", "sin(x)", 0, -100, 100, 63},
+        {"e^x = 3x", "exp(x) = 3*x", 0, -10, 10, 2},
+        {"tan x = x", "tan(x) = x", 0, -20, 20, 11},
+        {"sin(1/x)", "sin(1/x)", 0, 0.01, 1, 31},
+        {"(x - 1)^2", "x^2 - 2*x + 1", 0, -10, 10, 1},
+        {"ln x = 1", "ln(x) = 1", 0, 0.001, 10, 1},
+        {"Wilkinson 20", "", 20, 0, 25, 20},
+        {"x^200 - 1", "", -200, -2, 2, 2},
+    };
+    const int kCaseCount = (int)(sizeof(kCases) / sizeof(kCases[0]));
+    const long long kCells = 100000;
+    int threads = (int)std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    WCHAR buf[2048], row[200];
+    StringCchPrintfW(buf, 2048, L"%lld grid cells, %d threads\n\tcase\troots\tmax |f|\tper solve\n", kCells, threads);
+    bool ok = true;
+    double totalSec = 0;
+    for (int c = 0; c < kCaseCount; c++) {
+        const SolveBenchCase& bc = kCases[c];
+        std::vector<double> coeffs;
+        ExprProgram program;
+        char msg[128];
+        if (bc.degree > 0) {
+            coeffs.assign(1, 1.0);
+            for (int k = 1; k <= bc.degree; k++) {
+                coeffs.push_back(0);
+                for (size_t i = coeffs.size() - 1; i > 0; i--) coeffs[i] -= k * coeffs[i - 1];
+            }
+        } else if (bc.degree < 0) {
+            coeffs.assign((size_t)(1 - bc.degree), 0.0);
+            coeffs[0] = 1;
+            coeffs.back() = -1;
+        } else {
+            SolveCompile(bc.text, &program, msg, sizeof(msg));
+        }
+
+        SolveJob job;
+        job.program = &program;
+        job.a = bc.a;
+        job.b = bc.b;
+        job.cells = kCells;
+        std::vector<SolveComplex> all;
+        std::vector<SolveRoot> roots;
+        int reps = 0, iterations, complexCount;
+        double sec = 0;
+        QueryPerformanceCounter(&t0);
+        do {
+            if (coeffs.empty()) {
+                SolveRun(&job, threads);
+            } else {
+                SolvePolynomial(coeffs, &all, NULL, &iterations);
+                SolvePolyRealRoots(coeffs, all, bc.a, bc.b, &roots, &complexCount);
+            }
+            reps++;
+            QueryPerformanceCounter(&t1);
+            sec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+        } while (sec < 0.2);
+        if (coeffs.empty()) roots.swap(job.roots);
+
+        double worst = 0;
+        for (size_t i = 0; i < roots.size(); i++) worst = std::max(worst, fabs(roots[i].fx));
+        bool right = (int)roots.size() == bc.expected;
+        ok = ok && right;
+        totalSec += sec / reps;
+        StringCchPrintfW(row, 200, L"%S\t%d of %d%s\t%.2g\t%.3f ms\n", bc.name, (int)roots.size(), bc.expected,
+            right ? L"" : L" !", worst, sec / reps * 1000);
+        StringCchCatW(buf, 2048, row);
+    }
+    StringCchPrintfW(row, 200, L"\nWhole suite: %.2f ms, %.0f suites/s\n%s", totalSec * 1000, 1 / totalSec,
+        ok ? L"All root counts match" : L"ROOT COUNT MISMATCH");
+    StringCchCatW(buf, 2048, row);
+    MessageBoxW(NULL, buf, L"Solver benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// --- Integer UI ---
+// Primality, factoring, gcd, lcm and modular powers on integers of any
+// size (calc_primes.h). Every command runs on a worker thread, since a
+// thousand-digit power or a hard factorization can take a while.
+static HWND hIntCtrls[20];
+static int hIntCount = 0;
+static HWND hIntA, hIntB, hIntM, hIntResult, hIntStatus, hBtnIntCancel;
+
+// The running command. Its job owns the inputs and the factoring state
+// until the done callback runs; the factoring cancel flag stops any
+// command.
+static PrimeFactorJob g_intJob;
+static BigInt g_intA, g_intB, g_intM;
+static int g_intCommand = 0;
+static std::string g_intResult;       // Result box text
+static std::string g_intValue;        // The single integer result, for the keypad
+static std::string g_intHistory;
+static SchedHandle g_intTask;
+static int g_intThreadCount = 0;
+static LARGE_INTEGER g_intStart;
+
+void AddIntCtrl(HWND h) { if (hIntCount < 20) hIntCtrls[hIntCount++] = h; }
+
+void CreateIntegerUI(HWND hwnd) {
+    static const WCHAR* labels[] = {L"a:", L"b:", L"m:"};
+    static const WCHAR* values[] = {L"8539734222673769370568987281911", L"65537", L"1000000007"};
+    HWND* edits[] = {&hIntA, &hIntB, &hIntM};
+    for (int i = 0; i < 3; i++) {
+        AddIntCtrl(CreateWindowW(L"STATIC", labels[i], WS_CHILD|SS_CENTERIMAGE, 20, 45 + i * 33, 25, 25, hwnd, NULL, NULL, NULL));
+        *edits[i] = CreateWindowW(L"EDIT", values[i], WS_CHILD|WS_BORDER|ES_AUTOHSCROLL,
+            45, 45 + i * 33, i == 0 ? 505 : 635, 25, hwnd, (HMENU)(INT_PTR)(IDC_INT_A + i), NULL, NULL);
+        AddIntCtrl(*edits[i]);
+        SendMessage(*edits[i], EM_SETLIMITTEXT, PRIME_MAX_DIGITS + 1, 0);
+    }
+    AddIntCtrl(CreateWindowW(L"BUTTON", L"From keypad", WS_CHILD|BS_PUSHBUTTON, 560, 44, 120, 27, hwnd, (HMENU)IDC_BTN_INT_FROM_KEYPAD, NULL, NULL));
+
+    static const WCHAR* names[] = {L"Is a prime?", L"Factor a", L"Next prime", L"gcd(a, b)", L"lcm(a, b)", L"aᵇ mod m"};
+    for (int i = 0; i < 6; i++) {
+        AddIntCtrl(CreateWindowW(L"BUTTON", names[i], WS_CHILD|BS_PUSHBUTTON, 20 + i * 85, 146, 80, 27,
+            hwnd, (HMENU)(INT_PTR)(IDC_BTN_INT_PRIME + i), NULL, NULL));
+    }
+    hBtnIntCancel = CreateWindowW(L"BUTTON", L"Cancel", WS_CHILD|BS_PUSHBUTTON|WS_DISABLED, 530, 146, 70, 27, hwnd, (HMENU)IDC_BTN_INT_CANCEL, NULL, NULL);
+    AddIntCtrl(hBtnIntCancel);
+    AddIntCtrl(CreateWindowW(L"BUTTON", L"To keypad", WS_CHILD|BS_PUSHBUTTON, 605, 146, 75, 27, hwnd, (HMENU)IDC_BTN_INT_TO_KEYPAD, NULL, NULL));
+
+    hIntResult = CreateWindowW(L"EDIT", L"",
+        WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_READONLY,
+        20, 184, 660, 256, hwnd, (HMENU)IDC_INT_RESULT, NULL, NULL);
+    AddIntCtrl(hIntResult);
+    hIntStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 448, 660, 20, hwnd, NULL, NULL, NULL);
+    AddIntCtrl(hIntStatus);
+}
+
+// Digits with an optional sign; spaces, commas and underscores between
+// digit groups are skipped
+static bool ReadBigInt(HWND h, const char* name, BigInt* out) {
+    std::vector<WCHAR> w(PRIME_MAX_DIGITS + 2);
+    GetWindowTextW(h, &w[0], (int)w.size());
+    std::string digits;
+    for (size_t i = 0; w[i]; i++) {
+        if (w[i] == L' ' || w[i] == L',' || w[i] == L'_') continue;
+        digits += (char)(w[i] < 128 ? w[i] : '?');
+    }
+    char line[96];
+    if (digits.empty() || BigParse(digits.c_str(), out) != (int)digits.size()) {
+        snprintf(line, sizeof(line), "%s is not an integer", name);
+        SetFinText(hIntStatus, line);
+        return false;
+    }
+    return true;
+}
+
+static std::string BigText(const BigInt& v) {
+    std::vector<char> buf(v.mag.size() * 10 + 3);
+    BigToString(v, &buf[0], (int)buf.size());
+    return &buf[0];
+}
+
+// "2^3 × 5 × 7" from sorted factors; times is " × " for the result box
+// (UTF-8) and " * " for the history, which is ANSI
+static std::string FormatFactors(const std::vector<BigInt>& factors, const char* times) {
+    std::string text;
+    for (size_t i = 0; i < factors.size();) {
+        size_t j = i;
+        while (j < factors.size() && factors[j] == factors[i]) j++;
+        if (!text.empty()) text += times;
+        text += BigText(factors[i]);
+        if (j - i > 1) {
+            char power[16];
+            snprintf(power, sizeof(power), "^%d", (int)(j - i));
+            text += power;
+        }
+        i = j;
+    }
+    return text;
+}
+
+// Runs g_intCommand on the worker thread; fills the result strings
+static void RunIntCommand() {
+    const std::atomic<bool>* cancel = &g_intJob.cancel;
+    std::string a = BigText(g_intA);
+    switch (g_intCommand) {
+        case IDC_BTN_INT_PRIME: {
+            BigInt n = BigAbs(g_intA);
+            bool prime = PrimeIsProbablePrime(n, cancel);
+            if (cancel->load()) return;
+            const char* how = n.mag.size() <= 2 ? "exact Miller-Rabin" : "Baillie-PSW";
+            if (prime) g_intResult = a + " is prime (" + how + ")";
+            else if (n < BigInt(2)) g_intResult = a + " is neither prime nor composite";
+            else g_intResult = a + " is composite (" + how + ")";
+            g_intHistory = std::string("isprime(") + a + ") = " + (prime ? "yes" : "no");
+            break;
+        }
+        case IDC_BTN_INT_FACTOR: {
+            g_intJob.n = g_intA;
+            PrimeFactor(&g_intJob, g_intThreadCount);
+            BigInt n = BigAbs(g_intA);
+            std::string sign = g_intA.neg ? "-" : "";
+            if (n < BigInt(2)) {
+                g_intResult = a + " has no prime factors";
+                break;
+            }
+            std::string found = FormatFactors(g_intJob.factors, " × ");
+            for (size_t i = 0; i < g_intJob.unfactored.size(); i++) {
+                if (!found.empty()) found += " × ";
+                found += "(" + BigText(g_intJob.unfactored[i]) + ", composite)";
+            }
+            g_intResult = a + " =\r\n" + sign + found;
+            if (g_intJob.factors.size() == 1 && g_intJob.unfactored.empty()) g_intResult += "\r\n(prime)";
+            if (g_intJob.unfactored.empty()) g_intHistory = a + " = " + sign + FormatFactors(g_intJob.factors, " * ");
+            break;
+        }
+        case IDC_BTN_INT_NEXT: {
+            BigInt p = g_intA < BigInt(2) ? BigInt(2) : g_intA;
+            if (p != BigInt(2) && p.IsEven()) p = p + BigInt(1);
+            while (!PrimeIsProbablePrime(p, cancel)) {
+                if (cancel->load()) return;
+                p = p + BigInt(p == BigInt(2) ? 1 : 2);
+            }
+            g_intValue = BigText(p);
+            g_intResult = "Next prime >= " + a + ":\r\n" + g_intValue;
+            g_intHistory = "nextprime(" + a + ") = " + g_intValue;
+            break;
+        }
+        case IDC_BTN_INT_GCD:
+        case IDC_BTN_INT_LCM: {
+            bool gcd = g_intCommand == IDC_BTN_INT_GCD;
+            g_intValue = BigText(gcd ? BigGcd(g_intA, g_intB) : BigLcm(g_intA, g_intB));
+            std::string call = std::string(gcd ? "gcd(" : "lcm(") + a + ", " + BigText(g_intB) + ")";
+            g_intResult = call + " =\r\n" + g_intValue;
+            g_intHistory = call + " = " + g_intValue;
+            break;
+        }
+        case IDC_BTN_INT_POWMOD: {
+            BigInt r;
+            std::string call = a + "^" + BigText(g_intB) + " mod " + BigText(g_intM);
+            if (!BigPowMod(g_intA, g_intB, g_intM, &r, cancel)) {
+                if (cancel->load()) return;
+                g_intResult = call + ":\r\n" + (g_intM.IsZero() ? "the modulus is 0" : "a has no inverse mod m");
+                break;
+            }
+            g_intValue = BigText(r);
+            g_intResult = call + " =\r\n" + g_intValue;
+            g_intHistory = call + " = " + g_intValue;
+            break;
+        }
+    }
+}
+
+static void StartIntCommand(int id) {
+    if (g_intTask || !ReadBigInt(hIntA, "a", &g_intA)) return;
+    if ((id == IDC_BTN_INT_GCD || id == IDC_BTN_INT_LCM || id == IDC_BTN_INT_POWMOD) && !ReadBigInt(hIntB, "b", &g_intB)) return;
+    if (id == IDC_BTN_INT_POWMOD && !ReadBigInt(hIntM, "m", &g_intM)) return;
+
+    unsigned hw = std::thread::hardware_concurrency();
+    g_intThreadCount = hw ? (int)hw : 1;
+    g_intCommand = id;
+    g_intJob.cancel = false;
+    g_intJob.stage = PRIME_STAGE_DONE;
+    g_intResult.clear();
+    g_intValue.clear();
+    g_intHistory.clear();
+    EnableWindow(hBtnIntCancel, TRUE);
+    SetWindowTextW(hIntResult, L"");
+    SetWindowTextW(hIntStatus, L"Working...");
+    QueryPerformanceCounter(&g_intStart);
+
+    g_intTask = SubmitJob([](SchedJob*) { RunIntCommand(); },
+        [](SchedJob*) { FinishIntCommand(); }, [](SchedJob*) { UpdateIntProgress(); }, &g_intJob.cancel);
+}
+
+static void UpdateIntProgress() {
+    if (g_intCommand != IDC_BTN_INT_FACTOR) return;
+    WCHAR buf[160];
+    int bits = g_intJob.bits.load();
+    switch (g_intJob.stage.load()) {
+        case PRIME_STAGE_TRIAL:
+            StringCchPrintfW(buf, 160, L"Trial division...");
+            break;
+        case PRIME_STAGE_RHO:
+            StringCchPrintfW(buf, 160, L"Pollard rho on a %d-bit cofactor, %d threads", bits, g_intThreadCount);
+            break;
+        case PRIME_STAGE_ECM:
+            StringCchPrintfW(buf, 160, L"ECM on a %d-bit cofactor: %lld curves, B1 = %u, %d threads",
+                bits, g_intJob.curves.load(), g_intJob.b1.load(), g_intThreadCount);
+            break;
+        default:
+            return;
+    }
+    SetWindowTextW(hIntStatus, buf);
+}
+
+// Shows what a finished command found
+static void FinishIntCommand() {
+    if (!g_intTask) return;
+    g_intTask.reset();
+    EnableWindow(hBtnIntCancel, FALSE);
+
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    double ms = (double)(now.QuadPart - g_intStart.QuadPart) * 1000.0 / (double)freq.QuadPart;
+    bool cancelled = g_intJob.cancel.load();
+    char line[160];
+    if (cancelled && g_intResult.empty()) {
+        snprintf(line, sizeof(line), "Cancelled after %.0f ms", ms);
+        SetFinText(hIntStatus, line);
+        return;
+    }
+    SetMatText(hIntResult, g_intResult);
+    // History lines are kept short; long results stay in the box
+    if (!g_intHistory.empty() && g_intHistory.size() < CALC_TEXT_MAX) g_engine.PushHistory(g_intHistory.c_str());
+    if (g_intCommand == IDC_BTN_INT_FACTOR && g_intJob.curves.load()) {
+        snprintf(line, sizeof(line), "%s%.2f ms, %lld ECM curves on %d threads", cancelled ? "Cancelled after " : "",
+            ms, g_intJob.curves.load(), g_intThreadCount);
+    } else {
+        snprintf(line, sizeof(line), "%s%.2f ms", cancelled ? "Cancelled after " : "", ms);
+    }
+    SetFinText(hIntStatus, line);
+}
+
+static void CancelIntCommand() {
+    g_jobs.Cancel(g_intTask);
+}
+
+static void IntFromKeypad() {
+    BigInt v;
+    const char* text = g_state.displayText;
+    if (!*text || BigParse(text, &v) != (int)strlen(text)) {
+        SetWindowTextW(hIntStatus, L"The keypad is not showing an integer (exact mode keeps every digit)");
+        return;
+    }
+    SetFinText(hIntA, text);
+    SetWindowTextW(hIntStatus, L"");
+}
+
+static void IntToKeypad() {
+    if (g_intValue.empty()) {
+        SetWindowTextW(hIntStatus, L"No single integer result to send");
+        return;
+    }
+    if (g_intValue.size() >= sizeof(g_state.displayText)) {
+        SetWindowTextW(hIntStatus, L"Too many digits for the keypad");
+        return;
+    }
+    RecordInput(SES_TAB, TAB_CALC);
+    TabCtrl_SetCurSel(hTab, TAB_CALC);
+    SwitchTab(TAB_CALC);
+    RecordInput(SES_RECALL, 0, 0, g_intValue.c_str());
+    RecallValue(g_intValue.c_str());
+}
+
+// "calc.exe /bench-primes": factors a corpus of classic numbers and
+// balanced semiprimes of 20 to 40 digits, checking each factorization
+// against the known smallest factor, then times primality testing
+struct PrimeBenchCase {
+    const char* name;
+    const char* n;
+    const char* smallest;  // Smallest prime factor
+    int count;             // Prime factors with multiplicity
+};
+
+static int RunPrimeBenchmark() {
+    static const PrimeBenchCase kCases[] = {
+        {"F5", "4294967297", "641", 2},
+        {"F6", "18446744073709551617", "274177", 2},
+        {"M67", "147573952589676412927", "193707721", 2},
+        {"10^40 + 1", "10000000000000000000000000000000000000001", "17", 4},
+        {"F7", "340282366920938463463374607431768211457", "59649589127497217", 2},
+        {"20 digits", "8539734250799242291", "2718281831", 2},
+        {"24 digits", "85397342232111993342817", "271828182863", 2},
+        {"28 digits", "853973422269143962071642661", "27182818284617", 2},
+        {"32 digits", "8539734222673769370568987281911", "2718281828459051", 2},
+        {"36 digits", "85397342226735679921667655880679951", "271828182845904533", 2},
+        {"40 digits", "853973422267356708801755307227067758023", "27182818284590452387", 2},
+    };
+    const int kCaseCount = (int)(sizeof(kCases) / sizeof(kCases[0]));
+    int threads = (int)std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    WCHAR buf[2048], row[200];
+    StringCchPrintfW(buf, 2048, L"%d threads\n\tnumber\tfactors\tcurves\ttime\n", threads);
+    bool ok = true;
+    double totalSec = 0;
+    for (int c = 0; c < kCaseCount; c++) {
+        const PrimeBenchCase& bc = kCases[c];
+        PrimeFactorJob job;
+        BigParse(bc.n, &job.n);
+        QueryPerformanceCounter(&t0);
+        PrimeFactor(&job, threads);
+        QueryPerformanceCounter(&t1);
+        double sec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+        totalSec += sec;
+
+        BigInt smallest, product(1);
+        BigParse(bc.smallest, &smallest);
+        for (size_t i = 0; i < job.factors.size(); i++) product = product * job.factors[i];
+        bool right = job.unfactored.empty() && (int)job.factors.size() == bc.count &&
+                     job.factors[0] == smallest && product == job.n;
+        ok = ok && right;
+        StringCchPrintfW(row, 200, L"%S\t%d of %d%s\t%lld\t%.1f ms\n", bc.name, (int)job.factors.size(), bc.count,
+            right ? L"" : L" !", job.curves.load(), sec * 1000);
+        StringCchCatW(buf, 2048, row);
+    }
+
+    // Deterministic Miller-Rabin over a run of 64-bit odd numbers; the
+    // count of primes is checked against the prime number theorem
+    const uint64_t kStart = 0xFFFFFFFF00000001ull;
+    const int kOdd = 500000;
+    int primes = 0;
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < kOdd; i++) primes += PrimeIsPrime64(kStart + 2 * (uint64_t)i);
+    QueryPerformanceCounter(&t1);
+    double mrSec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+    double expected = 2.0 * kOdd / (64 * log(2.0));
+    bool density = fabs(primes - expected) < 0.05 * expected;
+    ok = ok && density;
+
+    // Baillie-PSW on the Mersenne prime 2^1279 - 1 and the composite 2^1277 - 1
+    BigInt m1279 = BigShiftLeft(BigInt(1), 1279) - BigInt(1);
+    BigInt m1277 = BigShiftLeft(BigInt(1), 1277) - BigInt(1);
+    QueryPerformanceCounter(&t0);
+    bool isPrime = PrimeIsProbablePrime(m1279);
+    bool isComposite = !PrimeIsProbablePrime(m1277);
+    QueryPerformanceCounter(&t1);
+    double bpswSec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+    ok = ok && isPrime && isComposite;
+
+    StringCchPrintfW(row, 200, L"\nCorpus: %.1f ms\n64-bit Miller-Rabin: %.0f tests/s, %d primes%s\n",
+        totalSec * 1000, kOdd / mrSec, primes, density ? L"" : L" !");
+    StringCchCatW(buf, 2048, row);
+    StringCchPrintfW(row, 200, L"Baillie-PSW, 2^1279 - 1 and 2^1277 - 1: %.1f ms%s\n%s", bpswSec * 1000,
+        isPrime && isComposite ? L"" : L" !", ok ? L"All factorizations match" : L"FACTORIZATION MISMATCH");
+    StringCchCatW(buf, 2048, row);
+    MessageBoxW(NULL, buf, L"Prime benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// --- Units UI ---
+// Conversions between the units of one quantity (calc_units.h). The input
+// takes one value or a whole list; lists go through the batch kernel. A
+// result can go to the keypad or straight into memory.
+static HWND hUnitCtrls[20];
+static int hUnitCount = 0;
+static HWND hUnitCategory, hUnitFrom, hUnitTo, hUnitInput, hUnitResult, hUnitStatus;
+
+#define UNIT_SHOW_MAX 1000  // Values listed in the result box
+
+// The last conversion, for the keypad and memory buttons
+static std::vector<double> g_unitValues;
+static char g_unitFirst[64] = "";
+
+static const WCHAR* kUnitCategoryNames[] = {L"Length", L"Mass", L"Temperature", L"Data size", L"Time", L"Area"};
+
+void AddUnitCtrl(HWND h) { if (hUnitCount < 20) hUnitCtrls[hUnitCount++] = h; }
+
+static int SelectedUnit(HWND combo) {
+    int sel = (int)SendMessage(combo, CB_GETCURSEL, 0, 0);
+    return sel < 0 ? -1 : (int)SendMessage(combo, CB_GETITEMDATA, sel, 0);
+}
+
+static void SelectUnit(HWND combo, int unit) {
+    int count = (int)SendMessage(combo, CB_GETCOUNT, 0, 0);
+    for (int i = 0; i < count; i++) {
+        if ((int)SendMessage(combo, CB_GETITEMDATA, i, 0) == unit) SendMessage(combo, CB_SETCURSEL, i, 0);
+    }
+}
+
+// Refills both unit combos for the chosen quantity
+static void FillUnitCombos() {
+    int category = (int)SendMessage(hUnitCategory, CB_GETCURSEL, 0, 0);
+    int units[UNIT_COUNT];
+    int n = UnitsOf(category, units, UNIT_COUNT);
+    HWND combos[] = {hUnitFrom, hUnitTo};
+    for (int c = 0; c < 2; c++) {
+        SendMessage(combos[c], CB_RESETCONTENT, 0, 0);
+        for (int i = 0; i < n; i++) {
+            char name[96];
+            WCHAR w[96];
+            snprintf(name, sizeof(name), "%s (%s)", kUnits[units[i]].name, kUnits[units[i]].symbol);
+            MultiByteToWideChar(CP_UTF8, 0, name, -1, w, 96);
+            int idx = (int)SendMessage(combos[c], CB_ADDSTRING, 0, (LPARAM)w);
+            SendMessage(combos[c], CB_SETITEMDATA, idx, units[i]);
+        }
+    }
+    SendMessage(hUnitFrom, CB_SETCURSEL, n > 1 ? 1 : 0, 0);
+    SendMessage(hUnitTo, CB_SETCURSEL, 0, 0);
+}
+
+void CreateUnitsUI(HWND hwnd) {
+    AddUnitCtrl(CreateWindowW(L"STATIC", L"Quantity:", WS_CHILD|SS_CENTERIMAGE, 20, 45, 70, 25, hwnd, NULL, NULL, NULL));
+    hUnitCategory = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 95, 45, 180, 200, hwnd, (HMENU)IDC_UNIT_CATEGORY, NULL, NULL);
+    AddUnitCtrl(hUnitCategory);
+    for (int i = 0; i < UNIT_CATEGORY_COUNT; i++) SendMessage(hUnitCategory, CB_ADDSTRING, 0, (LPARAM)kUnitCategoryNames[i]);
+    SendMessage(hUnitCategory, CB_SETCURSEL, UNIT_LENGTH, 0);
+
+    AddUnitCtrl(CreateWindowW(L"STATIC", L"From:", WS_CHILD|SS_CENTERIMAGE, 20, 80, 70, 25, hwnd, NULL, NULL, NULL));
+    hUnitFrom = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 95, 80, 230, 300, hwnd, (HMENU)IDC_UNIT_FROM, NULL, NULL);
+    AddUnitCtrl(hUnitFrom);
+    AddUnitCtrl(CreateWindowW(L"BUTTON", L"⇄", WS_CHILD|BS_PUSHBUTTON, 335, 79, 30, 27, hwnd, (HMENU)IDC_BTN_UNIT_SWAP, NULL, NULL));
+    AddUnitCtrl(CreateWindowW(L"STATIC", L"To:", WS_CHILD|SS_CENTERIMAGE, 375, 80, 30, 25, hwnd, NULL, NULL, NULL));
+    hUnitTo = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 410, 80, 270, 300, hwnd, (HMENU)IDC_UNIT_TO, NULL, NULL);
+    AddUnitCtrl(hUnitTo);
+    FillUnitCombos();
+
+    AddUnitCtrl(CreateWindowW(L"STATIC", L"Values, one or many:", WS_CHILD|SS_LEFT, 20, 118, 325, 20, hwnd, NULL, NULL, NULL));
+    hUnitInput = CreateWindowW(L"EDIT", L"1", WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_WANTRETURN,
+        20, 140, 325, 250, hwnd, (HMENU)IDC_UNIT_INPUT, NULL, NULL);
+    AddUnitCtrl(hUnitInput);
+    AddUnitCtrl(CreateWindowW(L"STATIC", L"Converted:", WS_CHILD|SS_LEFT, 355, 118, 325, 20, hwnd, NULL, NULL, NULL));
+    hUnitResult = CreateWindowW(L"EDIT", L"", WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_READONLY,
+        355, 140, 325, 250, hwnd, (HMENU)IDC_UNIT_RESULT, NULL, NULL);
+    AddUnitCtrl(hUnitResult);
+
+    AddUnitCtrl(CreateWindowW(L"BUTTON", L"From keypad", WS_CHILD|BS_PUSHBUTTON, 20, 400, 110, 28, hwnd, (HMENU)IDC_BTN_UNIT_FROM_KEYPAD, NULL, NULL));
+    AddUnitCtrl(CreateWindowW(L"BUTTON", L"To keypad", WS_CHILD|BS_PUSHBUTTON, 450, 400, 110, 28, hwnd, (HMENU)IDC_BTN_UNIT_TO_KEYPAD, NULL, NULL));
+    AddUnitCtrl(CreateWindowW(L"BUTTON", L"To memory", WS_CHILD|BS_PUSHBUTTON, 570, 400, 110, 28, hwnd, (HMENU)IDC_BTN_UNIT_TO_MEMORY, NULL, NULL));
+    hUnitStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 438, 660, 20, hwnd, NULL, NULL, NULL);
+    AddUnitCtrl(hUnitStatus);
+}
+
+// Reads the numbers in an edit box, separated by spaces, tabs, new lines
+// or semicolons. A bad entry stops the read with "Not a number: ..." in error.
+static bool ReadNumberList(HWND edit, std::vector<double>* values, char* error, size_t errorSize) {
+    int wlen = GetWindowTextLengthW(edit);
+    std::vector<WCHAR> w((size_t)wlen + 1);
+    GetWindowTextW(edit, &w[0], wlen + 1);
+    std::vector<char> text((size_t)wlen + 1);
+    for (int i = 0; i <= wlen; i++) text[(size_t)i] = w[(size_t)i] < 128 ? (char)w[(size_t)i] : '?';
+
+    values->clear();
+    char* p = &text[0];
+    while (*p) {
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == ';') {
+            p++;
+            continue;
+        }
+        char* end;
+        double v = strtod(p, &end);
+        if (end == p || (*end && !strchr(" \t\r\n;", *end))) {
+            char* stop = p;
+            while (*stop && !strchr(" \t\r\n;", *stop)) stop++;
+            snprintf(error, errorSize, "Not a number: %.*s", (int)std::min<ptrdiff_t>(stop - p, 40), p);
+            return false;
+        }
+        values->push_back(v);
+        p = end;
+    }
+    return true;
+}
+
+// Converts every value in the input box
+static void ConvertUnits() {
+    int from = SelectedUnit(hUnitFrom), to = SelectedUnit(hUnitTo);
+    if (!UnitConvertible(from, to)) return;
+
+    std::vector<double> values;
+    char line[160];
+    if (!ReadNumberList(hUnitInput, &values, line, sizeof(line))) {
+        SetFinText(hUnitStatus, line);
+        SetWindowTextW(hUnitResult, L"");
+        g_unitValues.clear();
+        g_unitFirst[0] = '\0';
+        return;
+    }
+
+    LARGE_INTEGER t0, t1, freq;
+    QueryPerformanceCounter(&t0);
+    UnitConvertBatch(from, to, values.empty() ? NULL : &values[0], values.empty() ? NULL : &values[0], values.size());
+    QueryPerformanceCounter(&t1);
+    QueryPerformanceFrequency(&freq);
+    g_unitValues.swap(values);
+
+    std::string result;
+    for (size_t i = 0; i < g_unitValues.size() && i < UNIT_SHOW_MAX; i++) {
+        snprintf(line, sizeof(line), "%.15g %s\r\n", g_unitValues[i], kUnits[to].symbol);
+        result += line;
+    }
+    if (g_unitValues.size() > UNIT_SHOW_MAX) {
+        snprintf(line, sizeof(line), "... %zu more\r\n", g_unitValues.size() - UNIT_SHOW_MAX);
+        result += line;
+    }
+    SetMatText(hUnitResult, result);
+    if (g_unitValues.empty()) g_unitFirst[0] = '\0';
+    else snprintf(g_unitFirst, sizeof(g_unitFirst), "%.15g", g_unitValues[0]);
+
+    // The transform itself, then the batch size and time for lists
+    const UnitAffine& t = kUnitTable.pair[from][to];
+    int len;
+    if (t.offset == 0) {
+        len = snprintf(line, sizeof(line), "1 %s = %.15g %s", kUnits[from].symbol, t.scale, kUnits[to].symbol);
+    } else {
+        len = snprintf(line, sizeof(line), "%s = %s × %.10g %s %.10g", kUnits[to].symbol, kUnits[from].symbol, t.scale,
+            t.offset < 0 ? "−" : "+", fabs(t.offset));
+    }
+    if (g_unitValues.size() > 1) {
+        double us = (double)(t1.QuadPart - t0.QuadPart) * 1e6 / (double)freq.QuadPart;
+        snprintf(line + len, sizeof(line) - (size_t)len, "    %zu values in %.1f µs", g_unitValues.size(), us);
+    }
+    WCHAR wline[160];
+    MultiByteToWideChar(CP_UTF8, 0, line, -1, wline, 160);
+    SetWindowTextW(hUnitStatus, wline);
+}
+
+static void SwapUnits() {
+    int from = SelectedUnit(hUnitFrom), to = SelectedUnit(hUnitTo);
+    SelectUnit(hUnitFrom, to);
+    SelectUnit(hUnitTo, from);
+    ConvertUnits();
+}
+
+static void UnitsFromKeypad() {
+    if (g_engine.IsErrorDisplay()) return;
+    SetFinText(hUnitInput, g_state.displayText);
+    ConvertUnits();
+}
+
+// The first result becomes the keypad entry, as a recalled history value does
+static void UnitsToKeypad() {
+    if (!g_unitFirst[0]) return;
+    RecordInput(SES_TAB, TAB_CALC);
+    TabCtrl_SetCurSel(hTab, TAB_CALC);
+    SwitchTab(TAB_CALC);
+    RecordInput(SES_RECALL, 0, 0, g_unitFirst);
+    RecallValue(g_unitFirst);
+}
+
+// Stores the first result with MS, so MR and M+ work on it in any number
+// mode; the keypad shows it as MS leaves it
+static void UnitsToMemory() {
+    if (!g_unitFirst[0]) return;
+    RecordInput(SES_RECALL, 0, 0, g_unitFirst);
+    RecallValue(g_unitFirst);
+    RecordInput(SES_BUTTON, BTN_MS);
+    g_engine.HandleButton(BTN_MS);
+    char line[96];
+    snprintf(line, sizeof(line), "Stored %s in memory", g_unitFirst);
+    SetFinText(hUnitStatus, line);
+}
+
+// "calc.exe /bench-units": converts a large array through every pair of
+// units with a loop of UnitConvert calls and with the batch kernel,
+// checking that the two agree bit for bit and that a round trip comes back
+static int RunUnitBenchmark() {
+    const size_t kCount = 1 << 20;
+    std::vector<double> in(kCount), one(kCount), batch(kCount), back(kCount);
+    for (size_t i = 0; i < kCount; i++) in[i] = ((double)(i * 2654435761u % 1000003) - 500000.0) / 37.0;
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    double oneSec = 0, batchSec = 0, worstTrip = 0;
+    int pairs = 0;
+    bool same = true;
+    for (int from = 0; from < UNIT_COUNT; from++) {
+        for (int to = 0; to < UNIT_COUNT; to++) {
+            if (!UnitConvertible(from, to)) continue;
+            pairs++;
+            QueryPerformanceCounter(&t0);
+            for (size_t i = 0; i < kCount; i++) one[i] = UnitConvert(from, to, in[i]);
+            QueryPerformanceCounter(&t1);
+            oneSec += (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+
+            QueryPerformanceCounter(&t0);
+            UnitConvertBatch(from, to, &in[0], &batch[0], kCount);
+            QueryPerformanceCounter(&t1);
+            batchSec += (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+
+            same = same && memcmp(&one[0], &batch[0], kCount * sizeof(double)) == 0;
+            UnitConvertBatch(to, from, &batch[0], &back[0], kCount);
+            for (size_t i = 0; i < kCount; i += 64) {
+                // Relative to the value, or to the offset where it cancels
+                double scale = std::max(fabs(in[i]), fabs(kUnitTable.pair[from][to].offset) + 1);
+                worstTrip = std::max(worstTrip, fabs(back[i] - in[i]) / scale);
+            }
+        }
+    }
+    double values = (double)kCount * pairs;
+    bool ok = same && worstTrip < 1e-13;
+    WCHAR buf[512];
+    StringCchPrintfW(buf, 512,
+        L"%d unit pairs, %zu values each\n\n"
+        L"Scalar loop:\t%.0f M values/s\n"
+        L"Batch kernel:\t%.0f M values/s (%.1fx)\n\n"
+        L"Batch and single results %s\nWorst round trip error: %.2g\n%s",
+        pairs, kCount, values / oneSec / 1e6, values / batchSec / 1e6, oneSec / batchSec,
+        same ? L"identical" : L"DIFFER", worstTrip, ok ? L"All conversions check" : L"CONVERSION CHECK FAILED");
+    MessageBoxW(NULL, buf, L"Unit conversion benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// --- Registers UI ---
+// A file of named memory slots (calc_registers.h) beside the keypad's own
+// M keys. MS, M+ and M- take the keypad's value in its current mode and
+// MR recalls a slot onto the keypad; a column of values (typed, pasted or
+// the last unit conversion) adds into a slot in one pass. The slots are
+// restored at startup and saved when the window closes.
+static HWND hRegCtrls[20];
+static int hRegCount = 0;
+static HWND hRegList, hRegSlot, hRegName, hRegColumn, hRegStatus;
+
+static CalcRegisterFile g_regs;
+static int g_regSel = 0;
+static bool g_regsDirty = false;
+
+void AddRegCtrl(HWND h) { if (hRegCount < 20) hRegCtrls[hRegCount++] = h; }
+
+// %LOCALAPPDATA%\calc_win7\registers.bin, creating the folder if asked
+static bool RegisterFilePath(WCHAR* path, size_t size, bool create) {
+    WCHAR dir[MAX_PATH];
+    DWORD len = GetEnvironmentVariableW(L"LOCALAPPDATA", dir, MAX_PATH);
+    if (len == 0 || len >= MAX_PATH) return false;
+    StringCchCatW(dir, MAX_PATH, L"\\calc_win7");
+    if (create) CreateDirectoryW(dir, NULL);
+    StringCchPrintfW(path, size, L"%s\\registers.bin", dir);
+    return true;
+}
+
+static void LoadRegisters() {
+    g_regs.Reset();
+    WCHAR path[MAX_PATH];
+    if (!RegisterFilePath(path, MAX_PATH, false)) return;
+    FILE* f = _wfopen(path, L"rb");
+    if (!f) return;
+    g_regs.Load(f);
+    fclose(f);
+}
+
+// Writes a temporary file and renames it over the old one, so a failed
+// save never leaves half a file behind
+static void SaveRegisters() {
+    if (!g_regsDirty) return;
+    WCHAR path[MAX_PATH], temp[MAX_PATH];
+    if (!RegisterFilePath(path, MAX_PATH, true)) return;
+    StringCchPrintfW(temp, MAX_PATH, L"%s.tmp", path);
+    FILE* f = _wfopen(temp, L"wb");
+    if (!f) return;
+    bool ok = g_regs.Save(f);
+    ok = fclose(f) == 0 && ok;
+    if (ok && MoveFileExW(temp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) g_regsDirty = false;
+    else DeleteFileW(temp);
+}
+
+static void FillRegisterItem(NMLVDISPINFOW* info) {
+    if (!(info->item.mask & LVIF_TEXT)) return;
+    int k = info->item.iItem;
+    if (!CalcRegisterFile::Valid(k)) return;
+    char text[64];
+    text[0] = '\0';
+    if (info->item.iSubItem == 0) snprintf(text, sizeof(text), "R%d", k);
+    else if (info->item.iSubItem == 1) snprintf(text, sizeof(text), "%s", g_regs.name[k]);
+    else if (g_regs.used[k]) DDFormat(g_regs.Get(k), text, sizeof(text));
+    MultiByteToWideChar(CP_UTF8, 0, text, -1, info->item.pszText, info->item.cchTextMax);
+}
+
+static void RefreshRegister(int k) {
+    g_regsDirty = true;
+    ListView_RedrawItems(hRegList, k, k);
+}
+
+static void SelectRegister(int k) {
+    if (!CalcRegisterFile::Valid(k)) return;
+    g_regSel = k;
+    char text[32];
+    snprintf(text, sizeof(text), "R%d", k);
+    SetFinText(hRegSlot, text);
+    SetMatText(hRegName, g_regs.name[k]);
+}
+
+void CreateRegistersUI(HWND hwnd) {
+    LoadRegisters();
+
+    // Owner-data list over all the slots
+    hRegList = CreateWindowW(WC_LISTVIEW, L"", WS_CHILD|WS_BORDER|LVS_REPORT|LVS_OWNERDATA|LVS_SHOWSELALWAYS|LVS_SINGLESEL,
+        20, 45, 400, 365, hwnd, (HMENU)IDC_REG_LIST, NULL, NULL);
+    ListView_SetExtendedListViewStyle(hRegList, LVS_EX_FULLROWSELECT);
+    AddRegCtrl(hRegList);
+    LVCOLUMNW col = {0};
+    col.mask = LVCF_TEXT | LVCF_WIDTH;
+    static const WCHAR* names[] = {L"#", L"Name", L"Value"};
+    static const int widths[] = {45, 110, 220};
+    for (int i = 0; i < 3; i++) {
+        col.cx = widths[i];
+        col.pszText = (LPWSTR)names[i];
+        ListView_InsertColumn(hRegList, i, &col);
+    }
+    ListView_SetItemCountEx(hRegList, REG_COUNT, LVSICF_NOINVALIDATEALL);
+
+    AddRegCtrl(CreateWindowW(L"STATIC", L"Slot:", WS_CHILD|SS_CENTERIMAGE, 435, 45, 45, 25, hwnd, NULL, NULL, NULL));
+    hRegSlot = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_CENTERIMAGE, 485, 45, 60, 25, hwnd, NULL, NULL, NULL);
+    AddRegCtrl(hRegSlot);
+    AddRegCtrl(CreateWindowW(L"STATIC", L"Name:", WS_CHILD|SS_CENTERIMAGE, 435, 77, 45, 25, hwnd, NULL, NULL, NULL));
+    hRegName = CreateWindowW(L"EDIT", L"", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 485, 77, 115, 25, hwnd, (HMENU)IDC_REG_NAME, NULL, NULL);
+    SendMessage(hRegName, EM_LIMITTEXT, REG_NAME_LEN - 1, 0);
+    AddRegCtrl(hRegName);
+    AddRegCtrl(CreateWindowW(L"BUTTON", L"Rename", WS_CHILD|BS_PUSHBUTTON, 605, 76, 75, 27, hwnd, (HMENU)IDC_BTN_REG_RENAME, NULL, NULL));
+
+    // The keypad's memory keys, on the selected slot
+    static const WCHAR* keys[] = {L"MC", L"MR", L"MS", L"M+", L"M-"};
+    for (int i = 0; i < 5; i++) {
+        AddRegCtrl(CreateWindowW(L"BUTTON", keys[i], WS_CHILD|BS_PUSHBUTTON, 435 + i * 49, 112, 45, 30, hwnd,
+            (HMENU)(INT_PTR)(IDC_BTN_REG_MC + i), NULL, NULL));
+    }
+    AddRegCtrl(CreateWindowW(L"BUTTON", L"Clear all", WS_CHILD|BS_PUSHBUTTON, 580, 148, 100, 27, hwnd, (HMENU)IDC_BTN_REG_CLEAR_ALL, NULL, NULL));
+
+    AddRegCtrl(CreateWindowW(L"STATIC", L"Column of values:", WS_CHILD|SS_LEFT, 435, 185, 245, 20, hwnd, NULL, NULL, NULL));
+    hRegColumn = CreateWindowW(L"EDIT", L"", WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_WANTRETURN,
+        435, 207, 245, 135, hwnd, (HMENU)IDC_REG_COLUMN, NULL, NULL);
+    SendMessage(hRegColumn, EM_LIMITTEXT, 0, 0);
+    AddRegCtrl(hRegColumn);
+    AddRegCtrl(CreateWindowW(L"BUTTON", L"Add to slot", WS_CHILD|BS_PUSHBUTTON, 435, 348, 120, 28, hwnd, (HMENU)IDC_BTN_REG_ADD_COLUMN, NULL, NULL));
+    AddRegCtrl(CreateWindowW(L"BUTTON", L"Subtract", WS_CHILD|BS_PUSHBUTTON, 560, 348, 120, 28, hwnd, (HMENU)IDC_BTN_REG_SUB_COLUMN, NULL, NULL));
+    AddRegCtrl(CreateWindowW(L"BUTTON", L"Add unit results", WS_CHILD|BS_PUSHBUTTON, 435, 382, 245, 28, hwnd, (HMENU)IDC_BTN_REG_ADD_UNITS, NULL, NULL));
+
+    hRegStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 420, 660, 20, hwnd, NULL, NULL, NULL);
+    AddRegCtrl(hRegStatus);
+
+    ListView_SetItemState(hRegList, 0, LVIS_SELECTED | LVIS_FOCUSED, LVIS_SELECTED | LVIS_FOCUSED);
+    SelectRegister(0);
+}
+
+// MC, MR, MS, M+ and M- on the selected slot. MR goes through the keypad
+// like a recalled history value, so a recorded session replays it.
+static void RegisterKey(int id) {
+    int k = g_regSel;
+    char text[96], line[160];
+    if (id == IDC_BTN_REG_MC) {
+        g_regs.value[k] = 0;
+        g_regs.comp[k] = 0;
+        g_regs.used[k] = g_regs.name[k][0] != '\0';
+        RefreshRegister(k);
+        snprintf(line, sizeof(line), "Cleared R%d", k);
+        SetFinText(hRegStatus, line);
+        return;
+    }
+    if (id == IDC_BTN_REG_MR) {
+        if (!g_regs.used[k]) {
+            snprintf(line, sizeof(line), "R%d is empty", k);
+            SetFinText(hRegStatus, line);
+            return;
+        }
+        g_engine.FormatForEntry(g_regs.Get(k), text, sizeof(text));
+        RecordInput(SES_TAB, TAB_CALC);
+        TabCtrl_SetCurSel(hTab, TAB_CALC);
+        SwitchTab(TAB_CALC);
+        RecordInput(SES_RECALL, 0, 0, text);
+        RecallValue(text);
+        return;
+    }
+    if (g_engine.IsErrorDisplay()) {
+        SetFinText(hRegStatus, "The keypad shows an error");
+        return;
+    }
+    DDouble v = g_engine.GetDisplayValueDD();
+    if (id == IDC_BTN_REG_MS) g_regs.Store(k, v);
+    else g_regs.Add(k, id == IDC_BTN_REG_MPLUS ? v : DDNeg(v));
+    RefreshRegister(k);
+    DDFormat(v, text, sizeof(text));
+    snprintf(line, sizeof(line), "%s %s R%d", id == IDC_BTN_REG_MS ? "Stored" : id == IDC_BTN_REG_MPLUS ? "Added" : "Subtracted",
+        text, k);
+    SetFinText(hRegStatus, line);
+}
+
+static void RenameRegister() {
+    int len = GetWindowTextLengthW(hRegName);
+    std::vector<WCHAR> w((size_t)len + 1);
+    GetWindowTextW(hRegName, &w[0], len + 1);
+    char name[64];
+    if (!WideCharToMultiByte(CP_UTF8, 0, &w[0], -1, name, sizeof(name), NULL, NULL)) name[0] = '\0';
+    g_regs.name[g_regSel][0] = '\0';
+    g_regs.SetName(g_regSel, name);
+    RefreshRegister(g_regSel);
+}
+
+static void ClearRegisters() {
+    if (MessageBoxW(GetParent(hRegList), L"Clear every register and its name?", L"Registers", MB_OKCANCEL | MB_ICONQUESTION) != IDOK) return;
+    g_regs.Reset();
+    g_regsDirty = true;
+    InvalidateRect(hRegList, NULL, FALSE);
+    SelectRegister(g_regSel);
+    SetFinText(hRegStatus, "Cleared all registers");
+}
+
+// Adds a whole column into the selected slot; the status shows the kernel's
+// own time apart from parsing
+static void AddValuesToRegister(const std::vector<double>& values, bool subtract, const char* what) {
+    int k = g_regSel;
+    LARGE_INTEGER t0, t1, freq;
+    QueryPerformanceCounter(&t0);
+    g_regs.AddColumn(k, values.empty() ? NULL : &values[0], values.size(), subtract);
+    QueryPerformanceCounter(&t1);
+    QueryPerformanceFrequency(&freq);
+    RefreshRegister(k);
+    double us = (double)(t1.QuadPart - t0.QuadPart) * 1e6 / (double)freq.QuadPart;
+    char line[160];
+    snprintf(line, sizeof(line), "%s %zu %s %s R%d in %.1f us", subtract ? "Subtracted" : "Added", values.size(), what,
+        subtract ? "from" : "into", k, us);
+    SetFinText(hRegStatus, line);
+}
+
+static void AddColumnToRegister(bool subtract) {
+    std::vector<double> values;
+    char line[160];
+    if (!ReadNumberList(hRegColumn, &values, line, sizeof(line))) {
+        SetFinText(hRegStatus, line);
+        return;
+    }
+    AddValuesToRegister(values, subtract, "values");
+}
+
+static void AddUnitsToRegister() {
+    if (g_unitValues.empty()) {
+        SetFinText(hRegStatus, "No unit conversion results to add");
+        return;
+    }
+    AddValuesToRegister(g_unitValues, false, "unit results");
+}
+
+// "calc.exe /bench-registers": adds a large column into a slot with the
+// lane kernel and with a plain summing loop, on a column whose terms
+// cancel so the plain sum goes wrong, then round-trips the register file
+// through a temporary file
+static int RunRegisterBenchmark() {
+    const size_t kCount = 1 << 24;
+    const int kRuns = 8;
+    std::vector<double> column(kCount);
+    uint64_t seed = 88172645463325252ULL;
+    for (size_t i = 0; i < kCount; i += 2) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        double big = (double)(seed >> 11) / 9007199254740992.0 * 1e16;
+        double small = (double)(seed & 0x7ff) / 2048.0;
+        column[i] = big;
+        column[i + 1] = small - big;
+    }
+    // Double-double accumulation is far more precise than either sum tested
+    DDouble truth;
+    for (size_t i = 0; i < kCount; i++) truth = DDAdd(truth, DDouble(column[i]));
+
+    CalcRegisterFile* regs = new CalcRegisterFile;
+    regs->Reset();
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    double laneSec = 1e30, plainSec = 1e30, plain = 0;
+    for (int run = 0; run < kRuns; run++) {
+        regs->Clear(1);
+        QueryPerformanceCounter(&t0);
+        regs->AddColumn(1, &column[0], kCount);
+        QueryPerformanceCounter(&t1);
+        laneSec = std::min(laneSec, (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart);
+
+        volatile double sink;
+        QueryPerformanceCounter(&t0);
+        double sum = 0;
+        for (size_t i = 0; i < kCount; i++) sum += column[i];
+        sink = sum;
+        QueryPerformanceCounter(&t1);
+        plainSec = std::min(plainSec, (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart);
+        plain = sink;
+    }
+    double lane = DDToDouble(regs->Get(1));
+    double want = DDToDouble(truth);
+    double laneErr = fabs(lane - want) / fabs(want), plainErr = fabs(plain - want) / fabs(want);
+
+    // Subtracting the column again must come back to (almost) nothing
+    regs->AddColumn(1, &column[0], kCount, true);
+    double residue = DDToDouble(regs->Get(1));
+    bool zero = fabs(residue) <= 1e-15 * fabs(want);
+
+    // Save, reload and compare the whole image
+    for (int k = 0; k < REG_COUNT; k++) regs->Store(k, DDouble((double)k / 3, (double)k * 1e-20));
+    regs->SetName(7, "total");
+    bool trip = false;
+    WCHAR dir[MAX_PATH], path[MAX_PATH];
+    if (GetTempPathW(MAX_PATH, dir) && GetTempFileNameW(dir, L"reg", 0, path)) {
+        FILE* f = _wfopen(path, L"wb");
+        bool saved = f && regs->Save(f);
+        if (f) fclose(f);
+        CalcRegisterFile* back = new CalcRegisterFile;
+        f = saved ? _wfopen(path, L"rb") : NULL;
+        trip = f && back->Load(f) && memcmp(back, regs, sizeof(*regs)) == 0;
+        if (f) fclose(f);
+        delete back;
+        DeleteFileW(path);
+    }
+    delete regs;
+
+    double bytes = (double)kCount * sizeof(double);
+    bool ok = laneErr < 1e-15 && zero && trip;
+    WCHAR buf[512];
+    StringCchPrintfW(buf, 512,
+        L"%zu values (%.0f MB) into one register\n\n"
+        L"Plain sum:\t%.1f GB/s, relative error %.2g\n"
+        L"Compensated:\t%.1f GB/s, relative error %.2g\n\n"
+        L"Subtracting it again leaves %.2g\nSave and reload: %s\n%s",
+        kCount, bytes / 1e6, bytes / plainSec / 1e9, plainErr, bytes / laneSec / 1e9, laneErr,
+        residue, trip ? L"identical" : L"FAILED", ok ? L"All register checks pass" : L"REGISTER CHECK FAILED");
+    MessageBoxW(NULL, buf, L"Register benchmark", MB_OK | (ok ? MB_ICONINFORMATION : MB_ICONERROR));
+    return ok ? 0 : 1;
+}
+
+// --- Complex UI ---
+// Batch complex arithmetic (calc_complex.h): a list of values, each taken
+// through one operation (with the operand b for + - × ÷), converted as a
+// whole array by the batch kernels. Values may be typed as a+bi or r∠θ;
+// results show either way.
+static HWND hCplxCtrls[20];
+static int hCplxCount = 0;
+static HWND hCplxOp, hCplxOperand, hCplxPolar, hCplxInput, hCplxResult, hCplxStatus;
+
+#define CPLX_SHOW_MAX 1000  // Values listed in the result box
+
+// The first result of the last run, as keypad text
+static char g_cplxFirst[96] = "";
+
+static const WCHAR* kCplxOpNames[] = {
+    L"a + b", L"a − b", L"a × b", L"a ÷ b",
+    L"|a|", L"arg a (degrees)", L"√a", L"exp a", L"ln a"};
+
+void AddCplxCtrl(HWND h) { if (hCplxCount < 20) hCplxCtrls[hCplxCount++] = h; }
+
+// An edit box's text as ASCII, with ∠ as '<' so it reads as polar
+static std::vector<char> ReadComplexText(HWND edit) {
+    int wlen = GetWindowTextLengthW(edit);
+    std::vector<WCHAR> w((size_t)wlen + 1);
+    GetWindowTextW(edit, &w[0], wlen + 1);
+    std::vector<char> text((size_t)wlen + 1);
+    for (int i = 0; i <= wlen; i++) {
+        WCHAR c = w[(size_t)i];
+        text[(size_t)i] = c == L'\u2220' ? '<' : c < 128 ? (char)c : '?';
+    }
+    return text;
+}
+
+void CreateComplexUI(HWND hwnd) {
+    AddCplxCtrl(CreateWindowW(L"STATIC", L"Operation:", WS_CHILD|SS_CENTERIMAGE, 20, 45, 75, 25, hwnd, NULL, NULL, NULL));
+    hCplxOp = CreateWindowW(L"COMBOBOX", L"", WS_CHILD|CBS_DROPDOWNLIST|WS_VSCROLL, 100, 45, 170, 250, hwnd, (HMENU)IDC_CPLX_OP, NULL, NULL);
+    AddCplxCtrl(hCplxOp);
+    for (int i = 0; i < CPLX_OP_COUNT; i++) SendMessage(hCplxOp, CB_ADDSTRING, 0, (LPARAM)kCplxOpNames[i]);
+    SendMessage(hCplxOp, CB_SETCURSEL, CPLX_MUL, 0);
+
+    AddCplxCtrl(CreateWindowW(L"STATIC", L"b:", WS_CHILD|SS_CENTERIMAGE, 290, 45, 20, 25, hwnd, NULL, NULL, NULL));
+    hCplxOperand = CreateWindowW(L"EDIT", L"1+i", WS_CHILD|WS_BORDER|ES_AUTOHSCROLL, 315, 45, 180, 25, hwnd, (HMENU)IDC_CPLX_OPERAND, NULL, NULL);
+    AddCplxCtrl(hCplxOperand);
+    hCplxPolar = CreateWindowW(L"BUTTON", L"Results as r∠θ", WS_CHILD|BS_AUTOCHECKBOX, 515, 45, 165, 25, hwnd, (HMENU)IDC_CPLX_POLAR, NULL, NULL);
+    AddCplxCtrl(hCplxPolar);
+
+    AddCplxCtrl(CreateWindowW(L"STATIC", L"Values a (a+bi or r∠θ), one per line:", WS_CHILD|SS_LEFT, 20, 85, 325, 20, hwnd, NULL, NULL, NULL));
+    hCplxInput = CreateWindowW(L"EDIT", L"3+4i", WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_WANTRETURN,
+        20, 107, 325, 285, hwnd, (HMENU)IDC_CPLX_INPUT, NULL, NULL);
+    SendMessage(hCplxInput, EM_LIMITTEXT, 0, 0);
+    AddCplxCtrl(hCplxInput);
+    AddCplxCtrl(CreateWindowW(L"STATIC", L"Results:", WS_CHILD|SS_LEFT, 355, 85, 325, 20, hwnd, NULL, NULL, NULL));
+    hCplxResult = CreateWindowW(L"EDIT", L"", WS_CHILD|WS_BORDER|WS_VSCROLL|ES_MULTILINE|ES_AUTOVSCROLL|ES_READONLY,
+        355, 107, 325, 285, hwnd, (HMENU)IDC_CPLX_RESULT, NULL, NULL);
+    AddCplxCtrl(hCplxResult);
+
+    AddCplxCtrl(CreateWindowW(L"BUTTON", L"From keypad", WS_CHILD|BS_PUSHBUTTON, 20, 400, 110, 28, hwnd, (HMENU)IDC_BTN_CPLX_FROM_KEYPAD, NULL, NULL));
+    AddCplxCtrl(CreateWindowW(L"BUTTON", L"To keypad", WS_CHILD|BS_PUSHBUTTON, 570, 400, 110, 28, hwnd, (HMENU)IDC_BTN_CPLX_TO_KEYPAD, NULL, NULL));
+    hCplxStatus = CreateWindowW(L"STATIC", L"", WS_CHILD|SS_LEFT, 20, 438, 660, 20, hwnd, NULL, NULL, NULL);
+    AddCplxCtrl(hCplxStatus);
+}
+
+static void CplxError(const char* message) {
+    SetFinText(hCplxStatus, message);
+    SetWindowTextW(hCplxResult, L"");
+    g_cplxFirst[0] = '\0';
+}
+
+// Runs the chosen operation over every value in the input box. Values are
+// separated by new lines or semicolons.
+static void RunComplexBatch() {
+    int op = (int)SendMessage(hCplxOp, CB_GETCURSEL, 0, 0);
+    if (op < 0 || op >= CPLX_OP_COUNT) return;
+    bool polar = SendMessage(hCplxPolar, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    char line[160];
+
+    Complex b;
+    if (CBatchBinary(op)) {
+        std::vector<char> text = ReadComplexText(hCplxOperand);
+        if (!CParse(&text[0], &b)) {
+            CplxError("b is not a complex number");
+            return;
+        }
+        if (op == CPLX_DIV && b.IsZero()) {
+            CplxError("Division by zero");
+            return;
+        }
+    }
+
+    std::vector<char> text = ReadComplexText(hCplxInput);
+    std::vector<double> values;
+    for (char* p = &text[0]; *p; ) {
+        char* stop = p;
+        while (*stop && *stop != '\r' && *stop != '\n' && *stop != ';') stop++;
+        char save = *stop;
+        *stop = '\0';
+        Complex a;
+        bool blank = strspn(p, " \t") == strlen(p);
+        if (!blank && !CParse(p, &a)) {
+            snprintf(line, sizeof(line), "Not a complex number: %.40s", p);
+            CplxError(line);
+            return;
+        }
+        if (!blank) {
+            values.push_back(a.re);
+            values.push_back(a.im);
+        }
+        *stop = save;
+        p = *stop ? stop + 1 : stop;
+    }
+    size_t n = values.size() / 2;
+    double bv[2] = {b.re, b.im};
+
+    LARGE_INTEGER t0, t1, freq;
+    QueryPerformanceCounter(&t0);
+    CBatch(op, n ? &values[0] : NULL, bv, 0, n ? &values[0] : NULL, n);
+    QueryPerformanceCounter(&t1);
+    QueryPerformanceFrequency(&freq);
+
+    // Magnitude and phase are real; the rest show in the chosen form
+    bool real = op == CPLX_ABS || op == CPLX_ARG;
+    std::string result;
+    for (size_t i = 0; i < n && i < CPLX_SHOW_MAX; i++) {
+        Complex z(values[2 * i], values[2 * i + 1]);
+        CFormat(z, polar && !real, line, sizeof(line));
+        for (char* c = line; *c; c++) {
+            if (*c == '<') {
+                result += "\xe2\x88\xa0"; // ∠
+                continue;
+            }
+            result += *c;
+        }
+        result += "\r\n";
+    }
+    if (n > CPLX_SHOW_MAX) {
+        snprintf(line, sizeof(line), "... %zu more\r\n", n - CPLX_SHOW_MAX);
+        result += line;
+    }
+    SetMatText(hCplxResult, result);
+    if (n) CFormat(Complex(values[0], values[1]), false, g_cplxFirst, sizeof(g_cplxFirst));
+    else g_cplxFirst[0] = '\0';
+
+    double us = (double)(t1.QuadPart - t0.QuadPart) * 1e6 / (double)freq.QuadPart;
+    snprintf(line, sizeof(line), "%zu values in %.1f us", n, us);
+    SetFinText(hCplxStatus, line);
+}
+
+static void ComplexFromKeypad() {
+    if (g_engine.IsErrorDisplay()) return;
+    SetFinText(hCplxInput, g_state.displayText);
+    RunComplexBatch();
+}
+
+// The first result becomes the keypad entry, in complex mode
+static void ComplexToKeypad() {
+    if (!g_cplxFirst[0]) return;
+    RecordInput(SES_TAB, TAB_CALC);
+    TabCtrl_SetCurSel(hTab, TAB_CALC);
+    SwitchTab(TAB_CALC);
+    if (g_state.numMode != NUM_COMPLEX) {
+        RecordInput(SES_NUMMODE, NUM_COMPLEX);
+        SendMessage(hNumModeCombo, CB_SETCURSEL, NUM_COMPLEX, 0);
+        g_engine.SetNumberMode(NUM_COMPLEX);
+        ShowComplexKeys();
+    }
+    RecordInput(SES_RECALL, 0, 0, g_cplxFirst);
+    RecallValue(g_cplxFirst);
+}
+
+// "calc.exe /bench-complex": runs each kernel over a cache-sized array with
+// the one-at-a-time loop and with the batch kernel and checks they agree
+// bit for bit, then times keypad keys in double and complex mode
+static int RunComplexBenchmark() {
+    const size_t kCount = 4096;   // Complex values; a, b and out fit in L2
+    const int kRuns = 2000;
+    std::vector<double> a(2 * kCount), b(2 * kCount), one(2 * kCount), batch(2 * kCount);
+    for (size_t i = 0; i < 2 * kCount; i++) {
+        a[i] = ((double)(i * 2654435761u % 1000003) - 500000.0) / 37.0;
+        b[i] = ((double)(i * 40503u % 65521) - 32760.0) / 11.0;
+    }
+    a[6] = 1e300;                // Takes the scaled path
+    b[8] = b[9] = 0;             // Zero divisor
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    static const int kOps[] = {CPLX_ADD, CPLX_MUL, CPLX_DIV, CPLX_ABS, CPLX_SQRT};
+    static const WCHAR* kNames[] = {L"a + b", L"a × b", L"a ÷ b", L"|a|", L"√a"};
+    WCHAR report[1024] = L"";
+    bool same = true;
+    double sink = 0;
+    for (int k = 0; k < 5; k++) {
+        int op = kOps[k];
+        QueryPerformanceCounter(&t0);
+        for (int run = 0; run < kRuns; run++) {
+            CBatchScalar(op, &a[0], &b[0], 1, &one[0], 0, kCount);
+            sink += one[(size_t)run % kCount];
+        }
+        QueryPerformanceCounter(&t1);
+        double oneSec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+        QueryPerformanceCounter(&t0);
+        for (int run = 0; run < kRuns; run++) {
+            CBatch(op, &a[0], &b[0], 1, &batch[0], kCount);
+            sink += batch[(size_t)run % kCount];
+        }
+        QueryPerformanceCounter(&t1);
+        double batchSec = (double)(t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+        bool agree = memcmp(&one[0], &batch[0], 2 * kCount * sizeof(double)) == 0;
+        same = same && agree;
+
+        double values = (double)kCount * kRuns;
+        WCHAR line[160];
+        StringCchPrintfW(line, 160, L"%s\tscalar %.0f M/s\tbatch %.0f M/s (%.1fx)%s\n", kNames[k],
+            values / oneSec / 1e6, values / batchSec / 1e6, oneSec / batchSec, agree ? L"" : L"  DIFFER");
+        StringCchCatW(report, 1024, line);
+    }
+
+    // Keypad latency: the same keys in double mode and (with i) complex mode
+    double perKey[2];
+    for (int m = 0; m < 2; m++) {
+        CalcEngine engine;
+        engine.recordHistory = false;
+        engine.SetNumberMode(m ? NUM_COMPLEX : NUM_DOUBLE);
+        static const int kKeys[] = {BTN_3, BTN_DOT, BTN_5, BTN_I, BTN_4, BTN_MUL, BTN_1, BTN_2, BTN_DIV, BTN_7,
+                                    BTN_EQUAL, BTN_SQRT, BTN_ADD, BTN_9, BTN_EQUAL, BTN_C};
+        const int kKeyRuns = 200000, nKeys = sizeof(kKeys) / sizeof(kKeys[0]);
+        QueryPerformanceCounter(&t0);
+        for (int run = 0; run < kKeyRuns; run++) {
+            for (int i = 0; i < nKeys; i++) engine.HandleButton(kKeys[i]);
+        }
+        QueryPerformanceCounter(&t1);
+        perKey[m] = (double)(t1.QuadPart - t0.QuadPart) * 1e9 / (double)freq.QuadPart / ((double)kKeyRuns * nKeys);
+        sink += engine.GetDisplayNumber();
+    }
+
+    WCHAR buf[1400];
+    StringCchPrintfW(buf, 1400,
+        L"%zu complex values x %d runs\n\n%s\n"
+        L"Keypad: %.0f ns/key in double mode, %.0f ns/key in complex mode\n\n"
+        L"Batch and single results %s%s",
+        kCount, kRuns, report, perKey[0], perKey[1],
+        same ? L"identical" : L"DIFFER", sink == 12345.678 ? L" " : L"");
+    MessageBoxW(NULL, buf, L"Complex benchmark", MB_OK | (same ? MB_ICONINFORMATION : MB_ICONERROR));
+    return same ? 0 : 1;
+}
+
+void SwitchTab(int tab) {
+    g_curTab = tab;
+    
+    // 1. Calculator Controls
+    int showCalc = (tab == TAB_CALC) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hCalcCount; i++) ShowWindow(hCalcControls[i], showCalc);
+    ShowComplexKeys();
+
+    // 2. Calendar Controls
+    int showCal = (tab == TAB_CALENDAR) ? SW_SHOW : SW_HIDE;
+    ShowWindow(g_calState.hMonthCal, showCal);
+    ShowWindow(g_calState.hInfoLabel, showCal);
+    ShowWindow(g_calState.hLunarLabel, showCal);
+    ShowWindow(g_calState.hBtnToday, showCal);
+
+    // 3. Date Calc Controls
+    int showDate = (tab == TAB_DATECALC) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hDateCount; i++) ShowWindow(hDateCtrls[i], showDate);
+
+    // 4. Sweep Controls
+    int showSweep = (tab == TAB_SWEEP) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hSweepCount; i++) ShowWindow(hSweepCtrls[i], showSweep);
+
+    // 5. Finance Controls
+    int showFin = (tab == TAB_FINANCE) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hFinCount; i++) ShowWindow(hFinCtrls[i], showFin);
+
+    // 6. Graph Controls
+    int showGraph = (tab == TAB_GRAPH) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hGraphCount; i++) ShowWindow(hGraphCtrls[i], showGraph);
+    if (tab == TAB_GRAPH) {
+        if (g_plotReady) RenderPlot();
+        else PlotExpression();
+    }
+
+    // 7. Matrix Controls
+    int showMat = (tab == TAB_MATRIX) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hMatCount; i++) ShowWindow(hMatCtrls[i], showMat);
+
+    // 8. Solve Controls
+    int showSolve = (tab == TAB_SOLVE) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hSolveCount; i++) ShowWindow(hSolveCtrls[i], showSolve);
+
+    // 9. Integer Controls
+    int showInt = (tab == TAB_INTEGER) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hIntCount; i++) ShowWindow(hIntCtrls[i], showInt);
+
+    // 10. Unit Controls
+    int showUnit = (tab == TAB_UNITS) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hUnitCount; i++) ShowWindow(hUnitCtrls[i], showUnit);
+
+    // 11. Register Controls
+    int showReg = (tab == TAB_REGISTERS) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hRegCount; i++) ShowWindow(hRegCtrls[i], showReg);
+
+    // 12. Complex Controls
+    int showCplx = (tab == TAB_COMPLEX) ? SW_SHOW : SW_HIDE;
+    for (int i = 0; i < hCplxCount; i++) ShowWindow(hCplxCtrls[i], showCplx);
+    if (tab == TAB_COMPLEX && !g_cplxFirst[0]) RunComplexBatch();
+
+    // Hidden controls invalidate only the area they uncover; no full repaint
+    g_comp.ShowWidget(IDC_DISPLAY, tab == TAB_CALC);
+}
+
+// Window procedure
+LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    switch (msg) {
+        case WM_CREATE: {
+            // Enable DWM
+            DWMNCRENDERINGPOLICY policy = DWMNCRP_ENABLED;
+            DwmSetWindowAttribute(hwnd, DWMWA_NCRENDERING_POLICY, &policy, sizeof(policy));
+            MARGINS margins = {0, 0, 30, 0};
+            DwmExtendFrameIntoClientArea(hwnd, &margins);
+            
+            InitFonts(); // Initialize fonts first
+            CreateTabControl(hwnd);
+            CreateCalculatorUI(hwnd);
+            CreateCalendarUI(hwnd);
+            CreateDateCalcUI(hwnd);
+            CreateSweepUI(hwnd);
+            CreateFinanceUI(hwnd);
+            CreateGraphUI(hwnd);
+            CreateMatrixUI(hwnd);
+            CreateSolveUI(hwnd);
+            CreateIntegerUI(hwnd);
+            CreateUnitsUI(hwnd);
+            CreateRegistersUI(hwnd);
+            CreateComplexUI(hwnd);
+            StartJobs(hwnd);
+
+            g_comp.SetGradient(CompRgb(232, 244, 252), CompRgb(196, 224, 240));
+            EnsureCompositor(hwnd);
+            
+            // Initial state: Show calc, hide others
+            SwitchTab(TAB_CALC);
+            return 0;
+        }
+        
+        case WM_NOTIFY: {
+            NMHDR* pnm = (NMHDR*)lParam;
+            if (pnm->idFrom == IDC_TAB && pnm->code == TCN_SELCHANGE) {
+                int tab = TabCtrl_GetCurSel(hTab);
+                RecordInput(SES_TAB, tab);
+                SwitchTab(tab);
+            }
+            else if (pnm->idFrom == IDC_MONTHCAL && (pnm->code == MCN_SELECT || pnm->code == MCN_SELCHANGE)) {
+                UpdateCalendarInfo();
+            }
+            else if (pnm->idFrom == IDC_MONTHCAL && pnm->code == MCN_GETDAYSTATE) {
+                FillCalendarDayState((NMDAYSTATE*)lParam);
+            }
+            else if (pnm->idFrom == IDC_LIST_SCHEDULE && pnm->code == LVN_GETDISPINFOW) {
+                FillScheduleItem((NMLVDISPINFOW*)lParam);
+            }
+            else if (pnm->idFrom == IDC_LIST_FIN && pnm->code == LVN_GETDISPINFOW) {
+                FillFinItem((NMLVDISPINFOW*)lParam);
+            }
+            else if (pnm->idFrom == IDC_REG_LIST && pnm->code == LVN_GETDISPINFOW) {
+                FillRegisterItem((NMLVDISPINFOW*)lParam);
+            }
+            else if (pnm->idFrom == IDC_REG_LIST && pnm->code == LVN_ITEMCHANGED) {
+                NMLISTVIEW* lv = (NMLISTVIEW*)lParam;
+                if ((lv->uNewState & LVIS_SELECTED) && !(lv->uOldState & LVIS_SELECTED)) SelectRegister(lv->iItem);
+            }
+            return 0;
+        }
+        
+        case WM_CTLCOLORSTATIC: {
+            HDC hdc = (HDC)wParam;
             HWND hCtl = (HWND)lParam;
+
+            // Read-only edits come here too. They scroll and select, so
+            // they paint opaque on a plain brush of their own.
+            WCHAR cls[16];
+            GetClassNameW(hCtl, cls, 16);
+            if (_wcsicmp(cls, L"Edit") == 0) {
+                SetBkMode(hdc, OPAQUE);
+                SetTextColor(hdc, GetSysColor(COLOR_WINDOWTEXT));
+                SetBkColor(hdc, GetSysColor(COLOR_WINDOW));
+                return (LRESULT)GetSysColorBrush(COLOR_WINDOW);
+            }
+
             SetBkMode(hdc, TRANSPARENT);
+            SetTextColor(hdc, RGB(50, 50, 50));
 
-            if (hCtl == hDisplay && IsErrorDisplay()) {
-                SetTextColor(hdc, RGB(200, 20, 20)); // Error 红色高亮
-            } else {
-                SetTextColor(hdc, RGB(50, 50, 50));
+            // Statics erase with their slice of the cached background, so a
+            // text change repaints just that control
+            if (g_backBrush) {
+                POINT pt = {0, 0};
+                MapWindowPoints(hCtl, hwnd, &pt, 1);
+                SetBrushOrgEx(hdc, -pt.x, -pt.y, NULL);
+                return (LRESULT)g_backBrush;
             }
             return (LRESULT)GetStockObject(NULL_BRUSH);
         }
@@ -961,6 +5148,15 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
         case WM_DRAWITEM: {
             LPDRAWITEMSTRUCT dis = (LPDRAWITEMSTRUCT)lParam;
             if (dis->CtlType == ODT_BUTTON) return TRUE;
+            if (dis->CtlType == ODT_STATIC && dis->CtlID == IDC_DISPLAY) {
+                // Only the display's rectangle is recomposed
+                EnsureCompositor(hwnd);
+                CompWidget* w = g_comp.FindWidget(IDC_DISPLAY);
+                if (!g_compDC || !w) return FALSE;
+                g_comp.InvalidateWidget(IDC_DISPLAY);
+                ComposeAndPresent(dis->hDC, w->rect.left, w->rect.top, DrawDisplayWidget);
+                return TRUE;
+            }
             return FALSE;
         }
         
@@ -969,24 +5165,48 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             int code = HIWORD(wParam);
             
             if (g_curTab == TAB_CALC) {
-                if (code == BN_CLICKED) HandleButton(id);
+                if (id == IDC_DISPLAY && code == STN_CLICKED) {
+                    // Clicking the display flips fraction/decimal in exact mode, a+bi/r∠θ in complex mode
+                    RecordInput(SES_TOGGLE);
+                    g_engine.ToggleFractionView();
+                    UpdateDisplay();
+                }
+                else if (id == IDC_COMBO_NUMMODE && code == CBN_SELCHANGE) {
+                    int mode = (int)SendMessage(hNumModeCombo, CB_GETCURSEL, 0, 0);
+                    RecordInput(SES_NUMMODE, mode);
+                    g_engine.SetNumberMode(mode);
+                    ShowComplexKeys();
+                    UpdateDisplay();
+                    SetFocus(hwnd); // Keep keyboard input on the main window
+                }
+                else if (code == BN_CLICKED) {
+                    RecordInput(SES_BUTTON, id);
+                    g_engine.HandleButton(id);
+                }
                 else if (id == IDC_LIST_HISTORY && code == LBN_DBLCLK) {
                     // Double click on history item to recall value
                     int idx = SendMessage(hHistoryList, LB_GETCURSEL, 0, 0);
-                    if (idx != LB_ERR) {
-                        WCHAR wtext[256];
-                        SendMessage(hHistoryList, LB_GETTEXT, idx, (LPARAM)wtext);
+                    int len = idx != LB_ERR ? (int)SendMessage(hHistoryList, LB_GETTEXTLEN, idx, 0) : LB_ERR;
+                    if (len != LB_ERR) {
+                        std::vector<WCHAR> line((size_t)len + 1);
+                        SendMessage(hHistoryList, LB_GETTEXT, idx, (LPARAM)&line[0]);
+                        WCHAR* wtext = &line[0];
                         // Parse result (after last '=')
                         WCHAR* res = wcsrchr(wtext, L'=');
                         if (res) {
                             res++; // Skip '='
                             while (*res == L' ') res++; // Skip spaces
-                            char buf[256];
-                            WideCharToMultiByte(CP_ACP, 0, res, -1, buf, sizeof(buf), NULL, NULL);
-                            strncpy(g_state.displayText, buf, sizeof(g_state.displayText)-1);
-                            g_state.displayText[sizeof(g_state.displayText)-1] = '\0';
-                            g_state.waitingForOperand = false;
-                            UpdateDisplay();
+                            for (WCHAR* p = res; *p; p++) {
+                                if (*p == L'\u2220') *p = L'<';
+                            }
+                            // A value too long for the display is not recalled rather than cut
+                            char buf[CALC_TEXT_MAX];
+                            if (WideCharToMultiByte(CP_ACP, 0, res, -1, buf, sizeof(buf), NULL, NULL)) {
+                                RecordInput(SES_RECALL, 0, 0, buf);
+                                RecallValue(buf);
+                            } else {
+                                MessageBeep(MB_ICONWARNING);
+                            }
                         }
                     }
                 }
@@ -1003,86 +5223,152 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                 if (code == BN_CLICKED) {
                     if (id == IDC_BTN_CALCDIFF) CalcDateDiff();
                     else if (id == IDC_BTN_CALCADD) CalcDateAdd();
+                    else if (id == IDC_BTN_SCHEDULE) ShowSchedule();
+                    else if (id == IDC_BTN_EXPORT) ExportSchedule(hwnd);
+                }
+            }
+            else if (g_curTab == TAB_SWEEP) {
+                if (code == BN_CLICKED) {
+                    if (id == IDC_BTN_SWEEP) StartSweep(hwnd);
+                    else if (id == IDC_BTN_SWEEP_CANCEL) CancelSweep();
+                }
+            }
+            else if (g_curTab == TAB_FINANCE) {
+                if (code == BN_CLICKED) {
+                    if (id == IDC_BTN_FIN_PAYMENT) FinShowPayment();
+                    else if (id == IDC_BTN_FIN_RATE) FinShowSolvedRate();
+                    else if (id == IDC_BTN_FIN_SCHEDULE) FinShowSchedule();
+                    else if (id == IDC_BTN_FIN_EXPORT) ExportFinSchedule(hwnd);
+                    else if (id == IDC_BTN_FIN_NPV) FinShowNpv();
+                    else if (id == IDC_BTN_FIN_IRR) FinShowIrr();
+                    else if (id == IDC_BTN_FIN_BATCH) StartFinBatch(hwnd);
+                    else if (id == IDC_BTN_FIN_CANCEL) CancelFinBatch();
+                }
+            }
+            else if (g_curTab == TAB_GRAPH) {
+                if (code == BN_CLICKED) {
+                    if (id == IDC_BTN_GRAPH) PlotExpression();
+                    else if (id == IDC_BTN_GRAPH_RESET) { ResetPlotView(); RenderPlot(); }
+                }
+                else if (id == IDC_GRAPH_SAMPLES && code == CBN_SELCHANGE) RenderPlot();
+            }
+            else if (g_curTab == TAB_MATRIX) {
+                if (code == BN_CLICKED) {
+                    if (id == IDC_BTN_MAT_TO_A) MatResultToA();
+                    else if (id >= IDC_BTN_MAT_ADD && id <= IDC_BTN_MAT_SOLVE) MatRunCommand(id);
+                    else if (id == IDC_BTN_MAT_CANCEL) CancelMatCommand();
+                }
+            }
+            else if (g_curTab == TAB_SOLVE) {
+                if (code == BN_CLICKED) {
+                    if (id == IDC_BTN_SOLVE) StartSolve();
+                    else if (id == IDC_BTN_SOLVE_CANCEL) CancelSolve();
+                }
+                else if (id == IDC_SOLVE_MODE && code == CBN_SELCHANGE) SolveModeChanged();
+            }
+            else if (g_curTab == TAB_INTEGER && code == BN_CLICKED) {
+                if (id >= IDC_BTN_INT_PRIME && id <= IDC_BTN_INT_POWMOD) StartIntCommand(id);
+                else if (id == IDC_BTN_INT_CANCEL) CancelIntCommand();
+                else if (id == IDC_BTN_INT_FROM_KEYPAD) IntFromKeypad();
+                else if (id == IDC_BTN_INT_TO_KEYPAD) IntToKeypad();
+            }
+            else if (g_curTab == TAB_UNITS) {
+                if (id == IDC_UNIT_CATEGORY && code == CBN_SELCHANGE) {
+                    FillUnitCombos();
+                    ConvertUnits();
+                }
+                else if ((id == IDC_UNIT_FROM || id == IDC_UNIT_TO) && code == CBN_SELCHANGE) ConvertUnits();
+                else if (id == IDC_UNIT_INPUT && code == EN_CHANGE) ConvertUnits();
+                else if (code == BN_CLICKED) {
+                    if (id == IDC_BTN_UNIT_SWAP) SwapUnits();
+                    else if (id == IDC_BTN_UNIT_FROM_KEYPAD) UnitsFromKeypad();
+                    else if (id == IDC_BTN_UNIT_TO_KEYPAD) UnitsToKeypad();
+                    else if (id == IDC_BTN_UNIT_TO_MEMORY) UnitsToMemory();
+                }
+            }
+            else if (g_curTab == TAB_REGISTERS && code == BN_CLICKED) {
+                if (id >= IDC_BTN_REG_MC && id <= IDC_BTN_REG_MMINUS) RegisterKey(id);
+                else if (id == IDC_BTN_REG_RENAME) RenameRegister();
+                else if (id == IDC_BTN_REG_CLEAR_ALL) ClearRegisters();
+                else if (id == IDC_BTN_REG_ADD_COLUMN) AddColumnToRegister(false);
+                else if (id == IDC_BTN_REG_SUB_COLUMN) AddColumnToRegister(true);
+                else if (id == IDC_BTN_REG_ADD_UNITS) AddUnitsToRegister();
+            }
+            else if (g_curTab == TAB_COMPLEX) {
+                if (id == IDC_CPLX_OP && code == CBN_SELCHANGE) RunComplexBatch();
+                else if ((id == IDC_CPLX_OPERAND || id == IDC_CPLX_INPUT) && code == EN_CHANGE) RunComplexBatch();
+                else if (code == BN_CLICKED) {
+                    if (id == IDC_CPLX_POLAR) RunComplexBatch();
+                    else if (id == IDC_BTN_CPLX_FROM_KEYPAD) ComplexFromKeypad();
+                    else if (id == IDC_BTN_CPLX_TO_KEYPAD) ComplexToKeypad();
                 }
             }
             return 0;
         }
             
+        case WM_ERASEBKGND:
+            return 1; // The compositor paints the whole background
+
         case WM_PAINT: {
+            // Recompose only what Windows reports invalid, from the cached
+            // background (no per-paint GradientFill)
+            EnsureCompositor(hwnd);
+            HRGN rgn = CreateRectRgn(0, 0, 0, 0);
+            GetUpdateRgn(hwnd, rgn, FALSE);
             PAINTSTRUCT ps;
             HDC hdc = BeginPaint(hwnd, &ps);
-            RECT rect;
-            GetClientRect(hwnd, &rect);
-            
-            // Gradient Background
-            TRIVERTEX vert[2];
-            GRADIENT_RECT gRect;
-            vert[0].x = 0; vert[0].y = 0;
-            vert[0].Red = 232 << 8; vert[0].Green = 244 << 8; vert[0].Blue = 252 << 8; vert[0].Alpha = 0;
-            vert[1].x = rect.right; vert[1].y = rect.bottom;
-            vert[1].Red = 196 << 8; vert[1].Green = 224 << 8; vert[1].Blue = 240 << 8; vert[1].Alpha = 0;
-            gRect.UpperLeft = 0; gRect.LowerRight = 1;
-            GradientFill(hdc, vert, 2, &gRect, 1, GRADIENT_FILL_RECT_V);
-            
-            // Only draw "Calculator" title if in Calc tab? No, keep generic or update based on tab?
-            // The Tab control covers the top, so we probably don't need the manually drawn title anymore.
-            // But if DwmExtendFrameIntoClientArea is used, we have a glass top area.
-            // Let's remove the "Calculator" text drawing to avoid clashing with Tab control.
-            
+            if (g_compDC) {
+                InvalidateCompRegion(rgn, ps.rcPaint);
+                ExcludeChildWindows(hwnd, hdc);
+                ComposeAndPresent(hdc, 0, 0, DrawNoWidgets);
+            } else {
+                FillRect(hdc, &ps.rcPaint, (HBRUSH)(COLOR_BTNFACE + 1));
+            }
             EndPaint(hwnd, &ps);
+            DeleteObject(rgn);
             return 0;
         }
         
         case WM_KEYDOWN: {
             if (g_curTab == TAB_CALC) {
-                // Ctrl+C / Ctrl+V
-                if (GetKeyState(VK_CONTROL) < 0) {
-                    if (wParam == 'C') {
-                        CopyTextToClipboard(hwnd, g_state.displayText);
-                        return 0;
-                    } else if (wParam == 'V') {
-                        char pasted[128];
-                        if (PasteTextFromClipboard(hwnd, pasted, sizeof(pasted))) {
-                            strncpy(g_state.displayText, pasted, sizeof(g_state.displayText) - 1);
-                            g_state.displayText[sizeof(g_state.displayText) - 1] = '\0';
-                            g_state.waitingForOperand = false;
-                            PushHistory("Paste value");
-                            UpdateDisplay();
-                        }
-                        return 0;
+                int mods = CurrentKeyMods();
+                if ((mods & SES_MOD_CTRL) && wParam == 'V') {
+                    char pasted[128];
+                    if (PasteTextFromClipboard(hwnd, pasted, sizeof(pasted))) {
+                        RecordInput(SES_PASTE, 0, 0, pasted);
+                        ApplyPaste(pasted);
                     }
+                    return 0;
                 }
-
-                // 运算（先处理 Shift+8 的 *，避免被当作数字 8）
-                if (wParam == VK_MULTIPLY || (wParam == '8' && GetKeyState(VK_SHIFT) < 0)) HandleButton(BTN_MUL);
-                else if (wParam == VK_ADD || wParam == VK_OEM_PLUS) HandleButton(BTN_ADD);
-                else if (wParam == VK_SUBTRACT || wParam == VK_OEM_MINUS) HandleButton(BTN_SUB);
-                else if (wParam == VK_DIVIDE || wParam == VK_OEM_2) HandleButton(BTN_DIV);
-
-                // 顶排数字
-                else if (wParam >= '0' && wParam <= '9') InputDigit((int)(wParam - '0'));
-                // 小键盘数字
-                else if (wParam >= VK_NUMPAD0 && wParam <= VK_NUMPAD9) InputDigit((int)(wParam - VK_NUMPAD0));
-
-                // 结果与编辑
-                else if (wParam == VK_RETURN) HandleButton(BTN_EQUAL);
-                else if (wParam == VK_BACK) HandleButton(BTN_BACK);
-                else if (wParam == VK_DELETE) HandleButton(BTN_CE);
-                else if (wParam == VK_ESCAPE) HandleButton(BTN_C);
-
-                // 小数点
-                else if (wParam == VK_DECIMAL || wParam == VK_OEM_PERIOD) HandleButton(BTN_DOT);
-
-                // 快捷功能键
-                else if (wParam == 'C') HandleButton(BTN_C);
-                else if (wParam == 'N') HandleButton(BTN_NEG);
-                else if (wParam == 'R') HandleButton(BTN_SQRT);
-                else if (wParam == 'P' || (wParam == '5' && GetKeyState(VK_SHIFT) < 0)) HandleButton(BTN_PERCENT);
+                RecordInput(SES_KEY, (int)wParam, mods);
+                HandleCalcKey(hwnd, (UINT)wParam, mods);
             }
             return 0;
         }
         
+        case WM_TIMER:
+            if (wParam == IDT_JOB_PROGRESS) g_jobs.Pump();
+            else if (wParam == IDT_REPLAY) ReplayDueEvents(hwnd);
+            return 0;
+
+        case WM_MOUSEWHEEL:
+            // The wheel goes to the focused window; the plot zooms wherever it came from
+            if (g_curTab == TAB_GRAPH && GetFocus() != hGraphView) return SendMessage(hGraphView, msg, wParam, lParam);
+            break;
+
+        case WM_JOB_WAKE:
+            DeliverJobs(hwnd);
+            return 0;
+
         case WM_DESTROY:
+            g_recorder.Close();
+            // Cancel whatever is running and deliver it, so files get closed
+            g_jobs.Stop();
+            DeliverJobs(hwnd);
+            SaveRegisters();
+            ReleasePlotSurface();
+            ReleaseCompositor();
+            ReleaseGlyphFonts();
             PostQuitMessage(0);
             return 0;
     }
@@ -1091,7 +5377,47 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 }
 
 // Entry point
-int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
+int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR lpCmdLine, int nCmdShow) {
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-lunar")) return RunLunarBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-display")) return RunDisplayBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-sweep")) return RunSweepBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-finance")) return RunFinanceBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-plot")) return RunPlotBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-matrix")) return RunMatrixBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-solve")) return RunSolveBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-primes")) return RunPrimeBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-units")) return RunUnitBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-registers")) return RunRegisterBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-complex")) return RunComplexBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-exact")) return RunExactBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/bench-ddouble")) return RunDDoubleBenchmark();
+    if (lpCmdLine && wcsstr(lpCmdLine, L"/check-alloc")) return RunAllocCheck();
+
+    g_engine.onDisplay = OnEngineDisplay;
+    g_engine.onHistory = OnEngineHistory;
+
+    // /record <file>, /replay <file> [/realtime] [/loops <n>]
+    const WCHAR* recordPath = NULL;
+    const WCHAR* replayPath = NULL;
+    bool realtime = false;
+    int loops = 1;
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    for (int i = 1; argv && i < argc; i++) {
+        if (_wcsicmp(argv[i], L"/record") == 0 && i + 1 < argc) recordPath = argv[++i];
+        else if (_wcsicmp(argv[i], L"/replay") == 0 && i + 1 < argc) replayPath = argv[++i];
+        else if (_wcsicmp(argv[i], L"/realtime") == 0) realtime = true;
+        else if (_wcsicmp(argv[i], L"/loops") == 0 && i + 1 < argc) loops = _wtoi(argv[++i]);
+    }
+    if (replayPath && !realtime) return RunSessionReplay(replayPath, loops);
+    if (replayPath && !LoadSession(replayPath, &g_replayEvents)) {
+        MessageBoxW(NULL, L"Not a session log", L"Replay", MB_OK | MB_ICONERROR);
+        return 1;
+    }
+    if (recordPath && !StartRecording(recordPath)) {
+        MessageBoxW(NULL, L"Cannot create the session log", L"Record", MB_OK | MB_ICONEXCLAMATION);
+    }
+
     // Register window class
     WNDCLASSEXW wc = {0};
     wc.cbSize = sizeof(WNDCLASSEXW);
@@ -1106,14 +5432,23 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
         MessageBoxW(NULL, L"Window Registration Failed!", L"Error", MB_ICONEXCLAMATION | MB_OK);
         return 0;
     }
+
+    // The graph tab's plot area
+    WNDCLASSEXW pc = {0};
+    pc.cbSize = sizeof(WNDCLASSEXW);
+    pc.lpfnWndProc = PlotWndProc;
+    pc.hInstance = hInstance;
+    pc.hCursor = LoadCursor(NULL, IDC_SIZEALL);
+    pc.lpszClassName = L"CalcPlotClass";
+    RegisterClassExW(&pc);
     
     // Calculate required window size based on client area
     RECT rc = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
-    AdjustWindowRectEx(&rc, WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX, FALSE, WS_EX_CLIENTEDGE | WS_EX_COMPOSITED);
+    AdjustWindowRectEx(&rc, WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX, FALSE, WS_EX_CLIENTEDGE);
 
     // Create window
     HWND hwnd = CreateWindowExW(
-        WS_EX_CLIENTEDGE | WS_EX_COMPOSITED,
+        WS_EX_CLIENTEDGE,
         L"Win7CalcClass",
         L"Calculator",
         WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX,
@@ -1129,6 +5464,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
     
     ShowWindow(hwnd, nCmdShow);
     UpdateWindow(hwnd);
+    if (replayPath) StartRealtimeReplay(hwnd);
     
     // Message loop
     MSG msg;
@@ -1136,6 +5472,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
+    if (argv) LocalFree(argv);
     
     return (int)msg.wParam;
 }
@@ -0,0 +1,185 @@
+// Scheduler stress test
+// Portable C++ (no Win32). Hammers calc_sched.h the way the window uses
+// it: this thread plays the UI thread, submitting, cancelling, pumping
+// progress and draining whenever a worker wakes it, while the pool runs
+// jobs of random length. Checks that every job is delivered exactly once,
+// runs at most once, never runs after a cancel that came while it was
+// queued, has its callbacks called on the host thread only, and that the
+// pool ends idle, including across Stop() with work queued and a restart.
+//
+// Build and run: g++ -O2 -std=c++17 -pthread stress_sched.cpp -o stress_sched && ./stress_sched
+// (add -fsanitize=thread to check for data races as well)
+
+#include <chrono>
+#include <cstdio>
+
+#include "calc_sched.h"
+
+static std::thread::id g_host;
+static std::atomic<int> g_failures(0);   // Workers check too
+
+#define CHECK(cond, ...) do { if (!(cond)) { if (g_failures++ < 20) { printf(__VA_ARGS__); printf("\n"); } } } while (0)
+
+static uint64_t g_seed = 88172645463325252ULL;
+
+static unsigned Next(unsigned n) {
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return (unsigned)(g_seed >> 33) % n;
+}
+
+// The host's message queue: onWake stands in for PostMessage
+struct Wake {
+    std::mutex lock;
+    std::condition_variable posted;
+    bool pending = false;
+    std::atomic<int> calls{0};
+
+    static void Post(void* ctx) {
+        Wake* w = (Wake*)ctx;
+        w->calls++;
+        {
+            std::lock_guard<std::mutex> guard(w->lock);
+            w->pending = true;
+        }
+        w->posted.notify_one();
+    }
+
+    // GetMessage with a timer: true when woken, false on timeout
+    bool Wait(int ms) {
+        std::unique_lock<std::mutex> guard(lock);
+        bool woken = posted.wait_for(guard, std::chrono::milliseconds(ms), [this]() { return pending; });
+        pending = false;
+        return woken;
+    }
+};
+
+// What happened to one job, as seen by its work and its callbacks
+struct Record {
+    std::atomic<int> runs{0};
+    int delivered = 0;
+    bool cancelledQueued = false;  // Cancelled before any worker took it
+    std::atomic<bool> external{false};
+};
+
+// Work of random length that polls its cancel flag and reports progress
+static void Spin(SchedJob* job, Record* rec, int steps) {
+    rec->runs++;
+    CHECK(std::this_thread::get_id() != g_host, "job ran on the host thread");
+    for (int i = 0; i < steps && !job->Cancelled(); i++) {
+        job->Progress(i + 1, steps);
+        volatile int sink = 0;
+        for (int k = 0; k < 200; k++) sink += k;
+    }
+}
+
+static SchedHandle SubmitOne(Scheduler& s, Record* rec, int steps) {
+    SchedFn run = [rec, steps](SchedJob* job) { Spin(job, rec, steps); };
+    SchedFn done = [rec](SchedJob* job) {
+        CHECK(std::this_thread::get_id() == g_host, "done callback off the host thread");
+        CHECK(job->state == SCHED_DELIVERED, "done callback before delivery");
+        rec->delivered++;
+    };
+    SchedFn progress = [](SchedJob* job) {
+        CHECK(std::this_thread::get_id() == g_host, "progress callback off the host thread");
+        CHECK(job->current.load() <= job->total.load() || job->total.load() == 0, "progress past its total");
+    };
+    // Every third job brings its own cancel flag, as the sweep and integer tabs do
+    std::atomic<bool>* flag = Next(3) == 0 ? &rec->external : NULL;
+    return s.Submit(run, done, progress, flag);
+}
+
+// Checks every record once all jobs are delivered
+static void Verify(const char* round, std::vector<Record>& recs, const Scheduler& s) {
+    for (size_t i = 0; i < recs.size(); i++) {
+        CHECK(recs[i].delivered == 1, "%s: job %zu delivered %d times", round, i, recs[i].delivered);
+        CHECK(recs[i].runs.load() <= 1, "%s: job %zu ran %d times", round, i, recs[i].runs.load());
+        CHECK(!recs[i].cancelledQueued || recs[i].runs.load() == 0, "%s: job %zu ran after being cancelled while queued", round, i);
+    }
+    CHECK(!s.Busy(), "%s: pool still busy", round);
+}
+
+// One round: kJobs submitted in bursts, random cancels, pumps and drains
+// while the workers run
+static void StressRound(int threads, int kJobs) {
+    char round[64];
+    snprintf(round, sizeof(round), "%d workers", threads);
+    Wake wake;
+    Scheduler s;
+    s.Start(threads, Wake::Post, &wake);
+    std::vector<Record> recs((size_t)kJobs);
+    std::vector<SchedHandle> handles;
+    int submitted = 0, cancelled = 0, ran = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while (submitted < kJobs || s.Busy()) {
+        int burst = (int)Next(40);
+        for (int b = 0; b < burst && submitted < kJobs; b++) {
+            handles.push_back(SubmitOne(s, &recs[(size_t)submitted], (int)Next(300)));
+            submitted++;
+        }
+        // Cancel a few, sometimes before a worker can take them
+        for (int c = (int)Next(4); c > 0 && submitted > 0; c--) {
+            size_t k = Next((unsigned)submitted);
+            SchedHandle& h = handles[k];
+            if (h->state.load() == SCHED_DELIVERED) continue;
+            {
+                // Holding the queue lock, a still-queued job cannot be taken
+                std::lock_guard<std::mutex> guard(s.lock);
+                bool queued = false;
+                for (size_t q = 0; q < s.queue.size(); q++) queued = queued || s.queue[q] == h;
+                if (queued) recs[k].cancelledQueued = true;
+                s.Cancel(h);
+            }
+            cancelled++;
+        }
+        if (Next(3) == 0) s.Pump();
+        if (wake.Wait(Next(4) == 0 ? 0 : 1)) s.Drain();
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(60), "%s: jobs never finished", round);
+        if (g_failures) break;
+    }
+    s.Drain();
+    Verify(round, recs, s);
+    for (size_t i = 0; i < recs.size(); i++) ran += recs[i].runs.load();
+    printf("%-10s %d jobs, %d cancel requests, %d ran, %d wakes\n", round, kJobs, cancelled, ran, wake.calls.load());
+    s.Stop();
+}
+
+// Stop() with most of the work still queued, then a restart of the same pool
+static void StopAndRestart(int kJobs) {
+    Wake wake;
+    Scheduler s;
+    s.Start(4, Wake::Post, &wake);
+    std::vector<Record> recs((size_t)kJobs);
+    for (int i = 0; i < kJobs; i++) SubmitOne(s, &recs[(size_t)i], 2000);
+    s.Stop();
+    int delivered = s.Drain();
+    CHECK(delivered == kJobs, "stop: %d of %d delivered", delivered, kJobs);
+    Verify("stop", recs, s);
+    int ran = 0;
+    for (size_t i = 0; i < recs.size(); i++) ran += recs[i].runs.load();
+
+    std::vector<Record> again((size_t)kJobs);
+    s.Start(4, Wake::Post, &wake);
+    for (int i = 0; i < kJobs; i++) SubmitOne(s, &again[(size_t)i], (int)Next(50));
+    auto start = std::chrono::steady_clock::now();
+    while (s.Busy() && std::chrono::steady_clock::now() - start < std::chrono::seconds(60)) {
+        if (wake.Wait(5)) s.Drain();
+    }
+    Verify("restart", again, s);
+    int ranAgain = 0;
+    for (size_t i = 0; i < again.size(); i++) ranAgain += again[i].runs.load();
+    CHECK(ranAgain == kJobs, "restart: %d of %d ran", ranAgain, kJobs);
+    printf("stop       %d jobs queued, %d ran before Stop(), %d delivered; restart ran %d\n", kJobs, ran, delivered, ranAgain);
+    s.Stop();
+}
+
+int main() {
+    g_host = std::this_thread::get_id();
+    const int kJobs = 2000;
+    for (int threads = 1; threads <= SCHED_MAX_WORKERS; threads++) StressRound(threads, kJobs);
+    StopAndRestart(kJobs);
+    printf("%s\n", g_failures ? "FAIL" : "PASS");
+    return g_failures ? 1 : 0;
+}